@@ -0,0 +1,98 @@
+#!/bin/sh
+#
+# Compares the request rate of the server with unpinned worker threads and with
+# worker groups pinned to CPU sets (by default one group per NUMA node).
+#
+# usage: affinity-benchmark.sh <indigo-filer binary> [cpuSets] [seconds] [connections]
+#
+# Requires wrk, or ab (ApacheBench) as a fallback. For meaningful numbers, run
+# the load generator on another machine, or at least pin it away from the
+# server with taskset, and use a multi-socket host.
+
+set -e
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 <indigo-filer binary> [cpuSets] [seconds] [connections]" >&2
+	exit 1
+fi
+
+BINARY=$1
+CPUSETS=${2:-numa}
+DURATION=${3:-20}
+CONNECTIONS=${4:-256}
+PORT=18080
+MISC=$(cd "$(dirname "$0")" && pwd)
+
+WORK=$(mktemp -d)
+PID=
+cleanup()
+{
+	[ -n "$PID" ] && kill "$PID" 2>/dev/null
+	rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+mkdir "$WORK/data"
+head -c 8192 /dev/urandom > "$WORK/data/small.bin"
+head -c 1048576 /dev/urandom > "$WORK/data/large.bin"
+
+# load <url>
+load()
+{
+	if command -v wrk > /dev/null; then
+		wrk -t 4 -c "$CONNECTIONS" -d "${DURATION}s" "$1" | awk '/Requests\/sec/ { print $2 }'
+	else
+		ab -q -k -c "$CONNECTIONS" -t "$DURATION" -n 100000000 "$1" 2>/dev/null | awk '/Requests per second/ { print $4 }'
+	fi
+}
+
+# run_server <name> [settings...]
+run_server()
+{
+	NAME=$1
+	shift
+
+	DIR="$WORK/$NAME"
+	mkdir "$DIR"
+	cp "$BINARY" "$DIR/indigo-filer"
+	cp "$MISC"/mime.types* "$DIR/"
+
+	{
+		echo "[Server]"
+		echo "address = 127.0.0.1"
+		echo "port = $PORT"
+		echo "root = $WORK/data"
+		echo "minThreads = $CONNECTIONS"
+		echo "maxThreads = $CONNECTIONS"
+		echo "maxQueued = $CONNECTIONS"
+		for SETTING in "$@"; do
+			echo "$SETTING"
+		done
+	} > "$DIR/indigo-filer.ini"
+
+	"$DIR/indigo-filer" > "$DIR/log" 2>&1 &
+	PID=$!
+
+	URL="http://127.0.0.1:$PORT"
+	TRIES=0
+	until curl -s -o /dev/null "$URL/small.bin"; do
+		TRIES=$((TRIES + 1))
+		if [ $TRIES -gt 50 ]; then
+			echo "$NAME: server did not start" >&2
+			cat "$DIR/log" >&2
+			exit 1
+		fi
+		sleep 0.1
+	done
+
+	printf '%-10s small files %10s req/s, 1 MB files %10s req/s\n' "$NAME" "$(load "$URL/small.bin")" "$(load "$URL/large.bin")"
+
+	kill "$PID"
+	wait "$PID" 2>/dev/null || true
+	PID=
+}
+
+echo "$CONNECTIONS connections, $DURATION s per run"
+
+run_server unpinned
+run_server pinned "cpuSets = $CPUSETS"
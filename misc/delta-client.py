@@ -0,0 +1,149 @@
+#!/usr/bin/env python3
+#
+# Reference client for delta downloads (Server.deltaBlockSize). Updates an
+# old copy of a file to the version on the server, downloading only the
+# blocks that the old copy does not already have, at any offset.
+#
+# usage: delta-client.py <file URL> <old copy> <output file>
+#
+# The checksum table comes from <URL>?blocks. Blocks of the old copy that
+# are still where they were are found first; the rest of the old copy is then
+# searched by rolling the Adler-32 checksum one byte at a time, and confirming
+# matches with the SHA-256 prefix. The missing blocks are fetched with
+# <URL>?blocks=<ranges>&version=<version>, and the result is checked against
+# the SHA-256 of the whole file before it is written.
+# This is a test tool: the old copy is held in memory and the search is in
+# pure Python, so it is slow on large files.
+
+import hashlib
+import sys
+import urllib.request
+import zlib
+
+MOD_ADLER = 65521
+RANGES_PER_REQUEST = 256
+
+
+def fetch(url):
+	with urllib.request.urlopen(url) as response:
+		return response.read()
+
+
+def read_table(url):
+	lines = fetch(url + "?blocks").decode("ascii").splitlines()
+	fields = dict(line.split(" ", 1) for line in lines[:4])
+	blocks = []
+	for line in lines[4:]:
+		weak, strong = line.split(" ")
+		blocks.append((int(weak, 16), bytes.fromhex(strong)))
+	return fields["version"], int(fields["size"]), int(fields["block-size"]), fields["sha-256"], blocks
+
+
+def strong_sum(data):
+	return hashlib.sha256(data).digest()[:16]
+
+
+def find_blocks(old, size, block_size, blocks):
+	found = {}
+	by_weak = {}
+	for i, (weak, strong) in enumerate(blocks):
+		by_weak.setdefault(weak, []).append(i)
+
+	def block_length(i):
+		return min(block_size, size - i * block_size)
+
+	def match(offset, data, weak):
+		for i in by_weak.get(weak, ()):
+			if i not in found and block_length(i) == len(data) and blocks[i][1] == strong_sum(data):
+				found[i] = offset
+		return any(found.get(i) == offset for i in by_weak.get(weak, ()))
+
+	# unchanged blocks, and the short last block, are checked where they were
+	for i in range(len(blocks)):
+		offset = i * block_size
+		data = old[offset:offset + block_length(i)]
+		if len(data) == block_length(i):
+			match(offset, data, zlib.adler32(data))
+
+	# the rest are searched for at every offset, skipping past each match
+	offset = 0
+	a = b = None
+	while offset + block_size <= len(old) and len(found) < len(blocks):
+		if a is None:
+			window = old[offset:offset + block_size]
+			weak = zlib.adler32(window)
+			a, b = weak & 0xffff, weak >> 16
+		if match(offset, old[offset:offset + block_size], (b << 16) | a):
+			offset += block_size
+			a = None
+			continue
+		if offset + block_size == len(old):
+			break
+		out, new = old[offset], old[offset + block_size]
+		a = (a - out + new) % MOD_ADLER
+		b = (b - block_size * out + a - 1) % MOD_ADLER
+		offset += 1
+
+	return found
+
+
+def missing_ranges(count, found):
+	ranges = []
+	for i in range(count):
+		if i in found:
+			continue
+		if ranges and ranges[-1][1] == i - 1:
+			ranges[-1][1] = i
+		else:
+			ranges.append([i, i])
+	return ranges
+
+
+def main():
+	if len(sys.argv) != 4:
+		sys.stderr.write("usage: %s <file URL> <old copy> <output file>\n" % sys.argv[0])
+		return 1
+
+	url, old_path, output_path = sys.argv[1:]
+	version, size, block_size, digest, blocks = read_table(url)
+
+	with open(old_path, "rb") as f:
+		old = f.read()
+
+	found = find_blocks(old, size, block_size, blocks)
+	ranges = missing_ranges(len(blocks), found)
+
+	parts = {}
+	for i, offset in found.items():
+		parts[i] = old[offset:offset + min(block_size, size - i * block_size)]
+
+	downloaded = 0
+	for first in range(0, len(ranges), RANGES_PER_REQUEST):
+		batch = ranges[first:first + RANGES_PER_REQUEST]
+		query = ",".join("%d-%d" % (r[0], r[1]) if r[0] != r[1] else "%d" % r[0] for r in batch)
+		body = fetch("%s?blocks=%s&version=%s" % (url, query, version))
+		downloaded += len(body)
+		pos = 0
+		for r in batch:
+			for i in range(r[0], r[1] + 1):
+				length = min(block_size, size - i * block_size)
+				parts[i] = body[pos:pos + length]
+				pos += length
+		if pos != len(body):
+			sys.stderr.write("unexpected block data length\n")
+			return 1
+
+	result = b"".join(parts[i] for i in range(len(blocks)))
+	if len(result) != size or hashlib.sha256(result).hexdigest() != digest:
+		sys.stderr.write("the assembled file does not match the server's digest\n")
+		return 1
+
+	with open(output_path, "wb") as f:
+		f.write(result)
+
+	print("%d of %d blocks reused, %d of %d bytes downloaded" % (len(found), len(blocks), downloaded, size))
+	return 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -0,0 +1,520 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+// Checks that RequestPath gives the same results as the scalar decoder it
+// replaced, for random request targets and decoded paths, with each of the
+// scanners that the CPU supports: scalar, SSE2 and AVX2.
+//
+// usage: requestpath-fuzz [cases per scanner] [seed]
+//
+// Built with "make requestpath-fuzz". The only intended difference is that
+// raw control bytes in the path are now rejected; such cases are checked for
+// rejection instead. On a mismatch, the input and both results are printed.
+//
+// The scalar decoder is itself a rewrite, so "make requestpath-oracle" also
+// builds in REQUESTPATH_POCO_ORACLE and links POCO, to check the decoded path
+// against Poco::URI::decode and Poco::Path, as the request handler once used
+// them. The target is split at '?' and '#' as RequestPath does, and only the
+// path is compared; absolute-form targets, and targets starting with "//",
+// which Poco::URI took for an authority, are checked against the scalar
+// decoder alone. The intended differences from POCO are:
+//  - raw control bytes, decoded NUL bytes and reserved characters are rejected,
+//    even in a segment that a later ".." removes
+//  - a trailing "." or ".." segment is resolved, and the path is left without
+//    a trailing slash, instead of naming a file called "." or ".."
+//  - a path must start with '/', so "~" no longer expands to a home directory
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+#ifdef REQUESTPATH_POCO_ORACLE
+#include "Poco/Exception.h"
+#include "Poco/Path.h"
+#include "Poco/URI.h"
+#endif
+
+// the scanners and the selected one are private to the translation unit
+#include "../src/RequestPath.cpp"
+
+using namespace std;
+
+// The decoder before vectorization: the whole path is decoded first, and then split and checked.
+class ScalarRequestPath
+{
+public:
+	bool parse(const string &uri)
+	{
+		const char *begin = uri.data();
+		const char *end = begin + uri.length();
+		const char *it = begin;
+
+		query.clear();
+		hasQuery = false;
+
+		if (it != end && *it != '/')
+		{
+			while (it != end && *it != ':' && *it != '/' && *it != '?' && *it != '#')
+				++it;
+
+			if (end - it < 3 || it[0] != ':' || it[1] != '/' || it[2] != '/')
+				return false;
+
+			it += 3;
+			while (it != end && *it != '/' && *it != '?' && *it != '#')
+				++it;
+
+			if (it == end || *it != '/')
+				return false;
+		}
+
+		const char *pathEnd = it;
+		while (pathEnd != end && *pathEnd != '?' && *pathEnd != '#')
+			++pathEnd;
+
+		if (pathEnd != end && *pathEnd == '?')
+		{
+			const char *queryEnd = pathEnd + 1;
+			while (queryEnd != end && *queryEnd != '#')
+				++queryEnd;
+			query.assign(pathEnd + 1, queryEnd);
+			hasQuery = true;
+		}
+
+		if (it == pathEnd || !decode(it, pathEnd))
+			return false;
+
+		return split();
+	}
+
+	bool assign(const string &decodedPath)
+	{
+		query.clear();
+		hasQuery = false;
+
+		if (decodedPath.empty() || decodedPath[0] != '/')
+			return false;
+
+		buffer.assign(decodedPath);
+
+		return split();
+	}
+
+	vector<string> segments;
+	bool directory;
+	string query;
+	bool hasQuery;
+
+private:
+	bool decode(const char *begin, const char *end)
+	{
+		buffer.clear();
+
+		const char *it = begin;
+		while (it != end)
+		{
+			char c = *it++;
+			if (c == '%')
+			{
+				if (end - it < 2)
+					return false;
+
+				int hi = hexValue(it[0]);
+				int lo = hexValue(it[1]);
+				if (hi < 0 || lo < 0)
+					return false;
+
+				c = (char) ((hi << 4) | lo);
+				it += 2;
+			}
+
+			buffer += c;
+		}
+
+		return true;
+	}
+
+	bool split()
+	{
+		segments.clear();
+		directory = true;
+
+		const char *data = buffer.data();
+		size_t length = buffer.length();
+
+		size_t pos = 1;
+		while (pos <= length)
+		{
+			const char *sep = (const char *) memchr(data + pos, '/', length - pos);
+			size_t next = (sep != NULL ? sep - data : length);
+			size_t n = next - pos;
+			bool last = (sep == NULL);
+
+			if (last)
+				directory = (n == 0);
+
+			if (n == 0 || (n == 1 && data[pos] == '.'))
+			{
+			}
+			else if (n == 2 && data[pos] == '.' && data[pos + 1] == '.')
+			{
+				if (!segments.empty())
+					segments.pop_back();
+			}
+			else
+			{
+				for (size_t i = pos; i < next; i++)
+				{
+					if (data[i] == '\0' || isReserved(data[i]))
+						return false;
+				}
+
+				segments.push_back(string(data + pos, n));
+			}
+
+			pos = next + 1;
+		}
+
+		return true;
+	}
+
+	static int hexValue(char c)
+	{
+		if (c >= '0' && c <= '9')
+			return c - '0';
+		else if (c >= 'a' && c <= 'f')
+			return c - 'a' + 10;
+		else if (c >= 'A' && c <= 'F')
+			return c - 'A' + 10;
+		else
+			return -1;
+	}
+
+	string buffer;
+};
+
+#ifdef REQUESTPATH_POCO_ORACLE
+// The decoding and splitting that the request handler did with POCO, with the intended differences applied.
+class PocoRequestPath
+{
+public:
+	bool parse(const string &uri)
+	{
+		string::size_type end = uri.find_first_of("?#");
+		string decoded;
+
+		try
+		{
+			Poco::URI::decode(uri.substr(0, end), decoded);
+		}
+		catch (Poco::SyntaxException &)
+		{
+			return false;
+		}
+
+		return assign(decoded);
+	}
+
+	bool assign(const string &decodedPath)
+	{
+		segments.clear();
+		directory = true;
+
+		// Poco::Path expanded a leading "~", which RequestPath rejects like any other relative path
+		if (decodedPath.empty() || decodedPath[0] != '/')
+			return false;
+
+		for (string::size_type i = 0; i < decodedPath.length(); i++)
+		{
+			if (decodedPath[i] == '\0' || isReserved(decodedPath[i]))
+				return false;
+		}
+
+		Poco::Path path(decodedPath, Poco::Path::PATH_UNIX);
+		if (!path.isAbsolute())
+			return false;
+
+		// RequestPath resolves the dot segment, but still answers that the path does not end with a slash
+		const string name = path.getFileName();
+		bool dots = (name == "." || name == "..");
+		if (dots)
+		{
+			path.pushDirectory(name);
+			path.setFileName("");
+		}
+
+		for (int i = 0; i < path.depth(); i++)
+			segments.push_back(path[i]);
+
+		directory = path.isDirectory() && !dots;
+		if (!path.isDirectory())
+			segments.push_back(path.getFileName());
+
+		return true;
+	}
+
+	vector<string> segments;
+	bool directory;
+};
+#endif
+
+static unsigned long long state;
+
+static unsigned next(unsigned bound)
+{
+	// xorshift64*, so that a seed reproduces a run on any platform
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return (unsigned) ((state * 2685821657736338717ULL) >> 33) % bound;
+}
+
+// Builds a string of pieces that exercise the decoder: separators, dot segments, valid and broken
+// percent-encodings, encoded separators and NUL bytes, control bytes, and plain runs of every length.
+static string randomPath(bool target)
+{
+	static const char *const pieces[] = {"/", "/", "/", ".", "..", "%", "%2F", "%2f", "%2E", "%00", "%41", "%4", "%G1",
+		"%7F", "%1F", "?", "#", "&", "=", ":", "\\", "%5C", "%3A", "\x7F", "\x01", "\x1F", "\t", "\xC3\xA9", "\xFF"};
+	static const char plain[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-._~!$'()*+,;@";
+
+	string s;
+	if (target)
+	{
+		switch (next(8))
+		{
+		case 0:
+			s = "http://example.com";
+			break;
+		case 1:
+			s = "http:/";
+			break;
+		default:
+			s = "/";
+			break;
+		}
+	}
+	else if (next(16) != 0)
+	{
+		s = "/";
+	}
+
+	unsigned count = next(24);
+	for (unsigned i = 0; i < count; i++)
+	{
+		if (next(3) == 0)
+		{
+			s += pieces[next(sizeof(pieces) / sizeof(pieces[0]))];
+		}
+		else
+		{
+			// runs around the 16 and 32 byte blocks of the vector scanners
+			unsigned length = next(72);
+			for (unsigned j = 0; j < length; j++)
+				s += plain[next(sizeof(plain) - 1)];
+		}
+	}
+
+	if (!target && next(8) == 0)
+		s += '\0';
+
+	return s;
+}
+
+static bool hasRawControl(const string &uri)
+{
+	// the path starts after the authority of an absolute-form target, and ends at the query or fragment
+	string::size_type start = 0;
+	if (!uri.empty() && uri[0] != '/')
+	{
+		start = uri.find("://");
+		start = (start == string::npos ? uri.length() : uri.find('/', start + 3));
+		if (start == string::npos)
+			start = uri.length();
+	}
+
+	for (string::size_type i = start; i < uri.length() && uri[i] != '?' && uri[i] != '#'; i++)
+	{
+		unsigned char c = uri[i];
+		if (c < 0x20 || c == 0x7F)
+			return true;
+	}
+
+	return false;
+}
+
+static string escape(const string &s)
+{
+	string escaped;
+	for (string::size_type i = 0; i < s.length(); i++)
+	{
+		unsigned char c = s[i];
+		if (c < 0x20 || c >= 0x7F || c == '\\')
+		{
+			char hex[8];
+			sprintf(hex, "\\x%02X", c);
+			escaped += hex;
+		}
+		else
+		{
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+static string describe(bool ok, const vector<string> &segments, bool directory, bool hasQuery, const string &query)
+{
+	if (!ok)
+		return "rejected";
+
+	string d = (directory ? "directory [" : "file [");
+	for (vector<string>::size_type i = 0; i < segments.size(); i++)
+	{
+		if (i > 0)
+			d += ", ";
+		d += escape(segments[i]);
+	}
+	d += "]";
+	if (hasQuery)
+		d += " query " + escape(query);
+	return d;
+}
+
+#ifdef REQUESTPATH_POCO_ORACLE
+static bool checkPoco(const string &input, bool target, bool ok, const vector<string> &segments, bool directory)
+{
+	// see the top of the file for the targets that are left to the scalar decoder
+	if (target && (input.empty() || input[0] != '/' || input.compare(0, 2, "//") == 0))
+		return true;
+
+	PocoRequestPath oracle;
+	bool expected = (target ? oracle.parse(input) : oracle.assign(input));
+
+	if (ok == expected && (!ok || (segments == oracle.segments && directory == oracle.directory)))
+		return true;
+
+	printf("%s \"%s\": %s, POCO expected %s\n", target ? "parsed" : "assigned", escape(input).c_str(),
+		describe(ok, segments, directory, false, string()).c_str(),
+		describe(expected, oracle.segments, oracle.directory, false, string()).c_str());
+	return false;
+}
+#endif
+
+static bool check(const string &input, bool target, RequestPath &path, ScalarRequestPath &reference)
+{
+	bool ok = (target ? path.parse(input) : path.assign(input));
+	bool expected = (target ? reference.parse(input) : reference.assign(input));
+
+	vector<string> segments;
+	bool hasQuery = false;
+	string query;
+	if (ok)
+	{
+		for (int i = 0; i < path.depth(); i++)
+			segments.push_back(string(path.segment(i), path.segmentLength(i)));
+
+		hasQuery = (path.query() != NULL);
+		if (hasQuery)
+			query.assign(path.query(), path.queryLength());
+	}
+
+	// raw control bytes used to be passed on, and are now rejected
+	if (target && hasRawControl(input))
+	{
+		if (!ok)
+			return true;
+
+		printf("%s target \"%s\": %s, expected rejected\n", target ? "parsed" : "assigned", escape(input).c_str(),
+			describe(ok, segments, path.isDirectory(), hasQuery, query).c_str());
+		return false;
+	}
+
+#ifdef REQUESTPATH_POCO_ORACLE
+	if (!checkPoco(input, target, ok, segments, path.isDirectory()))
+		return false;
+#endif
+
+	if (ok == expected && (!ok || (segments == reference.segments && path.isDirectory() == reference.directory &&
+		hasQuery == reference.hasQuery && query == reference.query)))
+		return true;
+
+	printf("%s \"%s\": %s, expected %s\n", target ? "parsed" : "assigned", escape(input).c_str(),
+		describe(ok, segments, path.isDirectory(), hasQuery, query).c_str(),
+		describe(expected, reference.segments, reference.directory, reference.hasQuery, reference.query).c_str());
+	return false;
+}
+
+static bool run(const char *name, ScanFunction function, unsigned long cases, unsigned long long seed)
+{
+	scan = function;
+	state = seed;
+
+	RequestPath path;
+	ScalarRequestPath reference;
+
+	unsigned long failures = 0;
+	for (unsigned long i = 0; i < cases && failures < 10; i++)
+	{
+		bool target = (next(4) != 0);
+		if (!check(randomPath(target), target, path, reference))
+			failures++;
+	}
+
+	printf("%s: %lu cases, %s\n", name, cases, failures == 0 ? "no differences" : "differences found");
+	return failures == 0;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long cases = (argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000);
+	unsigned long long seed = (argc > 2 ? strtoull(argv[2], NULL, 10) : 1);
+	if (seed == 0)
+		seed = 1;
+
+	bool passed = run("scalar", scanScalar, cases, seed);
+
+#ifdef REQUESTPATH_SSE2
+	passed = run("SSE2", scanSSE2, cases, seed) && passed;
+#else
+	printf("SSE2: not built\n");
+#endif
+
+#ifdef REQUESTPATH_AVX2
+	if (__builtin_cpu_supports("avx2"))
+		passed = run("AVX2", scanAVX2, cases, seed) && passed;
+	else
+		printf("AVX2: not supported by this CPU\n");
+#else
+	printf("AVX2: not built\n");
+#endif
+
+	return passed ? 0 : 1;
+}
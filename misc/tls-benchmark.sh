@@ -0,0 +1,110 @@
+#!/bin/sh
+#
+# Compares the download speed of a large file over plain HTTP, TLS encrypted
+# by OpenSSL in user space, and TLS encrypted by the kernel (kTLS).
+#
+# usage: tls-benchmark.sh <indigo-filer binary> [file size in MB] [runs]
+#
+# The binary must be built with -DINDIGO_TLS. kTLS needs Linux, OpenSSL 3.0 or
+# later and the "tls" kernel module (modprobe tls); without them, the third
+# server falls back to user space, which the output points out.
+# Requires openssl and curl.
+
+set -e
+
+if [ $# -lt 1 ]; then
+	echo "usage: $0 <indigo-filer binary> [file size in MB] [runs]" >&2
+	exit 1
+fi
+
+BINARY=$1
+SIZE=${2:-256}
+RUNS=${3:-5}
+PORT=18443
+MISC=$(cd "$(dirname "$0")" && pwd)
+
+WORK=$(mktemp -d)
+PID=
+cleanup()
+{
+	[ -n "$PID" ] && kill "$PID" 2>/dev/null
+	rm -rf "$WORK"
+}
+trap cleanup EXIT INT TERM
+
+mkdir "$WORK/data"
+head -c "$((SIZE * 1048576))" /dev/urandom > "$WORK/data/file.bin"
+
+openssl req -x509 -newkey rsa:2048 -nodes -days 1 -subj /CN=localhost \
+	-keyout "$WORK/key.pem" -out "$WORK/cert.pem" 2>/dev/null
+
+# run_server <name> <scheme> [TLS settings...]
+run_server()
+{
+	NAME=$1
+	SCHEME=$2
+	shift 2
+
+	DIR="$WORK/$NAME"
+	mkdir "$DIR"
+	cp "$BINARY" "$DIR/indigo-filer"
+	cp "$MISC"/mime.types* "$DIR/"
+
+	{
+		echo "[Server]"
+		echo "address = 127.0.0.1"
+		echo "port = $PORT"
+		echo "root = $WORK/data"
+		echo "statusPath = /status"
+		# send the whole file with sendfile() where possible, instead of streaming it
+		echo "streamFileSize = 0"
+		for SETTING in "$@"; do
+			echo "$SETTING"
+		done
+	} > "$DIR/indigo-filer.ini"
+
+	"$DIR/indigo-filer" > "$DIR/log" 2>&1 &
+	PID=$!
+
+	URL="$SCHEME://127.0.0.1:$PORT"
+	TRIES=0
+	until curl -sk -o /dev/null "$URL/status"; do
+		TRIES=$((TRIES + 1))
+		if [ $TRIES -gt 50 ]; then
+			echo "$NAME: server did not start" >&2
+			cat "$DIR/log" >&2
+			exit 1
+		fi
+		sleep 0.1
+	done
+
+	# the first download also brings the file into the page cache
+	curl -sk -o /dev/null "$URL/file.bin"
+
+	BEST=0
+	TOTAL=0
+	RUN=0
+	while [ $RUN -lt "$RUNS" ]; do
+		SPEED=$(curl -sk -o /dev/null -w '%{speed_download}' "$URL/file.bin")
+		SPEED=${SPEED%.*}
+		TOTAL=$((TOTAL + SPEED))
+		[ "$SPEED" -gt "$BEST" ] && BEST=$SPEED
+		RUN=$((RUN + 1))
+	done
+
+	printf '%-10s average %6d MB/s, best %6d MB/s\n' "$NAME" "$((TOTAL / RUNS / 1048576))" "$((BEST / 1048576))"
+
+	if [ "$SCHEME" = https ]; then
+		curl -sk "$URL/status" | grep "encrypted by the kernel" | sed 's/^/           /'
+	fi
+
+	kill "$PID"
+	wait "$PID" 2>/dev/null || true
+	PID=
+}
+
+echo "$SIZE MB file, $RUNS runs each"
+
+run_server plain http
+run_server tls https "tlsCertificate = $WORK/cert.pem" "tlsKey = $WORK/key.pem" "tlsOffload = no"
+run_server ktls https "tlsCertificate = $WORK/cert.pem" "tlsKey = $WORK/key.pem" "tlsOffload = yes"
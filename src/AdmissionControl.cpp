@@ -0,0 +1,203 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "Poco/Platform.h"
+
+#if defined(POCO_OS_FAMILY_UNIX)
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#include "Poco/Net/HTTPServerConnection.h"
+#include "Poco/Timespan.h"
+#include "Poco/Timestamp.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/Exception.h"
+
+#include "IndigoFiler.h"
+#include "IndigoConfiguration.h"
+#include "AdmissionControl.h"
+#include "Http2Connection.h"
+#include "TlsConnection.h"
+#include "RequestTrace.h"
+
+static string buildOverloadResponse()
+{
+	const string body = "<html><head><title>503 Service Unavailable</title></head><body><h1>Service Unavailable</h1></body></html>";
+
+	return
+		"HTTP/1.1 503 Service Unavailable\r\n"
+		"Server: " SERVER_FIELD_VALUE "\r\n"
+		"Retry-After: 1\r\n"
+		"Content-Type: text/html\r\n"
+		"Content-Length: " + NumberFormatter::format(body.length()) + "\r\n"
+		"Connection: close\r\n"
+		"\r\n" + body;
+}
+
+const string AdmissionControl::overloadResponse = buildOverloadResponse();
+
+AtomicCounter AdmissionControl::rejectedConnections;
+AtomicCounter AdmissionControl::droppedConnections;
+AtomicCounter AdmissionControl::lastQueueWait;
+
+AdmissionControl::RejectConnection::RejectConnection(const StreamSocket &socket, bool respond):
+	TCPServerConnection(socket),
+	respond(respond)
+{
+}
+
+void AdmissionControl::RejectConnection::run()
+{
+	if (!respond)
+		return;
+
+	try
+	{
+		StreamSocket &sock = socket();
+		sock.sendBytes(overloadResponse.data(), overloadResponse.length());
+		sock.shutdownSend();
+
+		// read what the client has sent, so that closing the socket does not reset the connection before the response arrives,
+		// but give up on clients that keep sending, so that a rejected connection cannot hold a worker thread
+		char buffer[4096];
+		int drained = 0;
+		Timestamp started;
+		sock.setReceiveTimeout(Timespan(0, 100000));
+		while (drained < MAX_DRAIN_BYTES && !started.isElapsed(MAX_DRAIN_TIME))
+		{
+			int n = sock.receiveBytes(buffer, sizeof(buffer));
+			if (n <= 0)
+				break;
+			drained += n;
+		}
+	}
+	catch (Exception &e)
+	{
+	}
+}
+
+AdmissionControl::DetectConnection::DetectConnection(const StreamSocket &socket, HTTPServerParams::Ptr params, HTTPRequestHandlerFactory::Ptr factory, ThreadPool &pool, int maxStreams):
+	TCPServerConnection(socket),
+	params(params),
+	factory(factory),
+	pool(pool),
+	maxStreams(maxStreams)
+{
+}
+
+void AdmissionControl::DetectConnection::run()
+{
+	if (Http2Connection::detect(socket(), params->getTimeout()))
+	{
+		Http2Connection connection(socket(), params, factory, pool, maxStreams);
+		connection.run();
+	}
+	else
+	{
+		HTTPServerConnection connection(socket(), params, factory);
+		connection.run();
+	}
+}
+
+AdmissionControl::AdmissionControl(HTTPServerParams::Ptr params, HTTPRequestHandlerFactory::Ptr factory, ThreadPool &pool):
+	params(params),
+	factory(factory),
+	pool(pool)
+{
+}
+
+TCPServerConnection *AdmissionControl::createConnection(const StreamSocket &socket)
+{
+	IndigoConfiguration::Snapshot snapshot;
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	// a prebuilt response cannot be sent before the TLS handshake
+	bool respond = true;
+#ifdef INDIGO_TLS
+	if (TlsConnection::enabled())
+		respond = false;
+#endif
+
+	int maxQueueWait = configuration.getMaxQueueWait();
+	int queueDeadline = configuration.getQueueDeadline();
+
+	// the wait is also traced as the first phase of the first request on the connection
+	long wait = queueWait(socket);
+	RequestTrace::setQueueWait(wait);
+
+	if (wait >= 0)
+	{
+		lastQueueWait = (int) wait;
+
+		if (queueDeadline > 0 && wait > queueDeadline)
+		{
+			droppedConnections++;
+			return new RejectConnection(socket, false);
+		}
+
+		if (maxQueueWait > 0 && wait > maxQueueWait)
+		{
+			rejectedConnections++;
+			return new RejectConnection(socket, respond);
+		}
+	}
+
+#ifdef INDIGO_TLS
+	if (TlsConnection::enabled())
+		return new TlsConnection(socket, params, factory, pool, configuration.getHttp2(), configuration.getHttp2MaxStreams());
+#endif
+
+	if (configuration.getHttp2())
+		return new DetectConnection(socket, params, factory, pool, configuration.getHttp2MaxStreams());
+
+	return new HTTPServerConnection(socket, params, factory);
+}
+
+void AdmissionControl::appendStatus(ostream &out)
+{
+	out << "Last queue wait: " << lastQueueWait.value() << " ms" << endl;
+	out << "Rejected connections: " << rejectedConnections.value() << endl;
+	out << "Dropped connections: " << droppedConnections.value() << endl;
+}
+
+// Returns the number of milliseconds since the client last sent data on the socket, or -1 if this is not known.
+// For a connection that was just taken out of the dispatch queue, this is the time its request waited in the queue.
+long AdmissionControl::queueWait(const StreamSocket &socket)
+{
+#if defined(POCO_OS_FAMILY_UNIX) && defined(TCP_INFO)
+	tcp_info info;
+	socklen_t length = sizeof(info);
+	if (getsockopt(socket.impl()->sockfd(), IPPROTO_TCP, TCP_INFO, &info, &length) == 0)
+		return info.tcpi_last_data_recv;
+#endif
+
+	return -1;
+}
@@ -0,0 +1,106 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef ADMISSIONCONTROL_H
+#define ADMISSIONCONTROL_H
+
+#include <string>
+#include <ostream>
+
+#include "Poco/Net/TCPServerConnectionFactory.h"
+#include "Poco/Net/TCPServerConnection.h"
+#include "Poco/Net/HTTPServerParams.h"
+#include "Poco/Net/HTTPRequestHandlerFactory.h"
+#include "Poco/Net/StreamSocket.h"
+#include "Poco/ThreadPool.h"
+#include "Poco/AtomicCounter.h"
+
+using namespace std;
+
+using namespace Poco;
+using namespace Poco::Net;
+
+// Creates the HTTP connections of the server, unless a connection has waited in the dispatch queue for too long.
+// Such connections get a prebuilt 503 response, or are closed right away if the client has probably given up.
+// When HTTP/2 is enabled, admitted connections are served as HTTP/2 or HTTP/1.x, depending on how the client starts.
+// When TLS is enabled, all connections are served over TLS.
+class AdmissionControl: public TCPServerConnectionFactory
+{
+public:
+	AdmissionControl(HTTPServerParams::Ptr params, HTTPRequestHandlerFactory::Ptr factory, ThreadPool &pool);
+
+	TCPServerConnection *createConnection(const StreamSocket &socket);
+
+	static void appendStatus(ostream &out);
+
+private:
+	class RejectConnection: public TCPServerConnection
+	{
+	public:
+		RejectConnection(const StreamSocket &socket, bool respond);
+
+		void run();
+
+	private:
+		enum
+		{
+			MAX_DRAIN_BYTES = 65536,
+			MAX_DRAIN_TIME = 1000000
+		};
+
+		bool respond;
+	};
+
+	class DetectConnection: public TCPServerConnection
+	{
+	public:
+		DetectConnection(const StreamSocket &socket, HTTPServerParams::Ptr params, HTTPRequestHandlerFactory::Ptr factory, ThreadPool &pool, int maxStreams);
+
+		void run();
+
+	private:
+		HTTPServerParams::Ptr params;
+		HTTPRequestHandlerFactory::Ptr factory;
+		ThreadPool &pool;
+		int maxStreams;
+	};
+
+	static long queueWait(const StreamSocket &socket);
+
+	HTTPServerParams::Ptr params;
+	HTTPRequestHandlerFactory::Ptr factory;
+	ThreadPool &pool;
+
+	static const string overloadResponse;
+
+	static AtomicCounter rejectedConnections;
+	static AtomicCounter droppedConnections;
+	static AtomicCounter lastQueueWait;
+};
+
+#endif //ADMISSIONCONTROL_H
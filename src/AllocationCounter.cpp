@@ -0,0 +1,121 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifdef INDIGO_COUNT_ALLOCATIONS
+
+#include <cstdlib>
+#include <new>
+
+#include <string>
+
+#include "Poco/Util/Application.h"
+#include "Poco/NumberFormatter.h"
+
+#include "AllocationCounter.h"
+
+using namespace std;
+
+using namespace Poco;
+using namespace Poco::Util;
+
+// dynamic exception specifications are ill-formed since C++17
+#if __cplusplus < 201103L
+#define THROWS_BAD_ALLOC throw(bad_alloc)
+#define THROWS_NOTHING throw()
+#else
+#define THROWS_BAD_ALLOC noexcept(false)
+#define THROWS_NOTHING noexcept
+#endif
+
+static __thread unsigned long allocations = 0;
+
+void *operator new(size_t size) THROWS_BAD_ALLOC
+{
+	++allocations;
+
+	void *p = malloc(size > 0 ? size : 1);
+	if (p == NULL)
+		throw bad_alloc();
+
+	return p;
+}
+
+void *operator new[](size_t size) THROWS_BAD_ALLOC
+{
+	return operator new(size);
+}
+
+void operator delete(void *p) THROWS_NOTHING
+{
+	free(p);
+}
+
+void operator delete[](void *p) THROWS_NOTHING
+{
+	free(p);
+}
+
+// C++14 compilers call the sized forms when they know the size of the object
+#if __cplusplus >= 201402L
+void operator delete(void *p, size_t size) THROWS_NOTHING
+{
+	free(p);
+}
+
+void operator delete[](void *p, size_t size) THROWS_NOTHING
+{
+	free(p);
+}
+#endif
+
+AllocationCounter::AllocationCounter(const HTTPServerRequest &request):
+	request(request),
+	start(count())
+{
+}
+
+AllocationCounter::~AllocationCounter()
+{
+	unsigned long n = count() - start;
+
+	try
+	{
+		string logString = request.getMethod() + " " + request.getURI() + " - " + NumberFormatter::format(n) + " allocations";
+		Application::instance().logger().information(logString);
+	}
+	catch (...)
+	{
+	}
+}
+
+unsigned long AllocationCounter::count()
+{
+	return allocations;
+}
+
+#endif //INDIGO_COUNT_ALLOCATIONS
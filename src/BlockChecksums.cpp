@@ -0,0 +1,272 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <cstring>
+
+#include "Poco/Checksum.h"
+#include "Poco/Buffer.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/NumberParser.h"
+#include "Poco/ScopedLock.h"
+#include "Poco/Exception.h"
+
+#include "BlockChecksums.h"
+#include "IndigoConfiguration.h"
+#include "StreamingFile.h"
+
+// at most this many tables are kept, however small they are
+#define MAX_CACHED_TABLES 4096
+
+unordered_map<string, BlockChecksums::TablePtr> BlockChecksums::tables;
+deque<pair<string, BlockChecksums::TablePtr> > BlockChecksums::order;
+size_t BlockChecksums::cachedBlocks = 0;
+FastMutex BlockChecksums::mutex;
+
+AtomicCounter BlockChecksums::hits;
+AtomicCounter BlockChecksums::misses;
+
+// Returns the checksum table of this version of the file, or NULL if the file changed while it was read.
+BlockChecksums::TablePtr BlockChecksums::lookup(const string &path, File::FileSize size, const Timestamp &modified, int blockSize)
+{
+	{
+		FastMutex::ScopedLock lock(mutex);
+
+		unordered_map<string, TablePtr>::const_iterator it = tables.find(path);
+		if (it != tables.end())
+		{
+			const Table &table = *it->second;
+			if (table.size == size && table.modified == modified.epochMicroseconds() && table.blockSize == blockSize)
+			{
+				hits++;
+				return it->second;
+			}
+		}
+	}
+
+	misses++;
+
+	// concurrent misses of the same version are usually coalesced by the request handler before they get here
+	TablePtr table = compute(path, size, modified, blockSize);
+	if (!table.isNull())
+		store(path, table);
+
+	return table;
+}
+
+// The version names both the file contents and the way they are split, so that blocks are
+// never assembled from tables of different files or block sizes.
+string BlockChecksums::version(File::FileSize size, const Timestamp &modified, int blockSize)
+{
+	string v;
+	NumberFormatter::appendHex(v, (UInt64) size);
+	v += '-';
+	NumberFormatter::appendHex(v, (UInt64) modified.epochMicroseconds());
+	v += '-';
+	NumberFormatter::appendHex(v, (unsigned) blockSize);
+	return v;
+}
+
+void BlockChecksums::writeTable(ostream &out, const Table &table)
+{
+	string hex;
+
+	for (int i = 0; i < Sha256::DIGEST_SIZE; i++)
+		NumberFormatter::appendHex(hex, (unsigned) table.digest[i], 2);
+
+	out << "version " << version(table.size, Timestamp(table.modified), table.blockSize) << "\n";
+	out << "size " << table.size << "\n";
+	out << "block-size " << table.blockSize << "\n";
+	out << "sha-256 " << hex << "\n";
+
+	vector<Block>::const_iterator end = table.blocks.end();
+	for (vector<Block>::const_iterator it = table.blocks.begin(); it != end; ++it)
+	{
+		hex.clear();
+		NumberFormatter::appendHex(hex, it->weak, 8);
+		hex += ' ';
+		for (int i = 0; i < STRONG_SIZE; i++)
+			NumberFormatter::appendHex(hex, (unsigned) it->strong[i], 2);
+		hex += '\n';
+		out << hex;
+	}
+}
+
+// Recognizes ?blocks, which asks for the checksum table, and ?blocks=<ranges>&version=<version>,
+// which asks for the blocks in the ranges.
+BlockChecksums::Query BlockChecksums::parseQuery(const char *query, size_t length, string &version, string &blocks)
+{
+	Query result = QUERY_NONE;
+	version.clear();
+	blocks.clear();
+
+	const char *end = query + length;
+	const char *param = query;
+	while (param < end)
+	{
+		const char *paramEnd = param;
+		while (paramEnd != end && *paramEnd != '&')
+			++paramEnd;
+
+		string p(param, paramEnd);
+		if (p == "blocks")
+		{
+			result = QUERY_TABLE;
+		}
+		else if (p.compare(0, 7, "blocks=") == 0)
+		{
+			result = QUERY_BLOCKS;
+			blocks.assign(p, 7, string::npos);
+		}
+		else if (p.compare(0, 8, "version=") == 0)
+		{
+			version.assign(p, 8, string::npos);
+		}
+
+		param = paramEnd + 1;
+	}
+
+	return result;
+}
+
+// Parses comma-separated block numbers and inclusive ranges of them, such as "0-3,17".
+bool BlockChecksums::parseBlocks(const string &blocks, size_t count, vector<pair<size_t, size_t> > &ranges)
+{
+	ranges.clear();
+
+	string::size_type pos = 0;
+	while (pos < blocks.length())
+	{
+		string::size_type comma = blocks.find(',', pos);
+		if (comma == string::npos)
+			comma = blocks.length();
+
+		string range(blocks, pos, comma - pos);
+		string::size_type dash = range.find('-');
+		string firstText(range, 0, dash);
+		string lastText(dash == string::npos ? firstText : range.substr(dash + 1));
+
+		unsigned first;
+		unsigned last;
+		if (!NumberParser::tryParseUnsigned(firstText, first) || !NumberParser::tryParseUnsigned(lastText, last))
+			return false;
+		if (first > last || last >= count || ranges.size() >= MAX_RANGES)
+			return false;
+
+		ranges.push_back(make_pair((size_t) first, (size_t) last));
+		pos = comma + 1;
+	}
+
+	return !ranges.empty();
+}
+
+void BlockChecksums::appendStatus(ostream &out)
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	out << "Block checksums: " << tables.size() << " tables, " << cachedBlocks << " blocks cached, ";
+	out << hits.value() << " hits, " << misses.value() << " misses" << endl;
+}
+
+BlockChecksums::TablePtr BlockChecksums::compute(const string &path, File::FileSize size, const Timestamp &modified, int blockSize)
+{
+	TablePtr table = new Table;
+	table->size = size;
+	table->modified = modified.epochMicroseconds();
+	table->blockSize = blockSize;
+	table->blocks.reserve((size_t) ((size + blockSize - 1) / blockSize));
+
+	// large files are read the way they are sent, without filling the page cache
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+	int streamFileSize = configuration.getStreamFileSize();
+	bool large = (streamFileSize > 0 && size > (File::FileSize) streamFileSize);
+
+	StreamingFile istr(path, large, configuration.getStreamReadahead());
+	Buffer<char> buffer(blockSize);
+	Sha256 whole;
+	File::FileSize total = 0;
+
+	for (;;)
+	{
+		// reads may come up short, but blocks must not
+		streamsize n = 0;
+		streamsize r;
+		while (n < blockSize && (r = istr.read(buffer.begin() + n, blockSize - n)) > 0)
+			n += r;
+		if (n == 0)
+			break;
+
+		Block block;
+
+		Checksum weak(Checksum::TYPE_ADLER32);
+		weak.update(buffer.begin(), (unsigned) n);
+		block.weak = weak.checksum();
+
+		unsigned char digest[Sha256::DIGEST_SIZE];
+		Sha256 strong;
+		strong.update(buffer.begin(), n);
+		strong.finish(digest);
+		memcpy(block.strong, digest, STRONG_SIZE);
+
+		whole.update(buffer.begin(), n);
+		table->blocks.push_back(block);
+		total += n;
+	}
+
+	whole.finish(table->digest);
+
+	// the table is only good if the file did not change while it was read
+	File file(path);
+	if (total != size || file.getSize() != size || file.getLastModified() != modified)
+		return TablePtr();
+
+	return table;
+}
+
+void BlockChecksums::store(const string &path, TablePtr table)
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	TablePtr &cached = tables[path];
+	if (!cached.isNull())
+		cachedBlocks -= cached->blocks.size();
+	cached = table;
+	cachedBlocks += table->blocks.size();
+	order.push_back(make_pair(path, table));
+
+	// the oldest tables go first; entries of tables that were replaced since are skipped
+	while ((cachedBlocks > MAX_CACHED_BLOCKS || order.size() > MAX_CACHED_TABLES) && order.size() > 1)
+	{
+		unordered_map<string, TablePtr>::iterator it = tables.find(order.front().first);
+		if (it != tables.end() && it->second == order.front().second)
+		{
+			cachedBlocks -= it->second->blocks.size();
+			tables.erase(it);
+		}
+		order.pop_front();
+	}
+}
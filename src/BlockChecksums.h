@@ -0,0 +1,123 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef BLOCKCHECKSUMS_H
+#define BLOCKCHECKSUMS_H
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+#include <ostream>
+#include <tr1/unordered_map> // change to <unordered_map> on c++0x compilers
+
+#include "Poco/Types.h"
+#include "Poco/File.h"
+#include "Poco/Timestamp.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/Mutex.h"
+#include "Poco/AtomicCounter.h"
+
+#include "Sha256.h"
+
+using namespace std;
+using namespace std::tr1; // remove this on c++0x compilers
+
+using namespace Poco;
+
+// Per-block checksums of files, for delta downloads in the style of rsync
+// and zsync. A client fetches the checksum table of the current version of
+// a file, finds the blocks it already has anywhere in its old copy by
+// rolling the weak checksum over it and confirming matches with the strong
+// one, and downloads only the remaining blocks. The weak checksum is
+// Adler-32, and the strong one is the first half of the SHA-256 of the
+// block. Tables are computed when first requested, and kept in memory for
+// as long as the size and modification time of the file stay the same.
+class BlockChecksums
+{
+public:
+	enum
+	{
+		STRONG_SIZE = 16
+	};
+
+	enum Query
+	{
+		QUERY_NONE,
+		QUERY_TABLE,
+		QUERY_BLOCKS
+	};
+
+	struct Block
+	{
+		UInt32 weak;
+		unsigned char strong[STRONG_SIZE];
+	};
+
+	struct Table
+	{
+		File::FileSize size;
+		Int64 modified;
+		int blockSize;
+		vector<Block> blocks;
+		unsigned char digest[Sha256::DIGEST_SIZE];
+	};
+
+	typedef SharedPtr<Table> TablePtr;
+
+	static TablePtr lookup(const string &path, File::FileSize size, const Timestamp &modified, int blockSize);
+	static string version(File::FileSize size, const Timestamp &modified, int blockSize);
+	static void writeTable(ostream &out, const Table &table);
+
+	static Query parseQuery(const char *query, size_t length, string &version, string &blocks);
+	static bool parseBlocks(const string &blocks, size_t count, vector<pair<size_t, size_t> > &ranges);
+
+	static void appendStatus(ostream &out);
+
+private:
+	static TablePtr compute(const string &path, File::FileSize size, const Timestamp &modified, int blockSize);
+	static void store(const string &path, TablePtr table);
+
+	enum
+	{
+		MAX_CACHED_BLOCKS = 1048576,
+		MAX_RANGES = 4096
+	};
+
+	static unordered_map<string, TablePtr> tables;
+	static deque<pair<string, TablePtr> > order;
+	static size_t cachedBlocks;
+	static FastMutex mutex;
+
+	static AtomicCounter hits;
+	static AtomicCounter misses;
+};
+
+#endif //BLOCKCHECKSUMS_H
@@ -0,0 +1,117 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <cstring>
+
+#include "Poco/File.h"
+#include "Poco/Exception.h"
+
+#include "Bundle.h"
+
+const char Bundle::magic[8] = { 'I', 'F', 'B', 'U', 'N', 'D', 'L', 'E' };
+
+Bundle::Bundle(const string &path):
+	path(path),
+	memory(File(path), SharedMemory::AM_READ),
+	base(memory.begin()),
+	size(memory.end() - memory.begin()),
+	slotCount(0),
+	slots(NULL)
+{
+	if (size < HEADER_SIZE || memcmp(base, magic, sizeof(magic)) != 0 || readLE(base + 8, 4) != VERSION)
+		throw DataFormatException("\"" + path + "\" is not a bundle");
+
+	slotCount = readLE(base + 16, 8);
+	UInt64 slotsOffset = readLE(base + 24, 8);
+
+	// the table size is a power of two, so that probing can wrap with a mask
+	if (slotCount == 0 || (slotCount & (slotCount - 1)) != 0 ||
+		slotsOffset > size || slotCount > (size - slotsOffset) / SLOT_SIZE)
+		throw DataFormatException("\"" + path + "\" is a damaged bundle");
+
+	slots = base + slotsOffset;
+}
+
+bool Bundle::find(const char *name, size_t length, Entry &entry) const
+{
+	UInt64 h = hash(name, length);
+	UInt64 mask = slotCount - 1;
+
+	for (UInt64 i = h & mask, probes = 0; probes < slotCount; i = (i + 1) & mask, probes++)
+	{
+		const char *slot = slots + i * SLOT_SIZE;
+
+		UInt64 slotHash = readLE(slot, 8);
+		if (slotHash == 0)
+			return false;
+		if (slotHash != h)
+			continue;
+
+		UInt64 nameOffset = readLE(slot + 8, 8);
+		UInt64 nameLength = readLE(slot + 40, 4);
+		if (nameLength != length || nameOffset > size || nameLength > size - nameOffset)
+			continue;
+		if (memcmp(base + nameOffset, name, length) != 0)
+			continue;
+
+		UInt64 dataOffset = readLE(slot + 16, 8);
+		UInt64 dataLength = readLE(slot + 24, 8);
+		if (dataOffset > size || dataLength > size - dataOffset)
+			throw DataFormatException("\"" + path + "\" is a damaged bundle");
+
+		entry.data = base + dataOffset;
+		entry.length = dataLength;
+		entry.modified = Timestamp::fromEpochTime((time_t) readLE(slot + 32, 8));
+		entry.directory = ((readLE(slot + 44, 4) & FLAG_DIRECTORY) != 0);
+
+		return true;
+	}
+
+	return false;
+}
+
+// 64 bit FNV-1a; zero is reserved for empty slots
+UInt64 Bundle::hash(const char *name, size_t length)
+{
+	UInt64 h = 14695981039346656037ULL;
+	for (size_t i = 0; i < length; i++)
+	{
+		h ^= (unsigned char) name[i];
+		h *= 1099511628211ULL;
+	}
+
+	return (h != 0 ? h : 1);
+}
+
+UInt64 Bundle::readLE(const char *p, int bytes)
+{
+	UInt64 value = 0;
+	for (int i = bytes - 1; i >= 0; i--)
+		value = (value << 8) | (unsigned char) p[i];
+	return value;
+}
@@ -0,0 +1,92 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef BUNDLE_H
+#define BUNDLE_H
+
+#include <cstddef>
+
+#include <string>
+
+#include "Poco/Types.h"
+#include "Poco/Timestamp.h"
+#include "Poco/SharedMemory.h"
+
+using namespace std;
+
+using namespace Poco;
+
+// A read-only, memory mapped bundle of files, packed with indigo-filer --pack=<bundle> <directory>.
+//
+// Layout, with all integers in little endian byte order:
+//   header: magic "IFBUNDLE", UInt32 version, UInt32 reserved,
+//           UInt64 slot count, UInt64 offset of the slots, UInt64 entry count
+//   slots:  an open addressing hash table with linear probing, in which each slot holds
+//           UInt64 name hash, UInt64 name offset, UInt64 data offset, UInt64 data length,
+//           Int64 modification time, UInt32 name length, UInt32 flags;
+//           a zero hash marks an empty slot
+//   names and file data follow, without any alignment
+// Names are relative paths with '/' separators. Directories have entries of their own.
+class Bundle
+{
+public:
+	struct Entry
+	{
+		const char *data;
+		UInt64 length;
+		Timestamp modified;
+		bool directory;
+	};
+
+	Bundle(const string &path);
+
+	bool find(const char *name, size_t length, Entry &entry) const;
+
+	static UInt64 hash(const char *name, size_t length);
+	static UInt64 readLE(const char *p, int bytes);
+
+	static const char magic[8];
+
+	enum
+	{
+		VERSION = 1,
+		HEADER_SIZE = 40,
+		SLOT_SIZE = 48,
+		FLAG_DIRECTORY = 1
+	};
+
+private:
+	const string path;
+	SharedMemory memory;
+	const char *base;
+	UInt64 size;
+	UInt64 slotCount;
+	const char *slots;
+};
+
+#endif //BUNDLE_H
@@ -0,0 +1,186 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <algorithm>
+
+#include "Poco/DirectoryIterator.h"
+#include "Poco/FileStream.h"
+#include "Poco/StreamCopier.h"
+#include "Poco/Exception.h"
+
+#include "BundleWriter.h"
+#include "Bundle.h"
+
+BundleWriter::BundleWriter():
+	entries()
+{
+}
+
+void BundleWriter::addTree(const string &path)
+{
+	addTree(path, "");
+}
+
+void BundleWriter::addTree(const string &path, const string &prefix)
+{
+	DirectoryIterator it(path);
+	DirectoryIterator end;
+	for (; it != end; ++it)
+	{
+		// hidden files are left out, as they are from directory listings
+		if (it->isHidden())
+			continue;
+
+		Entry entry;
+		entry.name = prefix + it.name();
+		entry.path = it->path();
+		entry.modified = it->getLastModified();
+
+		if (it->isDirectory())
+		{
+			if (it->isLink())
+				continue;
+
+			entry.length = 0;
+			entry.directory = true;
+			entries.push_back(entry);
+
+			addTree(entry.path, entry.name + '/');
+		}
+		else if (it->isFile())
+		{
+			entry.length = it->getSize();
+			entry.directory = false;
+			entries.push_back(entry);
+		}
+	}
+}
+
+// Writes the bundle to a temporary file next to the target and renames it into place when done,
+// so that a server that maps the old bundle is not disturbed.
+void BundleWriter::write(const string &bundlePath)
+{
+	UInt64 slotCount = 1;
+	while (slotCount < 2 * entries.size())
+		slotCount *= 2;
+
+	UInt64 slotsOffset = Bundle::HEADER_SIZE;
+	UInt64 namesOffset = slotsOffset + slotCount * Bundle::SLOT_SIZE;
+
+	UInt64 dataOffset = namesOffset;
+	for (vector<Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+		dataOffset += it->name.length();
+
+	vector<string> slots(slotCount);
+	string names;
+	UInt64 nextData = dataOffset;
+
+	for (vector<Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		const Entry &entry = *it;
+		UInt64 hash = Bundle::hash(entry.name.data(), entry.name.length());
+
+		UInt64 i = hash & (slotCount - 1);
+		while (!slots[i].empty())
+			i = (i + 1) & (slotCount - 1);
+
+		string &slot = slots[i];
+		appendLE(slot, hash, 8);
+		appendLE(slot, namesOffset + names.length(), 8);
+		appendLE(slot, nextData, 8);
+		appendLE(slot, entry.length, 8);
+		appendLE(slot, entry.modified.epochTime(), 8);
+		appendLE(slot, entry.name.length(), 4);
+		appendLE(slot, entry.directory ? Bundle::FLAG_DIRECTORY : 0, 4);
+
+		names += entry.name;
+		nextData += entry.length;
+	}
+
+	string tempPath = bundlePath + ".tmp";
+	{
+		FileOutputStream out(tempPath);
+		if (!out.good())
+			throw CreateFileException(tempPath);
+
+		string header(Bundle::magic, sizeof(Bundle::magic));
+		appendLE(header, Bundle::VERSION, 4);
+		appendLE(header, 0, 4);
+		appendLE(header, slotCount, 8);
+		appendLE(header, slotsOffset, 8);
+		appendLE(header, entries.size(), 8);
+		out.write(header.data(), header.length());
+
+		const string emptySlot(Bundle::SLOT_SIZE, '\0');
+		for (vector<string>::const_iterator it = slots.begin(); it != slots.end(); ++it)
+		{
+			const string &slot = (it->empty() ? emptySlot : *it);
+			out.write(slot.data(), slot.length());
+		}
+
+		out.write(names.data(), names.length());
+
+		for (vector<Entry>::const_iterator it = entries.begin(); it != entries.end(); ++it)
+			writeData(out, *it);
+
+		out.close();
+		if (!out.good())
+			throw WriteFileException(tempPath);
+	}
+
+	File(tempPath).renameTo(bundlePath);
+}
+
+size_t BundleWriter::count() const
+{
+	return entries.size();
+}
+
+void BundleWriter::writeData(ostream &out, const Entry &entry)
+{
+	if (entry.directory)
+		return;
+
+	FileInputStream in(entry.path);
+	if (!in.good())
+		throw OpenFileException(entry.path);
+
+	// the length in the slot is already written, so the file must not have changed meanwhile
+	streamsize copied = StreamCopier::copyStream(in, out);
+	if ((UInt64) copied != entry.length)
+		throw ReadFileException(entry.path + " changed while it was being packed");
+}
+
+void BundleWriter::appendLE(string &str, UInt64 value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+	{
+		str += (char) (value & 0xFF);
+		value >>= 8;
+	}
+}
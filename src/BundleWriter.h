@@ -0,0 +1,73 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef BUNDLEWRITER_H
+#define BUNDLEWRITER_H
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "Poco/Types.h"
+#include "Poco/File.h"
+#include "Poco/Timestamp.h"
+
+using namespace std;
+
+using namespace Poco;
+
+// Packs a directory tree into a bundle file, in the layout described in Bundle.h.
+class BundleWriter
+{
+public:
+	BundleWriter();
+
+	void addTree(const string &path);
+	void write(const string &bundlePath);
+
+	size_t count() const;
+
+private:
+	struct Entry
+	{
+		string name;
+		string path;
+		UInt64 length;
+		Timestamp modified;
+		bool directory;
+	};
+
+	void addTree(const string &path, const string &prefix);
+	void writeData(ostream &out, const Entry &entry);
+
+	static void appendLE(string &str, UInt64 value, int bytes);
+
+	vector<Entry> entries;
+};
+
+#endif //BUNDLEWRITER_H
@@ -0,0 +1,118 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <algorithm>
+
+#include "Poco/Timestamp.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/NumberParser.h"
+#include "Poco/ScopedLock.h"
+
+#include "ChangeJournal.h"
+
+// tokens name the run of the server that issued them, so that sequence numbers are not mixed up across restarts
+const string ChangeJournal::epoch = NumberFormatter::formatHex((UInt64) Timestamp().epochMicroseconds());
+
+deque<ChangeJournal::Change> ChangeJournal::changes;
+UInt64 ChangeJournal::lastSequence = 0;
+UInt64 ChangeJournal::lastDropped = 0;
+FastMutex ChangeJournal::mutex;
+
+// Records a change to the file at the path, relative to the share and separated by slashes.
+void ChangeJournal::record(const string &share, const string &path)
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	if (changes.size() >= MAX_CHANGES)
+	{
+		lastDropped = changes.front().sequence;
+		changes.pop_front();
+	}
+
+	Change change;
+	change.sequence = ++lastSequence;
+	change.share = share;
+	change.path = path;
+	changes.push_back(change);
+}
+
+// Returns the token of the current point in the journal.
+string ChangeJournal::token()
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	return epoch + "-" + NumberFormatter::formatHex(lastSequence);
+}
+
+// Finds the paths below the prefix of a share that changed after the token, relative to the prefix, each once.
+// Returns false if the changes since the token are not known.
+bool ChangeJournal::changesSince(const string &token, const string &share, const string &prefix, vector<string> &paths)
+{
+	UInt64 sequence;
+	if (!parseToken(token, sequence))
+		return false;
+
+	{
+		FastMutex::ScopedLock lock(mutex);
+
+		if (sequence < lastDropped || sequence > lastSequence)
+			return false;
+
+		// the journal is ordered by sequence, so the changes after the token are at its end
+		deque<Change>::const_iterator it = changes.end();
+		while (it != changes.begin() && (it - 1)->sequence > sequence)
+			--it;
+
+		for (; it != changes.end(); ++it)
+		{
+			if (it->share == share && it->path.compare(0, prefix.length(), prefix) == 0)
+				paths.push_back(it->path.substr(prefix.length()));
+		}
+	}
+
+	sort(paths.begin(), paths.end());
+	paths.erase(unique(paths.begin(), paths.end()), paths.end());
+
+	return true;
+}
+
+void ChangeJournal::appendStatus(ostream &out)
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	out << "Journaled changes: " << changes.size() << " of " << lastSequence << endl;
+}
+
+bool ChangeJournal::parseToken(const string &token, UInt64 &sequence)
+{
+	string::size_type dash = token.find('-');
+	if (dash == string::npos || token.compare(0, dash, epoch) != 0 || dash != epoch.length())
+		return false;
+
+	return NumberParser::tryParseHex64(token.substr(dash + 1), sequence);
+}
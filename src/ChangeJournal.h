@@ -0,0 +1,83 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef CHANGEJOURNAL_H
+#define CHANGEJOURNAL_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <ostream>
+
+#include "Poco/Types.h"
+#include "Poco/Mutex.h"
+
+using namespace std;
+
+using namespace Poco;
+
+// A bounded, in-memory record of the files changed through the server, for
+// incremental manifests. Every change gets the next sequence number, and a
+// change token names the point in the journal after which a client wants
+// the changes. A token from another run of the server, or one older than the
+// oldest change still kept, cannot be answered, and the client gets a full
+// manifest instead. Changes made to the files outside the server are not
+// recorded.
+class ChangeJournal
+{
+public:
+	static void record(const string &share, const string &path);
+	static string token();
+	static bool changesSince(const string &token, const string &share, const string &prefix, vector<string> &paths);
+
+	static void appendStatus(ostream &out);
+
+private:
+	struct Change
+	{
+		UInt64 sequence;
+		string share;
+		string path;
+	};
+
+	static bool parseToken(const string &token, UInt64 &sequence);
+
+	enum
+	{
+		MAX_CHANGES = 65536
+	};
+
+	static const string epoch;
+
+	static deque<Change> changes;
+	static UInt64 lastSequence;
+	static UInt64 lastDropped;
+	static FastMutex mutex;
+};
+
+#endif //CHANGEJOURNAL_H
@@ -0,0 +1,199 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+#include <algorithm>
+
+#include "Poco/StringTokenizer.h"
+#include "Poco/NumberParser.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/FileStream.h"
+#include "Poco/Exception.h"
+
+#include "CpuAffinity.h"
+
+using namespace Poco;
+
+CpuAffinity::Scope::Scope(const CpuSet &cpus):
+	pinned(false),
+	saved()
+{
+	if (cpus.empty())
+		return;
+
+#if defined(__linux__)
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	if (sched_getaffinity(0, sizeof(mask), &mask) != 0)
+		throw SystemException("Cannot get the CPU affinity of the thread");
+
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+	{
+		if (CPU_ISSET(cpu, &mask))
+			saved.push_back(cpu);
+	}
+
+	CPU_ZERO(&mask);
+	for (CpuSet::const_iterator it = cpus.begin(); it != cpus.end(); ++it)
+	{
+		if (*it < CPU_SETSIZE)
+			CPU_SET(*it, &mask);
+	}
+
+	if (sched_setaffinity(0, sizeof(mask), &mask) != 0)
+		throw SystemException("Cannot pin threads to CPUs " + format(cpus));
+
+	pinned = true;
+#endif
+}
+
+CpuAffinity::Scope::~Scope()
+{
+#if defined(__linux__)
+	if (!pinned)
+		return;
+
+	cpu_set_t mask;
+	CPU_ZERO(&mask);
+	for (CpuSet::const_iterator it = saved.begin(); it != saved.end(); ++it)
+		CPU_SET(*it, &mask);
+
+	sched_setaffinity(0, sizeof(mask), &mask);
+#endif
+}
+
+// Parses a list of CPU sets separated by semicolons, each in the kernel's cpulist format, e.g. "0-7,16-23;8-15,24-31".
+// The special value "numa" gives one set per NUMA node, with the CPUs of the node.
+void CpuAffinity::parse(const string &spec, vector<CpuSet> &sets)
+{
+	sets.clear();
+
+#if !defined(__linux__)
+	if (!spec.empty())
+		throw ApplicationException("CPU affinity is only supported on Linux");
+#endif
+
+	if (spec == "numa")
+	{
+		readNodes(sets);
+		return;
+	}
+
+	StringTokenizer tokenizer(spec, ";", StringTokenizer::TOK_TRIM | StringTokenizer::TOK_IGNORE_EMPTY);
+	for (StringTokenizer::Iterator it = tokenizer.begin(); it != tokenizer.end(); ++it)
+	{
+		CpuSet cpus;
+		parseList(*it, cpus);
+		sets.push_back(cpus);
+	}
+}
+
+string CpuAffinity::format(const CpuSet &cpus)
+{
+	string s;
+
+	CpuSet::size_type i = 0;
+	while (i < cpus.size())
+	{
+		// collapse runs of consecutive CPUs into ranges
+		CpuSet::size_type j = i;
+		while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+			j++;
+
+		if (!s.empty())
+			s += ',';
+		NumberFormatter::append(s, cpus[i]);
+		if (j > i)
+		{
+			s += '-';
+			NumberFormatter::append(s, cpus[j]);
+		}
+
+		i = j + 1;
+	}
+
+	return s;
+}
+
+void CpuAffinity::parseList(const string &list, CpuSet &cpus)
+{
+	StringTokenizer tokenizer(list, ",", StringTokenizer::TOK_TRIM | StringTokenizer::TOK_IGNORE_EMPTY);
+	for (StringTokenizer::Iterator it = tokenizer.begin(); it != tokenizer.end(); ++it)
+	{
+		const string &range = *it;
+		string::size_type dash = range.find('-');
+
+		int first;
+		int last;
+		if (!NumberParser::tryParse(range.substr(0, dash), first) ||
+			!NumberParser::tryParse(dash == string::npos ? range : range.substr(dash + 1), last) ||
+			first < 0 || last < first)
+			throw ApplicationException("\"" + list + "\" is not a valid CPU list");
+
+		for (int cpu = first; cpu <= last; cpu++)
+			cpus.push_back(cpu);
+	}
+
+	if (cpus.empty())
+		throw ApplicationException("\"" + list + "\" is not a valid CPU list");
+
+	sort(cpus.begin(), cpus.end());
+	cpus.erase(unique(cpus.begin(), cpus.end()), cpus.end());
+}
+
+void CpuAffinity::readNodes(vector<CpuSet> &sets)
+{
+	const string nodes = "/sys/devices/system/node/";
+
+	string online;
+	{
+		FileInputStream istr(nodes + "online");
+		getline(istr, online);
+	}
+
+	CpuSet nodeIds;
+	parseList(online, nodeIds);
+
+	for (CpuSet::const_iterator it = nodeIds.begin(); it != nodeIds.end(); ++it)
+	{
+		string cpulist;
+		FileInputStream istr(nodes + "node" + NumberFormatter::format(*it) + "/cpulist");
+		getline(istr, cpulist);
+
+		// nodes with memory but no CPUs get no workers
+		if (cpulist.empty())
+			continue;
+
+		CpuSet cpus;
+		parseList(cpulist, cpus);
+		sets.push_back(cpus);
+	}
+}
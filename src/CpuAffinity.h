@@ -0,0 +1,65 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef CPUAFFINITY_H
+#define CPUAFFINITY_H
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Pins threads to sets of CPUs, on Linux. A new thread starts with the affinity of the thread
+// that creates it, so pinning the main thread while a worker group is set up pins all the threads
+// of the group, including those its pool creates later.
+class CpuAffinity
+{
+public:
+	typedef vector<int> CpuSet;
+
+	// Pins the calling thread to a set of CPUs for the lifetime of the object; an empty set leaves it as is.
+	class Scope
+	{
+	public:
+		Scope(const CpuSet &cpus);
+		~Scope();
+
+	private:
+		bool pinned;
+		CpuSet saved;
+	};
+
+	static void parse(const string &spec, vector<CpuSet> &sets);
+	static string format(const CpuSet &cpus);
+
+private:
+	static void parseList(const string &list, CpuSet &cpus);
+	static void readNodes(vector<CpuSet> &sets);
+};
+
+#endif //CPUAFFINITY_H
@@ -0,0 +1,395 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <cstring>
+
+#include "Poco/Util/Application.h"
+#include "Poco/Buffer.h"
+#include "Poco/File.h"
+#include "Poco/ScopedLock.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Exception.h"
+
+#if defined(POCO_OS_FAMILY_UNIX)
+#include <sys/stat.h>
+#endif
+
+#include "DigestCache.h"
+#include "IndigoConfiguration.h"
+#include "StreamingFile.h"
+
+using namespace Poco::Util;
+
+// files are read for hashing in chunks of this size
+#define DIGEST_CHUNK_SIZE 65536
+
+bool DigestCache::running = false;
+string DigestCache::storePath;
+FileOutputStream *DigestCache::store = NULL;
+
+unordered_map<DigestCache::Key, DigestCache::Entry, DigestCache::KeyHash> DigestCache::digests;
+list<DigestCache::Key> DigestCache::uses;
+deque<string> DigestCache::pending;
+unordered_set<string> DigestCache::queued;
+FastMutex DigestCache::mutex;
+Event DigestCache::wakeUp;
+
+Thread *DigestCache::thread = NULL;
+DigestCache::DigesterRunnable DigestCache::runnable;
+
+AtomicCounter DigestCache::hits;
+AtomicCounter DigestCache::misses;
+AtomicCounter DigestCache::computed;
+AtomicCounter DigestCache::evicted;
+
+bool DigestCache::Key::operator == (const Key &other) const
+{
+	return
+		device == other.device &&
+		inode == other.inode &&
+		size == other.size &&
+		modified == other.modified &&
+		changed == other.changed;
+}
+
+size_t DigestCache::KeyHash::operator () (const Key &key) const
+{
+	UInt64 h = key.inode * 0x9E3779B97F4A7C15ULL;
+	h ^= key.device + (h << 6) + (h >> 2);
+	h ^= (UInt64) key.modified + (h << 6) + (h >> 2);
+	h ^= key.size + (h << 6) + (h >> 2);
+	return (size_t) h;
+}
+
+DigestCache::DigesterRunnable::DigesterRunnable():
+	stopDigest()
+{
+}
+
+void DigestCache::DigesterRunnable::run()
+{
+	loadStore();
+
+	while (!stopDigest.tryWait(0))
+	{
+		string path;
+		if (takePending(path))
+			digestFile(path);
+		else
+			wakeUp.tryWait(1000);
+	}
+}
+
+void DigestCache::DigesterRunnable::stopDigesting()
+{
+	stopDigest.set();
+	wakeUp.set();
+}
+
+void DigestCache::start(const string &storePath)
+{
+#if defined(POCO_OS_FAMILY_UNIX)
+	DigestCache::storePath = storePath;
+	running = true;
+
+	thread = new Thread("DigestCache");
+	thread->start(runnable);
+#endif
+}
+
+void DigestCache::stop()
+{
+	if (thread == NULL)
+		return;
+
+	runnable.stopDigesting();
+	thread->join();
+	delete thread;
+	thread = NULL;
+
+	delete store;
+	store = NULL;
+}
+
+bool DigestCache::enabled()
+{
+	return running;
+}
+
+// Returns true and the digest if the file is known, otherwise queues the file for hashing.
+bool DigestCache::lookup(const string &path, Digest &digest)
+{
+	Key key;
+	if (!statFile(path, key))
+		return false;
+
+	FastMutex::ScopedLock lock(mutex);
+
+	unordered_map<Key, Entry, KeyHash>::iterator it = digests.find(key);
+	if (it != digests.end())
+	{
+		digest = it->second.digest;
+		uses.splice(uses.begin(), uses, it->second.use);
+		hits++;
+		return true;
+	}
+
+	misses++;
+
+	if (pending.size() < MAX_PENDING && queued.insert(path).second)
+	{
+		pending.push_back(path);
+		wakeUp.set();
+	}
+
+	return false;
+}
+
+void DigestCache::appendStatus(ostream &out)
+{
+	if (!running)
+		return;
+
+	FastMutex::ScopedLock lock(mutex);
+
+	out << "Digests: " << digests.size() << " cached, " << pending.size() << " pending, ";
+	out << computed.value() << " computed, " << evicted.value() << " evicted, " << hits.value() << " hits, " << misses.value() << " misses, ";
+	out << "SHA-256 " << Sha256::implementation() << endl;
+}
+
+bool DigestCache::statFile(const string &path, Key &key)
+{
+#if defined(POCO_OS_FAMILY_UNIX)
+	struct stat st;
+	if (stat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+		return false;
+
+	key.device = st.st_dev;
+	key.inode = st.st_ino;
+	key.size = st.st_size;
+	key.modified = (Int64) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec;
+	key.changed = (Int64) st.st_ctim.tv_sec * 1000000000 + st.st_ctim.tv_nsec;
+	return true;
+#else
+	return false;
+#endif
+}
+
+bool DigestCache::takePending(string &path)
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	if (pending.empty())
+		return false;
+
+	path.swap(pending.front());
+	pending.pop_front();
+	queued.erase(path);
+	return true;
+}
+
+// Adds the digest as the most recently used one, making room by dropping the least recently used one if the cache is full.
+// Called with the mutex held.
+void DigestCache::insert(const Key &key, const Digest &digest)
+{
+	unordered_map<Key, Entry, KeyHash>::iterator it = digests.find(key);
+	if (it != digests.end())
+	{
+		it->second.digest = digest;
+		uses.splice(uses.begin(), uses, it->second.use);
+		return;
+	}
+
+	while (digests.size() >= MAX_ENTRIES && !uses.empty())
+	{
+		digests.erase(uses.back());
+		uses.pop_back();
+		evicted++;
+	}
+
+	uses.push_front(key);
+	Entry &entry = digests[key];
+	entry.digest = digest;
+	entry.use = uses.begin();
+}
+
+void DigestCache::digestFile(const string &path)
+{
+	Key key;
+	if (!statFile(path, key))
+		return;
+
+	// a full cache is no reason to skip the file, since the least recently used digest makes room for it
+	{
+		FastMutex::ScopedLock lock(mutex);
+		if (digests.find(key) != digests.end())
+			return;
+	}
+
+	Sha256 sha;
+
+	try
+	{
+		// the digest thread handles no requests, so it pins the configuration itself while it reads it
+		int streamFileSize;
+		int streamReadahead;
+		{
+			IndigoConfiguration::Snapshot snapshot;
+			const IndigoConfiguration &configuration = IndigoConfiguration::get();
+			streamFileSize = configuration.getStreamFileSize();
+			streamReadahead = configuration.getStreamReadahead();
+		}
+
+		// large files are read the way they are sent, without filling the page cache
+		bool large = (streamFileSize > 0 && key.size > (UInt64) streamFileSize);
+
+		StreamingFile istr(path, large, streamReadahead);
+		Buffer<char> buffer(DIGEST_CHUNK_SIZE);
+		UInt64 total = 0;
+
+		streamsize n;
+		while ((n = istr.read(buffer.begin(), DIGEST_CHUNK_SIZE)) > 0)
+		{
+			sha.update(buffer.begin(), n);
+			total += n;
+		}
+
+		if (total != key.size)
+			return;
+	}
+	catch (Exception &e)
+	{
+		return;
+	}
+
+	// the digest is only kept if the file did not change while it was read
+	Key after;
+	if (!statFile(path, after) || !(after == key))
+		return;
+
+	// nor if it was changed so recently that another change may still be hidden by the timestamp granularity;
+	// it is hashed again when it is next requested
+	Int64 now = Timestamp().epochMicroseconds() * 1000;
+	if (now - key.modified < SETTLE_TIME || now - key.changed < SETTLE_TIME)
+		return;
+
+	Digest digest;
+	sha.finish(digest.bytes);
+	computed++;
+
+	{
+		FastMutex::ScopedLock lock(mutex);
+		insert(key, digest);
+	}
+
+	saveDigest(key, digest);
+}
+
+// Reads the digests kept by previous runs, and compacts the store if most of its records are superseded.
+void DigestCache::loadStore()
+{
+	if (storePath.empty())
+		return;
+
+	size_t records = 0;
+
+	try
+	{
+		File file(storePath);
+		if (file.exists())
+		{
+			FileInputStream istr(storePath);
+			char record[RECORD_SIZE];
+
+			while (istr.read(record, RECORD_SIZE) && istr.gcount() == RECORD_SIZE)
+			{
+				Key key;
+				Digest digest;
+				memcpy(&key.device, record, 8);
+				memcpy(&key.inode, record + 8, 8);
+				memcpy(&key.size, record + 16, 8);
+				memcpy(&key.modified, record + 24, 8);
+				memcpy(&key.changed, record + 32, 8);
+				memcpy(digest.bytes, record + 40, Sha256::DIGEST_SIZE);
+				records++;
+
+				// records with times in seconds can no longer match, and are dropped when the store is compacted
+				if (key.modified < MIN_NANOSECOND_TIME)
+					continue;
+
+				// later records are more recent, so the oldest are dropped if the store holds more than fit
+				FastMutex::ScopedLock lock(mutex);
+				insert(key, digest);
+			}
+		}
+
+		bool compact = (records > 2 * digests.size());
+		if (compact)
+		{
+			string tempPath = storePath + ".tmp";
+			{
+				FileOutputStream ostr(tempPath);
+
+				// written from the least to the most recently used, so that loading the store restores the order
+				FastMutex::ScopedLock lock(mutex);
+				for (list<Key>::reverse_iterator it = uses.rbegin(); it != uses.rend(); ++it)
+					writeRecord(ostr, *it, digests[*it].digest);
+			}
+			File(tempPath).renameTo(storePath);
+		}
+
+		store = new FileOutputStream(storePath, ios::out | ios::app);
+	}
+	catch (Exception &e)
+	{
+		Application::instance().logger().error("Unable to use the digest store " + storePath + ": " + e.displayText());
+	}
+}
+
+void DigestCache::saveDigest(const Key &key, const Digest &digest)
+{
+	if (store == NULL)
+		return;
+
+	writeRecord(*store, key, digest);
+	store->flush();
+}
+
+void DigestCache::writeRecord(ostream &out, const Key &key, const Digest &digest)
+{
+	// records are written in host byte order, as the store is only meaningful on the host that wrote it
+	char record[RECORD_SIZE];
+	memcpy(record, &key.device, 8);
+	memcpy(record + 8, &key.inode, 8);
+	memcpy(record + 16, &key.size, 8);
+	memcpy(record + 24, &key.modified, 8);
+	memcpy(record + 32, &key.changed, 8);
+	memcpy(record + 40, digest.bytes, Sha256::DIGEST_SIZE);
+
+	out.write(record, RECORD_SIZE);
+}
@@ -0,0 +1,159 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef DIGESTCACHE_H
+#define DIGESTCACHE_H
+
+#include <cstddef>
+
+#include <string>
+#include <deque>
+#include <list>
+#include <ostream>
+#include <tr1/unordered_map> // change to <unordered_map> on c++0x compilers
+#include <tr1/unordered_set> // change to <unordered_set> on c++0x compilers
+
+#include "Poco/Platform.h"
+#include "Poco/Types.h"
+#include "Poco/Thread.h"
+#include "Poco/Runnable.h"
+#include "Poco/Event.h"
+#include "Poco/Mutex.h"
+#include "Poco/AtomicCounter.h"
+#include "Poco/FileStream.h"
+
+#include "Sha256.h"
+
+using namespace std;
+using namespace std::tr1; // remove this on c++0x compilers
+
+using namespace Poco;
+
+// SHA-256 digests of served files, for strong ETag and Repr-Digest fields.
+// Request threads only look digests up; a file that is not known yet is
+// queued, and hashed later by a background thread. Digests are remembered
+// by device, inode, size, modification and change time, to the nanosecond,
+// so that they stay valid across restarts when kept in the optional store
+// file, and are not mistaken for those of a file that was replaced in place.
+// Files modified within the last second are not cached, since a filesystem
+// with coarse timestamps may not record a further write in that time.
+// When the cache is full, the least recently used digests are dropped.
+// Digests need the inode of a file and are only available on Unix.
+class DigestCache
+{
+public:
+	struct Digest
+	{
+		unsigned char bytes[Sha256::DIGEST_SIZE];
+	};
+
+	static void start(const string &storePath);
+	static void stop();
+	static bool enabled();
+
+	static bool lookup(const string &path, Digest &digest);
+	static void appendStatus(ostream &out);
+
+private:
+	struct Key
+	{
+		UInt64 device;
+		UInt64 inode;
+		UInt64 size;
+		// nanoseconds since the epoch
+		Int64 modified;
+		Int64 changed;
+
+		bool operator == (const Key &other) const;
+	};
+
+	struct KeyHash
+	{
+		size_t operator () (const Key &key) const;
+	};
+
+	struct Entry
+	{
+		Digest digest;
+		list<Key>::iterator use;
+	};
+
+	class DigesterRunnable: public Runnable
+	{
+	public:
+		DigesterRunnable();
+
+		void run();
+		void stopDigesting();
+
+	private:
+		Event stopDigest;
+	};
+
+	static bool statFile(const string &path, Key &key);
+	static bool takePending(string &path);
+	static void insert(const Key &key, const Digest &digest);
+	static void digestFile(const string &path);
+	static void loadStore();
+	static void saveDigest(const Key &key, const Digest &digest);
+	static void writeRecord(ostream &out, const Key &key, const Digest &digest);
+
+	enum
+	{
+		MAX_PENDING = 4096,
+		MAX_ENTRIES = 1048576,
+		RECORD_SIZE = 72
+	};
+
+	// changes this recent may not show in the modification time yet
+	static const Int64 SETTLE_TIME = 1000000000;
+
+	// stores written before times were kept in nanoseconds have times below this
+	static const Int64 MIN_NANOSECOND_TIME = 1000000000000000LL;
+
+	static bool running;
+	static string storePath;
+	static FileOutputStream *store;
+
+	static unordered_map<Key, Entry, KeyHash> digests;
+	static list<Key> uses;
+	static deque<string> pending;
+	static unordered_set<string> queued;
+	static FastMutex mutex;
+	static Event wakeUp;
+
+	static Thread *thread;
+	static DigesterRunnable runnable;
+
+	static AtomicCounter hits;
+	static AtomicCounter misses;
+	static AtomicCounter computed;
+	static AtomicCounter evicted;
+};
+
+#endif //DIGESTCACHE_H
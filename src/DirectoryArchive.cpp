@@ -0,0 +1,571 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <cstring>
+
+#include <string>
+#include <vector>
+#include <algorithm>
+
+#include "Poco/DirectoryIterator.h"
+#include "Poco/DateTime.h"
+#include "Poco/Checksum.h"
+#include "Poco/Exception.h"
+
+#include "DirectoryArchive.h"
+#include "IndigoConfiguration.h"
+#include "StreamingFile.h"
+
+#define TAR_BLOCK_SIZE 512
+#define COPY_BUFFER_SIZE 65536
+
+#define ZIP_VERSION 20
+#define ZIP64_VERSION 45
+#define ZIP_MADE_BY_UNIX 3
+#define ZIP_FLAG_DATA_DESCRIPTOR 0x0008
+#define ZIP_FLAG_UTF8 0x0800
+#define ZIP_METHOD_STORED 0
+#define ZIP_METHOD_DEFLATED 8
+#define ZIP_MAX_32 0xFFFFFFFFULL
+#define ZIP_MAX_16 0xFFFF
+
+DirectoryArchive::CountingStreamBuf::CountingStreamBuf(ostream &out):
+	out(out),
+	written(0)
+{
+}
+
+UInt64 DirectoryArchive::CountingStreamBuf::count() const
+{
+	return written;
+}
+
+int DirectoryArchive::CountingStreamBuf::overflow(int c)
+{
+	if (traits_type::eq_int_type(c, traits_type::eof()))
+		return traits_type::not_eof(c);
+
+	char ch = traits_type::to_char_type(c);
+	return (xsputn(&ch, 1) == 1 ? c : traits_type::eof());
+}
+
+streamsize DirectoryArchive::CountingStreamBuf::xsputn(const char *s, streamsize n)
+{
+	out.write(s, n);
+	if (!out.good())
+		return 0;
+
+	written += n;
+	return n;
+}
+
+DirectoryArchive::DirectoryArchive(ostream &out, Format format, bool compress):
+	out(out),
+	format(format),
+	compress(compress),
+	countingBuf(out),
+	counted(&countingBuf),
+	gzip(NULL),
+	target(&counted),
+	entries(),
+	buffer(COPY_BUFFER_SIZE),
+	finished(false)
+{
+	// zip compresses each entry separately, tar compresses the whole stream
+	if (format == FORMAT_TAR && compress)
+	{
+		gzip = new DeflatingOutputStream(counted, DeflatingStreamBuf::STREAM_GZIP);
+		target = gzip;
+	}
+}
+
+DirectoryArchive::~DirectoryArchive()
+{
+	delete gzip;
+}
+
+void DirectoryArchive::addTree(const string &path, const string &name)
+{
+	addDirectory(name + '/', File(path).getLastModified());
+
+	DirectoryIterator it(path);
+	DirectoryIterator end;
+	while (it != end)
+	{
+		try
+		{
+			if (!it->isHidden())
+				addEntry(*it, name + '/' + it.name());
+		}
+		catch (FileException &fe)
+		{
+			// the entry disappeared or became unreadable before anything was written for it
+		}
+		catch (PathSyntaxException &pse)
+		{
+		}
+
+		++it;
+	}
+}
+
+void DirectoryArchive::finish()
+{
+	if (finished)
+		return;
+
+	finished = true;
+
+	if (format == FORMAT_TAR)
+	{
+		// two zero blocks mark the end of a tar archive
+		writeTarPadding(0);
+		string zeros(2 * TAR_BLOCK_SIZE, '\0');
+		target->write(zeros.data(), zeros.length());
+
+		if (gzip != NULL)
+			gzip->close();
+	}
+	else
+	{
+		writeZipCentralDirectory();
+	}
+
+	target->flush();
+}
+
+// Parses "archive=tar" or "archive=zip", optionally followed by "compress=1", from a raw query string.
+bool DirectoryArchive::parseQuery(const char *query, size_t length, Format &format, bool &compress)
+{
+	bool found = false;
+	compress = false;
+
+	const char *end = query + length;
+	const char *param = query;
+	while (param < end)
+	{
+		const char *paramEnd = param;
+		while (paramEnd != end && *paramEnd != '&')
+			++paramEnd;
+
+		string p(param, paramEnd);
+		if (p == "archive=tar")
+		{
+			format = FORMAT_TAR;
+			found = true;
+		}
+		else if (p == "archive=zip")
+		{
+			format = FORMAT_ZIP;
+			found = true;
+		}
+		else if (p == "compress=1")
+		{
+			compress = true;
+		}
+
+		param = paramEnd + 1;
+	}
+
+	return found;
+}
+
+string DirectoryArchive::getFileName(const string &name, Format format, bool compress)
+{
+	if (format == FORMAT_ZIP)
+		return name + ".zip";
+	else if (compress)
+		return name + ".tar.gz";
+	else
+		return name + ".tar";
+}
+
+const string &DirectoryArchive::getMediaType(Format format, bool compress)
+{
+	static const string tarType = "application/x-tar";
+	static const string gzipType = "application/gzip";
+	static const string zipType = "application/zip";
+
+	if (format == FORMAT_ZIP)
+		return zipType;
+	else if (compress)
+		return gzipType;
+	else
+		return tarType;
+}
+
+// Called with the number of bytes of every piece of file data that is about to be written.
+void DirectoryArchive::fileDataRead(streamsize)
+{
+}
+
+void DirectoryArchive::addEntry(const File &file, const string &name)
+{
+	if (file.isDirectory())
+	{
+		// linked directories are skipped, since they may form cycles
+		if (!file.isLink())
+			addTree(file.path(), name);
+	}
+	else if (file.isFile())
+	{
+		addFile(file.path(), name, file.getSize(), file.getLastModified());
+	}
+}
+
+void DirectoryArchive::addDirectory(const string &name, const Timestamp &modified)
+{
+	if (format == FORMAT_TAR)
+	{
+		writeTarHeader(name, '5', 0, modified, 0755);
+		return;
+	}
+
+	ZipEntry entry;
+	entry.name = name;
+	entry.directory = true;
+	entry.deflated = false;
+	entry.crc = 0;
+	entry.compressedSize = 0;
+	entry.size = 0;
+	entry.offset = countingBuf.count();
+	toDosTime(modified, entry.time, entry.date);
+
+	writeZipLocalHeader(entry, false);
+	writeZipDataDescriptor(entry, false);
+
+	entries.push_back(entry);
+}
+
+void DirectoryArchive::addFile(const string &path, const string &name, File::FileSize size, const Timestamp &modified)
+{
+	if (format == FORMAT_TAR)
+	{
+		writeTarHeader(name, '0', size, modified, 0644);
+
+		// the size in the header is binding, so a file that changed meanwhile is cut or padded
+		UInt64 copied = copyData(path, size, *target, NULL);
+		if (copied < size)
+		{
+			string zeros(COPY_BUFFER_SIZE, '\0');
+			for (UInt64 remaining = size - copied; remaining > 0; )
+			{
+				streamsize n = (streamsize) min(remaining, (UInt64) zeros.length());
+				target->write(zeros.data(), n);
+				remaining -= n;
+			}
+		}
+
+		writeTarPadding(size);
+		return;
+	}
+
+	ZipEntry entry;
+	entry.name = name;
+	entry.directory = false;
+	entry.deflated = compress;
+	entry.crc = 0;
+	entry.compressedSize = 0;
+	entry.size = 0;
+	entry.offset = countingBuf.count();
+	toDosTime(modified, entry.time, entry.date);
+
+	// whether the sizes need 64 bit fields must be decided before the data is written
+	bool zip64 = (size >= ZIP_MAX_32);
+
+	writeZipLocalHeader(entry, zip64);
+
+	UInt64 start = countingBuf.count();
+	if (compress)
+	{
+		DeflatingOutputStream deflater(counted, -15, 6);
+		entry.size = copyData(path, size, deflater, &entry.crc);
+		deflater.close();
+	}
+	else
+	{
+		entry.size = copyData(path, size, counted, &entry.crc);
+	}
+	entry.compressedSize = countingBuf.count() - start;
+
+	writeZipDataDescriptor(entry, zip64);
+
+	entries.push_back(entry);
+}
+
+UInt64 DirectoryArchive::copyData(const string &path, File::FileSize size, ostream &target, UInt32 *crc)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	int streamFileSize = configuration.getStreamFileSize();
+	bool large = (streamFileSize > 0 && size > (File::FileSize) streamFileSize);
+
+	StreamingFile istr(path, large, configuration.getStreamReadahead());
+
+	Checksum checksum(Checksum::TYPE_CRC32);
+
+	UInt64 copied = 0;
+	while (copied < size)
+	{
+		streamsize n = istr.read(buffer.begin(), (streamsize) min(size - copied, (UInt64) buffer.size()));
+		if (n <= 0)
+			break;
+
+		fileDataRead(n);
+
+		if (crc != NULL)
+			checksum.update(buffer.begin(), (unsigned) n);
+
+		target.write(buffer.begin(), n);
+		if (!target.good())
+			throw WriteFileException(path);
+
+		copied += n;
+	}
+
+	if (crc != NULL)
+		*crc = checksum.checksum();
+
+	return copied;
+}
+
+void DirectoryArchive::writeTarHeader(const string &name, char type, File::FileSize size, const Timestamp &modified, int mode)
+{
+	// names that do not fit the header are stored in a preceding GNU long name entry
+	if (name.length() > 100)
+	{
+		writeTarHeader("././@LongLink", 'L', name.length() + 1, 0, 0644);
+		target->write(name.c_str(), name.length() + 1);
+		writeTarPadding(name.length() + 1);
+	}
+
+	char header[TAR_BLOCK_SIZE];
+	memset(header, 0, sizeof(header));
+
+	memcpy(header, name.data(), min(name.length(), (string::size_type) 100));
+	formatOctal(header + 100, 8, mode);
+	formatOctal(header + 108, 8, 0);
+	formatOctal(header + 116, 8, 0);
+	formatOctal(header + 124, 12, size);
+	formatOctal(header + 136, 12, modified.epochTime());
+	header[156] = type;
+	memcpy(header + 257, "ustar", 6);
+	memcpy(header + 263, "00", 2);
+
+	// the checksum is computed with its own field filled with spaces
+	memset(header + 148, ' ', 8);
+	unsigned int sum = 0;
+	for (int i = 0; i < TAR_BLOCK_SIZE; i++)
+		sum += (unsigned char) header[i];
+	formatOctal(header + 148, 7, sum);
+
+	target->write(header, sizeof(header));
+}
+
+void DirectoryArchive::writeTarPadding(UInt64 size)
+{
+	size_t padding = (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE;
+	if (padding > 0)
+	{
+		char zeros[TAR_BLOCK_SIZE];
+		memset(zeros, 0, padding);
+		target->write(zeros, padding);
+	}
+}
+
+void DirectoryArchive::writeZipLocalHeader(const ZipEntry &entry, bool zip64)
+{
+	string header;
+	appendLE(header, 0x04034b50, 4);
+	appendLE(header, zip64 ? ZIP64_VERSION : ZIP_VERSION, 2);
+	appendLE(header, ZIP_FLAG_DATA_DESCRIPTOR | ZIP_FLAG_UTF8, 2);
+	appendLE(header, entry.deflated ? ZIP_METHOD_DEFLATED : ZIP_METHOD_STORED, 2);
+	appendLE(header, entry.time, 2);
+	appendLE(header, entry.date, 2);
+
+	// the checksum and the sizes follow the data, in the data descriptor
+	appendLE(header, 0, 4);
+	appendLE(header, zip64 ? ZIP_MAX_32 : 0, 4);
+	appendLE(header, zip64 ? ZIP_MAX_32 : 0, 4);
+
+	appendLE(header, entry.name.length(), 2);
+	appendLE(header, zip64 ? 20 : 0, 2);
+	header += entry.name;
+
+	if (zip64)
+	{
+		appendLE(header, 0x0001, 2);
+		appendLE(header, 16, 2);
+		appendLE(header, 0, 8);
+		appendLE(header, 0, 8);
+	}
+
+	counted.write(header.data(), header.length());
+}
+
+void DirectoryArchive::writeZipDataDescriptor(const ZipEntry &entry, bool zip64)
+{
+	string descriptor;
+	appendLE(descriptor, 0x08074b50, 4);
+	appendLE(descriptor, entry.crc, 4);
+	appendLE(descriptor, entry.compressedSize, zip64 ? 8 : 4);
+	appendLE(descriptor, entry.size, zip64 ? 8 : 4);
+
+	counted.write(descriptor.data(), descriptor.length());
+}
+
+void DirectoryArchive::writeZipCentralDirectory()
+{
+	UInt64 start = countingBuf.count();
+
+	string record;
+	vector<ZipEntry>::const_iterator it;
+	vector<ZipEntry>::const_iterator end = entries.end();
+	for (it = entries.begin(); it != end; ++it)
+	{
+		const ZipEntry &entry = *it;
+
+		// values that do not fit their field are moved to the zip64 extra field
+		string extra;
+		if (entry.size >= ZIP_MAX_32)
+			appendLE(extra, entry.size, 8);
+		if (entry.compressedSize >= ZIP_MAX_32)
+			appendLE(extra, entry.compressedSize, 8);
+		if (entry.offset >= ZIP_MAX_32)
+			appendLE(extra, entry.offset, 8);
+		if (!extra.empty())
+		{
+			string field;
+			appendLE(field, 0x0001, 2);
+			appendLE(field, extra.length(), 2);
+			extra = field + extra;
+		}
+
+		int version = (extra.empty() ? ZIP_VERSION : ZIP64_VERSION);
+		int mode = (entry.directory ? 040755 : 0100644);
+
+		record.clear();
+		appendLE(record, 0x02014b50, 4);
+		appendLE(record, (ZIP_MADE_BY_UNIX << 8) | version, 2);
+		appendLE(record, version, 2);
+		appendLE(record, ZIP_FLAG_DATA_DESCRIPTOR | ZIP_FLAG_UTF8, 2);
+		appendLE(record, entry.deflated ? ZIP_METHOD_DEFLATED : ZIP_METHOD_STORED, 2);
+		appendLE(record, entry.time, 2);
+		appendLE(record, entry.date, 2);
+		appendLE(record, entry.crc, 4);
+		appendLE(record, min(entry.compressedSize, ZIP_MAX_32), 4);
+		appendLE(record, min(entry.size, ZIP_MAX_32), 4);
+		appendLE(record, entry.name.length(), 2);
+		appendLE(record, extra.length(), 2);
+		appendLE(record, 0, 2);
+		appendLE(record, 0, 2);
+		appendLE(record, 0, 2);
+		appendLE(record, (UInt64) mode << 16, 4);
+		appendLE(record, min(entry.offset, ZIP_MAX_32), 4);
+		record += entry.name;
+		record += extra;
+
+		counted.write(record.data(), record.length());
+	}
+
+	UInt64 size = countingBuf.count() - start;
+	UInt64 count = entries.size();
+
+	record.clear();
+	if (count >= ZIP_MAX_16 || size >= ZIP_MAX_32 || start >= ZIP_MAX_32)
+	{
+		UInt64 zip64End = countingBuf.count();
+
+		appendLE(record, 0x06064b50, 4);
+		appendLE(record, 44, 8);
+		appendLE(record, (ZIP_MADE_BY_UNIX << 8) | ZIP64_VERSION, 2);
+		appendLE(record, ZIP64_VERSION, 2);
+		appendLE(record, 0, 4);
+		appendLE(record, 0, 4);
+		appendLE(record, count, 8);
+		appendLE(record, count, 8);
+		appendLE(record, size, 8);
+		appendLE(record, start, 8);
+
+		appendLE(record, 0x07064b50, 4);
+		appendLE(record, 0, 4);
+		appendLE(record, zip64End, 8);
+		appendLE(record, 1, 4);
+	}
+
+	appendLE(record, 0x06054b50, 4);
+	appendLE(record, 0, 2);
+	appendLE(record, 0, 2);
+	appendLE(record, min(count, (UInt64) ZIP_MAX_16), 2);
+	appendLE(record, min(count, (UInt64) ZIP_MAX_16), 2);
+	appendLE(record, min(size, ZIP_MAX_32), 4);
+	appendLE(record, min(start, ZIP_MAX_32), 4);
+	appendLE(record, 0, 2);
+
+	counted.write(record.data(), record.length());
+}
+
+// Formats an octal number, terminated by NUL, into a tar header field.
+// Values that are too large for the field use the base-256 extension of GNU tar.
+void DirectoryArchive::formatOctal(char *field, size_t width, UInt64 value)
+{
+	if (width < 12 || value < (1ULL << (3 * (width - 1))))
+	{
+		field[width - 1] = '\0';
+		for (size_t i = width - 1; i > 0; i--)
+		{
+			field[i - 1] = (char) ('0' + (value & 7));
+			value >>= 3;
+		}
+	}
+	else
+	{
+		for (size_t i = width; i > 1; i--)
+		{
+			field[i - 1] = (char) (value & 0xFF);
+			value >>= 8;
+		}
+		field[0] = (char) 0x80;
+	}
+}
+
+void DirectoryArchive::toDosTime(const Timestamp &timestamp, UInt16 &time, UInt16 &date)
+{
+	DateTime dt(timestamp);
+	time = (UInt16) ((dt.hour() << 11) | (dt.minute() << 5) | (dt.second() / 2));
+	date = (UInt16) ((max(dt.year() - 1980, 0) << 9) | (dt.month() << 5) | dt.day());
+}
+
+void DirectoryArchive::appendLE(string &str, UInt64 value, int bytes)
+{
+	for (int i = 0; i < bytes; i++)
+	{
+		str += (char) (value & 0xFF);
+		value >>= 8;
+	}
+}
@@ -0,0 +1,132 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef DIRECTORYARCHIVE_H
+#define DIRECTORYARCHIVE_H
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <ostream>
+#include <streambuf>
+
+#include "Poco/Types.h"
+#include "Poco/File.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Buffer.h"
+#include "Poco/DeflatingStream.h"
+
+using namespace std;
+
+using namespace Poco;
+
+// Writes a directory tree as a tar or zip archive while walking it, without temporary files.
+// Only the zip central directory, which has one small record per entry, is kept in memory.
+class DirectoryArchive
+{
+public:
+	enum Format
+	{
+		FORMAT_TAR,
+		FORMAT_ZIP
+	};
+
+	DirectoryArchive(ostream &out, Format format, bool compress);
+	virtual ~DirectoryArchive();
+
+	void addTree(const string &path, const string &name);
+	void finish();
+
+	static bool parseQuery(const char *query, size_t length, Format &format, bool &compress);
+	static string getFileName(const string &name, Format format, bool compress);
+	static const string &getMediaType(Format format, bool compress);
+
+protected:
+	virtual void fileDataRead(streamsize bytes);
+
+private:
+	class CountingStreamBuf: public streambuf
+	{
+	public:
+		CountingStreamBuf(ostream &out);
+
+		UInt64 count() const;
+
+	protected:
+		int overflow(int c);
+		streamsize xsputn(const char *s, streamsize n);
+
+	private:
+		ostream &out;
+		UInt64 written;
+	};
+
+	struct ZipEntry
+	{
+		string name;
+		bool directory;
+		bool deflated;
+		UInt32 crc;
+		UInt64 compressedSize;
+		UInt64 size;
+		UInt64 offset;
+		UInt16 time;
+		UInt16 date;
+	};
+
+	void addEntry(const File &file, const string &name);
+	void addDirectory(const string &name, const Timestamp &modified);
+	void addFile(const string &path, const string &name, File::FileSize size, const Timestamp &modified);
+	UInt64 copyData(const string &path, File::FileSize size, ostream &target, UInt32 *crc);
+
+	void writeTarHeader(const string &name, char type, File::FileSize size, const Timestamp &modified, int mode);
+	void writeTarPadding(UInt64 size);
+	void writeZipLocalHeader(const ZipEntry &entry, bool zip64);
+	void writeZipDataDescriptor(const ZipEntry &entry, bool zip64);
+	void writeZipCentralDirectory();
+
+	static void formatOctal(char *field, size_t width, UInt64 value);
+	static void toDosTime(const Timestamp &timestamp, UInt16 &time, UInt16 &date);
+	static void appendLE(string &str, UInt64 value, int bytes);
+
+	ostream &out;
+	const Format format;
+	const bool compress;
+
+	CountingStreamBuf countingBuf;
+	ostream counted;
+	DeflatingOutputStream *gzip;
+	ostream *target;
+
+	vector<ZipEntry> entries;
+	Buffer<char> buffer;
+	bool finished;
+};
+
+#endif //DIRECTORYARCHIVE_H
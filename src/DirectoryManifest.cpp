@@ -0,0 +1,214 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "Poco/File.h"
+#include "Poco/Path.h"
+#include "Poco/DirectoryIterator.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/String.h"
+#include "Poco/URI.h"
+#include "Poco/Exception.h"
+
+#include "DirectoryManifest.h"
+
+const string DirectoryManifest::mediaType = "text/plain; charset=us-ascii";
+
+DirectoryManifest::DirectoryManifest(ostream &out):
+	out(out),
+	line()
+{
+}
+
+void DirectoryManifest::writeHeader(bool full, const string &token)
+{
+	out << (full ? "full " : "changes ") << token << "\n";
+}
+
+void DirectoryManifest::addTree(const string &path)
+{
+	addTree(path, "");
+}
+
+void DirectoryManifest::addIndexedTree(const ShareIndex &index, const ShareIndex::Entry &directory, const string &path)
+{
+	addIndexedTree(index, directory, path, "");
+}
+
+// Lists the current state of the changed paths, which are relative to the directory and separated by slashes.
+void DirectoryManifest::addChanges(const string &path, const vector<string> &changes)
+{
+	for (vector<string>::const_iterator it = changes.begin(); it != changes.end(); ++it)
+	{
+		const string &name = *it;
+
+		// hidden files are left out of full manifests too
+		string::size_type slash = name.rfind('/');
+		if (name[slash == string::npos ? 0 : slash + 1] == '.')
+			continue;
+
+		string native = name;
+		replaceInPlace(native, string("/"), string(1, Path::separator()));
+
+		try
+		{
+			File file(childPath(path, native));
+			if (file.isDirectory())
+				writeEntry('d', 0, file.getLastModified(), name + '/');
+			else
+				writeEntry('f', file.getSize(), file.getLastModified(), name);
+		}
+		catch (FileNotFoundException &fnfe)
+		{
+			writeEntry('-', 0, Timestamp(0), name);
+		}
+		catch (FileException &fe)
+		{
+			// an entry that cannot be read now is reported by a later manifest
+		}
+	}
+}
+
+bool DirectoryManifest::parseQuery(const char *query, size_t length, string &since)
+{
+	bool found = false;
+	since.clear();
+
+	const char *end = query + length;
+	const char *param = query;
+	while (param < end)
+	{
+		const char *paramEnd = param;
+		while (paramEnd != end && *paramEnd != '&')
+			++paramEnd;
+
+		string p(param, paramEnd);
+		if (p == "manifest")
+			found = true;
+		else if (p.compare(0, 6, "since=") == 0)
+			since.assign(p, 6, string::npos);
+
+		param = paramEnd + 1;
+	}
+
+	return found;
+}
+
+void DirectoryManifest::addTree(const string &path, const string &prefix)
+{
+	DirectoryIterator it(path);
+	DirectoryIterator end;
+	while (it != end)
+	{
+		try
+		{
+			if (!it->isHidden())
+			{
+				if (it->isDirectory())
+				{
+					writeEntry('d', 0, it->getLastModified(), prefix + it.name() + '/');
+
+					// linked directories are listed, but not walked, since they may form cycles
+					if (!it->isLink())
+						addTree(it->path(), prefix + it.name() + '/');
+				}
+				else if (it->isFile())
+				{
+					writeEntry('f', it->getSize(), it->getLastModified(), prefix + it.name());
+				}
+			}
+		}
+		catch (FileException &fe)
+		{
+			// the entry disappeared or became unreadable while the tree was walked
+		}
+		catch (PathSyntaxException &pse)
+		{
+		}
+
+		++it;
+	}
+}
+
+void DirectoryManifest::addIndexedTree(const ShareIndex &index, const ShareIndex::Entry &directory, const string &path, const string &prefix)
+{
+	vector<pair<string, ShareIndex::Entry> > entries;
+	if (!index.listEntries(directory, entries))
+	{
+		// linked directories are not indexed, and are not walked on the filesystem either
+		try
+		{
+			if (!File(path).isLink())
+				addTree(path, prefix);
+		}
+		catch (FileException &fe)
+		{
+		}
+
+		return;
+	}
+
+	for (vector<pair<string, ShareIndex::Entry> >::const_iterator it = entries.begin(); it != entries.end(); ++it)
+	{
+		const string &name = it->first;
+		const ShareIndex::Entry &entry = it->second;
+
+		if (entry.directory)
+		{
+			writeEntry('d', 0, entry.modified, prefix + name + '/');
+			addIndexedTree(index, entry, childPath(path, name), prefix + name + '/');
+		}
+		else
+		{
+			writeEntry('f', entry.size, entry.modified, prefix + name);
+		}
+	}
+}
+
+void DirectoryManifest::writeEntry(char type, UInt64 size, const Timestamp &modified, const string &name)
+{
+	// the line buffer is reused, so it only grows until it fits the longest path
+	line.assign(1, type);
+	line += ' ';
+	NumberFormatter::append(line, size);
+	line += ' ';
+	NumberFormatter::append(line, (Int64) modified.epochTime());
+	line += ' ';
+	URI::encode(name, "", line);
+	line += '\n';
+
+	out.write(line.data(), line.length());
+}
+
+string DirectoryManifest::childPath(const string &path, const string &name)
+{
+	string child = path;
+	if (child.empty() || child[child.length() - 1] != Path::separator())
+		child += Path::separator();
+	child += name;
+	return child;
+}
@@ -0,0 +1,80 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef DIRECTORYMANIFEST_H
+#define DIRECTORYMANIFEST_H
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <ostream>
+
+#include "Poco/Types.h"
+#include "Poco/Timestamp.h"
+
+#include "ShareIndex.h"
+
+using namespace std;
+
+using namespace Poco;
+
+// Writes the type, size, modification time and path of every entry in a
+// directory tree, one line per entry, while walking it. The first line holds
+// the change token of the manifest, and whether it lists the whole tree or
+// only the entries changed since an earlier token, in which case removed
+// entries are listed with the "-" type. Paths are relative to the directory
+// and percent-encoded, and directories end with a slash. Where the share
+// index can answer, the tree is taken from memory, without touching the
+// filesystem.
+class DirectoryManifest
+{
+public:
+	DirectoryManifest(ostream &out);
+
+	void writeHeader(bool full, const string &token);
+	void addTree(const string &path);
+	void addIndexedTree(const ShareIndex &index, const ShareIndex::Entry &directory, const string &path);
+	void addChanges(const string &path, const vector<string> &changes);
+
+	static bool parseQuery(const char *query, size_t length, string &since);
+
+	static const string mediaType;
+
+private:
+	void addTree(const string &path, const string &prefix);
+	void addIndexedTree(const ShareIndex &index, const ShareIndex::Entry &directory, const string &path, const string &prefix);
+	void writeEntry(char type, UInt64 size, const Timestamp &modified, const string &name);
+
+	static string childPath(const string &path, const string &name);
+
+	ostream &out;
+	string line;
+};
+
+#endif //DIRECTORYMANIFEST_H
@@ -0,0 +1,391 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "Poco/Platform.h"
+
+#if defined(POCO_OS_FAMILY_UNIX)
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#if defined(__linux__)
+#include <sys/sendfile.h>
+#endif
+
+#include "Poco/Net/HTTPServerRequestImpl.h"
+#include "Poco/Net/NetException.h"
+#include "Poco/FileStream.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/DateTimeFormatter.h"
+#include "Poco/DateTimeFormat.h"
+#include "Poco/String.h"
+#include "Poco/Exception.h"
+
+#include "IndigoFiler.h"
+#include "IndigoConfiguration.h"
+#include "HTTPDateCache.h"
+#include "FastResponse.h"
+#include "TlsConnection.h"
+#include "RequestTrace.h"
+#include "SenderReactor.h"
+
+// the most sendfile() is asked to send at a time, so that a send timeout applies to each part
+#define SENDFILE_CHUNK_SIZE (1 << 24)
+
+ThreadLocal<string> FastResponse::blocks;
+
+const string FastResponse::statusTemplate10 =
+	"HTTP/1.0 200 OK\r\n"
+	"Server: " SERVER_FIELD_VALUE "\r\n";
+const string FastResponse::statusTemplate11 =
+	"HTTP/1.1 200 OK\r\n"
+	"Server: " SERVER_FIELD_VALUE "\r\n";
+
+bool FastResponse::sendFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, int file, const string &mediaType, File::FileSize size, const Timestamp &lastModified)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	int limit = configuration.getSmallFileSize();
+	if (limit <= 0 || size > (File::FileSize) limit)
+		return false;
+
+	StreamSocket *socket = getSocket(request);
+	if (socket == NULL)
+		return false;
+
+	string &block = beginBlock(response, mediaType, size);
+	block += "Last-Modified: ";
+	DateTimeFormatter::append(block, lastModified, DateTimeFormat::HTTP_FORMAT);
+	block += "\r\n\r\n";
+
+	// read the file directly behind the header block
+	string::size_type headerLength = block.length();
+	block.resize(headerLength + (string::size_type) size);
+
+#if defined(POCO_OS_FAMILY_UNIX)
+	// a file stream would allocate a buffer and a copy of the path for every file, so the file is read with plain system calls
+	int fd = (file >= 0 ? file : open(path.c_str(), O_RDONLY));
+	if (fd < 0)
+		throw OpenFileException(path);
+
+	bool complete = readFully(fd, &block[headerLength], size);
+	if (fd != file)
+		close(fd);
+	if (!complete)
+		throw ReadFileException(path);
+#else
+	FileInputStream istr(path);
+	if (!istr.good())
+		throw OpenFileException(path);
+
+	if (size > 0)
+	{
+		istr.read(&block[headerLength], size);
+		if (istr.gcount() != (streamsize) size)
+			throw ReadFileException(path);
+	}
+#endif
+	RequestTrace::mark(RequestTrace::PHASE_OPEN);
+
+	sendBlock(*socket, block);
+
+	return true;
+}
+
+bool FastResponse::sendBuffer(HTTPServerRequest &request, HTTPServerResponse &response, const string &mediaType, const string &body)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	int limit = configuration.getSmallFileSize();
+	if (limit <= 0 || body.length() > (string::size_type) limit)
+		return false;
+
+	StreamSocket *socket = getSocket(request);
+	if (socket == NULL)
+		return false;
+
+	string &block = beginBlock(response, mediaType, body.length());
+	block += "\r\n";
+	block += body;
+
+	sendBlock(*socket, block);
+
+	return true;
+}
+
+bool FastResponse::sendMapped(HTTPServerRequest &request, HTTPServerResponse &response, const string &mediaType, const char *data, File::FileSize length, const Timestamp &lastModified)
+{
+	StreamSocket *socket = getSocket(request);
+	if (socket == NULL)
+		return false;
+
+	string &block = beginBlock(response, mediaType, length);
+	block += "Last-Modified: ";
+	DateTimeFormatter::append(block, lastModified, DateTimeFormat::HTTP_FORMAT);
+	block += "\r\n\r\n";
+
+	// small bodies still go out with the header in a single send; larger ones are sent straight from the mapping
+	int limit = IndigoConfiguration::get().getSmallFileSize();
+	if (limit > 0 && length <= (File::FileSize) limit)
+	{
+		block.append(data, (string::size_type) length);
+		sendBlock(*socket, block);
+	}
+	else
+	{
+		sendBlock(*socket, block);
+		sendBytes(*socket, data, length);
+	}
+
+	return true;
+}
+
+bool FastResponse::sendLargeFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, int file, const string &mediaType, File::FileSize size, const Timestamp &lastModified)
+{
+#if defined(__linux__)
+	StreamSocket *socket = getSocket(request);
+	if (socket == NULL)
+		return false;
+
+#ifdef INDIGO_TLS
+	// over TLS, the file can only be written to the socket if the kernel encrypts the records
+	TlsSocketImpl *tls = dynamic_cast<TlsSocketImpl *>(socket->impl());
+	if (tls != NULL && !tls->sendsInKernel())
+		return false;
+#endif
+
+	int fd = (file >= 0 ? file : open(path.c_str(), O_RDONLY));
+	if (fd < 0)
+		throw OpenFileException(path);
+	RequestTrace::mark(RequestTrace::PHASE_OPEN);
+
+	try
+	{
+		string &block = beginBlock(response, mediaType, size);
+		block += "Last-Modified: ";
+		DateTimeFormatter::append(block, lastModified, DateTimeFormat::HTTP_FORMAT);
+		block += "\r\n\r\n";
+
+		sendBlock(*socket, block);
+
+		// once the header is sent, failures can only be reported by closing the connection, so they are all network errors
+		off_t offset = 0;
+		while ((File::FileSize) offset < size)
+		{
+			File::FileSize left = size - offset;
+			ssize_t n = sendfile(socket->impl()->sockfd(), fd, &offset, (size_t) (left < SENDFILE_CHUNK_SIZE ? left : SENDFILE_CHUNK_SIZE));
+			if (n > 0)
+				continue;
+
+			if (n == 0)
+				throw NetException("File shrank while it was sent", path);
+
+			if (errno == EINTR)
+				continue;
+
+			if (errno == EAGAIN)
+			{
+				if (!socket->poll(socket->getSendTimeout(), Socket::SELECT_WRITE))
+					throw TimeoutException();
+				continue;
+			}
+
+			throw NetException("Cannot send file", path);
+		}
+	}
+	catch (...)
+	{
+		if (fd != file)
+			close(fd);
+		throw;
+	}
+
+	if (fd != file)
+		close(fd);
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+// Sends the header, and leaves the body to a sender thread. The worker thread
+// lets go of the connection when the request handler returns, and the sender
+// closes it once the body is sent. The connection cannot be kept alive, since
+// requests that the client has already pipelined may be in the buffer of the
+// server session, which is gone by then.
+bool FastResponse::offloadFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, int file, const string &mediaType, File::FileSize size, const Timestamp &lastModified)
+{
+#if defined(__linux__)
+	if (!SenderReactor::enabled())
+		return false;
+
+	StreamSocket *socket = getSocket(request);
+	if (socket == NULL)
+		return false;
+
+#ifdef INDIGO_TLS
+	// the state of a TLS session stays with the connection, so only plain connections are handed over
+	if (dynamic_cast<TlsSocketImpl *>(socket->impl()) != NULL)
+		return false;
+#endif
+
+	// the sender closes the file when it is done, so it gets a descriptor of its own
+	int fd = (file >= 0 ? dup(file) : open(path.c_str(), O_RDONLY));
+	if (fd < 0)
+		throw OpenFileException(path);
+	RequestTrace::mark(RequestTrace::PHASE_OPEN);
+
+	// the sender gets a descriptor of its own, which stays open when the server connection closes its socket
+	int sockfd = dup(socket->impl()->sockfd());
+	if (sockfd < 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	// the header says so, so that the client does not wait for responses to its next requests
+	response.setKeepAlive(false);
+
+	try
+	{
+		string &block = beginBlock(response, mediaType, size);
+		block += "Last-Modified: ";
+		DateTimeFormatter::append(block, lastModified, DateTimeFormat::HTTP_FORMAT);
+		block += "\r\n\r\n";
+
+		sendBlock(*socket, block);
+	}
+	catch (...)
+	{
+		close(sockfd);
+		close(fd);
+		throw;
+	}
+
+	string description = request.clientAddress().host().toString() + " - " + request.getMethod() + " " + request.getURI();
+	SenderReactor::submit(sockfd, fd, size, description);
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+#if defined(POCO_OS_FAMILY_UNIX)
+// Reads exactly length bytes, and returns false on a read error or if the file ends early.
+bool FastResponse::readFully(int fd, char *data, File::FileSize length)
+{
+	while (length > 0)
+	{
+		ssize_t n = read(fd, data, (size_t) length);
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		if (n <= 0)
+			return false;
+
+		data += n;
+		length -= n;
+	}
+
+	return true;
+}
+#endif
+
+StreamSocket *FastResponse::getSocket(HTTPServerRequest &request)
+{
+	HTTPServerRequestImpl *impl = dynamic_cast<HTTPServerRequestImpl *>(&request);
+	if (impl == NULL)
+		return NULL;
+
+	return &impl->socket();
+}
+
+string &FastResponse::beginBlock(const HTTPServerResponse &response, const string &mediaType, File::FileSize length)
+{
+	// the block buffer is reused by the thread, so it only grows until it fits the largest small response
+	string &block = *blocks;
+
+	if (response.getVersion() == HTTPMessage::HTTP_1_0)
+		block.assign(statusTemplate10);
+	else
+		block.assign(statusTemplate11);
+
+	block += "Date: ";
+	HTTPDateCache::append(block);
+	block += "\r\n";
+
+	block += "Content-Type: ";
+	block += mediaType;
+	block += "\r\n";
+
+	block += "Content-Length: ";
+	NumberFormatter::append(block, (Int64) length);
+	block += "\r\n";
+
+	// copy the remaining fields, e.g. Connection, that are already set on the response
+	NameValueCollection::ConstIterator it;
+	NameValueCollection::ConstIterator end = response.end();
+	for (it = response.begin(); it != end; ++it)
+	{
+		const string &name = it->first;
+		if (icompare(name, string("Date")) == 0 ||
+			icompare(name, string("Server")) == 0 ||
+			icompare(name, HTTPMessage::CONTENT_TYPE) == 0 ||
+			icompare(name, HTTPMessage::CONTENT_LENGTH) == 0 ||
+			icompare(name, HTTPMessage::TRANSFER_ENCODING) == 0)
+			continue;
+
+		block += name;
+		block += ": ";
+		block += it->second;
+		block += "\r\n";
+	}
+
+	return block;
+}
+
+void FastResponse::sendBlock(StreamSocket &socket, const string &block)
+{
+	sendBytes(socket, block.data(), block.length());
+}
+
+void FastResponse::sendBytes(StreamSocket &socket, const char *data, File::FileSize length)
+{
+	// sendBytes() takes an int, so very large bodies are sent in parts
+	const File::FileSize maxPart = 1 << 30;
+
+	while (length > 0)
+	{
+		int n = socket.sendBytes(data, (int) (length < maxPart ? length : maxPart));
+		data += n;
+		length -= n;
+	}
+}
@@ -0,0 +1,80 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef FASTRESPONSE_H
+#define FASTRESPONSE_H
+
+#include <string>
+
+#include "Poco/Net/HTTPServerRequest.h"
+#include "Poco/Net/HTTPServerResponse.h"
+#include "Poco/Net/StreamSocket.h"
+#include "Poco/ThreadLocal.h"
+#include "Poco/Timestamp.h"
+#include "Poco/File.h"
+
+using namespace std;
+
+using namespace Poco;
+using namespace Poco::Net;
+
+// Sends small and in-memory responses without going through the POCO
+// response streams. The header block is built from a prebuilt status
+// template and the cached Date value, and the body is placed right after it
+// in the same buffer, so that the whole response is written to the socket
+// with a single send. Larger files are sent with sendfile() where it is
+// available, so that they go from the page cache to the socket without being
+// copied through user space, or handed over to a sender thread after the
+// header, so that the worker does not wait for the client to take them.
+// Files are read from the given descriptor, which the caller keeps open and
+// closes, or opened by their path if the descriptor is -1.
+class FastResponse
+{
+public:
+	static bool sendFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, int file, const string &mediaType, File::FileSize size, const Timestamp &lastModified);
+	static bool sendBuffer(HTTPServerRequest &request, HTTPServerResponse &response, const string &mediaType, const string &body);
+	static bool sendMapped(HTTPServerRequest &request, HTTPServerResponse &response, const string &mediaType, const char *data, File::FileSize length, const Timestamp &lastModified);
+	static bool sendLargeFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, int file, const string &mediaType, File::FileSize size, const Timestamp &lastModified);
+	static bool offloadFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, int file, const string &mediaType, File::FileSize size, const Timestamp &lastModified);
+
+private:
+#if defined(POCO_OS_FAMILY_UNIX)
+	static bool readFully(int fd, char *data, File::FileSize length);
+#endif
+	static StreamSocket *getSocket(HTTPServerRequest &request);
+	static string &beginBlock(const HTTPServerResponse &response, const string &mediaType, File::FileSize length);
+	static void sendBlock(StreamSocket &socket, const string &block);
+	static void sendBytes(StreamSocket &socket, const char *data, File::FileSize length);
+
+	static ThreadLocal<string> blocks;
+
+	static const string statusTemplate10;
+	static const string statusTemplate11;
+};
+
+#endif //FASTRESPONSE_H
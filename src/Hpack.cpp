@@ -0,0 +1,554 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <cstring>
+
+#include "Hpack.h"
+
+struct HuffmanCode
+{
+	UInt32 code;
+	int length;
+};
+
+// RFC 7541, appendix B; the last entry is the end of string symbol
+static const HuffmanCode huffmanCodes[257] =
+{
+	{ 0x00001ff8, 13 }, { 0x007fffd8, 23 }, { 0x0fffffe2, 28 }, { 0x0fffffe3, 28 },
+	{ 0x0fffffe4, 28 }, { 0x0fffffe5, 28 }, { 0x0fffffe6, 28 }, { 0x0fffffe7, 28 },
+	{ 0x0fffffe8, 28 }, { 0x00ffffea, 24 }, { 0x3ffffffc, 30 }, { 0x0fffffe9, 28 },
+	{ 0x0fffffea, 28 }, { 0x3ffffffd, 30 }, { 0x0fffffeb, 28 }, { 0x0fffffec, 28 },
+	{ 0x0fffffed, 28 }, { 0x0fffffee, 28 }, { 0x0fffffef, 28 }, { 0x0ffffff0, 28 },
+	{ 0x0ffffff1, 28 }, { 0x0ffffff2, 28 }, { 0x3ffffffe, 30 }, { 0x0ffffff3, 28 },
+	{ 0x0ffffff4, 28 }, { 0x0ffffff5, 28 }, { 0x0ffffff6, 28 }, { 0x0ffffff7, 28 },
+	{ 0x0ffffff8, 28 }, { 0x0ffffff9, 28 }, { 0x0ffffffa, 28 }, { 0x0ffffffb, 28 },
+	{ 0x00000014, 6 }, { 0x000003f8, 10 }, { 0x000003f9, 10 }, { 0x00000ffa, 12 },
+	{ 0x00001ff9, 13 }, { 0x00000015, 6 }, { 0x000000f8, 8 }, { 0x000007fa, 11 },
+	{ 0x000003fa, 10 }, { 0x000003fb, 10 }, { 0x000000f9, 8 }, { 0x000007fb, 11 },
+	{ 0x000000fa, 8 }, { 0x00000016, 6 }, { 0x00000017, 6 }, { 0x00000018, 6 },
+	{ 0x00000000, 5 }, { 0x00000001, 5 }, { 0x00000002, 5 }, { 0x00000019, 6 },
+	{ 0x0000001a, 6 }, { 0x0000001b, 6 }, { 0x0000001c, 6 }, { 0x0000001d, 6 },
+	{ 0x0000001e, 6 }, { 0x0000001f, 6 }, { 0x0000005c, 7 }, { 0x000000fb, 8 },
+	{ 0x00007ffc, 15 }, { 0x00000020, 6 }, { 0x00000ffb, 12 }, { 0x000003fc, 10 },
+	{ 0x00001ffa, 13 }, { 0x00000021, 6 }, { 0x0000005d, 7 }, { 0x0000005e, 7 },
+	{ 0x0000005f, 7 }, { 0x00000060, 7 }, { 0x00000061, 7 }, { 0x00000062, 7 },
+	{ 0x00000063, 7 }, { 0x00000064, 7 }, { 0x00000065, 7 }, { 0x00000066, 7 },
+	{ 0x00000067, 7 }, { 0x00000068, 7 }, { 0x00000069, 7 }, { 0x0000006a, 7 },
+	{ 0x0000006b, 7 }, { 0x0000006c, 7 }, { 0x0000006d, 7 }, { 0x0000006e, 7 },
+	{ 0x0000006f, 7 }, { 0x00000070, 7 }, { 0x00000071, 7 }, { 0x00000072, 7 },
+	{ 0x000000fc, 8 }, { 0x00000073, 7 }, { 0x000000fd, 8 }, { 0x00001ffb, 13 },
+	{ 0x0007fff0, 19 }, { 0x00001ffc, 13 }, { 0x00003ffc, 14 }, { 0x00000022, 6 },
+	{ 0x00007ffd, 15 }, { 0x00000003, 5 }, { 0x00000023, 6 }, { 0x00000004, 5 },
+	{ 0x00000024, 6 }, { 0x00000005, 5 }, { 0x00000025, 6 }, { 0x00000026, 6 },
+	{ 0x00000027, 6 }, { 0x00000006, 5 }, { 0x00000074, 7 }, { 0x00000075, 7 },
+	{ 0x00000028, 6 }, { 0x00000029, 6 }, { 0x0000002a, 6 }, { 0x00000007, 5 },
+	{ 0x0000002b, 6 }, { 0x00000076, 7 }, { 0x0000002c, 6 }, { 0x00000008, 5 },
+	{ 0x00000009, 5 }, { 0x0000002d, 6 }, { 0x00000077, 7 }, { 0x00000078, 7 },
+	{ 0x00000079, 7 }, { 0x0000007a, 7 }, { 0x0000007b, 7 }, { 0x00007ffe, 15 },
+	{ 0x000007fc, 11 }, { 0x00003ffd, 14 }, { 0x00001ffd, 13 }, { 0x0ffffffc, 28 },
+	{ 0x000fffe6, 20 }, { 0x003fffd2, 22 }, { 0x000fffe7, 20 }, { 0x000fffe8, 20 },
+	{ 0x003fffd3, 22 }, { 0x003fffd4, 22 }, { 0x003fffd5, 22 }, { 0x007fffd9, 23 },
+	{ 0x003fffd6, 22 }, { 0x007fffda, 23 }, { 0x007fffdb, 23 }, { 0x007fffdc, 23 },
+	{ 0x007fffdd, 23 }, { 0x007fffde, 23 }, { 0x00ffffeb, 24 }, { 0x007fffdf, 23 },
+	{ 0x00ffffec, 24 }, { 0x00ffffed, 24 }, { 0x003fffd7, 22 }, { 0x007fffe0, 23 },
+	{ 0x00ffffee, 24 }, { 0x007fffe1, 23 }, { 0x007fffe2, 23 }, { 0x007fffe3, 23 },
+	{ 0x007fffe4, 23 }, { 0x001fffdc, 21 }, { 0x003fffd8, 22 }, { 0x007fffe5, 23 },
+	{ 0x003fffd9, 22 }, { 0x007fffe6, 23 }, { 0x007fffe7, 23 }, { 0x00ffffef, 24 },
+	{ 0x003fffda, 22 }, { 0x001fffdd, 21 }, { 0x000fffe9, 20 }, { 0x003fffdb, 22 },
+	{ 0x003fffdc, 22 }, { 0x007fffe8, 23 }, { 0x007fffe9, 23 }, { 0x001fffde, 21 },
+	{ 0x007fffea, 23 }, { 0x003fffdd, 22 }, { 0x003fffde, 22 }, { 0x00fffff0, 24 },
+	{ 0x001fffdf, 21 }, { 0x003fffdf, 22 }, { 0x007fffeb, 23 }, { 0x007fffec, 23 },
+	{ 0x001fffe0, 21 }, { 0x001fffe1, 21 }, { 0x003fffe0, 22 }, { 0x001fffe2, 21 },
+	{ 0x007fffed, 23 }, { 0x003fffe1, 22 }, { 0x007fffee, 23 }, { 0x007fffef, 23 },
+	{ 0x000fffea, 20 }, { 0x003fffe2, 22 }, { 0x003fffe3, 22 }, { 0x003fffe4, 22 },
+	{ 0x007ffff0, 23 }, { 0x003fffe5, 22 }, { 0x003fffe6, 22 }, { 0x007ffff1, 23 },
+	{ 0x03ffffe0, 26 }, { 0x03ffffe1, 26 }, { 0x000fffeb, 20 }, { 0x0007fff1, 19 },
+	{ 0x003fffe7, 22 }, { 0x007ffff2, 23 }, { 0x003fffe8, 22 }, { 0x01ffffec, 25 },
+	{ 0x03ffffe2, 26 }, { 0x03ffffe3, 26 }, { 0x03ffffe4, 26 }, { 0x07ffffde, 27 },
+	{ 0x07ffffdf, 27 }, { 0x03ffffe5, 26 }, { 0x00fffff1, 24 }, { 0x01ffffed, 25 },
+	{ 0x0007fff2, 19 }, { 0x001fffe3, 21 }, { 0x03ffffe6, 26 }, { 0x07ffffe0, 27 },
+	{ 0x07ffffe1, 27 }, { 0x03ffffe7, 26 }, { 0x07ffffe2, 27 }, { 0x00fffff2, 24 },
+	{ 0x001fffe4, 21 }, { 0x001fffe5, 21 }, { 0x03ffffe8, 26 }, { 0x03ffffe9, 26 },
+	{ 0x0ffffffd, 28 }, { 0x07ffffe3, 27 }, { 0x07ffffe4, 27 }, { 0x07ffffe5, 27 },
+	{ 0x000fffec, 20 }, { 0x00fffff3, 24 }, { 0x000fffed, 20 }, { 0x001fffe6, 21 },
+	{ 0x003fffe9, 22 }, { 0x001fffe7, 21 }, { 0x001fffe8, 21 }, { 0x007ffff3, 23 },
+	{ 0x003fffea, 22 }, { 0x003fffeb, 22 }, { 0x01ffffee, 25 }, { 0x01ffffef, 25 },
+	{ 0x00fffff4, 24 }, { 0x00fffff5, 24 }, { 0x03ffffea, 26 }, { 0x007ffff4, 23 },
+	{ 0x03ffffeb, 26 }, { 0x07ffffe6, 27 }, { 0x03ffffec, 26 }, { 0x03ffffed, 26 },
+	{ 0x07ffffe7, 27 }, { 0x07ffffe8, 27 }, { 0x07ffffe9, 27 }, { 0x07ffffea, 27 },
+	{ 0x07ffffeb, 27 }, { 0x0ffffffe, 28 }, { 0x07ffffec, 27 }, { 0x07ffffed, 27 },
+	{ 0x07ffffee, 27 }, { 0x07ffffef, 27 }, { 0x07fffff0, 27 }, { 0x03ffffee, 26 },
+	{ 0x3fffffff, 30 }
+};
+
+struct StaticEntry
+{
+	const char *name;
+	const char *value;
+};
+
+// RFC 7541, appendix A
+static const StaticEntry staticTable[] =
+{
+	{ ":authority", "" },
+	{ ":method", "GET" },
+	{ ":method", "POST" },
+	{ ":path", "/" },
+	{ ":path", "/index.html" },
+	{ ":scheme", "http" },
+	{ ":scheme", "https" },
+	{ ":status", "200" },
+	{ ":status", "204" },
+	{ ":status", "206" },
+	{ ":status", "304" },
+	{ ":status", "400" },
+	{ ":status", "404" },
+	{ ":status", "500" },
+	{ "accept-charset", "" },
+	{ "accept-encoding", "gzip, deflate" },
+	{ "accept-language", "" },
+	{ "accept-ranges", "" },
+	{ "accept", "" },
+	{ "access-control-allow-origin", "" },
+	{ "age", "" },
+	{ "allow", "" },
+	{ "authorization", "" },
+	{ "cache-control", "" },
+	{ "content-disposition", "" },
+	{ "content-encoding", "" },
+	{ "content-language", "" },
+	{ "content-length", "" },
+	{ "content-location", "" },
+	{ "content-range", "" },
+	{ "content-type", "" },
+	{ "cookie", "" },
+	{ "date", "" },
+	{ "etag", "" },
+	{ "expect", "" },
+	{ "expires", "" },
+	{ "from", "" },
+	{ "host", "" },
+	{ "if-match", "" },
+	{ "if-modified-since", "" },
+	{ "if-none-match", "" },
+	{ "if-range", "" },
+	{ "if-unmodified-since", "" },
+	{ "last-modified", "" },
+	{ "link", "" },
+	{ "location", "" },
+	{ "max-forwards", "" },
+	{ "proxy-authenticate", "" },
+	{ "proxy-authorization", "" },
+	{ "range", "" },
+	{ "referer", "" },
+	{ "refresh", "" },
+	{ "retry-after", "" },
+	{ "server", "" },
+	{ "set-cookie", "" },
+	{ "strict-transport-security", "" },
+	{ "transfer-encoding", "" },
+	{ "user-agent", "" },
+	{ "vary", "" },
+	{ "via", "" },
+	{ "www-authenticate", "" },
+};
+
+#define STATIC_TABLE_SIZE (sizeof(staticTable) / sizeof(staticTable[0]))
+
+// every entry of the dynamic table is accounted with this overhead, in addition to its name and value
+#define ENTRY_OVERHEAD 32
+
+// The Huffman code is decoded bit by bit over a binary tree, which is built
+// from the code table once. Leaves hold the symbol, and inner nodes the index
+// of their children.
+class HuffmanTree
+{
+public:
+	HuffmanTree():
+		nodes(1)
+	{
+		for (int symbol = 0; symbol < 257; symbol++)
+		{
+			const HuffmanCode &code = huffmanCodes[symbol];
+			int node = 0;
+
+			for (int bit = code.length - 1; bit >= 0; bit--)
+			{
+				int branch = (code.code >> bit) & 1;
+				if (nodes[node].children[branch] == 0)
+				{
+					nodes[node].children[branch] = nodes.size();
+					nodes.push_back(Node());
+				}
+				node = nodes[node].children[branch];
+			}
+
+			nodes[node].symbol = symbol;
+		}
+	}
+
+	struct Node
+	{
+		Node():
+			symbol(-1)
+		{
+			children[0] = 0;
+			children[1] = 0;
+		}
+
+		int children[2];
+		int symbol;
+	};
+
+	vector<Node> nodes;
+};
+
+static const HuffmanTree huffmanTree;
+
+// the static entries are turned into strings once, so that entries of both tables are returned the same way
+static vector<pair<string, string> > buildStaticEntries()
+{
+	vector<pair<string, string> > entries;
+	for (size_t i = 0; i < STATIC_TABLE_SIZE; i++)
+		entries.push_back(make_pair(string(staticTable[i].name), string(staticTable[i].value)));
+	return entries;
+}
+
+static const vector<pair<string, string> > staticEntries = buildStaticEntries();
+
+HpackDecoder::HpackDecoder(size_t maxTableSize):
+	table(),
+	tableSize(0),
+	maxTableSize(maxTableSize),
+	settingsTableSize(maxTableSize)
+{
+}
+
+bool HpackDecoder::decode(const char *data, size_t length, size_t maxListSize, HeaderList &headers)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	const unsigned char *end = p + length;
+	size_t listSize = 0;
+
+	string name;
+	string value;
+
+	while (p < end)
+	{
+		unsigned char first = *p;
+		bool indexing = false;
+
+		if (first & 0x80)
+		{
+			// indexed field
+			UInt64 index;
+			const string *n;
+			const string *v;
+			if (!decodeInteger(p, end, 7, index) || !findEntry(index, n, v))
+				return false;
+
+			name = *n;
+			value = *v;
+		}
+		else if ((first & 0xE0) == 0x20)
+		{
+			// dynamic table size update, which may not exceed the size allowed by the settings
+			UInt64 size;
+			if (!decodeInteger(p, end, 5, size) || size > settingsTableSize)
+				return false;
+
+			maxTableSize = (size_t) size;
+			evict(maxTableSize);
+			continue;
+		}
+		else
+		{
+			// literal field, with incremental indexing, without indexing, or never indexed
+			int prefixBits;
+			if (first & 0x40)
+			{
+				indexing = true;
+				prefixBits = 6;
+			}
+			else
+			{
+				prefixBits = 4;
+			}
+
+			UInt64 index;
+			if (!decodeInteger(p, end, prefixBits, index))
+				return false;
+
+			if (index == 0)
+			{
+				if (!decodeString(p, end, name))
+					return false;
+			}
+			else
+			{
+				const string *n;
+				const string *v;
+				if (!findEntry(index, n, v))
+					return false;
+
+				name = *n;
+			}
+
+			if (!decodeString(p, end, value))
+				return false;
+
+			if (indexing)
+				addEntry(name, value);
+		}
+
+		listSize += name.length() + value.length() + ENTRY_OVERHEAD;
+		if (listSize > maxListSize)
+			return false;
+
+		headers.push_back(make_pair(name, value));
+	}
+
+	return true;
+}
+
+bool HpackDecoder::findEntry(UInt64 index, const string *&name, const string *&value) const
+{
+	if (index == 0)
+		return false;
+
+	if (index <= STATIC_TABLE_SIZE)
+	{
+		const pair<string, string> &entry = staticEntries[index - 1];
+		name = &entry.first;
+		value = &entry.second;
+		return true;
+	}
+
+	index -= STATIC_TABLE_SIZE + 1;
+	if (index >= table.size())
+		return false;
+
+	const pair<string, string> &entry = table[index];
+	name = &entry.first;
+	value = &entry.second;
+	return true;
+}
+
+void HpackDecoder::addEntry(const string &name, const string &value)
+{
+	size_t size = name.length() + value.length() + ENTRY_OVERHEAD;
+
+	// an entry larger than the table empties it and is not added
+	if (size > maxTableSize)
+	{
+		evict(0);
+		return;
+	}
+
+	evict(maxTableSize - size);
+
+	table.push_front(make_pair(name, value));
+	tableSize += size;
+}
+
+void HpackDecoder::evict(size_t limit)
+{
+	while (tableSize > limit && !table.empty())
+	{
+		const pair<string, string> &entry = table.back();
+		tableSize -= entry.first.length() + entry.second.length() + ENTRY_OVERHEAD;
+		table.pop_back();
+	}
+}
+
+bool HpackDecoder::decodeInteger(const unsigned char *&p, const unsigned char *end, int prefixBits, UInt64 &value)
+{
+	if (p >= end)
+		return false;
+
+	UInt64 mask = (1 << prefixBits) - 1;
+	value = *p++ & mask;
+	if (value < mask)
+		return true;
+
+	// continuation bytes; anything longer than fits in 56 bits is rejected as an error
+	for (int shift = 0; shift < 56; shift += 7)
+	{
+		if (p >= end)
+			return false;
+
+		unsigned char b = *p++;
+		value += (UInt64) (b & 0x7F) << shift;
+		if ((b & 0x80) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+bool HpackDecoder::decodeString(const unsigned char *&p, const unsigned char *end, string &str)
+{
+	if (p >= end)
+		return false;
+
+	bool huffman = ((*p & 0x80) != 0);
+
+	UInt64 length;
+	if (!decodeInteger(p, end, 7, length) || length > (UInt64) (end - p))
+		return false;
+
+	if (huffman)
+	{
+		str.clear();
+		if (!decodeHuffman(p, (size_t) length, str))
+			return false;
+	}
+	else
+	{
+		str.assign((const char *) p, (size_t) length);
+	}
+
+	p += length;
+	return true;
+}
+
+bool HpackDecoder::decodeHuffman(const unsigned char *p, size_t length, string &str)
+{
+	const vector<HuffmanTree::Node> &nodes = huffmanTree.nodes;
+	int node = 0;
+	int depth = 0;
+	bool ones = true;
+
+	for (size_t i = 0; i < length; i++)
+	{
+		unsigned char b = p[i];
+		for (int bit = 7; bit >= 0; bit--)
+		{
+			int branch = (b >> bit) & 1;
+			node = nodes[node].children[branch];
+			if (node == 0)
+				return false;
+
+			depth++;
+			ones = ones && (branch == 1);
+
+			int symbol = nodes[node].symbol;
+			if (symbol >= 0)
+			{
+				// the end of string symbol may not appear in the data
+				if (symbol == 256)
+					return false;
+
+				str += (char) symbol;
+				node = 0;
+				depth = 0;
+				ones = true;
+			}
+		}
+	}
+
+	// the padding is a prefix of the end of string symbol, shorter than a byte
+	return (depth < 8 && ones);
+}
+
+void HpackEncoder::encodeStatus(int status, string &block)
+{
+	// the common status codes have static table entries of their own
+	int index = 0;
+	switch (status)
+	{
+	case 200: index = 8; break;
+	case 204: index = 9; break;
+	case 206: index = 10; break;
+	case 304: index = 11; break;
+	case 400: index = 12; break;
+	case 404: index = 13; break;
+	case 500: index = 14; break;
+	}
+
+	if (index > 0)
+	{
+		encodeInteger(index, 7, 0x80, block);
+		return;
+	}
+
+	char value[4];
+	value[0] = (char) ('0' + (status / 100) % 10);
+	value[1] = (char) ('0' + (status / 10) % 10);
+	value[2] = (char) ('0' + status % 10);
+	value[3] = '\0';
+
+	// literal without indexing, with the name of static entry 8 (":status")
+	encodeInteger(8, 4, 0x00, block);
+	encodeString(value, block);
+}
+
+void HpackEncoder::encodeField(const string &name, const string &value, string &block)
+{
+	// names are looked up among the regular fields of the static table, which follow the pseudo fields
+	size_t index = 0;
+	for (size_t i = 14; i < STATIC_TABLE_SIZE; i++)
+	{
+		if (name == staticTable[i].name)
+		{
+			index = i + 1;
+			break;
+		}
+	}
+
+	// literal without indexing
+	encodeInteger(index, 4, 0x00, block);
+	if (index == 0)
+		encodeString(name, block);
+	encodeString(value, block);
+}
+
+void HpackEncoder::encodeInteger(UInt64 value, int prefixBits, unsigned char prefix, string &block)
+{
+	UInt64 mask = (1 << prefixBits) - 1;
+	if (value < mask)
+	{
+		block += (char) (prefix | value);
+		return;
+	}
+
+	block += (char) (prefix | mask);
+	value -= mask;
+	while (value >= 0x80)
+	{
+		block += (char) (0x80 | (value & 0x7F));
+		value >>= 7;
+	}
+	block += (char) value;
+}
+
+void HpackEncoder::encodeString(const string &str, string &block)
+{
+	encodeInteger(str.length(), 7, 0x00, block);
+	block += str;
+}
@@ -0,0 +1,87 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef HPACK_H
+#define HPACK_H
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <utility>
+
+#include "Poco/Types.h"
+
+using namespace std;
+
+using namespace Poco;
+
+typedef vector<pair<string, string> > HeaderList;
+
+// Decodes HPACK header blocks (RFC 7541), keeping the dynamic table of the
+// peer's encoder. A decoding error is a connection error in HTTP/2, after
+// which the decoder must not be used any more.
+class HpackDecoder
+{
+public:
+	HpackDecoder(size_t maxTableSize);
+
+	bool decode(const char *data, size_t length, size_t maxListSize, HeaderList &headers);
+
+private:
+	bool findEntry(UInt64 index, const string *&name, const string *&value) const;
+	void addEntry(const string &name, const string &value);
+	void evict(size_t limit);
+
+	static bool decodeInteger(const unsigned char *&p, const unsigned char *end, int prefixBits, UInt64 &value);
+	static bool decodeString(const unsigned char *&p, const unsigned char *end, string &str);
+	static bool decodeHuffman(const unsigned char *p, size_t length, string &str);
+
+	deque<pair<string, string> > table;
+	size_t tableSize;
+	size_t maxTableSize;
+	const size_t settingsTableSize;
+};
+
+// Encodes response header blocks. Only the static table is used, so the
+// encoder has no state, and the peer's table size setting does not matter.
+// Values are sent as plain literals, which costs a few bytes against Huffman
+// coding, but nothing on the CPU.
+class HpackEncoder
+{
+public:
+	static void encodeStatus(int status, string &block);
+	static void encodeField(const string &name, const string &value, string &block);
+
+private:
+	static void encodeInteger(UInt64 value, int prefixBits, unsigned char prefix, string &block);
+	static void encodeString(const string &str, string &block);
+};
+
+#endif //HPACK_H
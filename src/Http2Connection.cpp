@@ -0,0 +1,909 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <cstring>
+
+#include "Poco/Platform.h"
+
+#if defined(POCO_OS_FAMILY_UNIX)
+#include <sys/types.h>
+#include <sys/socket.h>
+#endif
+
+#include "Poco/Thread.h"
+#include "Poco/Timestamp.h"
+#include "Poco/ScopedLock.h"
+#include "Poco/Exception.h"
+#include "Poco/Net/Socket.h"
+
+#include "Http2Connection.h"
+#include "Http2Stream.h"
+
+// protocol defaults and limits (RFC 9113, section 6.5.2)
+#define DEFAULT_WINDOW_SIZE 65535
+#define MAX_WINDOW_SIZE 0x7fffffff
+#define DEFAULT_FRAME_SIZE 16384
+#define MAX_FRAME_SIZE 16777215
+#define DEFAULT_TABLE_SIZE 4096
+
+#define FRAME_HEADER_SIZE 9
+
+// limits on the header blocks of the client, before and after decoding
+#define MAX_HEADER_BLOCK_SIZE 65536
+#define MAX_HEADER_LIST_SIZE 65536
+
+// DATA frames are not made larger than this, even if the client would accept them
+#define MAX_DATA_FRAME_SIZE 65536
+
+const string Http2Connection::preface("PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n");
+
+AtomicCounter Http2Connection::connectionCount;
+AtomicCounter Http2Connection::streamCount;
+AtomicCounter Http2Connection::refusedStreams;
+
+Http2Connection::Http2Connection(const StreamSocket &socket, HTTPServerParams::Ptr params, HTTPRequestHandlerFactory::Ptr factory, ThreadPool &pool, int maxStreams):
+	TCPServerConnection(socket),
+	params(params),
+	factory(factory),
+	pool(pool),
+	clientAddress(socket.peerAddress()),
+	serverAddress(socket.address()),
+	maxStreams(maxStreams),
+	decoder(DEFAULT_TABLE_SIZE),
+	headerStreamId(0),
+	headerNewStream(false),
+	lastStreamId(0),
+	goingAway(false),
+	sendWindow(DEFAULT_WINDOW_SIZE),
+	initialWindow(DEFAULT_WINDOW_SIZE),
+	maxFrameSize(DEFAULT_FRAME_SIZE),
+	closed(false)
+{
+}
+
+Http2Connection::~Http2Connection()
+{
+	reapStreams();
+}
+
+void Http2Connection::run()
+{
+	connectionCount++;
+
+	try
+	{
+		socket().setReceiveTimeout(params->getTimeout());
+
+		// small frames, e.g. those that open flow control windows, must not be held back until earlier ones are acknowledged
+		socket().setNoDelay(true);
+
+		if (readPreface())
+		{
+			sendSettings();
+
+			Frame frame;
+			UInt32 error = H2_NO_ERROR;
+			while (waitForFrame() && readFrame(frame, error))
+			{
+				error = handleFrame(frame);
+				if (error != H2_NO_ERROR)
+					break;
+			}
+
+			if (error != H2_NO_ERROR)
+				sendGoAway(error);
+		}
+	}
+	catch (Exception &e)
+	{
+	}
+
+	closeStreams();
+}
+
+// Tells whether the client has started the connection with the HTTP/2 preface, without consuming any data.
+// An HTTP/1.x request cannot be mistaken for the preface, because its method would have to be "PRI".
+bool Http2Connection::detect(StreamSocket &socket, const Timespan &timeout)
+{
+	char buffer[64];
+	int length = (int) preface.length();
+	Timestamp start;
+
+	while (socket.poll(timeout, Socket::SELECT_READ))
+	{
+		int n = socket.receiveBytes(buffer, length, MSG_PEEK);
+		if (n <= 0)
+			return false;
+
+		if (preface.compare(0, n, buffer, n) != 0)
+			return false;
+
+		if (n == length)
+			return true;
+
+		// only a part of the preface has arrived so far
+		if (start.isElapsed(timeout.totalMicroseconds()))
+			return false;
+
+		Thread::sleep(10);
+	}
+
+	return false;
+}
+
+void Http2Connection::appendStatus(ostream &out)
+{
+	out << "HTTP/2 connections: " << connectionCount.value() << endl;
+	out << "HTTP/2 streams: " << streamCount.value() << endl;
+	out << "Refused HTTP/2 streams: " << refusedStreams.value() << endl;
+}
+
+const HTTPServerParams &Http2Connection::getParams() const
+{
+	return *params;
+}
+
+HTTPRequestHandlerFactory &Http2Connection::getFactory()
+{
+	return *factory;
+}
+
+const SocketAddress &Http2Connection::getClientAddress() const
+{
+	return clientAddress;
+}
+
+const SocketAddress &Http2Connection::getServerAddress() const
+{
+	return serverAddress;
+}
+
+// Sends a part of a response body, preceded by the header block of the response if given, waiting for the client
+// to open its flow control windows as needed. The header block goes out in the same send as the first DATA frame.
+// Returns false if the stream has been reset, the connection has failed, or the client has not made room in time.
+bool Http2Connection::sendData(Http2Stream &stream, const string *headers, const char *data, size_t length, bool endStream)
+{
+	long timeout = (long) params->getTimeout().totalMilliseconds();
+
+	while (true)
+	{
+		size_t n = 0;
+		{
+			FastMutex::ScopedLock lock(mutex);
+
+			// a pending header block is sent while waiting, so that the client does not wait for it in turn
+			while (length > 0 && headers == NULL && !closed && !stream.reset && (sendWindow <= 0 || stream.window <= 0))
+			{
+				if (!changed.tryWait(mutex, timeout))
+					return false;
+			}
+
+			if (closed || stream.reset)
+				return false;
+
+			if (length > 0 && sendWindow > 0 && stream.window > 0)
+			{
+				n = length;
+				if (n > maxFrameSize)
+					n = maxFrameSize;
+				if (n > MAX_DATA_FRAME_SIZE)
+					n = MAX_DATA_FRAME_SIZE;
+				if ((Int64) n > sendWindow)
+					n = (size_t) sendWindow;
+				if ((Int64) n > stream.window)
+					n = (size_t) stream.window;
+
+				sendWindow -= n;
+				stream.window -= n;
+			}
+		}
+
+		bool last = (endStream && n == length);
+		{
+			FastMutex::ScopedLock lock(writeMutex);
+
+			if (headers != NULL)
+			{
+				bool headersOnly = (endStream && length == 0);
+				if (!putHeaders(stream.id, *headers, headersOnly, (n > 0 || last)))
+					return false;
+
+				headers = NULL;
+
+				if (headersOnly)
+					return true;
+			}
+
+			if ((n > 0 || last) && !putFrame(DATA, (last ? FLAG_END_STREAM : 0), stream.id, data, n, false))
+				return false;
+		}
+
+		data += n;
+		length -= n;
+
+		if (length == 0 && (last || !endStream))
+			return true;
+	}
+}
+
+void Http2Connection::resetStream(Http2Stream &stream, UInt32 error)
+{
+	{
+		FastMutex::ScopedLock lock(mutex);
+
+		if (stream.reset || closed)
+			return;
+
+		stream.reset = true;
+	}
+
+	sendReset(stream.id, error);
+}
+
+// Called by a stream as the last thing it does; the connection thread deletes the stream later.
+void Http2Connection::streamFinished(Http2Stream &stream)
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	streams.erase(stream.id);
+	finished.push_back(&stream);
+	changed.broadcast();
+}
+
+// Queues a header block, split into a HEADERS frame and as many CONTINUATION frames as needed.
+// The frames of a block must not be separated by any other frame, so the write mutex must stay locked meanwhile.
+bool Http2Connection::putHeaders(UInt32 streamId, const string &block, bool endStream, bool more)
+{
+	size_t frameSize;
+	{
+		FastMutex::ScopedLock lock(mutex);
+		frameSize = maxFrameSize;
+	}
+
+	const char *data = block.data();
+	size_t length = block.length();
+	int type = HEADERS;
+	int flags = (endStream ? FLAG_END_STREAM : 0);
+
+	while (true)
+	{
+		size_t n = (length < frameSize ? length : frameSize);
+		if (n == length)
+			flags |= FLAG_END_HEADERS;
+
+		if (!putFrame(type, flags, streamId, data, n, (more || n < length)))
+			return false;
+
+		data += n;
+		length -= n;
+
+		if (length == 0)
+			return true;
+
+		type = CONTINUATION;
+		flags = 0;
+	}
+}
+
+bool Http2Connection::readPreface()
+{
+	char buffer[64];
+	size_t length = preface.length();
+
+	if (!readBytes(buffer, length))
+		return false;
+
+	return (preface.compare(0, length, buffer, length) == 0);
+}
+
+// Waits for the next frame of the client, checking on the streams every second in the meantime.
+// Returns false when the connection is done: it has failed, it has been idle for too long,
+// or the client is going away and all of its streams have finished.
+bool Http2Connection::waitForFrame()
+{
+	Timestamp idleSince;
+	Timestamp::TimeDiff idleTimeout = params->getKeepAliveTimeout().totalMicroseconds();
+
+	while (!socket().poll(Timespan(1, 0), Socket::SELECT_READ))
+	{
+		size_t active = reapStreams();
+
+		{
+			FastMutex::ScopedLock lock(mutex);
+
+			if (closed)
+				return false;
+		}
+
+		if (active > 0)
+		{
+			idleSince.update();
+		}
+		else if (goingAway)
+		{
+			return false;
+		}
+		else if (idleSince.isElapsed(idleTimeout))
+		{
+			sendGoAway(H2_NO_ERROR);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool Http2Connection::readFrame(Frame &frame, UInt32 &error)
+{
+	char header[FRAME_HEADER_SIZE];
+	if (!readBytes(header, sizeof(header)))
+		return false;
+
+	const unsigned char *p = (const unsigned char *) header;
+	frame.length = (p[0] << 16) | (p[1] << 8) | p[2];
+	frame.type = p[3];
+	frame.flags = p[4];
+	frame.streamId = getUInt32(header + 5) & 0x7fffffff;
+
+	// the server never allows frames larger than the default
+	if (frame.length > DEFAULT_FRAME_SIZE)
+	{
+		error = H2_FRAME_SIZE_ERROR;
+		return false;
+	}
+
+	frame.payload.resize(frame.length);
+
+	return (frame.length == 0 || readBytes(&frame.payload[0], frame.length));
+}
+
+bool Http2Connection::readBytes(char *buffer, size_t length)
+{
+	while (length > 0)
+	{
+		int n = socket().receiveBytes(buffer, (int) length);
+		if (n <= 0)
+			return false;
+
+		buffer += n;
+		length -= n;
+	}
+
+	return true;
+}
+
+// Handles a frame of the client. Returns the error code of a connection error, after which the connection is closed.
+UInt32 Http2Connection::handleFrame(Frame &frame)
+{
+	// a header block must not be interrupted by any other frame
+	if (headerStreamId != 0 && (frame.type != CONTINUATION || frame.streamId != headerStreamId))
+		return H2_PROTOCOL_ERROR;
+
+	switch (frame.type)
+	{
+	case DATA: return handleData(frame);
+	case HEADERS: return handleHeaders(frame);
+	case PRIORITY: return handlePriority(frame);
+	case RST_STREAM: return handleRstStream(frame);
+	case SETTINGS: return handleSettings(frame);
+	case PUSH_PROMISE: return H2_PROTOCOL_ERROR;
+	case PING: return handlePing(frame);
+	case GOAWAY: return handleGoAway(frame);
+	case WINDOW_UPDATE: return handleWindowUpdate(frame);
+	case CONTINUATION: return handleContinuation(frame);
+	}
+
+	// frames of unknown types are ignored
+	return H2_NO_ERROR;
+}
+
+UInt32 Http2Connection::handleData(Frame &frame)
+{
+	if (frame.streamId == 0 || frame.streamId > lastStreamId)
+		return H2_PROTOCOL_ERROR;
+
+	if (!removePadding(frame))
+		return H2_PROTOCOL_ERROR;
+
+	// request bodies are discarded, but they still use up the flow control windows, which are opened again right away
+	if (frame.length > 0)
+	{
+		sendWindowUpdate(0, frame.length);
+
+		bool open;
+		{
+			FastMutex::ScopedLock lock(mutex);
+			open = (streams.find(frame.streamId) != streams.end());
+		}
+
+		if (open && (frame.flags & FLAG_END_STREAM) == 0)
+			sendWindowUpdate(frame.streamId, frame.length);
+	}
+
+	return H2_NO_ERROR;
+}
+
+UInt32 Http2Connection::handleHeaders(Frame &frame)
+{
+	if (frame.streamId == 0 || (frame.streamId & 1) == 0)
+		return H2_PROTOCOL_ERROR;
+
+	if (!removePadding(frame))
+		return H2_PROTOCOL_ERROR;
+
+	if (frame.flags & FLAG_PRIORITY)
+	{
+		if (frame.payload.length() < 5)
+			return H2_FRAME_SIZE_ERROR;
+
+		frame.payload.erase(0, 5);
+	}
+
+	// a stream is opened by its first HEADERS frame; another one on the same stream carries trailers
+	headerNewStream = (frame.streamId > lastStreamId);
+	if (headerNewStream)
+		lastStreamId = frame.streamId;
+
+	headerBlock.swap(frame.payload);
+
+	if ((frame.flags & FLAG_END_HEADERS) == 0)
+	{
+		headerStreamId = frame.streamId;
+		return H2_NO_ERROR;
+	}
+
+	return finishHeaders(frame.streamId, headerNewStream);
+}
+
+UInt32 Http2Connection::handleContinuation(Frame &frame)
+{
+	if (headerStreamId == 0)
+		return H2_PROTOCOL_ERROR;
+
+	if (headerBlock.length() + frame.payload.length() > MAX_HEADER_BLOCK_SIZE)
+		return H2_ENHANCE_YOUR_CALM;
+
+	headerBlock += frame.payload;
+
+	if ((frame.flags & FLAG_END_HEADERS) == 0)
+		return H2_NO_ERROR;
+
+	UInt32 streamId = headerStreamId;
+	headerStreamId = 0;
+
+	return finishHeaders(streamId, headerNewStream);
+}
+
+UInt32 Http2Connection::handlePriority(Frame &frame)
+{
+	if (frame.streamId == 0)
+		return H2_PROTOCOL_ERROR;
+
+	// responses are not prioritized, so the frame only has to be well formed
+	if (frame.length != 5)
+		sendReset(frame.streamId, H2_FRAME_SIZE_ERROR);
+
+	return H2_NO_ERROR;
+}
+
+UInt32 Http2Connection::handleRstStream(Frame &frame)
+{
+	if (frame.streamId == 0 || frame.streamId > lastStreamId)
+		return H2_PROTOCOL_ERROR;
+
+	if (frame.length != 4)
+		return H2_FRAME_SIZE_ERROR;
+
+	FastMutex::ScopedLock lock(mutex);
+
+	map<UInt32, Http2Stream *>::iterator it = streams.find(frame.streamId);
+	if (it != streams.end())
+	{
+		it->second->reset = true;
+		changed.broadcast();
+	}
+
+	return H2_NO_ERROR;
+}
+
+UInt32 Http2Connection::handleSettings(Frame &frame)
+{
+	if (frame.streamId != 0)
+		return H2_PROTOCOL_ERROR;
+
+	if (frame.flags & FLAG_ACK)
+		return (frame.length == 0 ? H2_NO_ERROR : H2_FRAME_SIZE_ERROR);
+
+	if (frame.length % 6 != 0)
+		return H2_FRAME_SIZE_ERROR;
+
+	for (size_t i = 0; i < frame.length; i += 6)
+	{
+		const unsigned char *p = (const unsigned char *) frame.payload.data() + i;
+		int id = (p[0] << 8) | p[1];
+		UInt32 value = getUInt32((const char *) p + 2);
+
+		if (id == SETTINGS_ENABLE_PUSH)
+		{
+			if (value > 1)
+				return H2_PROTOCOL_ERROR;
+		}
+		else if (id == SETTINGS_INITIAL_WINDOW_SIZE)
+		{
+			if (value > MAX_WINDOW_SIZE)
+				return H2_FLOW_CONTROL_ERROR;
+
+			// the change applies to the windows of the open streams too, which may even become negative
+			FastMutex::ScopedLock lock(mutex);
+
+			Int64 delta = (Int64) value - initialWindow;
+			initialWindow = value;
+
+			map<UInt32, Http2Stream *>::iterator it;
+			for (it = streams.begin(); it != streams.end(); ++it)
+			{
+				Http2Stream &stream = *it->second;
+				stream.window += delta;
+				if (stream.window > MAX_WINDOW_SIZE)
+					return H2_FLOW_CONTROL_ERROR;
+			}
+
+			changed.broadcast();
+		}
+		else if (id == SETTINGS_MAX_FRAME_SIZE)
+		{
+			if (value < DEFAULT_FRAME_SIZE || value > MAX_FRAME_SIZE)
+				return H2_PROTOCOL_ERROR;
+
+			FastMutex::ScopedLock lock(mutex);
+			maxFrameSize = value;
+		}
+
+		// the header table size does not matter, because responses are encoded without the dynamic table
+	}
+
+	writeFrame(SETTINGS, FLAG_ACK, 0, NULL, 0);
+
+	return H2_NO_ERROR;
+}
+
+UInt32 Http2Connection::handlePing(Frame &frame)
+{
+	if (frame.streamId != 0)
+		return H2_PROTOCOL_ERROR;
+
+	if (frame.length != 8)
+		return H2_FRAME_SIZE_ERROR;
+
+	if ((frame.flags & FLAG_ACK) == 0)
+		writeFrame(PING, FLAG_ACK, 0, frame.payload.data(), frame.length);
+
+	return H2_NO_ERROR;
+}
+
+UInt32 Http2Connection::handleGoAway(Frame &frame)
+{
+	if (frame.streamId != 0)
+		return H2_PROTOCOL_ERROR;
+
+	if (frame.length < 8)
+		return H2_FRAME_SIZE_ERROR;
+
+	// the streams that are already open are still served
+	goingAway = true;
+
+	return H2_NO_ERROR;
+}
+
+UInt32 Http2Connection::handleWindowUpdate(Frame &frame)
+{
+	if (frame.length != 4)
+		return H2_FRAME_SIZE_ERROR;
+
+	UInt32 increment = getUInt32(frame.payload.data()) & 0x7fffffff;
+
+	if (frame.streamId == 0)
+	{
+		if (increment == 0)
+			return H2_PROTOCOL_ERROR;
+
+		FastMutex::ScopedLock lock(mutex);
+
+		sendWindow += increment;
+		if (sendWindow > MAX_WINDOW_SIZE)
+			return H2_FLOW_CONTROL_ERROR;
+
+		changed.broadcast();
+
+		return H2_NO_ERROR;
+	}
+
+	if (frame.streamId > lastStreamId)
+		return H2_PROTOCOL_ERROR;
+
+	UInt32 error = H2_NO_ERROR;
+	{
+		FastMutex::ScopedLock lock(mutex);
+
+		map<UInt32, Http2Stream *>::iterator it = streams.find(frame.streamId);
+		if (it == streams.end())
+			return H2_NO_ERROR;
+
+		Http2Stream &stream = *it->second;
+		stream.window += increment;
+
+		if (increment == 0)
+			error = H2_PROTOCOL_ERROR;
+		else if (stream.window > MAX_WINDOW_SIZE)
+			error = H2_FLOW_CONTROL_ERROR;
+
+		if (error != H2_NO_ERROR)
+			stream.reset = true;
+
+		changed.broadcast();
+	}
+
+	if (error != H2_NO_ERROR)
+		sendReset(frame.streamId, error);
+
+	return H2_NO_ERROR;
+}
+
+bool Http2Connection::removePadding(Frame &frame)
+{
+	if ((frame.flags & FLAG_PADDED) == 0)
+		return true;
+
+	if (frame.payload.empty())
+		return false;
+
+	size_t padding = (unsigned char) frame.payload[0];
+	if (padding + 1 > frame.payload.length())
+		return false;
+
+	frame.payload.erase(frame.payload.length() - padding);
+	frame.payload.erase(0, 1);
+
+	return true;
+}
+
+// Decodes a complete header block, and starts the request of a new stream in the thread pool.
+UInt32 Http2Connection::finishHeaders(UInt32 streamId, bool isNew)
+{
+	HeaderList headers;
+	if (!decoder.decode(headerBlock.data(), headerBlock.length(), MAX_HEADER_LIST_SIZE, headers))
+		return H2_COMPRESSION_ERROR;
+
+	// trailers are decoded only to keep the table of the decoder in step with the client
+	if (!isNew)
+		return H2_NO_ERROR;
+
+	if (reapStreams() >= maxStreams)
+	{
+		refuseStream(streamId);
+		return H2_NO_ERROR;
+	}
+
+	Http2Stream *stream = new Http2Stream(*this, streamId, initialWindow);
+
+	if (!stream->readHeaders(headers))
+	{
+		delete stream;
+		sendReset(streamId, H2_PROTOCOL_ERROR);
+		return H2_NO_ERROR;
+	}
+
+	{
+		FastMutex::ScopedLock lock(mutex);
+		streams[streamId] = stream;
+	}
+
+	try
+	{
+		pool.start(*stream);
+	}
+	catch (NoThreadAvailableException &ntae)
+	{
+		{
+			FastMutex::ScopedLock lock(mutex);
+			streams.erase(streamId);
+		}
+
+		delete stream;
+		refuseStream(streamId);
+		return H2_NO_ERROR;
+	}
+
+	streamCount++;
+
+	return H2_NO_ERROR;
+}
+
+// A refused stream has not been processed at all, so the client can retry its request safely.
+void Http2Connection::refuseStream(UInt32 streamId)
+{
+	refusedStreams++;
+	sendReset(streamId, H2_REFUSED_STREAM);
+}
+
+// Deletes the streams that have finished, and returns the number of streams that are still running.
+size_t Http2Connection::reapStreams()
+{
+	vector<Http2Stream *> reaped;
+	size_t active;
+	{
+		FastMutex::ScopedLock lock(mutex);
+
+		reaped.swap(finished);
+		active = streams.size();
+	}
+
+	vector<Http2Stream *>::iterator it;
+	for (it = reaped.begin(); it != reaped.end(); ++it)
+		delete *it;
+
+	return active;
+}
+
+// Makes the streams that are still running give up on their responses, and waits for their threads to finish.
+void Http2Connection::closeStreams()
+{
+	{
+		FastMutex::ScopedLock lock(mutex);
+
+		closed = true;
+		changed.broadcast();
+
+		while (!streams.empty())
+			changed.wait(mutex);
+	}
+
+	reapStreams();
+}
+
+bool Http2Connection::writeFrame(int type, int flags, UInt32 streamId, const char *data, size_t length)
+{
+	FastMutex::ScopedLock lock(writeMutex);
+
+	return putFrame(type, flags, streamId, data, length, false);
+}
+
+// Appends a frame to the write buffer, and sends the buffer unless more frames are to follow right away.
+// The write mutex must be locked.
+bool Http2Connection::putFrame(int type, int flags, UInt32 streamId, const char *data, size_t length, bool more)
+{
+	size_t offset = frameBuffer.length();
+	frameBuffer.resize(offset + FRAME_HEADER_SIZE);
+
+	char *p = &frameBuffer[offset];
+	p[0] = (char) (length >> 16);
+	p[1] = (char) (length >> 8);
+	p[2] = (char) length;
+	p[3] = (char) type;
+	p[4] = (char) flags;
+	putUInt32(p + 5, streamId);
+
+	if (length > 0)
+		frameBuffer.append(data, length);
+
+	if (more)
+		return true;
+
+	return flushFrames();
+}
+
+// Sends the write buffer; the write mutex must be locked. A failed send closes the connection for the streams.
+bool Http2Connection::flushFrames()
+{
+	const char *p = frameBuffer.data();
+	size_t left = frameBuffer.length();
+
+	try
+	{
+		while (left > 0)
+		{
+			int n = socket().sendBytes(p, (int) left);
+			if (n <= 0)
+				break;
+
+			p += n;
+			left -= n;
+		}
+	}
+	catch (Exception &e)
+	{
+	}
+
+	frameBuffer.clear();
+
+	if (left == 0)
+		return true;
+
+	FastMutex::ScopedLock lock(mutex);
+
+	closed = true;
+	changed.broadcast();
+
+	return false;
+}
+
+void Http2Connection::sendSettings()
+{
+	char payload[12];
+	putSetting(payload, SETTINGS_MAX_CONCURRENT_STREAMS, (UInt32) maxStreams);
+	putSetting(payload + 6, SETTINGS_MAX_HEADER_LIST_SIZE, MAX_HEADER_LIST_SIZE);
+
+	writeFrame(SETTINGS, 0, 0, payload, sizeof(payload));
+}
+
+void Http2Connection::sendWindowUpdate(UInt32 streamId, UInt32 increment)
+{
+	char payload[4];
+	putUInt32(payload, increment);
+
+	writeFrame(WINDOW_UPDATE, 0, streamId, payload, sizeof(payload));
+}
+
+void Http2Connection::sendReset(UInt32 streamId, UInt32 error)
+{
+	char payload[4];
+	putUInt32(payload, error);
+
+	writeFrame(RST_STREAM, 0, streamId, payload, sizeof(payload));
+}
+
+void Http2Connection::sendGoAway(UInt32 error)
+{
+	char payload[8];
+	putUInt32(payload, lastStreamId);
+	putUInt32(payload + 4, error);
+
+	writeFrame(GOAWAY, 0, 0, payload, sizeof(payload));
+}
+
+void Http2Connection::putSetting(char *p, int id, UInt32 value)
+{
+	p[0] = (char) (id >> 8);
+	p[1] = (char) id;
+	putUInt32(p + 2, value);
+}
+
+void Http2Connection::putUInt32(char *p, UInt32 value)
+{
+	p[0] = (char) (value >> 24);
+	p[1] = (char) (value >> 16);
+	p[2] = (char) (value >> 8);
+	p[3] = (char) value;
+}
+
+UInt32 Http2Connection::getUInt32(const char *p)
+{
+	const unsigned char *q = (const unsigned char *) p;
+
+	return ((UInt32) q[0] << 24) | ((UInt32) q[1] << 16) | ((UInt32) q[2] << 8) | (UInt32) q[3];
+}
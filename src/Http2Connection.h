@@ -0,0 +1,213 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef HTTP2CONNECTION_H
+#define HTTP2CONNECTION_H
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <map>
+#include <ostream>
+
+#include "Poco/Types.h"
+#include "Poco/Mutex.h"
+#include "Poco/Condition.h"
+#include "Poco/ThreadPool.h"
+#include "Poco/Timespan.h"
+#include "Poco/AtomicCounter.h"
+#include "Poco/Net/TCPServerConnection.h"
+#include "Poco/Net/HTTPServerParams.h"
+#include "Poco/Net/HTTPRequestHandlerFactory.h"
+#include "Poco/Net/StreamSocket.h"
+#include "Poco/Net/SocketAddress.h"
+
+#include "Hpack.h"
+
+using namespace std;
+
+using namespace Poco;
+using namespace Poco::Net;
+
+class Http2Stream;
+
+// Serves an HTTP/2 connection whose client started with the connection preface right away (h2c with prior knowledge).
+// The connection thread only reads frames; every request runs as a stream in the server's thread pool, where it
+// is handled by the usual request handler. The responses of all streams are interleaved on the socket, within the
+// flow control windows granted by the client.
+class Http2Connection: public TCPServerConnection
+{
+public:
+	Http2Connection(const StreamSocket &socket, HTTPServerParams::Ptr params, HTTPRequestHandlerFactory::Ptr factory, ThreadPool &pool, int maxStreams);
+	~Http2Connection();
+
+	void run();
+
+	static bool detect(StreamSocket &socket, const Timespan &timeout);
+	static void appendStatus(ostream &out);
+
+	// used by the streams
+	const HTTPServerParams &getParams() const;
+	HTTPRequestHandlerFactory &getFactory();
+	const SocketAddress &getClientAddress() const;
+	const SocketAddress &getServerAddress() const;
+
+	bool sendData(Http2Stream &stream, const string *headers, const char *data, size_t length, bool endStream);
+	void resetStream(Http2Stream &stream, UInt32 error);
+	void streamFinished(Http2Stream &stream);
+
+	// error codes, prefixed to keep clear of the Windows error macros
+	enum ErrorCode
+	{
+		H2_NO_ERROR = 0x0,
+		H2_PROTOCOL_ERROR = 0x1,
+		H2_INTERNAL_ERROR = 0x2,
+		H2_FLOW_CONTROL_ERROR = 0x3,
+		H2_STREAM_CLOSED = 0x5,
+		H2_FRAME_SIZE_ERROR = 0x6,
+		H2_REFUSED_STREAM = 0x7,
+		H2_CANCEL = 0x8,
+		H2_COMPRESSION_ERROR = 0x9,
+		H2_ENHANCE_YOUR_CALM = 0xb
+	};
+
+private:
+	enum FrameType
+	{
+		DATA = 0x0,
+		HEADERS = 0x1,
+		PRIORITY = 0x2,
+		RST_STREAM = 0x3,
+		SETTINGS = 0x4,
+		PUSH_PROMISE = 0x5,
+		PING = 0x6,
+		GOAWAY = 0x7,
+		WINDOW_UPDATE = 0x8,
+		CONTINUATION = 0x9
+	};
+
+	enum FrameFlags
+	{
+		FLAG_END_STREAM = 0x1,
+		FLAG_ACK = 0x1,
+		FLAG_END_HEADERS = 0x4,
+		FLAG_PADDED = 0x8,
+		FLAG_PRIORITY = 0x20
+	};
+
+	enum Setting
+	{
+		SETTINGS_HEADER_TABLE_SIZE = 0x1,
+		SETTINGS_ENABLE_PUSH = 0x2,
+		SETTINGS_MAX_CONCURRENT_STREAMS = 0x3,
+		SETTINGS_INITIAL_WINDOW_SIZE = 0x4,
+		SETTINGS_MAX_FRAME_SIZE = 0x5,
+		SETTINGS_MAX_HEADER_LIST_SIZE = 0x6
+	};
+
+	struct Frame
+	{
+		UInt32 length;
+		int type;
+		int flags;
+		UInt32 streamId;
+		string payload;
+	};
+
+	bool readPreface();
+	bool waitForFrame();
+	bool readFrame(Frame &frame, UInt32 &error);
+	bool readBytes(char *buffer, size_t length);
+
+	UInt32 handleFrame(Frame &frame);
+	UInt32 handleData(Frame &frame);
+	UInt32 handleHeaders(Frame &frame);
+	UInt32 handleContinuation(Frame &frame);
+	UInt32 handlePriority(Frame &frame);
+	UInt32 handleRstStream(Frame &frame);
+	UInt32 handleSettings(Frame &frame);
+	UInt32 handlePing(Frame &frame);
+	UInt32 handleGoAway(Frame &frame);
+	UInt32 handleWindowUpdate(Frame &frame);
+
+	static bool removePadding(Frame &frame);
+
+	UInt32 finishHeaders(UInt32 streamId, bool isNew);
+	void refuseStream(UInt32 streamId);
+	size_t reapStreams();
+	void closeStreams();
+
+	bool writeFrame(int type, int flags, UInt32 streamId, const char *data, size_t length);
+	bool putHeaders(UInt32 streamId, const string &block, bool endStream, bool more);
+	bool putFrame(int type, int flags, UInt32 streamId, const char *data, size_t length, bool more);
+	bool flushFrames();
+	void sendSettings();
+	void sendWindowUpdate(UInt32 streamId, UInt32 increment);
+	void sendReset(UInt32 streamId, UInt32 error);
+	void sendGoAway(UInt32 error);
+
+	static void putSetting(char *p, int id, UInt32 value);
+	static void putUInt32(char *p, UInt32 value);
+	static UInt32 getUInt32(const char *p);
+
+	HTTPServerParams::Ptr params;
+	HTTPRequestHandlerFactory::Ptr factory;
+	ThreadPool &pool;
+	SocketAddress clientAddress;
+	SocketAddress serverAddress;
+	const size_t maxStreams;
+
+	HpackDecoder decoder;
+	string headerBlock;
+	UInt32 headerStreamId;
+	bool headerNewStream;
+	UInt32 lastStreamId;
+	bool goingAway;
+
+	// the fields below are shared with the streams
+	FastMutex mutex;
+	Condition changed;
+	map<UInt32, Http2Stream *> streams;
+	vector<Http2Stream *> finished;
+	Int64 sendWindow;
+	Int64 initialWindow;
+	size_t maxFrameSize;
+	bool closed;
+
+	FastMutex writeMutex;
+	string frameBuffer;
+
+	static const string preface;
+
+	static AtomicCounter connectionCount;
+	static AtomicCounter streamCount;
+	static AtomicCounter refusedStreams;
+};
+
+#endif //HTTP2CONNECTION_H
@@ -0,0 +1,393 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <cstring>
+
+#include "Poco/File.h"
+#include "Poco/FileStream.h"
+#include "Poco/StreamCopier.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/String.h"
+#include "Poco/Timestamp.h"
+#include "Poco/DateTimeFormatter.h"
+#include "Poco/DateTimeFormat.h"
+#include "Poco/Exception.h"
+#include "Poco/Net/HTTPRequestHandler.h"
+#include "Poco/Net/HTTPRequestHandlerFactory.h"
+
+#include "Http2Stream.h"
+#include "Http2Connection.h"
+#include "HTTPDateCache.h"
+
+// the response body is sent in frames of at most this size, unless it is written in larger pieces
+#define STREAM_BUFFER_SIZE 16384
+
+static const string http2Version = "HTTP/2.0";
+
+Http2StreamBuf::Http2StreamBuf(Http2Connection &connection, Http2Stream &stream):
+	connection(connection),
+	stream(stream),
+	buffer(STREAM_BUFFER_SIZE),
+	failed(false)
+{
+	setp(buffer.begin(), buffer.end());
+}
+
+void Http2StreamBuf::setHeaders(const string &block)
+{
+	headers = block;
+}
+
+// Sends what is left of the body, and ends the stream.
+bool Http2StreamBuf::finish()
+{
+	return flush(true);
+}
+
+int Http2StreamBuf::overflow(int c)
+{
+	if (!flush(false))
+		return traits_type::eof();
+
+	if (c != traits_type::eof())
+	{
+		*pptr() = (char) c;
+		pbump(1);
+	}
+
+	return traits_type::not_eof(c);
+}
+
+int Http2StreamBuf::sync()
+{
+	return (flush(false) ? 0 : -1);
+}
+
+streamsize Http2StreamBuf::xsputn(const char *s, streamsize n)
+{
+	// large writes, e.g. of mapped files, go out without being copied into the buffer
+	if (n < (streamsize) buffer.size())
+		return streambuf::xsputn(s, n);
+
+	if (pptr() != pbase() && !flush(false))
+		return 0;
+
+	if (!send(s, (size_t) n, false))
+		return 0;
+
+	return n;
+}
+
+bool Http2StreamBuf::flush(bool endStream)
+{
+	size_t length = pptr() - pbase();
+	setp(buffer.begin(), buffer.end());
+
+	return send(buffer.begin(), length, endStream);
+}
+
+bool Http2StreamBuf::send(const char *data, size_t length, bool endStream)
+{
+	if (failed)
+		return false;
+
+	// the header block is sent along with the first part of the body
+	string block;
+	block.swap(headers);
+
+	if (!connection.sendData(stream, (block.empty() ? NULL : &block), data, length, endStream))
+	{
+		failed = true;
+		return false;
+	}
+
+	return true;
+}
+
+Http2Response::Http2Response(Http2Connection &connection, Http2Stream &stream):
+	connection(connection),
+	stream(stream),
+	buf(connection, stream),
+	ostr(&buf),
+	headersSent(false)
+{
+}
+
+void Http2Response::sendContinue()
+{
+	// request bodies are not read, so there is nothing to continue with
+}
+
+ostream &Http2Response::send()
+{
+	string block;
+	HpackEncoder::encodeStatus(getStatus(), block);
+
+	// field names are lowercase in HTTP/2, and the fields of HTTP/1.x connections are not allowed
+	ConstIterator it;
+	ConstIterator end = this->end();
+	for (it = begin(); it != end; ++it)
+	{
+		string name = toLower(it->first);
+		if (isConnectionField(name))
+			continue;
+
+		HpackEncoder::encodeField(name, it->second, block);
+	}
+
+	buf.setHeaders(block);
+	headersSent = true;
+
+	// the handler turns keep-alive off to cut a response short; for a stream, this means that it is reset
+	setKeepAlive(true);
+
+	return ostr;
+}
+
+void Http2Response::sendFile(const string &path, const string &mediaType)
+{
+	File file(path);
+	Timestamp lastModified = file.getLastModified();
+	File::FileSize length = file.getSize();
+
+	FileInputStream istr(path);
+
+	set("Last-Modified", DateTimeFormatter::format(lastModified, DateTimeFormat::HTTP_FORMAT));
+	setContentLength64(length);
+	setContentType(mediaType);
+	setChunkedTransferEncoding(false);
+
+	StreamCopier::copyStream(istr, send());
+}
+
+void Http2Response::sendBuffer(const void *buffer, size_t length)
+{
+	setContentLength((int) length);
+	setChunkedTransferEncoding(false);
+
+	send().write((const char *) buffer, (streamsize) length);
+}
+
+void Http2Response::redirect(const string &uri, HTTPStatus status)
+{
+	setContentLength(0);
+	setChunkedTransferEncoding(false);
+	setStatusAndReason(status);
+	set("Location", uri);
+
+	send();
+}
+
+void Http2Response::requireAuthentication(const string &realm)
+{
+	setContentLength(0);
+	setChunkedTransferEncoding(false);
+	setStatusAndReason(HTTP_UNAUTHORIZED);
+	set("WWW-Authenticate", "Basic realm=\"" + realm + "\"");
+
+	send();
+}
+
+bool Http2Response::sent() const
+{
+	return headersSent;
+}
+
+// Ends the stream after the handler has returned.
+void Http2Response::finish()
+{
+	if (!headersSent)
+	{
+		setStatusAndReason(HTTP_INTERNAL_SERVER_ERROR);
+		setContentLength(0);
+		send();
+	}
+
+	if (!getKeepAlive())
+	{
+		connection.resetStream(stream, Http2Connection::H2_INTERNAL_ERROR);
+		return;
+	}
+
+	if (!buf.finish())
+		connection.resetStream(stream, Http2Connection::H2_CANCEL);
+}
+
+bool Http2Response::isConnectionField(const string &name)
+{
+	return
+		name == "connection" ||
+		name == "keep-alive" ||
+		name == "proxy-connection" ||
+		name == "transfer-encoding" ||
+		name == "upgrade";
+}
+
+Http2Request::Http2Request(Http2Connection &connection, Http2Response &response):
+	connection(connection),
+	pResponse(&response)
+{
+}
+
+// Takes the request line and fields from the decoded header block. Returns false if the request is malformed.
+bool Http2Request::readHeaders(const HeaderList &headers)
+{
+	string method;
+	string path;
+	string scheme;
+	string authority;
+	bool regular = false;
+
+	HeaderList::const_iterator it;
+	for (it = headers.begin(); it != headers.end(); ++it)
+	{
+		const string &name = it->first;
+		const string &value = it->second;
+
+		if (name.empty())
+			return false;
+
+		string::const_iterator c;
+		for (c = name.begin(); c != name.end(); ++c)
+		{
+			if (*c >= 'A' && *c <= 'Z')
+				return false;
+		}
+
+		if (name[0] != ':')
+		{
+			if (Http2Response::isConnectionField(name))
+				return false;
+
+			add(name, value);
+			regular = true;
+			continue;
+		}
+
+		// pseudo-header fields come before all others, and only once each
+		string *field;
+		if (name == ":method")
+			field = &method;
+		else if (name == ":path")
+			field = &path;
+		else if (name == ":scheme")
+			field = &scheme;
+		else if (name == ":authority")
+			field = &authority;
+		else
+			return false;
+
+		if (regular || !field->empty())
+			return false;
+
+		*field = value;
+	}
+
+	// CONNECT requests, which have no path, are not supported
+	if (method.empty() || path.empty() || scheme.empty())
+		return false;
+
+	setMethod(method);
+	setURI(path);
+	setVersion(http2Version);
+
+	if (!authority.empty() && !has(HTTPRequest::HOST))
+		set(HTTPRequest::HOST, authority);
+
+	return true;
+}
+
+istream &Http2Request::stream()
+{
+	return body;
+}
+
+bool Http2Request::expectContinue() const
+{
+	return false;
+}
+
+const SocketAddress &Http2Request::clientAddress() const
+{
+	return connection.getClientAddress();
+}
+
+const SocketAddress &Http2Request::serverAddress() const
+{
+	return connection.getServerAddress();
+}
+
+const HTTPServerParams &Http2Request::serverParams() const
+{
+	return connection.getParams();
+}
+
+HTTPServerResponse &Http2Request::response() const
+{
+	return *pResponse;
+}
+
+Http2Stream::Http2Stream(Http2Connection &connection, UInt32 id, Int64 window):
+	connection(connection),
+	id(id),
+	window(window),
+	reset(false),
+	response(connection, *this),
+	request(connection, response)
+{
+}
+
+bool Http2Stream::readHeaders(const HeaderList &headers)
+{
+	return request.readHeaders(headers);
+}
+
+void Http2Stream::run()
+{
+	try
+	{
+		const string &software = connection.getParams().getSoftwareVersion();
+
+		response.setVersion(http2Version);
+		response.set("Date", HTTPDateCache::get());
+		if (!software.empty())
+			response.set("Server", software);
+
+		SharedPtr<HTTPRequestHandler> handler(connection.getFactory().createRequestHandler(request));
+		if (!handler.isNull())
+			handler->handleRequest(request, response);
+
+		response.finish();
+	}
+	catch (...)
+	{
+		connection.resetStream(*this, Http2Connection::H2_INTERNAL_ERROR);
+	}
+
+	connection.streamFinished(*this);
+}
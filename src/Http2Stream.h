@@ -0,0 +1,156 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef HTTP2STREAM_H
+#define HTTP2STREAM_H
+
+#include <cstddef>
+
+#include <string>
+#include <istream>
+#include <ostream>
+#include <sstream>
+#include <streambuf>
+
+#include "Poco/Types.h"
+#include "Poco/Buffer.h"
+#include "Poco/Runnable.h"
+#include "Poco/Net/HTTPServerRequest.h"
+#include "Poco/Net/HTTPServerResponse.h"
+#include "Poco/Net/HTTPServerParams.h"
+#include "Poco/Net/SocketAddress.h"
+
+#include "Hpack.h"
+
+using namespace std;
+
+using namespace Poco;
+using namespace Poco::Net;
+
+class Http2Connection;
+class Http2Stream;
+
+// Buffers a response body, and sends it as DATA frames. The header block
+// goes out with the first frame, so that a response without a body ends its
+// stream with the HEADERS frame.
+class Http2StreamBuf: public streambuf
+{
+public:
+	Http2StreamBuf(Http2Connection &connection, Http2Stream &stream);
+
+	void setHeaders(const string &block);
+	bool finish();
+
+protected:
+	int overflow(int c);
+	int sync();
+	streamsize xsputn(const char *s, streamsize n);
+
+private:
+	bool flush(bool endStream);
+	bool send(const char *data, size_t length, bool endStream);
+
+	Http2Connection &connection;
+	Http2Stream &stream;
+	Buffer<char> buffer;
+	string headers;
+	bool failed;
+};
+
+class Http2Response: public HTTPServerResponse
+{
+public:
+	Http2Response(Http2Connection &connection, Http2Stream &stream);
+
+	void sendContinue();
+	ostream &send();
+	void sendFile(const string &path, const string &mediaType);
+	void sendBuffer(const void *buffer, size_t length);
+	void redirect(const string &uri, HTTPStatus status = HTTP_FOUND);
+	void requireAuthentication(const string &realm);
+	bool sent() const;
+
+	void finish();
+
+	static bool isConnectionField(const string &name);
+
+private:
+	Http2Connection &connection;
+	Http2Stream &stream;
+	Http2StreamBuf buf;
+	ostream ostr;
+	bool headersSent;
+};
+
+// Request bodies are not read by the handler, so their DATA frames are
+// discarded by the connection, and the request stream is always empty.
+class Http2Request: public HTTPServerRequest
+{
+public:
+	Http2Request(Http2Connection &connection, Http2Response &response);
+
+	bool readHeaders(const HeaderList &headers);
+
+	istream &stream();
+	bool expectContinue() const;
+	const SocketAddress &clientAddress() const;
+	const SocketAddress &serverAddress() const;
+	const HTTPServerParams &serverParams() const;
+	HTTPServerResponse &response() const;
+
+private:
+	Http2Connection &connection;
+	Http2Response *pResponse;
+	istringstream body;
+};
+
+// A request and its response, handled in a thread of the server's pool.
+// The window and reset fields belong to the connection, and are guarded by
+// its mutex.
+class Http2Stream: public Runnable
+{
+public:
+	Http2Stream(Http2Connection &connection, UInt32 id, Int64 window);
+
+	bool readHeaders(const HeaderList &headers);
+
+	void run();
+
+private:
+	friend class Http2Connection;
+
+	Http2Connection &connection;
+	const UInt32 id;
+	Int64 window;
+	bool reset;
+
+	Http2Response response;
+	Http2Request request;
+};
+
+#endif //HTTP2STREAM_H
@@ -26,25 +26,37 @@
  * DAMAGE.
  */
 
+#include <cstring>
+
 #include <string>
 #include <algorithm>
 
 #include <Poco/Path.h>
 #include <Poco/Exception.h>
 #include <Poco/String.h>
+#include <Poco/ScopedLock.h>
+#include <Poco/StringTokenizer.h>
+#include <Poco/NumberParser.h>
+#include <Poco/URI.h>
 
 #include "IndigoConfiguration.h"
+#include "CpuAffinity.h"
 
 using namespace std;
 
 using namespace Poco;
 
-IndigoConfiguration *IndigoConfiguration::singleton = NULL;
+IndigoConfiguration::Ptr IndigoConfiguration::published;
+FastMutex IndigoConfiguration::mutex;
+ThreadLocal<IndigoConfiguration::Pin> IndigoConfiguration::pins;
 
 const string IndigoConfiguration::defaultPath = "";
 const string IndigoConfiguration::defaultMimeType = "application/octet-stream";
 
-const IndigoConfiguration &IndigoConfiguration::init(
+const string IndigoConfiguration::bundlePrefix = "bundle:";
+const string IndigoConfiguration::indexPrefix = "indexed:";
+
+IndigoConfiguration::Ptr IndigoConfiguration::create(
 		const string &serverName,
 		const string &address,
 		int port,
@@ -59,16 +71,53 @@ const IndigoConfiguration &IndigoConfiguration::init(
 		int idleTime,
 		int threadIdleTime,
 		bool collectIdleThreads,
+		int smallFileSize,
+		const string &handoffSocket,
+		int drainTimeout,
+		const string &statusPath,
+		int clientRequestRate,
+		int clientRequestBurst,
+		int clientByteRate,
+		int shareRequestRate,
+		int shareRequestBurst,
+		int shareByteRate,
+		int maxQueueWait,
+		int queueDeadline,
+		int bulkFileSize,
+		int bulkLaneLimit,
+		int bulkLaneWait,
+		int streamFileSize,
+		int streamReadahead,
+		bool archives,
+		bool digests,
+		const string &digestStore,
+		bool http2,
+		int http2MaxStreams,
+		const string &tlsCertificate,
+		const string &tlsKey,
+		bool tlsOffload,
+		int slowRequestTime,
+		const string &cpuSets,
+		int senderThreads,
+		const vector<string> &writableShares,
+		const string &writeUser,
+		const string &writePassword,
+		bool manifests,
+		int deltaBlockSize,
+		const string &hotFileStore,
+		int hotFileCount,
+		int prewarmByteRate,
+		int prewarmLockSize,
+		int coalesceWait,
 		const string &root,
 		const vector<string> &indexes,
 		bool autoIndex,
 		const unordered_map<string, string> &shares,
+		const unordered_map<string, string> &shareCaches,
 		const unordered_map<string, string> &mimeTypes
 		)
 {
-	poco_assert(singleton == NULL);
-
-	singleton = new IndigoConfiguration(
+	return new IndigoConfiguration(
 		serverName,
 		address,
 		port,
@@ -83,21 +132,98 @@ const IndigoConfiguration &IndigoConfiguration::init(
 		idleTime,
 		threadIdleTime,
 		collectIdleThreads,
+		smallFileSize,
+		handoffSocket,
+		drainTimeout,
+		statusPath,
+		clientRequestRate,
+		clientRequestBurst,
+		clientByteRate,
+		shareRequestRate,
+		shareRequestBurst,
+		shareByteRate,
+		maxQueueWait,
+		queueDeadline,
+		bulkFileSize,
+		bulkLaneLimit,
+		bulkLaneWait,
+		streamFileSize,
+		streamReadahead,
+		archives,
+		digests,
+		digestStore,
+		http2,
+		http2MaxStreams,
+		tlsCertificate,
+		tlsKey,
+		tlsOffload,
+		slowRequestTime,
+		cpuSets,
+		senderThreads,
+		writableShares,
+		writeUser,
+		writePassword,
+		manifests,
+		deltaBlockSize,
+		hotFileStore,
+		hotFileCount,
+		prewarmByteRate,
+		prewarmLockSize,
+		coalesceWait,
 		root,
 		indexes,
 		autoIndex,
 		shares,
+		shareCaches,
 		mimeTypes
 		);
+}
 
-	return get();
+void IndigoConfiguration::publish(Ptr configuration)
+{
+	poco_assert(!configuration.isNull());
+
+	FastMutex::ScopedLock lock(mutex);
+	published = configuration;
 }
 
 const IndigoConfiguration &IndigoConfiguration::get()
 {
-	poco_assert(singleton != NULL);
+	const Pin &pin = *pins;
+	if (pin.depth > 0)
+		return *pin.configuration;
+
+	// not pinned; the reference is only guaranteed to be valid until the next publish()
+	FastMutex::ScopedLock lock(mutex);
+	poco_assert(!published.isNull());
+	return *published;
+}
+
+IndigoConfiguration::Snapshot::Snapshot()
+{
+	Pin &pin = *pins;
+	if (pin.depth++ > 0)
+		return;
+
+	// only the outermost snapshot takes the lock, and only long enough to take a reference
+	FastMutex::ScopedLock lock(mutex);
+	pin.configuration = published;
+}
+
+IndigoConfiguration::Snapshot::~Snapshot()
+{
+	Pin &pin = *pins;
+	poco_assert(pin.depth > 0);
+
+	// an idle thread must not keep a replaced configuration, and the shares it owns, alive
+	if (--pin.depth == 0)
+		pin.configuration = Ptr();
+}
 
-	return *singleton;
+IndigoConfiguration::Pin::Pin():
+	configuration(),
+	depth(0)
+{
 }
 
 IndigoConfiguration::IndigoConfiguration(
@@ -115,10 +241,49 @@ IndigoConfiguration::IndigoConfiguration(
 	int idleTime,
 	int threadIdleTime,
 	bool collectIdleThreads,
+	int smallFileSize,
+	const string &handoffSocket,
+	int drainTimeout,
+	const string &statusPath,
+	int clientRequestRate,
+	int clientRequestBurst,
+	int clientByteRate,
+	int shareRequestRate,
+	int shareRequestBurst,
+	int shareByteRate,
+	int maxQueueWait,
+	int queueDeadline,
+	int bulkFileSize,
+	int bulkLaneLimit,
+	int bulkLaneWait,
+	int streamFileSize,
+	int streamReadahead,
+	bool archives,
+	bool digests,
+	const string &digestStore,
+	bool http2,
+	int http2MaxStreams,
+	const string &tlsCertificate,
+	const string &tlsKey,
+	bool tlsOffload,
+	int slowRequestTime,
+	const string &cpuSets,
+	int senderThreads,
+	const vector<string> &writableShares,
+	const string &writeUser,
+	const string &writePassword,
+	bool manifests,
+	int deltaBlockSize,
+	const string &hotFileStore,
+	int hotFileCount,
+	int prewarmByteRate,
+	int prewarmLockSize,
+	int coalesceWait,
 	const string &root,
 	const vector<string> &indexes,
 	bool autoIndex,
 	const unordered_map<string, string> &shares,
+	const unordered_map<string, string> &shareCaches,
 	const unordered_map<string, string> &mimeTypes
 	):
 		serverName(serverName),
@@ -135,19 +300,109 @@ IndigoConfiguration::IndigoConfiguration(
 		idleTime(idleTime),
 		threadIdleTime(threadIdleTime),
 		collectIdleThreads(collectIdleThreads),
+		smallFileSize(smallFileSize),
+		handoffSocket(handoffSocket),
+		drainTimeout(drainTimeout),
+		statusPath(statusPath),
+		clientRequestRate(clientRequestRate),
+		clientRequestBurst(clientRequestBurst),
+		clientByteRate(clientByteRate),
+		shareRequestRate(shareRequestRate),
+		shareRequestBurst(shareRequestBurst),
+		shareByteRate(shareByteRate),
+		maxQueueWait(maxQueueWait),
+		queueDeadline(queueDeadline),
+		bulkFileSize(bulkFileSize),
+		bulkLaneLimit(bulkLaneLimit),
+		bulkLaneWait(bulkLaneWait),
+		streamFileSize(streamFileSize),
+		streamReadahead(streamReadahead),
+		archives(archives),
+		digests(digests),
+		digestStore(digestStore),
+		http2(http2),
+		http2MaxStreams(http2MaxStreams),
+		tlsCertificate(tlsCertificate),
+		tlsKey(tlsKey),
+		tlsOffload(tlsOffload),
+		slowRequestTime(slowRequestTime),
+		cpuSets(cpuSets),
+		senderThreads(senderThreads),
+		writableShares(writableShares),
+		writeUser(writeUser),
+		writePassword(writePassword),
+		manifests(manifests),
+		deltaBlockSize(deltaBlockSize),
+		hotFileStore(hotFileStore),
+		hotFileCount(hotFileCount),
+		prewarmByteRate(prewarmByteRate),
+		prewarmLockSize(prewarmLockSize),
+		coalesceWait(coalesceWait),
 		root(root),
 		indexes(indexes),
 		indexesNative(),
 		autoIndex(autoIndex),
 		shares(shares),
+		shareCaches(shareCaches),
 		mimeTypes(mimeTypes),
-		shareVec()
+		shareVec(),
+		shareEntries(),
+		bundleEntries(),
+		indexEntries(),
+		cacheEntries(),
+		proxyEntries()
 {
 	for (unordered_map<string, string>::const_iterator it = shares.begin(); it != shares.end(); ++it)
 	{
 		shareVec.push_back(it->first);
+
+		// bundles are opened here, so that a reload maps the bundle files anew
+		if (hasPrefix(it->second, bundlePrefix))
+		{
+			bundleEntries.push_back(make_pair(it->first, SharedPtr<Bundle>(new Bundle(it->second.substr(bundlePrefix.length())))));
+		}
+		else if (hasPrefix(it->second, indexPrefix))
+		{
+			string path = it->second.substr(indexPrefix.length());
+			shareEntries.push_back(make_pair(it->first, path));
+			indexEntries.push_back(make_pair(it->first, SharedPtr<ShareIndex>(new ShareIndex(path))));
+		}
+		else if (ProxyShare::isProxy(it->second))
+		{
+			// the cache of a proxy share is filled by the proxy, so it is not one of the caches of local shares
+			SharedPtr<ShareCache> cache;
+			unordered_map<string, string>::const_iterator shareCache = shareCaches.find(it->first);
+			string directory;
+			UInt64 capacity;
+			if (shareCache != shareCaches.end() && parseShareCache(shareCache->second, directory, capacity))
+				cache = ShareCache::open(directory, capacity);
+
+			proxyEntries.push_back(make_pair(it->first, SharedPtr<ProxyShare>(new ProxyShare(it->second, cache))));
+		}
+		else
+		{
+			shareEntries.push_back(*it);
+		}
 	}
 	sort(shareVec.begin(), shareVec.end());
+	sort(shareEntries.begin(), shareEntries.end());
+	sort(bundleEntries.begin(), bundleEntries.end(), compareEntries<SharedPtr<Bundle> >);
+	sort(indexEntries.begin(), indexEntries.end(), compareEntries<SharedPtr<ShareIndex> >);
+	sort(proxyEntries.begin(), proxyEntries.end(), compareEntries<SharedPtr<ProxyShare> >);
+
+	// invalid caches are rejected by validate()
+	for (unordered_map<string, string>::const_iterator it = shareCaches.begin(); it != shareCaches.end(); ++it)
+	{
+		unordered_map<string, string>::const_iterator share = shares.find(it->first);
+		if (share != shares.end() && ProxyShare::isProxy(share->second))
+			continue;
+
+		string directory;
+		UInt64 capacity;
+		if (parseShareCache(it->second, directory, capacity))
+			cacheEntries.push_back(make_pair(it->first, ShareCache::open(directory, capacity)));
+	}
+	sort(cacheEntries.begin(), cacheEntries.end(), compareEntries<SharedPtr<ShareCache> >);
 
 	for (vector<string>::const_iterator it = indexes.begin(); it != indexes.end(); ++it)
 	{
@@ -178,10 +433,159 @@ void IndigoConfiguration::validate() const
 		if (resolved != uri || p.depth() != 1)
 			throw ApplicationException("\"" + shareName + "\" is not a valid share name");
 
-		p.assign(sharePath);
+		if (ProxyShare::isProxy(sharePath))
+		{
+			string host, prefix;
+			UInt16 port;
+			if (!ProxyShare::parseURL(sharePath, host, port, prefix))
+				throw ApplicationException("\"" + sharePath + "\" is not a valid upstream URL");
+			continue;
+		}
+
+		if (hasPrefix(sharePath, bundlePrefix))
+			p.assign(sharePath.substr(bundlePrefix.length()));
+		else if (hasPrefix(sharePath, indexPrefix))
+			p.assign(sharePath.substr(indexPrefix.length()));
+		else
+			p.assign(sharePath);
 		if (!p.isAbsolute())
 			throw ApplicationException("\"" + sharePath + "\" is not an absolute path");
 	}
+
+	if (!handoffSocket.empty())
+	{
+		Path p(handoffSocket);
+		if (!p.isAbsolute())
+			throw ApplicationException("\"" + handoffSocket + "\" is not an absolute path");
+	}
+
+	if (!digestStore.empty())
+	{
+		Path p(digestStore);
+		if (!p.isAbsolute())
+			throw ApplicationException("\"" + digestStore + "\" is not an absolute path");
+	}
+
+	if (!hotFileStore.empty())
+	{
+		Path p(hotFileStore);
+		if (!p.isAbsolute())
+			throw ApplicationException("\"" + hotFileStore + "\" is not an absolute path");
+	}
+
+	if (hotFileCount <= 0)
+		throw ApplicationException("The hot file count must be positive");
+
+	if (prewarmByteRate < 0 || prewarmLockSize < 0)
+		throw ApplicationException("The prewarm byte rate and lock size must not be negative");
+
+	if (!tlsCertificate.empty() || !tlsKey.empty())
+	{
+#ifdef INDIGO_TLS
+		if (tlsCertificate.empty() || tlsKey.empty())
+			throw ApplicationException("TLS requires both a certificate and a private key");
+
+		Path c(tlsCertificate);
+		if (!c.isAbsolute())
+			throw ApplicationException("\"" + tlsCertificate + "\" is not an absolute path");
+
+		Path k(tlsKey);
+		if (!k.isAbsolute())
+			throw ApplicationException("\"" + tlsKey + "\" is not an absolute path");
+#else
+		throw ApplicationException("TLS is not supported by this build");
+#endif
+	}
+
+	if (!cpuSets.empty())
+	{
+		vector<CpuAffinity::CpuSet> sets;
+		CpuAffinity::parse(cpuSets, sets);
+	}
+
+	for (vector<string>::const_iterator it = writableShares.begin(); it != writableShares.end(); ++it)
+	{
+		unordered_map<string, string>::const_iterator share = shares.find(*it);
+		if (share == shares.end())
+			throw ApplicationException("\"" + *it + "\" is not a share");
+
+		if (hasPrefix(share->second, bundlePrefix))
+			throw ApplicationException("Bundle share \"" + *it + "\" cannot be writable");
+
+		if (ProxyShare::isProxy(share->second))
+			throw ApplicationException("Proxy share \"" + *it + "\" cannot be writable");
+	}
+
+	if (!writableShares.empty() && (writeUser.empty() || writePassword.empty()))
+		throw ApplicationException("Writable shares require a user name and a password");
+
+#if !defined(POCO_OS_FAMILY_UNIX)
+	if (!writableShares.empty())
+		throw ApplicationException("Writable shares are only supported on Unix");
+#endif
+
+	for (unordered_map<string, string>::const_iterator it = shareCaches.begin(); it != shareCaches.end(); ++it)
+	{
+		unordered_map<string, string>::const_iterator share = shares.find(it->first);
+		if (share == shares.end())
+			throw ApplicationException("\"" + it->first + "\" is not a share");
+
+		if (hasPrefix(share->second, bundlePrefix))
+			throw ApplicationException("Bundle share \"" + it->first + "\" cannot be cached");
+
+		string directory;
+		UInt64 capacity;
+		if (!parseShareCache(it->second, directory, capacity))
+			throw ApplicationException("\"" + it->second + "\" is not a cache size in megabytes and a directory");
+
+		Path p(directory);
+		if (!p.isAbsolute())
+			throw ApplicationException("\"" + directory + "\" is not an absolute path");
+	}
+
+#if !defined(POCO_OS_FAMILY_UNIX)
+	if (!shareCaches.empty())
+		throw ApplicationException("Share caches are only supported on Unix");
+#endif
+
+#if !defined(__linux__)
+	if (senderThreads > 0)
+		throw ApplicationException("Sender threads are only supported on Linux");
+#endif
+
+	// blocks are read into memory whole, and tables of tiny blocks are larger than the deltas they save
+	if (deltaBlockSize != 0 && (deltaBlockSize < 512 || deltaBlockSize > 1048576))
+		throw ApplicationException("The delta block size must be between 512 and 1048576 bytes");
+}
+
+bool IndigoConfiguration::requiresRestart(const IndigoConfiguration &other) const
+{
+	// these settings are only read when the server is started
+	return
+		address != other.address ||
+		port != other.port ||
+		backlog != other.backlog ||
+		minThreads != other.minThreads ||
+		maxThreads != other.maxThreads ||
+		maxQueued != other.maxQueued ||
+		timeout != other.timeout ||
+		keepalive != other.keepalive ||
+		keepaliveTimeout != other.keepaliveTimeout ||
+		maxKeepaliveRequests != other.maxKeepaliveRequests ||
+		idleTime != other.idleTime ||
+		threadIdleTime != other.threadIdleTime ||
+		collectIdleThreads != other.collectIdleThreads ||
+		handoffSocket != other.handoffSocket ||
+		drainTimeout != other.drainTimeout ||
+		digests != other.digests ||
+		digestStore != other.digestStore ||
+		tlsCertificate != other.tlsCertificate ||
+		tlsKey != other.tlsKey ||
+		tlsOffload != other.tlsOffload ||
+		cpuSets != other.cpuSets ||
+		senderThreads != other.senderThreads ||
+		hotFileStore != other.hotFileStore ||
+		prewarmLockSize != other.prewarmLockSize;
 }
 
 const string &IndigoConfiguration::getServerName() const
@@ -254,6 +658,207 @@ bool IndigoConfiguration::getCollectIdleThreads() const
 	return collectIdleThreads;
 }
 
+int IndigoConfiguration::getSmallFileSize() const
+{
+	return smallFileSize;
+}
+
+const string &IndigoConfiguration::getHandoffSocket() const
+{
+	return handoffSocket;
+}
+
+int IndigoConfiguration::getDrainTimeout() const
+{
+	return drainTimeout;
+}
+
+const string &IndigoConfiguration::getStatusPath() const
+{
+	return statusPath;
+}
+
+int IndigoConfiguration::getClientRequestRate() const
+{
+	return clientRequestRate;
+}
+
+int IndigoConfiguration::getClientRequestBurst() const
+{
+	return clientRequestBurst;
+}
+
+int IndigoConfiguration::getClientByteRate() const
+{
+	return clientByteRate;
+}
+
+int IndigoConfiguration::getShareRequestRate() const
+{
+	return shareRequestRate;
+}
+
+int IndigoConfiguration::getShareRequestBurst() const
+{
+	return shareRequestBurst;
+}
+
+int IndigoConfiguration::getShareByteRate() const
+{
+	return shareByteRate;
+}
+
+int IndigoConfiguration::getMaxQueueWait() const
+{
+	return maxQueueWait;
+}
+
+int IndigoConfiguration::getQueueDeadline() const
+{
+	return queueDeadline;
+}
+
+int IndigoConfiguration::getBulkFileSize() const
+{
+	return bulkFileSize;
+}
+
+int IndigoConfiguration::getBulkLaneLimit() const
+{
+	return bulkLaneLimit;
+}
+
+int IndigoConfiguration::getBulkLaneWait() const
+{
+	return bulkLaneWait;
+}
+
+int IndigoConfiguration::getStreamFileSize() const
+{
+	return streamFileSize;
+}
+
+int IndigoConfiguration::getStreamReadahead() const
+{
+	return streamReadahead;
+}
+
+bool IndigoConfiguration::getArchives() const
+{
+	return archives;
+}
+
+bool IndigoConfiguration::getDigests() const
+{
+	return digests;
+}
+
+const string &IndigoConfiguration::getDigestStore() const
+{
+	return digestStore;
+}
+
+bool IndigoConfiguration::getHttp2() const
+{
+	return http2;
+}
+
+int IndigoConfiguration::getHttp2MaxStreams() const
+{
+	return http2MaxStreams;
+}
+
+const string &IndigoConfiguration::getTlsCertificate() const
+{
+	return tlsCertificate;
+}
+
+const string &IndigoConfiguration::getTlsKey() const
+{
+	return tlsKey;
+}
+
+bool IndigoConfiguration::getTlsOffload() const
+{
+	return tlsOffload;
+}
+
+int IndigoConfiguration::getSlowRequestTime() const
+{
+	return slowRequestTime;
+}
+
+const string &IndigoConfiguration::getCpuSets() const
+{
+	return cpuSets;
+}
+
+int IndigoConfiguration::getSenderThreads() const
+{
+	return senderThreads;
+}
+
+const vector<string> &IndigoConfiguration::getWritableShares() const
+{
+	return writableShares;
+}
+
+bool IndigoConfiguration::isShareWritable(const char *share, size_t length) const
+{
+	for (vector<string>::const_iterator it = writableShares.begin(); it != writableShares.end(); ++it)
+	{
+		if (it->length() == length && it->compare(0, length, share, length) == 0)
+			return true;
+	}
+
+	return false;
+}
+
+const string &IndigoConfiguration::getWriteUser() const
+{
+	return writeUser;
+}
+
+const string &IndigoConfiguration::getWritePassword() const
+{
+	return writePassword;
+}
+
+bool IndigoConfiguration::getManifests() const
+{
+	return manifests;
+}
+
+int IndigoConfiguration::getDeltaBlockSize() const
+{
+	return deltaBlockSize;
+}
+
+const string &IndigoConfiguration::getHotFileStore() const
+{
+	return hotFileStore;
+}
+
+int IndigoConfiguration::getHotFileCount() const
+{
+	return hotFileCount;
+}
+
+int IndigoConfiguration::getPrewarmByteRate() const
+{
+	return prewarmByteRate;
+}
+
+int IndigoConfiguration::getPrewarmLockSize() const
+{
+	return prewarmLockSize;
+}
+
+int IndigoConfiguration::getCoalesceWait() const
+{
+	return coalesceWait;
+}
+
 const string &IndigoConfiguration::getRoot() const
 {
 	return root;
@@ -279,13 +884,142 @@ const vector<string> &IndigoConfiguration::getShares() const
 
 const string &IndigoConfiguration::getSharePath(const string &share) const
 {
-	unordered_map<string, string>::const_iterator it = shares.find(share);
-	if (it != shares.end())
-		return it->second;
+	const string *path = findSharePath(share.data(), share.length());
+	if (path != NULL)
+		return *path;
 	else
 		return defaultPath;
 }
 
+const string *IndigoConfiguration::findSharePath(const char *share, size_t length) const
+{
+	return findEntry(shareEntries, share, length);
+}
+
+const Bundle *IndigoConfiguration::findShareBundle(const char *share, size_t length) const
+{
+	const SharedPtr<Bundle> *bundle = findEntry(bundleEntries, share, length);
+	return (bundle != NULL ? bundle->get() : NULL);
+}
+
+const ShareIndex *IndigoConfiguration::findShareIndex(const char *share, size_t length) const
+{
+	const SharedPtr<ShareIndex> *index = findEntry(indexEntries, share, length);
+	return (index != NULL ? index->get() : NULL);
+}
+
+ShareCache *IndigoConfiguration::findShareCache(const char *share, size_t length) const
+{
+	// caches outlive configurations, so filling one does not change this configuration
+	const SharedPtr<ShareCache> *cache = findEntry(cacheEntries, share, length);
+	return (cache != NULL ? const_cast<ShareCache *>(cache->get()) : NULL);
+}
+
+const ProxyShare *IndigoConfiguration::findShareProxy(const char *share, size_t length) const
+{
+	const SharedPtr<ProxyShare> *proxy = findEntry(proxyEntries, share, length);
+	return (proxy != NULL ? proxy->get() : NULL);
+}
+
+void IndigoConfiguration::startIndexing()
+{
+	// every share is crawled by a thread of its own, so large shares do not hold up the others
+	for (vector<pair<string, SharedPtr<ShareIndex> > >::iterator it = indexEntries.begin(); it != indexEntries.end(); ++it)
+		it->second->startCrawling();
+}
+
+void IndigoConfiguration::appendIndexStatus(ostream &out) const
+{
+	for (vector<pair<string, SharedPtr<ShareIndex> > >::const_iterator it = indexEntries.begin(); it != indexEntries.end(); ++it)
+	{
+		const ShareIndex &index = *it->second;
+		out << "Index of " << it->first << ": ";
+		if (index.ready())
+			out << index.count() << " entries" << endl;
+		else
+			out << "crawling" << endl;
+	}
+}
+
+void IndigoConfiguration::appendCacheStatus(ostream &out) const
+{
+	for (vector<pair<string, SharedPtr<ShareCache> > >::const_iterator it = cacheEntries.begin(); it != cacheEntries.end(); ++it)
+	{
+		out << "Cache of " << it->first << ": ";
+		it->second->appendStatus(out);
+	}
+}
+
+void IndigoConfiguration::appendProxyStatus(ostream &out) const
+{
+	for (vector<pair<string, SharedPtr<ProxyShare> > >::const_iterator it = proxyEntries.begin(); it != proxyEntries.end(); ++it)
+	{
+		const ProxyShare &proxy = *it->second;
+		out << "Proxy " << it->first << ": ";
+		proxy.appendStatus(out);
+
+		const ShareCache *cache = proxy.getCache();
+		if (cache != NULL)
+		{
+			out << "Cache of " << it->first << ": ";
+			cache->appendStatus(out);
+		}
+	}
+}
+
+// Parses the size, in megabytes, and the directory of a share cache, separated by whitespace.
+bool IndigoConfiguration::parseShareCache(const string &value, string &directory, UInt64 &capacity)
+{
+	StringTokenizer tok(value, " \t", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
+	if (tok.count() != 2)
+		return false;
+
+	unsigned megabytes;
+	if (!NumberParser::tryParseUnsigned(tok[0], megabytes) || megabytes == 0)
+		return false;
+
+	URI::decode(tok[1], directory);
+	capacity = (UInt64) megabytes * 1048576;
+	return true;
+}
+
+bool IndigoConfiguration::hasPrefix(const string &path, const string &prefix)
+{
+	return path.compare(0, prefix.length(), prefix) == 0;
+}
+
+template <typename T>
+bool IndigoConfiguration::compareEntries(const pair<string, T> &a, const pair<string, T> &b)
+{
+	return a.first < b.first;
+}
+
+template <typename T>
+const T *IndigoConfiguration::findEntry(const vector<pair<string, T> > &entries, const char *share, size_t length)
+{
+	// binary search over the sorted share entries, which does not require the name to be copied into a string
+	size_t low = 0;
+	size_t high = entries.size();
+	while (low < high)
+	{
+		size_t mid = low + (high - low) / 2;
+		const string &name = entries[mid].first;
+
+		int cmp = memcmp(name.data(), share, min(name.length(), length));
+		if (cmp == 0)
+			cmp = (name.length() < length ? -1 : (name.length() > length ? 1 : 0));
+
+		if (cmp == 0)
+			return &entries[mid].second;
+		else if (cmp < 0)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+
+	return NULL;
+}
+
 const string &IndigoConfiguration::getMimeType(const string &extension) const
 {
 	unordered_map<string, string>::const_iterator it = mimeTypes.find(extension);
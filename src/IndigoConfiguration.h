@@ -29,17 +29,43 @@
 #ifndef INDIGOCONFIGURATION_H
 #define INDIGOCONFIGURATION_H
 
+#include <cstddef>
+
 #include <string>
 #include <vector>
+#include <utility>
+#include <ostream>
 #include <tr1/unordered_map> // change to <unordered_map> on c++0x compilers
 
+#include <Poco/SharedPtr.h>
+#include <Poco/Mutex.h>
+#include <Poco/ThreadLocal.h>
+
+#include "Bundle.h"
+#include "ShareIndex.h"
+#include "ShareCache.h"
+#include "ProxyShare.h"
+
 using namespace std;
 using namespace std::tr1; // remove this on c++0x compilers
 
+using namespace Poco;
+
 class IndigoConfiguration
 {
 public:
-	static const IndigoConfiguration &init(
+	typedef SharedPtr<IndigoConfiguration> Ptr;
+
+	// Pins the published configuration to the calling thread for the lifetime of the object.
+	// get() keeps returning the pinned configuration, even if a new one is published meanwhile.
+	class Snapshot
+	{
+	public:
+		Snapshot();
+		~Snapshot();
+	};
+
+	static Ptr create(
 		const string &serverName,
 		const string &address,
 		int port,
@@ -54,15 +80,60 @@ public:
 		int idleTime,
 		int threadIdleTime,
 		bool collectIdleThreads,
+		int smallFileSize,
+		const string &handoffSocket,
+		int drainTimeout,
+		const string &statusPath,
+		int clientRequestRate,
+		int clientRequestBurst,
+		int clientByteRate,
+		int shareRequestRate,
+		int shareRequestBurst,
+		int shareByteRate,
+		int maxQueueWait,
+		int queueDeadline,
+		int bulkFileSize,
+		int bulkLaneLimit,
+		int bulkLaneWait,
+		int streamFileSize,
+		int streamReadahead,
+		bool archives,
+		bool digests,
+		const string &digestStore,
+		bool http2,
+		int http2MaxStreams,
+		const string &tlsCertificate,
+		const string &tlsKey,
+		bool tlsOffload,
+		int slowRequestTime,
+		const string &cpuSets,
+		int senderThreads,
+		const vector<string> &writableShares,
+		const string &writeUser,
+		const string &writePassword,
+		bool manifests,
+		int deltaBlockSize,
+		const string &hotFileStore,
+		int hotFileCount,
+		int prewarmByteRate,
+		int prewarmLockSize,
+		int coalesceWait,
 		const string &root,
 		const vector<string> &indexes,
 		bool autoIndex,
 		const unordered_map<string, string> &shares,
+		const unordered_map<string, string> &shareCaches,
 		const unordered_map<string, string> &mimeTypes
 		);
+	static void publish(Ptr configuration);
 	static const IndigoConfiguration &get();
 
 	void validate() const;
+	bool requiresRestart(const IndigoConfiguration &other) const;
+	void startIndexing();
+	void appendCacheStatus(ostream &out) const;
+	void appendProxyStatus(ostream &out) const;
+	void appendIndexStatus(ostream &out) const;
 
 	const string &getServerName() const;
 	const string &getAddress() const;
@@ -78,11 +149,55 @@ public:
 	int getIdleTime() const;
 	int getThreadIdleTime() const;
 	bool getCollectIdleThreads() const;
+	int getSmallFileSize() const;
+	const string &getHandoffSocket() const;
+	int getDrainTimeout() const;
+	const string &getStatusPath() const;
+	int getClientRequestRate() const;
+	int getClientRequestBurst() const;
+	int getClientByteRate() const;
+	int getShareRequestRate() const;
+	int getShareRequestBurst() const;
+	int getShareByteRate() const;
+	int getMaxQueueWait() const;
+	int getQueueDeadline() const;
+	int getBulkFileSize() const;
+	int getBulkLaneLimit() const;
+	int getBulkLaneWait() const;
+	int getStreamFileSize() const;
+	int getStreamReadahead() const;
+	bool getArchives() const;
+	bool getDigests() const;
+	const string &getDigestStore() const;
+	bool getHttp2() const;
+	int getHttp2MaxStreams() const;
+	const string &getTlsCertificate() const;
+	const string &getTlsKey() const;
+	bool getTlsOffload() const;
+	int getSlowRequestTime() const;
+	const string &getCpuSets() const;
+	int getSenderThreads() const;
+	const vector<string> &getWritableShares() const;
+	bool isShareWritable(const char *share, size_t length) const;
+	const string &getWriteUser() const;
+	const string &getWritePassword() const;
+	bool getManifests() const;
+	int getDeltaBlockSize() const;
+	const string &getHotFileStore() const;
+	int getHotFileCount() const;
+	int getPrewarmByteRate() const;
+	int getPrewarmLockSize() const;
+	int getCoalesceWait() const;
 	const string &getRoot() const;
 	const vector<string> &getIndexes(bool native = false) const;
 	bool getAutoIndex() const;
 	const vector<string> &getShares() const;
 	const string &getSharePath(const string &share) const;
+	const string *findSharePath(const char *share, size_t length) const;
+	const Bundle *findShareBundle(const char *share, size_t length) const;
+	const ShareIndex *findShareIndex(const char *share, size_t length) const;
+	ShareCache *findShareCache(const char *share, size_t length) const;
+	const ProxyShare *findShareProxy(const char *share, size_t length) const;
 	const string &getMimeType(const string &extension) const;
 	bool virtualRoot() const;
 
@@ -102,14 +217,72 @@ private:
 		int idleTime,
 		int threadIdleTime,
 		bool collectIdleThreads,
+		int smallFileSize,
+		const string &handoffSocket,
+		int drainTimeout,
+		const string &statusPath,
+		int clientRequestRate,
+		int clientRequestBurst,
+		int clientByteRate,
+		int shareRequestRate,
+		int shareRequestBurst,
+		int shareByteRate,
+		int maxQueueWait,
+		int queueDeadline,
+		int bulkFileSize,
+		int bulkLaneLimit,
+		int bulkLaneWait,
+		int streamFileSize,
+		int streamReadahead,
+		bool archives,
+		bool digests,
+		const string &digestStore,
+		bool http2,
+		int http2MaxStreams,
+		const string &tlsCertificate,
+		const string &tlsKey,
+		bool tlsOffload,
+		int slowRequestTime,
+		const string &cpuSets,
+		int senderThreads,
+		const vector<string> &writableShares,
+		const string &writeUser,
+		const string &writePassword,
+		bool manifests,
+		int deltaBlockSize,
+		const string &hotFileStore,
+		int hotFileCount,
+		int prewarmByteRate,
+		int prewarmLockSize,
+		int coalesceWait,
 		const string &root,
 		const vector<string> &indexes,
 		bool autoIndex,
 		const unordered_map<string, string> &shares,
+		const unordered_map<string, string> &shareCaches,
 		const unordered_map<string, string> &mimeTypes
 		);
 
-	static IndigoConfiguration *singleton;
+	struct Pin
+	{
+		Pin();
+
+		Ptr configuration;
+		int depth;
+	};
+
+	static bool hasPrefix(const string &path, const string &prefix);
+	static bool parseShareCache(const string &value, string &directory, UInt64 &capacity);
+
+	template <typename T>
+	static bool compareEntries(const pair<string, T> &a, const pair<string, T> &b);
+
+	template <typename T>
+	static const T *findEntry(const vector<pair<string, T> > &entries, const char *share, size_t length);
+
+	static Ptr published;
+	static FastMutex mutex;
+	static ThreadLocal<Pin> pins;
 
 	const string serverName;
 	const string address;
@@ -125,17 +298,65 @@ private:
 	const int idleTime;
 	const int threadIdleTime;
 	const bool collectIdleThreads;
+	const int smallFileSize;
+	const string handoffSocket;
+	const int drainTimeout;
+	const string statusPath;
+	const int clientRequestRate;
+	const int clientRequestBurst;
+	const int clientByteRate;
+	const int shareRequestRate;
+	const int shareRequestBurst;
+	const int shareByteRate;
+	const int maxQueueWait;
+	const int queueDeadline;
+	const int bulkFileSize;
+	const int bulkLaneLimit;
+	const int bulkLaneWait;
+	const int streamFileSize;
+	const int streamReadahead;
+	const bool archives;
+	const bool digests;
+	const string digestStore;
+	const bool http2;
+	const int http2MaxStreams;
+	const string tlsCertificate;
+	const string tlsKey;
+	const bool tlsOffload;
+	const int slowRequestTime;
+	const string cpuSets;
+	const int senderThreads;
+	const vector<string> writableShares;
+	const string writeUser;
+	const string writePassword;
+	const bool manifests;
+	const int deltaBlockSize;
+	const string hotFileStore;
+	const int hotFileCount;
+	const int prewarmByteRate;
+	const int prewarmLockSize;
+	const int coalesceWait;
 	const string root;
 	const vector<string> indexes;
 	vector<string> indexesNative;
 	const bool autoIndex;
 	const unordered_map<string, string> shares;
+	const unordered_map<string, string> shareCaches;
 	const unordered_map<string, string> mimeTypes;
 
 	vector<string> shareVec;
+	vector<pair<string, string> > shareEntries;
+	vector<pair<string, SharedPtr<Bundle> > > bundleEntries;
+	vector<pair<string, SharedPtr<ShareIndex> > > indexEntries;
+	vector<pair<string, SharedPtr<ShareCache> > > cacheEntries;
+	vector<pair<string, SharedPtr<ProxyShare> > > proxyEntries;
 
 	static const string defaultPath;
 	static const string defaultMimeType;
+
+	// share paths with these prefixes name bundle files and directories to be kept indexed in memory
+	static const string bundlePrefix;
+	static const string indexPrefix;
 };
 
 #endif //INDIGOCONFIGURATION_H
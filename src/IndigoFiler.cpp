@@ -30,9 +30,20 @@
 #include <vector>
 #include <iostream>
 
+#include "Poco/Platform.h"
+
+#if defined(POCO_OS_FAMILY_UNIX)
+#include <cstdlib>
+#include <signal.h>
+#endif
+
 #include "Poco/Util/ServerApplication.h"
 #include "Poco/Net/HTTPServer.h"
 #include "Poco/Util/HelpFormatter.h"
+#include "Poco/Util/IniFileConfiguration.h"
+#include "Poco/AutoPtr.h"
+#include "Poco/Timestamp.h"
+#include "Poco/Thread.h"
 #include "Poco/Net/DNS.h"
 #include "Poco/String.h"
 #include "Poco/FileStream.h"
@@ -40,11 +51,20 @@
 #include "Poco/StringTokenizer.h"
 #include "Poco/URI.h"
 #include "Poco/Path.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/SharedPtr.h"
 
 #include "IndigoFiler.h"
 #include "IndigoConfiguration.h"
 #include "IndigoRequestHandler.h"
-#include "ThreadPoolCollector.h"
+#include "SocketHandoff.h"
+#include "BundleWriter.h"
+#include "DigestCache.h"
+#include "PageCacheWarmer.h"
+#include "TlsConnection.h"
+#include "CpuAffinity.h"
+#include "WorkerGroup.h"
+#include "SenderReactor.h"
 
 using namespace std;
 
@@ -64,7 +84,7 @@ public:
 class IndigoFiler: public ServerApplication
 {
 public:
-	IndigoFiler(): helpRequested(false), versionRequested(false)
+	IndigoFiler(): helpRequested(false), versionRequested(false), bundlePath(), configPath()
 	{
 	}
 
@@ -73,7 +93,7 @@ protected:
 	{
 		ServerApplication::initialize(self);
 
-		string configPath = locateConfiguration(APP_NAME_UNIX "." "ini");
+		configPath = locateConfiguration(APP_NAME_UNIX "." "ini");
 		loadConfiguration(configPath);
 	}
 
@@ -95,6 +115,12 @@ protected:
 			Option("version", "v", "display version information")
 				.required(false)
 				.repeatable(false));
+
+		options.addOption(
+			Option("pack", "p", "pack the directory given as argument into a bundle file, then exit")
+				.required(false)
+				.repeatable(false)
+				.argument("bundle"));
 	}
 
 	void handleOption(const string &name, const string &value)
@@ -105,6 +131,8 @@ protected:
 			helpRequested = true;
 		else if (name == "version")
 			versionRequested = true;
+		else if (name == "pack")
+			bundlePath = value;
 	}
 
 	int main(const vector<string> &args)
@@ -117,78 +145,130 @@ protected:
 		{
 			displayVersion();
 		}
+		else if (!bundlePath.empty())
+		{
+			if (args.size() != 1)
+			{
+				displayHelp();
+				return EXIT_USAGE;
+			}
+
+			packBundle(args[0], bundlePath);
+		}
 		else
 		{
-			const string serverSection = "Server";
-
-			string serverName = config().getString(serverSection + "." + "name", "");
-			if (serverName.empty())
-				serverName = DNS::hostName();
-
-			string root = config().getString(serverSection + "." + "root", "virtual");
-			if (root == "virtual")
-				root = "";
-
-			string index = config().getString(serverSection + "." + "index", "index.html");
-
-			const IndigoConfiguration &configuration = IndigoConfiguration::init(
-				serverName,
-				config().getString(serverSection + "." + "address", "0.0.0.0"),
-				config().getInt(serverSection + "." + "port", 80),
-				config().getInt(serverSection + "." + "backlog", 64),
-				config().getInt(serverSection + "." + "minThreads", 2),
-				config().getInt(serverSection + "." + "maxThreads", 16),
-				config().getInt(serverSection + "." + "maxQueued", 64),
-				config().getInt(serverSection + "." + "timeout", 60),
-				config().getBool(serverSection + "." + "keepalive", true),
-				config().getInt(serverSection + "." + "keepaliveTimeout", 15),
-				config().getInt(serverSection + "." + "maxKeepaliveRequests", 0),
-				config().getInt(serverSection + "." + "idleTime", 60),
-				config().getInt(serverSection + "." + "threadIdleTime", 10),
-				config().getBool(serverSection + "." + "collectIdleThreads", false),
-				root,
-				readIndexes(index),
-				config().getBool(serverSection + "." + "autoIndex", true),
-				readShares(),
-				readMimeTypes()
-				);
-			configuration.validate();
-
-			HTTPServerParams::Ptr params = new HTTPServerParams;
-			params->setMaxThreads(configuration.getMaxThreads());
-			params->setMaxQueued(configuration.getMaxQueued());
-			params->setServerName(configuration.getServerName());
-			params->setSoftwareVersion(SERVER_FIELD_VALUE);
-			params->setTimeout(configuration.getTimeout() * 1000000);
-			params->setKeepAlive(configuration.getKeepalive());
-			params->setKeepAliveTimeout(configuration.getKeepaliveTimeout() * 1000000);
-			params->setMaxKeepAliveRequests(configuration.getMaxKeepaliveRequests());
-			params->setThreadIdleTime(configuration.getThreadIdleTime() * 1000000);
+#if defined(POCO_OS_FAMILY_UNIX)
+			// block the signals before any threads are started, so that only the main thread receives them
+			sigset_t signals;
+			blockSignals(signals);
+#endif
+
+			IndigoConfiguration::Ptr configuration = createConfiguration(config());
+			configuration->validate();
+			configuration->startIndexing();
+			IndigoConfiguration::publish(configuration);
+
+#ifdef INDIGO_TLS
+			if (!configuration->getTlsCertificate().empty())
+				TlsConnection::initialize(configuration->getTlsCertificate(), configuration->getTlsKey(), configuration->getTlsOffload());
+#endif
 
 			HTTPRequestHandlerFactory::Ptr factory = new IndigoRequestHandlerFactory();
 
-			ThreadPool pool("workers", configuration.getMinThreads(), configuration.getMaxThreads(), configuration.getIdleTime());
+			// one worker group per CPU set, or a single unpinned group
+			vector<CpuAffinity::CpuSet> cpuSets;
+			CpuAffinity::parse(configuration->getCpuSets(), cpuSets);
+			if (cpuSets.empty())
+				cpuSets.push_back(CpuAffinity::CpuSet());
+			int groupCount = (int) cpuSets.size();
 
-			SocketAddress saddr(configuration.getAddress(), configuration.getPort());
 			ServerSocket sock;
-			sock.bind(saddr, false);
-			sock.listen(configuration.getBacklog());
-			sock.setSendTimeout(configuration.getTimeout() * 1000000); // not done in POCO
+			bool inherited = false;
+
+#if defined(POCO_OS_FAMILY_UNIX)
+			SocketHandoff handoff(configuration->getHandoffSocket());
+			if (!configuration->getHandoffSocket().empty())
+				inherited = handoff.receive(sock);
+#endif
+
+			if (inherited)
+			{
+				logger().information("Took over the listening socket of the running server");
+			}
+			else
+			{
+				SocketAddress saddr(configuration->getAddress(), configuration->getPort());
+				sock.bind(saddr, false);
+				sock.listen(configuration->getBacklog());
+			}
+			sock.setSendTimeout(configuration->getTimeout() * 1000000); // not done in POCO
+
+			// the acceptors of all groups are woken by a new connection, and those that lose the race must not block in accept()
+			if (groupCount > 1)
+				sock.setBlocking(false);
+
+			if (configuration->getDigests())
+				DigestCache::start(configuration->getDigestStore());
+
+			if (!configuration->getHotFileStore().empty())
+				PageCacheWarmer::start(configuration->getHotFileStore(), configuration->getPrewarmLockSize());
+
+			SenderReactor::start(configuration->getSenderThreads(), configuration->getTimeout());
+
+			vector<SharedPtr<WorkerGroup> > groups;
+			for (int i = 0; i < groupCount; i++)
+			{
+				string name = "workers";
+				if (groupCount > 1)
+					name += NumberFormatter::format(i);
 
-			ThreadPoolCollector collector(pool);
+				// the threads of the group are created while the main thread is pinned to the CPUs of the group
+				CpuAffinity::Scope affinity(cpuSets[i]);
 
-			HTTPServer srv(factory, pool, sock, params);
+				SharedPtr<WorkerGroup> group = new WorkerGroup(name, sock, createParams(*configuration, groupCount), factory,
+					divideAmong(configuration->getMinThreads(), groupCount), configuration->getIdleTime());
+				group->start(configuration->getCollectIdleThreads());
+				groups.push_back(group);
 
-			if (configuration.getCollectIdleThreads())
-				collector.startCollecting();
+				if (!cpuSets[i].empty())
+					logger().information("Worker group " + name + " runs on CPUs " + CpuAffinity::format(cpuSets[i]));
+			}
+
+#if defined(POCO_OS_FAMILY_UNIX)
+			if (!configuration->getHandoffSocket().empty())
+			{
+				// the previous server stops accepting connections once this is confirmed
+				if (inherited)
+					handoff.confirm();
+				handoff.startListening(sock);
+			}
 
-			srv.start();
+			waitForSignals(signals, *configuration);
 
+			handoff.stopListening();
+#else
 			waitForTerminationRequest();
+#endif
+
+			// the acceptors stop first, so that the connections that are still queued are not dropped with the queues
+			for (int i = 0; i < groupCount; i++)
+				groups[i]->stopAccepting();
+
+#if defined(POCO_OS_FAMILY_UNIX)
+			if (handoff.handedOff())
+				drainConnections(groups, configuration->getDrainTimeout());
+#endif
 
-			srv.stop();
+			for (int i = 0; i < groupCount; i++)
+				groups[i]->stop();
 
-			collector.stopCollecting();
+			SenderReactor::stop();
+			PageCacheWarmer::stop();
+			DigestCache::stop();
+
+#ifdef INDIGO_TLS
+			TlsConnection::uninitialize();
+#endif
 		}
 
 		return EXIT_OK;
@@ -199,7 +279,7 @@ private:
 	{
 		HelpFormatter helpFormatter(options());
 		helpFormatter.setCommand(commandName());
-		helpFormatter.setUsage("[options]");
+		helpFormatter.setUsage("[options] | --pack=<bundle> <directory>");
 		helpFormatter.setHeader("A simple web server for static content.");
 		helpFormatter.format(cout);
 	}
@@ -210,7 +290,188 @@ private:
 		cout << APP_COPYRIGHT_NOTICE;
 	}
 
-	vector<string> readIndexes(const string &index)
+	void packBundle(const string &directory, const string &bundlePath)
+	{
+		BundleWriter writer;
+		writer.addTree(directory);
+		writer.write(bundlePath);
+
+		cout << "Packed " << writer.count() << " entries into " << bundlePath << endl;
+	}
+
+	IndigoConfiguration::Ptr createConfiguration(const AbstractConfiguration &conf)
+	{
+		const string serverSection = "Server";
+
+		string serverName = conf.getString(serverSection + "." + "name", "");
+		if (serverName.empty())
+			serverName = DNS::hostName();
+
+		string root = conf.getString(serverSection + "." + "root", "virtual");
+		if (root == "virtual")
+			root = "";
+
+		string index = conf.getString(serverSection + "." + "index", "index.html");
+
+		return IndigoConfiguration::create(
+			serverName,
+			conf.getString(serverSection + "." + "address", "0.0.0.0"),
+			conf.getInt(serverSection + "." + "port", 80),
+			conf.getInt(serverSection + "." + "backlog", 64),
+			conf.getInt(serverSection + "." + "minThreads", 2),
+			conf.getInt(serverSection + "." + "maxThreads", 16),
+			conf.getInt(serverSection + "." + "maxQueued", 64),
+			conf.getInt(serverSection + "." + "timeout", 60),
+			conf.getBool(serverSection + "." + "keepalive", true),
+			conf.getInt(serverSection + "." + "keepaliveTimeout", 15),
+			conf.getInt(serverSection + "." + "maxKeepaliveRequests", 0),
+			conf.getInt(serverSection + "." + "idleTime", 60),
+			conf.getInt(serverSection + "." + "threadIdleTime", 10),
+			conf.getBool(serverSection + "." + "collectIdleThreads", false),
+			conf.getInt(serverSection + "." + "smallFileSize", 16384),
+			conf.getString(serverSection + "." + "handoffSocket", ""),
+			conf.getInt(serverSection + "." + "drainTimeout", 300),
+			conf.getString(serverSection + "." + "statusPath", ""),
+			conf.getInt(serverSection + "." + "clientRequestRate", 0),
+			conf.getInt(serverSection + "." + "clientRequestBurst", 20),
+			conf.getInt(serverSection + "." + "clientByteRate", 0),
+			conf.getInt(serverSection + "." + "shareRequestRate", 0),
+			conf.getInt(serverSection + "." + "shareRequestBurst", 200),
+			conf.getInt(serverSection + "." + "shareByteRate", 0),
+			conf.getInt(serverSection + "." + "maxQueueWait", 0),
+			conf.getInt(serverSection + "." + "queueDeadline", 0),
+			conf.getInt(serverSection + "." + "bulkFileSize", 1048576),
+			conf.getInt(serverSection + "." + "bulkLaneLimit", 0),
+			conf.getInt(serverSection + "." + "bulkLaneWait", 1000),
+			conf.getInt(serverSection + "." + "streamFileSize", 67108864),
+			conf.getInt(serverSection + "." + "streamReadahead", 4194304),
+			conf.getBool(serverSection + "." + "archives", false),
+			conf.getBool(serverSection + "." + "digests", false),
+			conf.getString(serverSection + "." + "digestStore", ""),
+			conf.getBool(serverSection + "." + "http2", false),
+			conf.getInt(serverSection + "." + "http2MaxStreams", 100),
+			conf.getString(serverSection + "." + "tlsCertificate", ""),
+			conf.getString(serverSection + "." + "tlsKey", ""),
+			conf.getBool(serverSection + "." + "tlsOffload", true),
+			conf.getInt(serverSection + "." + "slowRequestTime", 0),
+			conf.getString(serverSection + "." + "cpuSets", ""),
+			conf.getInt(serverSection + "." + "senderThreads", 0),
+			readList(conf.getString(serverSection + "." + "writableShares", "")),
+			conf.getString(serverSection + "." + "writeUser", ""),
+			conf.getString(serverSection + "." + "writePassword", ""),
+			conf.getBool(serverSection + "." + "manifests", false),
+			conf.getInt(serverSection + "." + "deltaBlockSize", 0),
+			conf.getString(serverSection + "." + "hotFileStore", ""),
+			conf.getInt(serverSection + "." + "hotFileCount", 1000),
+			conf.getInt(serverSection + "." + "prewarmByteRate", 33554432),
+			conf.getInt(serverSection + "." + "prewarmLockSize", 0),
+			conf.getInt(serverSection + "." + "coalesceWait", 1000),
+			root,
+			readList(index),
+			conf.getBool(serverSection + "." + "autoIndex", true),
+			readShares(conf),
+			readShareCaches(conf),
+			readMimeTypes()
+			);
+	}
+
+	void reloadConfiguration(const IndigoConfiguration &running)
+	{
+		try
+		{
+			AutoPtr<IniFileConfiguration> conf = new IniFileConfiguration(configPath);
+
+			IndigoConfiguration::Ptr configuration = createConfiguration(*conf);
+			configuration->validate();
+
+			// the TLS context is only set up at startup, so TLS changes are among the settings that require a restart
+			if (configuration->requiresRestart(running))
+				logger().warning("Some of the changed settings will not take effect until the server is restarted");
+
+			// indexed shares are crawled anew, so a reload also serves to rescan them
+			configuration->startIndexing();
+			IndigoConfiguration::publish(configuration);
+
+			logger().information("Configuration reloaded");
+		}
+		catch (Exception &e)
+		{
+			logger().error("Failed to reload configuration, keeping the current one: " + e.displayText());
+		}
+	}
+
+#if defined(POCO_OS_FAMILY_UNIX)
+	void drainConnections(const vector<SharedPtr<WorkerGroup> > &groups, int drainTimeout)
+	{
+		// connections already being served by this process finish normally, new ones go to the replacement
+		Timestamp start;
+		while (currentConnections(groups) > 0 && !start.isElapsed((Timestamp::TimeDiff) drainTimeout * 1000000))
+			Thread::sleep(100);
+
+		if (currentConnections(groups) > 0)
+			logger().warning("Drain timeout expired with connections still open");
+	}
+
+	// Returns the number of connections still queued or being served, including those whose response is finished by a sender.
+	int currentConnections(const vector<SharedPtr<WorkerGroup> > &groups)
+	{
+		int connections = 0;
+		for (vector<SharedPtr<WorkerGroup> >::size_type i = 0; i < groups.size(); i++)
+			connections += groups[i]->queuedConnections() + groups[i]->currentConnections();
+		return connections + SenderReactor::activeTransfers();
+	}
+
+	// Creates the server parameters of one of several worker groups, which share the threads and the connection queue.
+	HTTPServerParams::Ptr createParams(const IndigoConfiguration &configuration, int groupCount)
+	{
+		HTTPServerParams::Ptr params = new HTTPServerParams;
+		params->setMaxThreads(divideAmong(configuration.getMaxThreads(), groupCount));
+		params->setMaxQueued(divideAmong(configuration.getMaxQueued(), groupCount));
+		params->setServerName(configuration.getServerName());
+		params->setSoftwareVersion(SERVER_FIELD_VALUE);
+		params->setTimeout(configuration.getTimeout() * 1000000);
+		params->setKeepAlive(configuration.getKeepalive());
+		params->setKeepAliveTimeout(configuration.getKeepaliveTimeout() * 1000000);
+		params->setMaxKeepAliveRequests(configuration.getMaxKeepaliveRequests());
+		params->setThreadIdleTime(configuration.getThreadIdleTime() * 1000000);
+		return params;
+	}
+
+	static int divideAmong(int total, int groupCount)
+	{
+		// rounded up, so that every group gets at least one
+		return (total + groupCount - 1) / groupCount;
+	}
+
+	void blockSignals(sigset_t &signals)
+	{
+		sigemptyset(&signals);
+		if (!getenv("POCO_ENABLE_DEBUGGER"))
+			sigaddset(&signals, SIGINT);
+		sigaddset(&signals, SIGQUIT);
+		sigaddset(&signals, SIGTERM);
+		sigaddset(&signals, SIGHUP);
+		pthread_sigmask(SIG_BLOCK, &signals, NULL);
+	}
+
+	void waitForSignals(const sigset_t &signals, const IndigoConfiguration &running)
+	{
+		for (;;)
+		{
+			int sig = 0;
+			if (sigwait(&signals, &sig) != 0)
+				continue;
+
+			if (sig != SIGHUP)
+				break;
+
+			reloadConfiguration(running);
+		}
+	}
+#endif
+
+	// Reads a list of percent-encoded names, such as index files or shares, separated by whitespace.
+	vector<string> readList(const string &index)
 	{
 		vector<string> indexes;
 
@@ -228,14 +489,14 @@ private:
 		return indexes;
 	}
 
-	unordered_map<string, string> readShares()
+	unordered_map<string, string> readShares(const AbstractConfiguration &conf)
 	{
 		const string sharesSection = "VirtualRoot";
 
 		unordered_map<string, string> shares;
 
 		AbstractConfiguration::Keys keys;
-		config().keys(sharesSection, keys);
+		conf.keys(sharesSection, keys);
 
 		for (size_t i = 0; i < keys.size(); i++)
 		{
@@ -243,7 +504,7 @@ private:
 			if (shareName.empty())
 				continue;
 
-			string sharePath = config().getString(sharesSection + "." + shareName, "");
+			string sharePath = conf.getString(sharesSection + "." + shareName, "");
 			if (sharePath.empty())
 				continue;
 
@@ -258,6 +519,31 @@ private:
 		return shares;
 	}
 
+	unordered_map<string, string> readShareCaches(const AbstractConfiguration &conf)
+	{
+		const string cachesSection = "ShareCache";
+
+		unordered_map<string, string> caches;
+
+		AbstractConfiguration::Keys keys;
+		conf.keys(cachesSection, keys);
+
+		for (size_t i = 0; i < keys.size(); i++)
+		{
+			const string &shareName = keys[i];
+			string cache = conf.getString(cachesSection + "." + shareName, "");
+			if (shareName.empty() || cache.empty())
+				continue;
+
+			string decodedShareName;
+			URI::decode(shareName, decodedShareName);
+
+			caches[decodedShareName] = cache;
+		}
+
+		return caches;
+	}
+
 	void readMimeTypes(string filename, unordered_map<string, string> &mimeTypes)
 	{
 		string filepath = locateConfiguration(filename);
@@ -309,6 +595,8 @@ private:
 
 	bool helpRequested;
 	bool versionRequested;
+	string bundlePath;
+	string configPath;
 };
 
 int main(int argc, char **argv)
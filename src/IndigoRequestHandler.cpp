@@ -30,194 +30,1401 @@
 
 #include <string>
 #include <vector>
+#include <algorithm>
 #include <ostream>
+#include <sstream>
 #include <iostream>
 
+#include "Poco/Platform.h"
+
+#if defined(POCO_OS_FAMILY_UNIX)
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#endif
+
 #include "Poco/Util/ServerApplication.h"
-#include "Poco/URI.h"
 #include "Poco/File.h"
 #include "Poco/DirectoryIterator.h"
 #include "Poco/NumberFormatter.h"
+#include "Poco/String.h"
+#include "Poco/Net/NetException.h"
+#include "Poco/DateTimeFormatter.h"
+#include "Poco/DateTimeFormat.h"
+#include "Poco/DateTimeParser.h"
+#include "Poco/Buffer.h"
+#include "Poco/FileStream.h"
+#include "Poco/StreamCopier.h"
+#include "Poco/Base64Encoder.h"
+#include "Poco/StringTokenizer.h"
+#include "Poco/Net/HTTPBasicCredentials.h"
+#include "Poco/Net/HTTPClientSession.h"
+
+#include "IndigoFiler.h"
+#include "IndigoRequestHandler.h"
+#include "IndigoConfiguration.h"
+#include "FastResponse.h"
+#include "RequestThrottle.h"
+#include "AdmissionControl.h"
+#include "Http2Connection.h"
+#include "TlsConnection.h"
+#include "RequestTrace.h"
+#include "SenderReactor.h"
+#include "StreamingFile.h"
+#include "DirectoryArchive.h"
+#include "DirectoryManifest.h"
+#include "ChangeJournal.h"
+#include "AllocationCounter.h"
+#include "DigestCache.h"
+#include "ShareWriter.h"
+#include "PageCacheWarmer.h"
+#include "BlockChecksums.h"
+#include "ProxyShare.h"
+
+using namespace std;
+
+using namespace Poco;
+using namespace Poco::Util;
+using namespace Poco::Net;
+
+POCO_DECLARE_EXCEPTION(, ShareNotFoundException, ApplicationException)
+POCO_IMPLEMENT_EXCEPTION(ShareNotFoundException, ApplicationException, "ShareNotFoundException")
+
+// size of the pieces in which large and throttled files are sent
+#define STREAM_CHUNK_SIZE 65536
+
+// charges the file data of an archive to the byte rate limits of the request
+class PacedDirectoryArchive: public DirectoryArchive
+{
+public:
+	PacedDirectoryArchive(ostream &out, Format format, bool compress, const string &client, const string &share):
+		DirectoryArchive(out, format, compress),
+		client(client),
+		share(share)
+	{
+	}
+
+protected:
+	void fileDataRead(streamsize bytes)
+	{
+		RequestThrottle::pace(client, share, bytes);
+	}
+
+private:
+	const string &client;
+	const string &share;
+};
+
+ThreadLocal<IndigoRequestHandler::Arena> IndigoRequestHandler::arenas;
+AtomicCounter IndigoRequestHandler::requestCount;
+WorkerLane IndigoRequestHandler::smallLane("Small");
+WorkerLane IndigoRequestHandler::bulkLane("Bulk");
+SingleFlight IndigoRequestHandler::listingFlights("Listing");
+SingleFlight IndigoRequestHandler::tableFlights("Block table");
+
+IndigoRequestHandler::Arena::Arena():
+	uriPath(),
+	target(),
+	file(),
+	client(),
+	share(),
+	throttled(false)
+{
+}
+
+IndigoRequestHandler::IndigoRequestHandler()
+{
+}
+
+void IndigoRequestHandler::handleRequest(HTTPServerRequest &request, HTTPServerResponse &response)
+{
+#ifdef INDIGO_COUNT_ALLOCATIONS
+	AllocationCounter allocationCounter(request);
+#endif
+
+	// every lookup made while handling the request sees the same configuration, even across a reload
+	IndigoConfiguration::Snapshot snapshot;
+
+	RequestTrace::Scope trace(request, response);
+
+	logRequest(request);
+
+	requestCount++;
+
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	const string &method = request.getMethod();
+	bool change = (method == HTTPRequest::HTTP_PUT || method == HTTPRequest::HTTP_DELETE);
+
+	if (method != HTTPRequest::HTTP_GET && !(change && !configuration.getWritableShares().empty()))
+	{
+		sendMethodNotAllowed(response);
+		return;
+	}
+
+	const string &statusPath = configuration.getStatusPath();
+	if (!change && !statusPath.empty() && request.getURI() == statusPath)
+	{
+		sendStatus(request, response);
+		return;
+	}
+
+	Arena &arena = *arenas;
+	RequestPath &uriPath = arena.uriPath;
+
+	if (!uriPath.parse(request.getURI()))
+	{
+		sendBadRequest(response);
+		return;
+	}
+
+	arena.throttled = RequestThrottle::enabled();
+	if (arena.throttled)
+	{
+		arena.client = request.clientAddress().host().toString();
+
+		// requests outside of any share are accounted to the root, under the empty name
+		if (uriPath.depth() > 0 && (configuration.findSharePath(uriPath.segment(0), uriPath.segmentLength(0)) != NULL ||
+			configuration.findShareBundle(uriPath.segment(0), uriPath.segmentLength(0)) != NULL ||
+			configuration.findShareProxy(uriPath.segment(0), uriPath.segmentLength(0)) != NULL))
+			arena.share.assign(uriPath.segment(0), uriPath.segmentLength(0));
+		else
+			arena.share.clear();
+
+		long retryAfter = RequestThrottle::admit(arena.client, arena.share);
+		if (retryAfter > 0)
+		{
+			sendTooManyRequests(response, retryAfter);
+			return;
+		}
+	}
+
+	RequestTrace::mark(RequestTrace::PHASE_PARSE);
+
+	try
+	{
+		if (change)
+		{
+			changeEntry(request, response, uriPath);
+			return;
+		}
+
+		if (uriPath.depth() == 0)
+		{
+			if (!uriPath.isDirectory())
+			{
+				redirectToDirectory(response, "/", false);
+				return;
+			}
+
+			if (configuration.virtualRoot())
+			{
+				sendVirtualIndex(request, response);
+				return;
+			}
+		}
+
+		if (uriPath.depth() > 0)
+		{
+			const Bundle *bundle = configuration.findShareBundle(uriPath.segment(0), uriPath.segmentLength(0));
+			if (bundle != NULL)
+			{
+				sendBundleEntry(request, response, *bundle, uriPath);
+				return;
+			}
+
+			const ProxyShare *proxy = configuration.findShareProxy(uriPath.segment(0), uriPath.segmentLength(0));
+			if (proxy != NULL)
+			{
+				sendProxyEntry(request, response, *proxy, uriPath);
+				return;
+			}
+		}
+
+		string &target = arena.target;
+		resolveFSPath(uriPath, target);
+		RequestTrace::mark(RequestTrace::PHASE_RESOLVE);
+
+		if (uriPath.depth() > 0)
+		{
+			const ShareIndex *index = configuration.findShareIndex(uriPath.segment(0), uriPath.segmentLength(0));
+			ShareIndex::Entry entry;
+			if (index != NULL && index->find(uriPath, 1, entry))
+			{
+				RequestTrace::mark(RequestTrace::PHASE_STAT);
+				if (sendIndexedEntry(request, response, *index, entry, uriPath, target))
+					return;
+			}
+		}
+
+		File &f = arena.file;
+		f = target;
+
+		bool directory = f.isDirectory();
+		RequestTrace::mark(RequestTrace::PHASE_STAT);
+
+		if (uriPath.isDirectory())
+		{
+			DirectoryArchive::Format format;
+			bool compress;
+			string since;
+
+			if (directory)
+			{
+				if (configuration.getArchives() && DirectoryArchive::parseQuery(uriPath.query(), uriPath.queryLength(), format, compress))
+					sendArchive(response, target, uriPath, format, compress);
+				else if (configuration.getManifests() && DirectoryManifest::parseQuery(uriPath.query(), uriPath.queryLength(), since))
+					sendManifest(response, target, uriPath, since, NULL, NULL);
+				else
+					sendDirectoryIndex(request, response, target, uriPath.toDirectoryString());
+			}
+			else
+			{
+				sendNotFound(response);
+			}
+		}
+		else
+		{
+			if (directory)
+			{
+				redirectToDirectory(response, uriPath.toDirectoryString(), false);
+			}
+			else
+			{
+				sendFile(request, response, f);
+			}
+		}
+	}
+	catch (ShareNotFoundException &snfe)
+	{
+		sendNotFound(response);
+	}
+	catch (FileNotFoundException &fnfe)
+	{
+		sendNotFound(response);
+	}
+	catch (FileAccessDeniedException &fade)
+	{
+		sendForbidden(response);
+	}
+	catch (FileException &fe)
+	{
+		sendInternalServerError(response);
+	}
+	catch (PathSyntaxException &pse)
+	{
+		sendNotImplemented(response);
+	}
+	catch (NetException &ne)
+	{
+		response.setKeepAlive(false);
+	}
+	catch (TimeoutException &te)
+	{
+		response.setKeepAlive(false);
+	}
+	catch (...)
+	{
+		sendInternalServerError(response);
+	}
+}
+
+// Stores or removes a file in a writable share, for an authorized client.
+void IndigoRequestHandler::changeEntry(HTTPServerRequest &request, HTTPServerResponse &response, const RequestPath &uriPath)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	// the shares themselves and directories cannot be changed
+	if (uriPath.depth() < 2 || uriPath.isDirectory() || !configuration.isShareWritable(uriPath.segment(0), uriPath.segmentLength(0)))
+	{
+		sendMethodNotAllowed(response);
+		return;
+	}
+
+	if (!authorize(request))
+	{
+		response.set("WWW-Authenticate", "Basic realm=\"" + configuration.getServerName() + "\"");
+		sendError(response, HTTPResponse::HTTP_UNAUTHORIZED);
+		return;
+	}
+
+	if (!ShareWriter::accepts(request))
+	{
+		sendNotImplemented(response);
+		return;
+	}
+
+	string &target = (*arenas).target;
+	resolveFSPath(uriPath, target);
+	RequestTrace::mark(RequestTrace::PHASE_RESOLVE);
+
+	bool created = false;
+	try
+	{
+		if (request.getMethod() == HTTPRequest::HTTP_PUT)
+		{
+			// a body of unknown length would only end with the connection
+			if (!request.getChunkedTransferEncoding() && request.getContentLength64() == HTTPMessage::UNKNOWN_CONTENT_LENGTH)
+			{
+				sendError(response, HTTPResponse::HTTP_LENGTH_REQUIRED);
+				return;
+			}
+
+			created = ShareWriter::writeFile(request, target);
+		}
+		else
+		{
+			ShareWriter::removeFile(target);
+		}
+	}
+	catch (FileNotFoundException &fnfe)
+	{
+		// a file cannot be stored in a directory that does not exist
+		if (request.getMethod() == HTTPRequest::HTTP_PUT)
+			sendError(response, HTTPResponse::HTTP_CONFLICT);
+		else
+			sendNotFound(response);
+		return;
+	}
+	catch (FileExistsException &fee)
+	{
+		sendError(response, HTTPResponse::HTTP_CONFLICT);
+		return;
+	}
+	catch (InsufficientStorageException &ise)
+	{
+		sendError(response, 507, "Insufficient Storage");
+		return;
+	}
+
+	const ShareIndex *index = configuration.findShareIndex(uriPath.segment(0), uriPath.segmentLength(0));
+	if (index != NULL)
+		index->invalidate(uriPath, 1);
+
+	string share(uriPath.segment(0), uriPath.segmentLength(0));
+	string changed;
+	uriPath.appendSegments(changed, 1, '/');
+	ChangeJournal::record(share, changed);
+
+	response.setStatusAndReason(created ? HTTPResponse::HTTP_CREATED : HTTPResponse::HTTP_NO_CONTENT);
+	response.setContentLength(0);
+	response.send();
+}
+
+bool IndigoRequestHandler::authorize(const HTTPServerRequest &request)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	if (!request.hasCredentials())
+		return false;
+
+	try
+	{
+		HTTPBasicCredentials credentials(request);
+		return (equalSecrets(credentials.getUsername(), configuration.getWriteUser()) &
+			equalSecrets(credentials.getPassword(), configuration.getWritePassword()));
+	}
+	catch (Exception &e)
+	{
+		return false;
+	}
+}
+
+// Compares the strings in a time that does not depend on where they differ, so that a password cannot be guessed by timing.
+bool IndigoRequestHandler::equalSecrets(const string &a, const string &b)
+{
+	unsigned char difference = (a.length() != b.length());
+	for (string::size_type i = 0; i < a.length() && i < b.length(); i++)
+		difference |= (unsigned char) (a[i] ^ b[i]);
+
+	return (difference == 0);
+}
+
+void IndigoRequestHandler::resolveFSPath(const RequestPath &uriPath, string &fsPath)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	int first = 1;
+	const string *base = NULL;
+
+	if (uriPath.depth() > 0)
+		base = configuration.findSharePath(uriPath.segment(0), uriPath.segmentLength(0));
+
+	if (base == NULL)
+	{
+		base = &configuration.getRoot();
+		if (base->empty())
+			throw ShareNotFoundException();
+
+		first = 0;
+	}
+
+	const char separator = Path::separator();
+
+	fsPath.assign(*base);
+	if (first < uriPath.depth())
+	{
+		char last = fsPath[fsPath.length() - 1];
+		if (last != separator && last != '/')
+			fsPath += separator;
+
+		uriPath.appendSegments(fsPath, first, separator);
+	}
+}
+
+const string &IndigoRequestHandler::getMediaType(const string &path)
+{
+	// the extension is taken from the file name only, without parsing the whole path
+	string ext;
+	string::size_type dot = path.rfind('.');
+	if (dot != string::npos)
+	{
+		string::size_type sep = path.find_first_of("/\\", dot);
+		if (sep == string::npos)
+			ext.assign(path, dot + 1, string::npos);
+	}
+
+	return IndigoConfiguration::get().getMimeType(ext);
+}
+
+void IndigoRequestHandler::sendFile(HTTPServerRequest &request, HTTPServerResponse &response, const File &file)
+{
+	sendFile(request, response, file.path(), file.getSize(), file.getLastModified());
+}
+
+void IndigoRequestHandler::sendFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, File::FileSize size, const Timestamp &lastModified)
+{
+	sendFile(request, response, path, getMediaType(path), size, lastModified);
+}
+
+void IndigoRequestHandler::sendFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, const string &mediaType, File::FileSize size, const Timestamp &lastModified)
+{
+	sendFile(request, response, path, -1, mediaType, size, lastModified);
+}
+
+// Sends the file from the descriptor, which the caller keeps open and closes, or opens it by its path if the descriptor is -1.
+void IndigoRequestHandler::sendFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, int file, const string &mediaType, File::FileSize size, const Timestamp &lastModified)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	const Arena &arena = *arenas;
+
+	int deltaBlockSize = configuration.getDeltaBlockSize();
+	if (deltaBlockSize > 0)
+	{
+		string version;
+		string blocks;
+		switch (BlockChecksums::parseQuery(arena.uriPath.query(), arena.uriPath.queryLength(), version, blocks))
+		{
+		case BlockChecksums::QUERY_TABLE:
+			sendBlockTable(response, path, size, lastModified, deltaBlockSize);
+			return;
+		case BlockChecksums::QUERY_BLOCKS:
+			sendBlocks(response, path, size, lastModified, deltaBlockSize, version, blocks);
+			return;
+		default:
+			break;
+		}
+	}
+
+	if (PageCacheWarmer::enabled())
+		PageCacheWarmer::record(path);
+
+	if (DigestCache::enabled() && sendDigestFields(request, response, path, size))
+		return;
+
+	if (sendNotModified(request, response, size, lastModified))
+		return;
+
+	RequestTrace::mark(RequestTrace::PHASE_STAT);
+
+	int bulkFileSize = configuration.getBulkFileSize();
+	bool bulk = (bulkFileSize > 0 && size > (File::FileSize) bulkFileSize);
+
+	// files of shares on slow storage are sent from their local copies, and copied while they are first sent
+	ShareCache *cache = NULL;
+	if (arena.uriPath.depth() > 0)
+		cache = configuration.findShareCache(arena.uriPath.segment(0), arena.uriPath.segmentLength(0));
+
+	// a copy is sent from the descriptor that the lookup opened, so that evicting it meanwhile does not cut the response short
+	ShareCache::Copy copy;
+	bool cached = (cache != NULL && cache->lookup(path, size, copy));
+	bool fill = (cache != NULL && !cached && cache->cacheable(size));
+	const string &source = (cached ? copy.path() : path);
+	int sourceFile = (cached ? copy.descriptor() : file);
+
+	// bulk bodies sent by a sender do not hold a worker, so they do not wait for the bulk lane either
+	if (bulk && !fill && !arena.throttled && FastResponse::offloadFile(request, response, source, sourceFile, mediaType, size, lastModified))
+		return;
+
+	WorkerLane &lane = (bulk ? bulkLane : smallLane);
+	if (!lane.enter(bulk ? configuration.getBulkLaneLimit() : 0, configuration.getBulkLaneWait()))
+	{
+		sendServiceUnavailable(response);
+		return;
+	}
+	WorkerLane::Slot slot(lane);
+
+	// waiting for the lane is queueing too
+	RequestTrace::mark(RequestTrace::PHASE_QUEUE);
+
+	if (fill)
+	{
+		sendCachingFile(response, *cache, path, mediaType, size, lastModified);
+		return;
+	}
+
+	int smallFileSize = configuration.getSmallFileSize();
+	bool small = (smallFileSize > 0 && size <= (File::FileSize) smallFileSize);
+
+	int streamFileSize = configuration.getStreamFileSize();
+	bool large = (streamFileSize > 0 && size > (File::FileSize) streamFileSize);
+
+	if (large || (arena.throttled && !small))
+	{
+		sendStreamedFile(response, source, sourceFile, mediaType, size, lastModified, large);
+		return;
+	}
+
+	if (arena.throttled)
+		RequestThrottle::pace(arena.client, arena.share, size);
+
+	if (FastResponse::sendFile(request, response, source, sourceFile, mediaType, size, lastModified))
+		return;
+
+	if (FastResponse::sendLargeFile(request, response, source, sourceFile, mediaType, size, lastModified))
+		return;
+
+	if (sourceFile >= 0)
+		sendStreamedFile(response, source, sourceFile, mediaType, size, lastModified, false);
+	else
+		response.sendFile(source, mediaType);
+}
+
+// Sends the checksums of the blocks of the file, computing them first if this version of the file is new.
+void IndigoRequestHandler::sendBlockTable(HTTPServerResponse &response, const string &path, File::FileSize size, const Timestamp &lastModified, int blockSize)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	// concurrent requests for a new version share one reading of the file
+	SingleFlight::Call call(tableFlights, path + '\n' + BlockChecksums::version(size, lastModified, blockSize), configuration.getCoalesceWait());
+	SingleFlight::Result result = call.result();
+	if (result.isNull())
+	{
+		// computing a table reads the whole file
+		if (!bulkLane.enter(configuration.getBulkLaneLimit(), configuration.getBulkLaneWait()))
+		{
+			sendServiceUnavailable(response);
+			return;
+		}
+		WorkerLane::Slot slot(bulkLane);
+
+		// a file that changes while it is read has no consistent table to send; the client may try again
+		BlockChecksums::TablePtr table = BlockChecksums::lookup(path, size, lastModified, blockSize);
+		if (table.isNull())
+		{
+			sendServiceUnavailable(response);
+			return;
+		}
+
+		ostringstream out;
+		BlockChecksums::writeTable(out, *table);
+		result = new string(out.str());
+		call.complete(result);
+	}
+	const string &body = *result;
+
+	const Arena &arena = *arenas;
+	if (arena.throttled)
+		RequestThrottle::pace(arena.client, arena.share, body.length());
+
+	response.setContentType("text/plain; charset=us-ascii");
+	response.set("Cache-Control", "no-cache");
+	response.sendBuffer(body.data(), body.length());
+}
+
+// Sends the requested blocks of the file back to back, if the file is still the version the client has the table of.
+void IndigoRequestHandler::sendBlocks(HTTPServerResponse &response, const string &path, File::FileSize size, const Timestamp &lastModified, int blockSize, const string &version, const string &blocks)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	if (version != BlockChecksums::version(size, lastModified, blockSize))
+	{
+		sendError(response, HTTPResponse::HTTP_PRECONDITION_FAILED);
+		return;
+	}
+
+	size_t count = (size_t) ((size + blockSize - 1) / blockSize);
+	vector<pair<size_t, size_t> > ranges;
+	if (!BlockChecksums::parseBlocks(blocks, count, ranges))
+	{
+		sendBadRequest(response);
+		return;
+	}
+
+	File::FileSize length = 0;
+	vector<pair<size_t, size_t> >::const_iterator it;
+	vector<pair<size_t, size_t> >::const_iterator end = ranges.end();
+	for (it = ranges.begin(); it != end; ++it)
+	{
+		File::FileSize last = (File::FileSize) (it->second + 1) * blockSize;
+		length += (last < size ? last : size) - (File::FileSize) it->first * blockSize;
+	}
+
+	int bulkFileSize = configuration.getBulkFileSize();
+	bool bulk = (bulkFileSize > 0 && length > (File::FileSize) bulkFileSize);
+
+	WorkerLane &lane = (bulk ? bulkLane : smallLane);
+	if (!lane.enter(bulk ? configuration.getBulkLaneLimit() : 0, configuration.getBulkLaneWait()))
+	{
+		sendServiceUnavailable(response);
+		return;
+	}
+	WorkerLane::Slot slot(lane);
+
+	FileInputStream istr(path);
+	RequestTrace::mark(RequestTrace::PHASE_OPEN);
+
+	response.setContentLength64(length);
+	response.setContentType("application/octet-stream");
+	response.setChunkedTransferEncoding(false);
+	response.set("Cache-Control", "no-cache");
+
+	ostream &ostr = response.send();
+
+	const Arena &arena = *arenas;
+	Buffer<char> buffer(blockSize);
+	for (it = ranges.begin(); it != end && ostr.good(); ++it)
+	{
+		File::FileSize offset = (File::FileSize) it->first * blockSize;
+		File::FileSize last = (File::FileSize) (it->second + 1) * blockSize;
+		File::FileSize remaining = (last < size ? last : size) - offset;
+
+		istr.seekg((streamoff) offset);
+		while (remaining > 0 && ostr.good())
+		{
+			streamsize n = (remaining < (File::FileSize) blockSize ? (streamsize) remaining : blockSize);
+			istr.read(buffer.begin(), n);
+
+			// the file was truncated after the version was checked; the short body tells the client
+			if (istr.gcount() != n)
+			{
+				response.setKeepAlive(false);
+				return;
+			}
+
+			if (arena.throttled)
+				RequestThrottle::pace(arena.client, arena.share, n);
+
+			ostr.write(buffer.begin(), n);
+			remaining -= n;
+		}
+	}
+}
+
+// Sets the ETag and Repr-Digest fields if the digest of the file is known,
+// and sends a 304 response if the client already has this version of the file.
+bool IndigoRequestHandler::sendDigestFields(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, File::FileSize size)
+{
+	DigestCache::Digest digest;
+	if (!DigestCache::lookup(path, digest))
+		return false;
+
+	// half of the digest is plenty to tell the versions of a file apart
+	string etag(1, '"');
+	for (int i = 0; i < Sha256::DIGEST_SIZE / 2; i++)
+		NumberFormatter::appendHex(etag, (unsigned) digest.bytes[i], 2);
+	etag += '"';
+
+	ostringstream encoded;
+	{
+		Base64Encoder encoder(encoded);
+		encoder.write((const char *) digest.bytes, Sha256::DIGEST_SIZE);
+	}
+
+	response.set("ETag", etag);
+	response.set("Repr-Digest", "sha-256=:" + encoded.str() + ":");
+
+	if (!request.has("If-None-Match"))
+		return false;
+
+	// If-None-Match uses the weak comparison, so weak tags of this version match too
+	bool match = false;
+	StringTokenizer tags(request.get("If-None-Match"), ",", StringTokenizer::TOK_IGNORE_EMPTY | StringTokenizer::TOK_TRIM);
+	for (StringTokenizer::Iterator it = tags.begin(); it != tags.end() && !match; ++it)
+	{
+		const string &tag = *it;
+		match = (tag == "*" || tag == etag || (tag.compare(0, 2, "W/") == 0 && tag.compare(2, string::npos, etag) == 0));
+	}
+
+	if (!match)
+		return false;
+
+	response.setStatusAndReason(HTTPResponse::HTTP_NOT_MODIFIED);
+	response.setContentLength64(size);
+	response.send();
+
+	return true;
+}
+
+// Sends a 304 response if the file was not modified since the time given by the client, which is how proxy shares revalidate their copies.
+bool IndigoRequestHandler::sendNotModified(HTTPServerRequest &request, HTTPServerResponse &response, File::FileSize size, const Timestamp &lastModified)
+{
+	// If-Modified-Since is ignored when If-None-Match is present
+	if (!request.has("If-Modified-Since") || request.has("If-None-Match"))
+		return false;
+
+	DateTime since;
+	int tzd;
+	if (!DateTimeParser::tryParse(DateTimeFormat::HTTP_FORMAT, request.get("If-Modified-Since"), since, tzd))
+		return false;
+
+	// HTTP dates have a resolution of a second
+	if (lastModified.epochTime() > since.timestamp().epochTime())
+		return false;
+
+	response.set("Last-Modified", DateTimeFormatter::format(lastModified, DateTimeFormat::HTTP_FORMAT));
+	response.setStatusAndReason(HTTPResponse::HTTP_NOT_MODIFIED);
+	response.setContentLength64(size);
+	response.send();
+
+	return true;
+}
+
+// Returns false if the file to send changed since the share was crawled, and the filesystem has to answer.
+bool IndigoRequestHandler::sendIndexedEntry(HTTPServerRequest &request, HTTPServerResponse &response, const ShareIndex &index, const ShareIndex::Entry &entry, const RequestPath &uriPath, const string &path)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	if (!entry.exists)
+		throw FileNotFoundException();
+
+	if (!uriPath.isDirectory())
+	{
+		if (!entry.directory)
+			return sendIndexedFile(request, response, path, entry);
+
+		redirectToDirectory(response, uriPath.toDirectoryString(), false);
+		return true;
+	}
+
+	if (!entry.directory)
+		throw FileNotFoundException();
+
+	DirectoryArchive::Format format;
+	bool compress;
+
+	if (configuration.getArchives() && DirectoryArchive::parseQuery(uriPath.query(), uriPath.queryLength(), format, compress))
+	{
+		sendArchive(response, path, uriPath, format, compress);
+		return true;
+	}
+
+	string since;
+	if (configuration.getManifests() && DirectoryManifest::parseQuery(uriPath.query(), uriPath.queryLength(), since))
+	{
+		sendManifest(response, path, uriPath, since, &index, &entry);
+		return true;
+	}
+
+	// index files and the listing come from memory; only the file that is sent is opened
+	const vector<string> &indexes = configuration.getIndexes();
+	const vector<string> &indexesNative = configuration.getIndexes(true);
+	ShareIndex::Entry child;
+
+	for (vector<string>::size_type i = 0; i < indexes.size(); i++)
+	{
+		if (!index.findChild(entry, indexes[i], child))
+		{
+			sendDirectoryIndex(request, response, path, uriPath.toDirectoryString());
+			return true;
+		}
+
+		if (child.exists && !child.directory)
+		{
+			string indexPath = path;
+			if (indexPath[indexPath.length() - 1] != Path::separator())
+				indexPath += Path::separator();
+			indexPath += indexesNative[i];
+
+			return sendIndexedFile(request, response, indexPath, child);
+		}
+	}
+
+	if (!configuration.getAutoIndex())
+		throw FileNotFoundException();
+
+	vector<string> entries;
+	if (!index.list(entry, entries))
+	{
+		sendDirectoryIndex(request, response, path, uriPath.toDirectoryString());
+		return true;
+	}
+
+	sendDirectoryListing(request, response, formatDirectoryListing(uriPath.toDirectoryString(), entries));
+	return true;
+}
+
+// Sends a file found in the index from a descriptor whose size and modification time match the index entry.
+bool IndigoRequestHandler::sendIndexedFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, const ShareIndex::Entry &entry)
+{
+#if defined(POCO_OS_FAMILY_UNIX)
+	// the file is opened anyway, so checking the index against it only costs an fstat()
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (File::FileSize) st.st_size != entry.size || st.st_mtime != entry.modified.epochTime())
+	{
+		close(fd);
+		return false;
+	}
+
+	try
+	{
+		sendFile(request, response, path, fd, getMediaType(path), entry.size, entry.modified);
+	}
+	catch (...)
+	{
+		close(fd);
+		throw;
+	}
+
+	close(fd);
+	return true;
+#else
+	File file(path);
+	if (!file.exists() || !file.isFile() || file.getSize() != entry.size || file.getLastModified() != entry.modified)
+		return false;
+
+	sendFile(request, response, path, entry.size, entry.modified);
+	return true;
+#endif
+}
+
+void IndigoRequestHandler::sendBundleEntry(HTTPServerRequest &request, HTTPServerResponse &response, const Bundle &bundle, const RequestPath &uriPath)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
 
-#include "IndigoFiler.h"
-#include "IndigoRequestHandler.h"
-#include "IndigoConfiguration.h"
+	// the entry name is the request path below the share, which is how --pack names entries
+	string name;
+	uriPath.appendSegments(name, 1, '/');
 
-using namespace std;
+	Bundle::Entry entry;
 
-using namespace Poco;
-using namespace Poco::Util;
-using namespace Poco::Net;
+	if (uriPath.isDirectory())
+	{
+		if (!name.empty())
+		{
+			if (!bundle.find(name.data(), name.length(), entry) || !entry.directory)
+				throw ShareNotFoundException();
 
-POCO_DECLARE_EXCEPTION(, ShareNotFoundException, ApplicationException)
-POCO_IMPLEMENT_EXCEPTION(ShareNotFoundException, ApplicationException, "ShareNotFoundException")
+			name += '/';
+		}
 
-IndigoRequestHandler::IndigoRequestHandler()
-{
+		// bundles are meant for trees too large to list, so only index files are served for directories
+		string::size_type length = name.length();
+		const vector<string> &indexes = configuration.getIndexes();
+
+		vector<string>::const_iterator it;
+		vector<string>::const_iterator end = indexes.end();
+		for (it = indexes.begin(); it != end; ++it)
+		{
+			name.resize(length);
+			name += *it;
+
+			if (bundle.find(name.data(), name.length(), entry) && !entry.directory)
+			{
+				sendBundleFile(request, response, name, entry);
+				return;
+			}
+		}
+
+		throw ShareNotFoundException();
+	}
+	else
+	{
+		if (!bundle.find(name.data(), name.length(), entry))
+			throw ShareNotFoundException();
+
+		if (entry.directory)
+			redirectToDirectory(response, uriPath.toDirectoryString(), false);
+		else
+			sendBundleFile(request, response, name, entry);
+	}
 }
 
-void IndigoRequestHandler::handleRequest(HTTPServerRequest &request, HTTPServerResponse &response)
+void IndigoRequestHandler::sendBundleFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &name, const Bundle::Entry &entry)
 {
-	logRequest(request);
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
 
-	const string &method = request.getMethod();
+	const string &mediaType = getMediaType(name);
 
-	if (method != HTTPRequest::HTTP_GET)
+	int bulkFileSize = configuration.getBulkFileSize();
+	bool bulk = (bulkFileSize > 0 && entry.length > (UInt64) bulkFileSize);
+
+	WorkerLane &lane = (bulk ? bulkLane : smallLane);
+	if (!lane.enter(bulk ? configuration.getBulkLaneLimit() : 0, configuration.getBulkLaneWait()))
 	{
-		sendMethodNotAllowed(response);
+		sendServiceUnavailable(response);
 		return;
 	}
+	WorkerLane::Slot slot(lane);
 
-	URI uri;
-	try
+	const Arena &arena = *arenas;
+
+	int smallFileSize = configuration.getSmallFileSize();
+	bool small = (smallFileSize > 0 && entry.length <= (UInt64) smallFileSize);
+
+	// as with files, only small bodies are paced up front; larger ones are paced piece by piece below
+	bool paced = false;
+	if (arena.throttled && small)
 	{
-		uri = request.getURI();
+		RequestThrottle::pace(arena.client, arena.share, entry.length);
+		paced = true;
 	}
-	catch (SyntaxException &se)
-	{
-		sendBadRequest(response);
+
+	// the body is sent from the mapping, without being copied or read through a file stream
+	if ((!arena.throttled || small) && FastResponse::sendMapped(request, response, mediaType, entry.data, entry.length, entry.modified))
 		return;
+
+	response.set("Last-Modified", DateTimeFormatter::format(entry.modified, DateTimeFormat::HTTP_FORMAT));
+	response.setContentLength64(entry.length);
+	response.setContentType(mediaType);
+	response.setChunkedTransferEncoding(false);
+
+	ostream &ostr = response.send();
+
+	const char *data = entry.data;
+	UInt64 left = entry.length;
+	while (left > 0 && ostr.good())
+	{
+		streamsize n = (streamsize) min(left, (UInt64) STREAM_CHUNK_SIZE);
+
+		if (arena.throttled && !paced)
+			RequestThrottle::pace(arena.client, arena.share, n);
+
+		ostr.write(data, n);
+		data += n;
+		left -= n;
 	}
+}
 
-	const string processedURI = uri.getPath();
-	const Path uriPath(processedURI, Path::PATH_UNIX);
+// Passes a request for a proxy share on to the upstream. Files are served from the share cache while the upstream
+// reports them unmodified, and are stored in the cache while they are sent when they are new or changed.
+void IndigoRequestHandler::sendProxyEntry(HTTPServerRequest &request, HTTPServerResponse &response, const ProxyShare &proxy, const RequestPath &uriPath)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
 
-	if (!uriPath.isAbsolute())
+	if (uriPath.depth() == 1 && !uriPath.isDirectory())
 	{
-		sendBadRequest(response);
+		redirectToDirectory(response, uriPath.toDirectoryString(), false);
 		return;
 	}
 
-	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+	string uri = proxy.makeURI(uriPath);
 
+	// listings and the responses to queries are relayed as they are
+	ShareCache *cache = proxy.getCache();
+	if (uriPath.isDirectory() || uriPath.queryLength() > 0)
+		cache = NULL;
+
+	string key;
+	string cachedPath;
+	File::FileSize cachedSize = 0;
+	Timestamp cachedModified;
+	bool cached = false;
+	if (cache != NULL)
+	{
+		key = proxy.makeKey(uri);
+		cached = cache->find(key, cachedPath, cachedSize, cachedModified);
+	}
+
+	HTTPClientSession session(proxy.getHost(), proxy.getPort());
+	session.setTimeout(Timespan(configuration.getTimeout(), 0));
+
+	HTTPRequest upstreamRequest(HTTPRequest::HTTP_GET, uri, HTTPMessage::HTTP_1_1);
+	if (cached)
+		upstreamRequest.set("If-Modified-Since", DateTimeFormatter::format(cachedModified, DateTimeFormat::HTTP_FORMAT));
+
+	HTTPResponse upstreamResponse;
+	istream *istr;
 	try
 	{
-		if (uriPath.isDirectory() && uriPath.depth() == 0)
+		session.sendRequest(upstreamRequest);
+		istr = &session.receiveResponse(upstreamResponse);
+	}
+	catch (TimeoutException &te)
+	{
+		proxy.count(ProxyShare::OUTCOME_FAILED);
+		sendError(response, HTTPResponse::HTTP_GATEWAY_TIMEOUT);
+		return;
+	}
+	catch (NetException &ne)
+	{
+		proxy.count(ProxyShare::OUTCOME_FAILED);
+		sendError(response, HTTPResponse::HTTP_BAD_GATEWAY);
+		return;
+	}
+	RequestTrace::mark(RequestTrace::PHASE_OPEN);
+
+	HTTPResponse::HTTPStatus status = upstreamResponse.getStatus();
+	const string &mediaType = getMediaType(uri.substr(0, uri.find('?')));
+
+	if (cached)
+	{
+		if (status == HTTPResponse::HTTP_NOT_MODIFIED)
 		{
-			if (configuration.virtualRoot())
-			{
-				sendVirtualIndex(response);
-				return;
-			}
+			proxy.count(ProxyShare::OUTCOME_REVALIDATED);
+			sendFile(request, response, cachedPath, mediaType, cachedSize, cachedModified);
+			return;
 		}
 
-		const Path fsPath = resolveFSPath(uriPath);
-		const string target = fsPath.toString();
+		// the copy is out of date, or the file is gone
+		cache->discard(key);
+	}
 
-		File f(target);
+	if (cache != NULL && status == HTTPResponse::HTTP_OK && upstreamResponse.getContentLength64() != HTTPMessage::UNKNOWN_CONTENT_LENGTH)
+	{
+		File::FileSize size = upstreamResponse.getContentLength64();
 
-		if (uriPath.isDirectory())
-		{
-			if (f.isDirectory())
-			{
-				sendDirectoryIndex(response, target, processedURI);
-			}
-			else
-			{
-				sendNotFound(response);
-			}
-		}
-		else
+		// copies carry the modification time of the upstream file, so files without one cannot be revalidated
+		DateTime modified;
+		int tzd;
+		if (cache->cacheable(size) && upstreamResponse.has("Last-Modified") &&
+			DateTimeParser::tryParse(DateTimeFormat::HTTP_FORMAT, upstreamResponse.get("Last-Modified"), modified, tzd))
 		{
-			if (f.isDirectory())
-			{
-				Path uriDirPath = uriPath;
-				uriDirPath.makeDirectory();
-				redirectToDirectory(response, uriDirPath.toString(Path::PATH_UNIX), false);
-			}
-			else
-			{
-				sendFile(response, fsPath);
-			}
+			proxy.count(ProxyShare::OUTCOME_FETCHED);
+			sendFetchedFile(response, *cache, key, *istr, mediaType, size, modified.timestamp());
+			return;
 		}
 	}
-	catch (ShareNotFoundException &snfe)
+
+	proxy.count(ProxyShare::OUTCOME_RELAYED);
+	relayResponse(request, response, proxy, uriPath, upstreamResponse, *istr);
+}
+
+// Sends a file as it is received from the upstream, and copies it into the share cache at the same time.
+void IndigoRequestHandler::sendFetchedFile(HTTPServerResponse &response, ShareCache &cache, const string &key, istream &istr, const string &mediaType, File::FileSize size, const Timestamp &lastModified)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	int bulkFileSize = configuration.getBulkFileSize();
+	bool bulk = (bulkFileSize > 0 && size > (File::FileSize) bulkFileSize);
+
+	WorkerLane &lane = (bulk ? bulkLane : smallLane);
+	if (!lane.enter(bulk ? configuration.getBulkLaneLimit() : 0, configuration.getBulkLaneWait()))
 	{
-		sendNotFound(response);
+		sendServiceUnavailable(response);
+		return;
 	}
-	catch (FileNotFoundException &fnfe)
+	WorkerLane::Slot slot(lane);
+
+	RequestTrace::mark(RequestTrace::PHASE_QUEUE);
+
+	const Arena &arena = *arenas;
+
+	ShareCache::Fill fill(cache, key, size, lastModified);
+
+	response.set("Last-Modified", DateTimeFormatter::format(lastModified, DateTimeFormat::HTTP_FORMAT));
+	response.setContentLength64(size);
+	response.setContentType(mediaType);
+	response.setChunkedTransferEncoding(false);
+
+	ostream &ostr = response.send();
+
+	Buffer<char> buffer(STREAM_CHUNK_SIZE);
+	File::FileSize received = 0;
+	while (ostr.good() && received < size)
 	{
-		sendNotFound(response);
+		istr.read(buffer.begin(), (streamsize) min(size - received, (File::FileSize) STREAM_CHUNK_SIZE));
+		streamsize n = istr.gcount();
+		if (n <= 0)
+			break;
+
+		received += n;
+
+		if (arena.throttled)
+			RequestThrottle::pace(arena.client, arena.share, n);
+
+		ostr.write(buffer.begin(), n);
+		fill.write(buffer.begin(), n);
 	}
-	catch (FileAccessDeniedException &fade)
+
+	// the upstream closed the connection early; the short body tells the client
+	if (received != size)
 	{
-		sendForbidden(response);
+		response.setKeepAlive(false);
+		return;
 	}
-	catch (FileException &fe)
+
+	// a copy is only kept if all of the file came from the upstream and reached the client
+	if (ostr.good())
+		fill.commit();
+}
+
+// Sends the response of the upstream as it is, with redirects mapped back into the share.
+void IndigoRequestHandler::relayResponse(HTTPServerRequest &request, HTTPServerResponse &response, const ProxyShare &proxy, const RequestPath &uriPath, HTTPResponse &upstreamResponse, istream &istr)
+{
+	static const char *const fields[] = {"Content-Type", "Content-Disposition", "Last-Modified", "Cache-Control", "ETag", "Repr-Digest", "Retry-After"};
+
+	HTTPResponse::HTTPStatus status = upstreamResponse.getStatus();
+	response.setStatusAndReason(status, upstreamResponse.getReason());
+
+	for (size_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++)
 	{
-		sendInternalServerError(response);
+		if (upstreamResponse.has(fields[i]))
+			response.set(fields[i], upstreamResponse.get(fields[i]));
 	}
-	catch (PathSyntaxException &pse)
+
+	if (upstreamResponse.has("Location"))
 	{
-		sendNotImplemented(response);
+		string shareName(uriPath.segment(0), uriPath.segmentLength(0));
+		response.set("Location", proxy.rewriteLocation(upstreamResponse.get("Location"), shareName));
 	}
-	catch (...)
+
+	// bodies of unknown length are passed on in chunks, or up to the end of the connection for HTTP/1.0 clients
+	if (upstreamResponse.getContentLength64() != HTTPMessage::UNKNOWN_CONTENT_LENGTH)
 	{
-		sendInternalServerError(response);
+		response.setContentLength64(upstreamResponse.getContentLength64());
+		response.setChunkedTransferEncoding(false);
+	}
+	else if (request.getVersion() == HTTPMessage::HTTP_1_1)
+	{
+		response.setChunkedTransferEncoding(true);
 	}
+	else
+	{
+		response.setChunkedTransferEncoding(false);
+		response.setKeepAlive(false);
+	}
+
+	ostream &ostr = response.send();
+
+	if (status == HTTPResponse::HTTP_NOT_MODIFIED || status == HTTPResponse::HTTP_NO_CONTENT)
+		return;
+
+	Int64 copied = StreamCopier::copyStream(istr, ostr);
+
+	// as in sendFetchedFile(), a body that the upstream cut short cannot be followed by another response
+	if (response.getContentLength64() != HTTPMessage::UNKNOWN_CONTENT_LENGTH && copied != response.getContentLength64())
+		response.setKeepAlive(false);
 }
 
-Path IndigoRequestHandler::resolveFSPath(const Path &uriPath)
+void IndigoRequestHandler::sendStreamedFile(HTTPServerResponse &response, const string &path, int file, const string &mediaType, File::FileSize size, const Timestamp &lastModified, bool large)
 {
-	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+	const Arena &arena = *arenas;
+
+	StreamingFile istr(path, file, large, IndigoConfiguration::get().getStreamReadahead());
+	RequestTrace::mark(RequestTrace::PHASE_OPEN);
+
+	response.set("Last-Modified", DateTimeFormatter::format(lastModified, DateTimeFormat::HTTP_FORMAT));
+	response.setContentLength64(size);
+	response.setContentType(mediaType);
+	response.setChunkedTransferEncoding(false);
 
-	const string &shareName = uriPath[0];
-	string base = configuration.getSharePath(shareName);
-	bool share = true;
+	ostream &ostr = response.send();
 
-	if (base.empty())
+	File::FileSize copied = 0;
+	Buffer<char> buffer(STREAM_CHUNK_SIZE);
+	while (ostr.good())
 	{
-		base = configuration.getRoot();
-		if (base.empty())
-			throw ShareNotFoundException();
+		streamsize n = istr.read(buffer.begin(), STREAM_CHUNK_SIZE);
+		if (n <= 0)
+			break;
+
+		if (arena.throttled)
+			RequestThrottle::pace(arena.client, arena.share, n);
+
+		ostr.write(buffer.begin(), n);
+		copied += n;
+	}
+
+	// the file was truncated while it was sent; the client can only tell by the connection closing before the end of the body
+	if (copied != size)
+		response.setKeepAlive(false);
+}
+
+// Sends a file the way sendStreamedFile() does, and copies it into the share cache at the same time.
+void IndigoRequestHandler::sendCachingFile(HTTPServerResponse &response, ShareCache &cache, const string &path, const string &mediaType, File::FileSize size, const Timestamp &lastModified)
+{
+	const Arena &arena = *arenas;
+
+	StreamingFile istr(path, false, 0);
+	RequestTrace::mark(RequestTrace::PHASE_OPEN);
+
+	ShareCache::Fill fill(cache, path, size, lastModified);
+
+	response.set("Last-Modified", DateTimeFormatter::format(lastModified, DateTimeFormat::HTTP_FORMAT));
+	response.setContentLength64(size);
+	response.setContentType(mediaType);
+	response.setChunkedTransferEncoding(false);
+
+	ostream &ostr = response.send();
+
+	File::FileSize copied = 0;
+	Buffer<char> buffer(STREAM_CHUNK_SIZE);
+	while (ostr.good())
+	{
+		streamsize n = istr.read(buffer.begin(), STREAM_CHUNK_SIZE);
+		if (n <= 0)
+			break;
 
-		share = false;
+		if (arena.throttled)
+			RequestThrottle::pace(arena.client, arena.share, n);
+
+		ostr.write(buffer.begin(), n);
+		fill.write(buffer.begin(), n);
+		copied += n;
+	}
+
+	// the file was truncated while it was sent, so the connection is closed, and the partial copy is dropped when the fill goes out of scope
+	if (copied != size)
+	{
+		response.setKeepAlive(false);
+		return;
 	}
 
-	Path fsPath(base);
+	// a copy is only kept if the client received all of it too, since the original is then known to be readable to the end,
+	// and if the original did not change while it was read
+	if (!ostr.good())
+		return;
+
+	fill.commit(path);
+}
+
+void IndigoRequestHandler::sendArchive(HTTPServerResponse &response, const string &path, const RequestPath &uriPath, DirectoryArchive::Format format, bool compress)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
 
-	if (share)
+	// archives are bulk transfers, whatever their size turns out to be
+	if (!bulkLane.enter(configuration.getBulkLaneLimit(), configuration.getBulkLaneWait()))
 	{
-		fsPath.makeDirectory();
+		sendServiceUnavailable(response);
+		return;
+	}
+	WorkerLane::Slot slot(bulkLane);
+
+	string name = "root";
+	int depth = uriPath.depth();
+	if (depth > 0)
+		name.assign(uriPath.segment(depth - 1), uriPath.segmentLength(depth - 1));
+
+	string fileName = DirectoryArchive::getFileName(name, format, compress);
+	replaceInPlace(fileName, string("\\"), string("_"));
+	replaceInPlace(fileName, string("\""), string("_"));
+
+	response.setContentType(DirectoryArchive::getMediaType(format, compress));
+	response.set("Content-Disposition", "attachment; filename=\"" + fileName + "\"");
 
-		int d = uriPath.depth();
-		for (int i = 1; i <= d; i++)
-			fsPath.pushDirectory(uriPath[i]);
+	// the size is not known in advance
+	if (response.getVersion() == HTTPMessage::HTTP_1_0)
+	{
+		response.setChunkedTransferEncoding(false);
+		response.setKeepAlive(false);
 	}
 	else
 	{
-		fsPath.append(uriPath);
+		response.setChunkedTransferEncoding(true);
 	}
 
-	fsPath.makeFile();
-	return fsPath;
+	const Arena &arena = *arenas;
+	ostream &ostr = response.send();
+
+	if (arena.throttled)
+	{
+		PacedDirectoryArchive archive(ostr, format, compress, arena.client, arena.share);
+		archive.addTree(path, name);
+		archive.finish();
+	}
+	else
+	{
+		DirectoryArchive archive(ostr, format, compress);
+		archive.addTree(path, name);
+		archive.finish();
+	}
 }
 
-void IndigoRequestHandler::sendFile(HTTPServerResponse &response, const Path &path)
+// Sends the manifest of a directory tree, taken from the share index if there is one, or only the entries
+// changed since the token if the change journal still knows them.
+void IndigoRequestHandler::sendManifest(HTTPServerResponse &response, const string &path, const RequestPath &uriPath, const string &since, const ShareIndex *index, const ShareIndex::Entry *entry)
 {
-	string ext = path.getExtension();
-	const string &mediaType = IndigoConfiguration::get().getMimeType(ext);
-	response.sendFile(path.toString(), mediaType);
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	// changes are journaled by share, with paths relative to the share, and only writable shares change through the server;
+	// anywhere else files can only change outside the server, where the journal cannot see them, so the tree is always walked
+	bool journaled = (uriPath.depth() > 0 && configuration.isShareWritable(uriPath.segment(0), uriPath.segmentLength(0)));
+
+	// the token is taken first, so that changes made during the walk are also reported by the next manifest
+	string token = ChangeJournal::token();
+	vector<string> changes;
+	bool full = true;
+	if (journaled && !since.empty())
+	{
+		string share(uriPath.segment(0), uriPath.segmentLength(0));
+
+		string prefix;
+		uriPath.appendSegments(prefix, 1, '/');
+		if (!prefix.empty())
+			prefix += '/';
+
+		full = !ChangeJournal::changesSince(since, share, prefix, changes);
+	}
+
+	if (!full)
+	{
+		writeManifest(response, path, token, &changes, NULL, NULL);
+		return;
+	}
+
+	// walking a whole tree takes as long as a bulk transfer
+	if (!bulkLane.enter(configuration.getBulkLaneLimit(), configuration.getBulkLaneWait()))
+	{
+		sendServiceUnavailable(response);
+		return;
+	}
+	WorkerLane::Slot slot(bulkLane);
+
+	writeManifest(response, path, token, NULL, index, entry);
 }
 
-void IndigoRequestHandler::sendFile(HTTPServerResponse &response, const string &path)
+// Writes the manifest of the changes, or of the whole tree if there are none.
+void IndigoRequestHandler::writeManifest(HTTPServerResponse &response, const string &path, const string &token, const vector<string> *changes, const ShareIndex *index, const ShareIndex::Entry *entry)
 {
-	string ext = Path(path).getExtension();
-	const string &mediaType = IndigoConfiguration::get().getMimeType(ext);
-	response.sendFile(path, mediaType);
+	response.setContentType(DirectoryManifest::mediaType);
+	response.set("Cache-Control", "no-cache");
+
+	// the size is not known in advance
+	if (response.getVersion() == HTTPMessage::HTTP_1_0)
+	{
+		response.setChunkedTransferEncoding(false);
+		response.setKeepAlive(false);
+	}
+	else
+	{
+		response.setChunkedTransferEncoding(true);
+	}
+
+	ostream &ostr = response.send();
+	DirectoryManifest manifest(ostr);
+	manifest.writeHeader(changes == NULL, token);
+
+	if (changes != NULL)
+		manifest.addChanges(path, *changes);
+	else if (index != NULL)
+		manifest.addIndexedTree(*index, *entry, path);
+	else
+		manifest.addTree(path);
 }
 
-void IndigoRequestHandler::sendDirectoryListing(HTTPServerResponse &response, const string &uri, const vector<string> &entries)
+string IndigoRequestHandler::formatDirectoryListing(const string &uri, const vector<string> &entries)
 {
 	const IndigoConfiguration &configuration = IndigoConfiguration::get();
 
 	bool root = (uri == "/");
 
-	response.setContentLength(HTTPResponse::UNKNOWN_CONTENT_LENGTH);
-	response.setContentType("text/html");
-	response.setChunkedTransferEncoding(true);
-
-	ostream &out = response.send();
+	ostringstream out;
 
 	out << "<html>" << endl;
 	out << " <head>" << endl;
@@ -247,22 +1454,47 @@ void IndigoRequestHandler::sendDirectoryListing(HTTPServerResponse &response, co
 
 	out << "</body>" << endl;
 	out << "</html>" << endl;
+
+	return out.str();
+}
+
+void IndigoRequestHandler::sendDirectoryListing(HTTPServerRequest &request, HTTPServerResponse &response, const string &body)
+{
+	const string mediaType = "text/html";
+
+	smallLane.enter(0, 0);
+	WorkerLane::Slot slot(smallLane);
+
+	const Arena &arena = *arenas;
+	if (arena.throttled)
+		RequestThrottle::pace(arena.client, arena.share, body.length());
+
+	if (FastResponse::sendBuffer(request, response, mediaType, body))
+		return;
+
+	response.setContentType(mediaType);
+	response.sendBuffer(body.data(), body.length());
 }
 
-Path IndigoRequestHandler::findVirtualIndex()
+string IndigoRequestHandler::findVirtualIndex()
 {
 	const IndigoConfiguration &configuration = IndigoConfiguration::get();
 
 	const vector<string> &indexes = configuration.getIndexes();
 
+	RequestPath indexURI;
+	string index;
+
 	vector<string>::const_iterator it;
 	vector<string>::const_iterator end = indexes.end();
 	for (it = indexes.begin(); it != end; ++it)
 	{
 		try
 		{
-			Path indexURI = Path('/' + *it, Path::PATH_UNIX);
-			Path index = resolveFSPath(indexURI);
+			if (!indexURI.assign('/' + *it))
+				continue;
+
+			resolveFSPath(indexURI, index);
 
 			File f(index);
 			if (f.isFile())
@@ -279,17 +1511,18 @@ Path IndigoRequestHandler::findVirtualIndex()
 		}
 	}
 
-	return Path(false);
+	return "";
 }
 
-void IndigoRequestHandler::sendVirtualIndex(HTTPServerResponse &response)
+void IndigoRequestHandler::sendVirtualIndex(HTTPServerRequest &request, HTTPServerResponse &response)
 {
 	const IndigoConfiguration &configuration = IndigoConfiguration::get();
 
-	Path index = findVirtualIndex();
-	if (index.isAbsolute())
+	string index = findVirtualIndex();
+	RequestTrace::mark(RequestTrace::PHASE_INDEX);
+	if (!index.empty())
 	{
-		sendFile(response, index);
+		sendFile(request, response, File(index));
 		return;
 	}
 
@@ -299,6 +1532,9 @@ void IndigoRequestHandler::sendVirtualIndex(HTTPServerResponse &response)
 	const vector<string> &shares = configuration.getShares();
 	vector<string> entries;
 
+	RequestPath shareURI;
+	string fsPath;
+
 	vector<string>::const_iterator it;
 	vector<string>::const_iterator end = shares.end();
 	for (it = shares.begin(); it != end; ++it)
@@ -306,8 +1542,17 @@ void IndigoRequestHandler::sendVirtualIndex(HTTPServerResponse &response)
 		const string &shareName = *it;
 		try
 		{
-			Path shareURI = Path('/' + shareName, Path::PATH_UNIX);
-			Path fsPath = resolveFSPath(shareURI);
+			if (configuration.findShareBundle(shareName.data(), shareName.length()) != NULL ||
+				configuration.findShareProxy(shareName.data(), shareName.length()) != NULL)
+			{
+				entries.push_back(shareName + '/');
+				continue;
+			}
+
+			if (!shareURI.assign('/' + shareName))
+				continue;
+
+			resolveFSPath(shareURI, fsPath);
 			File f(fsPath);
 
 			if (!f.isHidden())
@@ -330,7 +1575,7 @@ void IndigoRequestHandler::sendVirtualIndex(HTTPServerResponse &response)
 		}
 	}
 
-	sendDirectoryListing(response, "/", entries);
+	sendDirectoryListing(request, response, formatDirectoryListing("/", entries));
 }
 
 string IndigoRequestHandler::findDirectoryIndex(const string &base)
@@ -365,20 +1610,30 @@ string IndigoRequestHandler::findDirectoryIndex(const string &base)
 	return "";
 }
 
-void IndigoRequestHandler::sendDirectoryIndex(HTTPServerResponse &response, const string &path, const string &uri)
+void IndigoRequestHandler::sendDirectoryIndex(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, const string &uri)
 {
 	const IndigoConfiguration &configuration = IndigoConfiguration::get();
 
 	string index = findDirectoryIndex(path);
+	RequestTrace::mark(RequestTrace::PHASE_INDEX);
 	if (!index.empty())
 	{
-		sendFile(response, index);
+		sendFile(request, response, File(index));
 		return;
 	}
 
 	if (!configuration.getAutoIndex())
 		throw FileNotFoundException();
 
+	// concurrent requests for the same listing share one walk of the directory
+	SingleFlight::Call call(listingFlights, path + '\n' + uri, configuration.getCoalesceWait());
+	if (!call.result().isNull())
+	{
+		RequestTrace::mark(RequestTrace::PHASE_STAT);
+		sendDirectoryListing(request, response, *call.result());
+		return;
+	}
+
 	vector<string> entries;
 
 	DirectoryIterator it(path);
@@ -406,7 +1661,50 @@ void IndigoRequestHandler::sendDirectoryIndex(HTTPServerResponse &response, cons
 		++it;
 	}
 
-	sendDirectoryListing(response, uri, entries);
+	RequestTrace::mark(RequestTrace::PHASE_STAT);
+
+	SingleFlight::Result body = new string(formatDirectoryListing(uri, entries));
+	call.complete(body);
+
+	sendDirectoryListing(request, response, *body);
+}
+
+void IndigoRequestHandler::sendStatus(HTTPServerRequest &request, HTTPServerResponse &response)
+{
+	ostringstream out;
+
+	out << "Requests: " << requestCount.value() << endl;
+	RequestThrottle::appendStatus(out);
+	AdmissionControl::appendStatus(out);
+	RequestTrace::appendStatus(out);
+	Http2Connection::appendStatus(out);
+#ifdef INDIGO_TLS
+	TlsConnection::appendStatus(out);
+#endif
+	smallLane.appendStatus(out);
+	bulkLane.appendStatus(out);
+	SenderReactor::appendStatus(out);
+	ShareWriter::appendStatus(out);
+	ChangeJournal::appendStatus(out);
+	BlockChecksums::appendStatus(out);
+	listingFlights.appendStatus(out);
+	tableFlights.appendStatus(out);
+	IndigoConfiguration::get().appendIndexStatus(out);
+	IndigoConfiguration::get().appendCacheStatus(out);
+	IndigoConfiguration::get().appendProxyStatus(out);
+	DigestCache::appendStatus(out);
+	PageCacheWarmer::appendStatus(out);
+
+	const string mediaType = "text/plain";
+	const string body = out.str();
+
+	response.set("Cache-Control", "no-cache");
+
+	if (FastResponse::sendBuffer(request, response, mediaType, body))
+		return;
+
+	response.setContentType(mediaType);
+	response.sendBuffer(body.data(), body.length());
 }
 
 void IndigoRequestHandler::redirectToDirectory(HTTPServerResponse &response, const string &uri, bool permanent)
@@ -440,23 +1738,30 @@ void IndigoRequestHandler::logRequest(const HTTPServerRequest &request)
 	}
 }
 
-void IndigoRequestHandler::sendError(HTTPServerResponse &response, int code)
+void IndigoRequestHandler::sendError(HTTPServerResponse &response, int code, const string &reason)
 {
+	// a response that is already under way can only be cut short by closing the connection
 	if (response.sent())
+	{
+		response.setKeepAlive(false);
 		return;
+	}
 
-	response.setStatusAndReason(HTTPResponse::HTTPStatus(code));
+	if (reason.empty())
+		response.setStatusAndReason(HTTPResponse::HTTPStatus(code));
+	else
+		response.setStatusAndReason(HTTPResponse::HTTPStatus(code), reason);
 	response.setContentLength(HTTPResponse::UNKNOWN_CONTENT_LENGTH);
 	response.setContentType("text/html");
 	response.setChunkedTransferEncoding(false);
 	response.setKeepAlive(false);
 
-	const string &reason = response.getReason();
+	const string &responseReason = response.getReason();
 
 	ostream &out = response.send();
 	out << "<html>";
-	out << "<head><title>" + NumberFormatter::format(code) + " " + reason + "</title></head>";
-	out << "<body><h1>" + reason + "</h1></body>";
+	out << "<head><title>" + NumberFormatter::format(code) + " " + responseReason + "</title></head>";
+	out << "<body><h1>" + responseReason + "</h1></body>";
 	out << "</html>";
 }
 
@@ -494,3 +1799,16 @@ void IndigoRequestHandler::sendInternalServerError(HTTPServerResponse &response)
 {
 	sendError(response, HTTPResponse::HTTP_INTERNAL_SERVER_ERROR);
 }
+
+void IndigoRequestHandler::sendTooManyRequests(HTTPServerResponse &response, long retryAfter)
+{
+	// round up to whole seconds, as required by the header format
+	response.set("Retry-After", NumberFormatter::format((retryAfter + 999) / 1000));
+	sendError(response, 429, "Too Many Requests");
+}
+
+void IndigoRequestHandler::sendServiceUnavailable(HTTPServerResponse &response)
+{
+	response.set("Retry-After", "1");
+	sendError(response, HTTPResponse::HTTP_SERVICE_UNAVAILABLE);
+}
@@ -33,6 +33,19 @@
 #include "Poco/Net/HTTPServerRequest.h"
 #include "Poco/Net/HTTPServerResponse.h"
 #include "Poco/Path.h"
+#include "Poco/File.h"
+#include "Poco/ThreadLocal.h"
+#include "Poco/AtomicCounter.h"
+#include "Poco/Timestamp.h"
+
+#include "RequestPath.h"
+#include "WorkerLane.h"
+#include "SingleFlight.h"
+#include "DirectoryArchive.h"
+#include "Bundle.h"
+#include "ShareIndex.h"
+#include "ShareCache.h"
+#include "ProxyShare.h"
 
 using namespace std;
 
@@ -47,17 +60,54 @@ public:
 	void handleRequest(HTTPServerRequest &request, HTTPServerResponse &response);
 
 private:
-	static Path resolveFSPath(const Path &uriPath);
-	static void sendFile(HTTPServerResponse &response, const Path &path);
-	static void sendFile(HTTPServerResponse &response, const string &path);
-	static void sendDirectoryListing(HTTPServerResponse &response, const string &uri, const vector<string> &entries);
-	static Path findVirtualIndex();
-	static void sendVirtualIndex(HTTPServerResponse &response);
+	// per-thread buffers reused by all requests of a connection
+	struct Arena
+	{
+		Arena();
+
+		RequestPath uriPath;
+		string target;
+		File file;
+		string client;
+		string share;
+		bool throttled;
+	};
+
+	static void changeEntry(HTTPServerRequest &request, HTTPServerResponse &response, const RequestPath &uriPath);
+	static bool authorize(const HTTPServerRequest &request);
+	static bool equalSecrets(const string &a, const string &b);
+	static void resolveFSPath(const RequestPath &uriPath, string &fsPath);
+	static const string &getMediaType(const string &path);
+	static void sendFile(HTTPServerRequest &request, HTTPServerResponse &response, const File &file);
+	static void sendFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, File::FileSize size, const Timestamp &lastModified);
+	static void sendFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, const string &mediaType, File::FileSize size, const Timestamp &lastModified);
+	static void sendFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, int file, const string &mediaType, File::FileSize size, const Timestamp &lastModified);
+	static void sendBlockTable(HTTPServerResponse &response, const string &path, File::FileSize size, const Timestamp &lastModified, int blockSize);
+	static void sendBlocks(HTTPServerResponse &response, const string &path, File::FileSize size, const Timestamp &lastModified, int blockSize, const string &version, const string &blocks);
+	static bool sendDigestFields(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, File::FileSize size);
+	static bool sendNotModified(HTTPServerRequest &request, HTTPServerResponse &response, File::FileSize size, const Timestamp &lastModified);
+	static bool sendIndexedEntry(HTTPServerRequest &request, HTTPServerResponse &response, const ShareIndex &index, const ShareIndex::Entry &entry, const RequestPath &uriPath, const string &path);
+	static bool sendIndexedFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, const ShareIndex::Entry &entry);
+	static void sendBundleEntry(HTTPServerRequest &request, HTTPServerResponse &response, const Bundle &bundle, const RequestPath &uriPath);
+	static void sendBundleFile(HTTPServerRequest &request, HTTPServerResponse &response, const string &name, const Bundle::Entry &entry);
+	static void sendCachingFile(HTTPServerResponse &response, ShareCache &cache, const string &path, const string &mediaType, File::FileSize size, const Timestamp &lastModified);
+	static void sendProxyEntry(HTTPServerRequest &request, HTTPServerResponse &response, const ProxyShare &proxy, const RequestPath &uriPath);
+	static void sendFetchedFile(HTTPServerResponse &response, ShareCache &cache, const string &key, istream &istr, const string &mediaType, File::FileSize size, const Timestamp &lastModified);
+	static void relayResponse(HTTPServerRequest &request, HTTPServerResponse &response, const ProxyShare &proxy, const RequestPath &uriPath, HTTPResponse &upstreamResponse, istream &istr);
+	static void sendStreamedFile(HTTPServerResponse &response, const string &path, int file, const string &mediaType, File::FileSize size, const Timestamp &lastModified, bool large);
+	static void sendArchive(HTTPServerResponse &response, const string &path, const RequestPath &uriPath, DirectoryArchive::Format format, bool compress);
+	static void sendManifest(HTTPServerResponse &response, const string &path, const RequestPath &uriPath, const string &since, const ShareIndex *index, const ShareIndex::Entry *entry);
+	static void writeManifest(HTTPServerResponse &response, const string &path, const string &token, const vector<string> *changes, const ShareIndex *index, const ShareIndex::Entry *entry);
+	static string formatDirectoryListing(const string &uri, const vector<string> &entries);
+	static void sendDirectoryListing(HTTPServerRequest &request, HTTPServerResponse &response, const string &body);
+	static string findVirtualIndex();
+	static void sendVirtualIndex(HTTPServerRequest &request, HTTPServerResponse &response);
 	static string findDirectoryIndex(const string &base);
-	static void sendDirectoryIndex(HTTPServerResponse &response, const string &path, const string &uri);
+	static void sendDirectoryIndex(HTTPServerRequest &request, HTTPServerResponse &response, const string &path, const string &uri);
+	static void sendStatus(HTTPServerRequest &request, HTTPServerResponse &response);
 	static void redirectToDirectory(HTTPServerResponse &response, const string &uri, bool permanent);
 	static void logRequest(const HTTPServerRequest &request);
-	static void sendError(HTTPServerResponse &response, int code);
+	static void sendError(HTTPServerResponse &response, int code, const string &reason = "");
 	static void sendMethodNotAllowed(HTTPServerResponse &response);
 	static void sendRequestURITooLong(HTTPServerResponse &response);
 	static void sendBadRequest(HTTPServerResponse &response);
@@ -65,6 +115,15 @@ private:
 	static void sendNotFound(HTTPServerResponse &response);
 	static void sendForbidden(HTTPServerResponse &response);
 	static void sendInternalServerError(HTTPServerResponse &response);
+	static void sendTooManyRequests(HTTPServerResponse &response, long retryAfter);
+	static void sendServiceUnavailable(HTTPServerResponse &response);
+
+	static ThreadLocal<Arena> arenas;
+	static AtomicCounter requestCount;
+	static WorkerLane smallLane;
+	static WorkerLane bulkLane;
+	static SingleFlight listingFlights;
+	static SingleFlight tableFlights;
 };
 
 #endif //INDIGOREQUESTHANDLER_H
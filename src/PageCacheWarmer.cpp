@@ -0,0 +1,416 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <algorithm>
+#include <functional>
+
+#include "Poco/Util/Application.h"
+#include "Poco/File.h"
+#include "Poco/FileStream.h"
+#include "Poco/URI.h"
+#include "Poco/NumberParser.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/Buffer.h"
+#include "Poco/Timestamp.h"
+#include "Poco/ScopedLock.h"
+#include "Poco/Exception.h"
+
+#if defined(POCO_OS_FAMILY_UNIX)
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#endif
+
+#include "PageCacheWarmer.h"
+#include "IndigoConfiguration.h"
+
+using namespace Poco::Util;
+
+// the most requested files are written to the store this often, in seconds
+#define HOT_FILES_SAVE_INTERVAL 600
+
+// files are warmed in chunks of this size
+#define WARM_CHUNK_SIZE 1048576
+
+bool PageCacheWarmer::running = false;
+string PageCacheWarmer::storePath;
+Int64 PageCacheWarmer::lockSize = 0;
+
+unordered_map<string, UInt32> PageCacheWarmer::counts;
+vector<pair<void *, size_t> > PageCacheWarmer::locked;
+UInt64 PageCacheWarmer::warmedFiles = 0;
+UInt64 PageCacheWarmer::warmedBytes = 0;
+UInt64 PageCacheWarmer::lockedBytes = 0;
+FastMutex PageCacheWarmer::mutex;
+
+Thread *PageCacheWarmer::thread = NULL;
+PageCacheWarmer::WarmerRunnable PageCacheWarmer::runnable;
+
+PageCacheWarmer::WarmerRunnable::WarmerRunnable():
+	stopWarm(false)
+{
+}
+
+void PageCacheWarmer::WarmerRunnable::run()
+{
+	vector<string> paths;
+	loadStore(paths);
+	warmFiles(paths);
+
+	while (pause(HOT_FILES_SAVE_INTERVAL * 1000))
+		saveStore();
+
+	saveStore();
+}
+
+void PageCacheWarmer::WarmerRunnable::stopWarming()
+{
+	stopWarm.set();
+}
+
+// Returns false if the warmer is stopping.
+bool PageCacheWarmer::WarmerRunnable::pause(long milliseconds)
+{
+	return !stopWarm.tryWait(milliseconds);
+}
+
+void PageCacheWarmer::start(const string &storePath, Int64 lockSize)
+{
+#if defined(POCO_OS_FAMILY_UNIX)
+	PageCacheWarmer::storePath = storePath;
+	PageCacheWarmer::lockSize = lockSize;
+	running = true;
+
+	thread = new Thread("PageCacheWarmer");
+	thread->start(runnable);
+#endif
+}
+
+void PageCacheWarmer::stop()
+{
+	if (thread == NULL)
+		return;
+
+	runnable.stopWarming();
+	thread->join();
+	delete thread;
+	thread = NULL;
+
+	unlockFiles();
+}
+
+bool PageCacheWarmer::enabled()
+{
+	return running;
+}
+
+void PageCacheWarmer::record(const string &path)
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	unordered_map<string, UInt32>::iterator it = counts.find(path);
+	if (it != counts.end())
+		it->second++;
+	else if (counts.size() < MAX_TRACKED)
+		counts[path] = 1;
+}
+
+void PageCacheWarmer::appendStatus(ostream &out)
+{
+	if (!running)
+		return;
+
+	FastMutex::ScopedLock lock(mutex);
+
+	out << "Page cache warming: " << counts.size() << " files tracked, " << warmedFiles << " files warmed (" << warmedBytes << " bytes), ";
+	out << locked.size() << " files locked (" << lockedBytes << " bytes)" << endl;
+}
+
+// Reads the files listed by the previous run, hottest first. Their counts are carried over, so that the
+// files stay hot until others are requested more often.
+void PageCacheWarmer::loadStore(vector<string> &paths)
+{
+	try
+	{
+		File file(storePath);
+		if (!file.exists())
+			return;
+
+		FileInputStream istr(storePath);
+		string line;
+		while (getline(istr, line))
+		{
+			string::size_type space = line.find(' ');
+			unsigned count;
+			if (space == string::npos || !NumberParser::tryParseUnsigned(line.substr(0, space), count))
+				continue;
+
+			string path;
+			URI::decode(line.substr(space + 1), path);
+			paths.push_back(path);
+
+			FastMutex::ScopedLock lock(mutex);
+			if (counts.size() < MAX_TRACKED)
+				counts[path] = count;
+		}
+	}
+	catch (Exception &e)
+	{
+		Application::instance().logger().error("Unable to read the hot file store " + storePath + ": " + e.displayText());
+	}
+}
+
+// Writes the most requested files to the store, and halves the counts, so that files that are no longer
+// requested cool down and make room for others.
+void PageCacheWarmer::saveStore()
+{
+	vector<pair<UInt32, string> > hottest;
+	{
+		FastMutex::ScopedLock lock(mutex);
+
+		hottest.reserve(counts.size());
+		unordered_map<string, UInt32>::iterator it = counts.begin();
+		while (it != counts.end())
+		{
+			hottest.push_back(make_pair(it->second, it->first));
+			it->second /= 2;
+			if (it->second == 0)
+				it = counts.erase(it);
+			else
+				++it;
+		}
+	}
+
+	// the warmer thread handles no requests, so it pins the configuration itself while it reads it
+	size_t count;
+	{
+		IndigoConfiguration::Snapshot snapshot;
+		count = IndigoConfiguration::get().getHotFileCount();
+	}
+	if (count > hottest.size())
+		count = hottest.size();
+	partial_sort(hottest.begin(), hottest.begin() + count, hottest.end(), greater<pair<UInt32, string> >());
+
+	try
+	{
+		string tempPath = storePath + ".tmp";
+		{
+			FileOutputStream ostr(tempPath);
+			for (size_t i = 0; i < count; i++)
+			{
+				string line;
+				URI::encode(hottest[i].second, "", line);
+				ostr << hottest[i].first << ' ' << line << '\n';
+			}
+		}
+		File(tempPath).renameTo(storePath);
+	}
+	catch (Exception &e)
+	{
+		Application::instance().logger().error("Unable to write the hot file store " + storePath + ": " + e.displayText());
+	}
+}
+
+#if defined(POCO_OS_FAMILY_UNIX)
+
+void PageCacheWarmer::warmFiles(const vector<string> &paths)
+{
+	// streamed files are dropped from the page cache as they are sent, so warming them would be wasted
+	int streamFileSize;
+	{
+		IndigoConfiguration::Snapshot snapshot;
+		streamFileSize = IndigoConfiguration::get().getStreamFileSize();
+	}
+	UInt64 lockBudget = (UInt64) lockSize * 1048576;
+
+	vector<string>::const_iterator end = paths.end();
+	for (vector<string>::const_iterator it = paths.begin(); it != end; ++it)
+	{
+		int fd = open(it->c_str(), O_RDONLY);
+		if (fd < 0)
+			continue;
+
+		struct stat st;
+		bool warm = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0 &&
+			(streamFileSize <= 0 || st.st_size <= (off_t) streamFileSize));
+
+		bool stopping = false;
+		if (warm)
+		{
+			// the hottest files are locked while the budget lasts, and the rest are only read
+			UInt64 size = st.st_size;
+			Timestamp started;
+			if (lockSize > 0 && size <= lockBudget && lockFile(fd, size))
+			{
+				lockBudget -= size;
+				stopping = !pace(size, started.elapsed());
+			}
+			else
+			{
+				stopping = !warmFile(fd, size);
+			}
+		}
+
+		close(fd);
+
+		if (stopping)
+			break;
+	}
+
+	if (!paths.empty())
+	{
+		FastMutex::ScopedLock lock(mutex);
+		Application::instance().logger().information("Warmed " + NumberFormatter::format(warmedFiles) + " of " +
+			NumberFormatter::format(paths.size()) + " hot files");
+	}
+}
+
+// Returns false if the warmer was stopped before the whole file was read.
+bool PageCacheWarmer::warmFile(int fd, UInt64 size)
+{
+	Buffer<char> buffer(WARM_CHUNK_SIZE);
+
+	for (UInt64 offset = 0; offset < size; offset += WARM_CHUNK_SIZE)
+	{
+		size_t length = (size - offset < WARM_CHUNK_SIZE ? (size_t) (size - offset) : WARM_CHUNK_SIZE);
+
+		// the advice starts reading the whole chunk at once, and the read waits for it,
+		// which tells how long the disk took
+		Timestamp started;
+#if defined(POSIX_FADV_WILLNEED)
+		posix_fadvise(fd, offset, length, POSIX_FADV_WILLNEED);
+#endif
+		ssize_t n;
+		do
+		{
+			n = pread(fd, buffer.begin(), length, offset);
+		}
+		while (n < 0 && errno == EINTR);
+
+		if (n <= 0)
+			break;
+
+		{
+			FastMutex::ScopedLock lock(mutex);
+			warmedBytes += n;
+		}
+
+		if (!pace(n, started.elapsed()))
+			return false;
+	}
+
+	FastMutex::ScopedLock lock(mutex);
+	warmedFiles++;
+	return true;
+}
+
+// Maps the file and locks it in memory. The pages are read by mlock(), and stay resident until the server stops.
+bool PageCacheWarmer::lockFile(int fd, UInt64 size)
+{
+	void *address = mmap(NULL, (size_t) size, PROT_READ, MAP_SHARED, fd, 0);
+	if (address == MAP_FAILED)
+		return false;
+
+	if (mlock(address, (size_t) size) != 0)
+	{
+		int error = errno;
+		munmap(address, (size_t) size);
+
+		// without the privilege or the limit to lock more, the remaining files are only warmed
+		if (error == EPERM || error == ENOMEM)
+		{
+			Application::instance().logger().warning(string("Unable to lock hot files in memory: ") + strerror(error));
+			lockSize = 0;
+		}
+		return false;
+	}
+
+	FastMutex::ScopedLock lock(mutex);
+	locked.push_back(make_pair(address, (size_t) size));
+	lockedBytes += size;
+	warmedBytes += size;
+	warmedFiles++;
+	return true;
+}
+
+void PageCacheWarmer::unlockFiles()
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	for (size_t i = 0; i < locked.size(); i++)
+		munmap(locked[i].first, locked[i].second);
+	locked.clear();
+	lockedBytes = 0;
+}
+
+#else
+
+void PageCacheWarmer::warmFiles(const vector<string> &paths)
+{
+}
+
+bool PageCacheWarmer::warmFile(int fd, UInt64 size)
+{
+	return false;
+}
+
+bool PageCacheWarmer::lockFile(int fd, UInt64 size)
+{
+	return false;
+}
+
+void PageCacheWarmer::unlockFiles()
+{
+}
+
+#endif
+
+// Waits after reading bytes in elapsed microseconds, for as long as the read took, and for longer if needed
+// to keep to the byte rate. Returns false if the warmer is stopping.
+bool PageCacheWarmer::pace(UInt64 bytes, Int64 elapsed)
+{
+	Int64 wait = elapsed;
+
+	int byteRate;
+	{
+		IndigoConfiguration::Snapshot snapshot;
+		byteRate = IndigoConfiguration::get().getPrewarmByteRate();
+	}
+	if (byteRate > 0)
+	{
+		Int64 budget = (Int64) (bytes * 1000000 / byteRate) - elapsed;
+		if (budget > wait)
+			wait = budget;
+	}
+
+	return runnable.pause((long) (wait / 1000));
+}
@@ -0,0 +1,113 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef PAGECACHEWARMER_H
+#define PAGECACHEWARMER_H
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <ostream>
+#include <tr1/unordered_map> // change to <unordered_map> on c++0x compilers
+
+#include "Poco/Platform.h"
+#include "Poco/Types.h"
+#include "Poco/Thread.h"
+#include "Poco/Runnable.h"
+#include "Poco/Event.h"
+#include "Poco/Mutex.h"
+
+using namespace std;
+using namespace std::tr1; // remove this on c++0x compilers
+
+using namespace Poco;
+
+// Refills the page cache after a restart. Request threads count how often
+// each file is sent, and a background thread periodically writes the most
+// requested ones to the store file, hottest first. When the server starts,
+// the same thread reads the files listed there, so that they are in the
+// page cache before clients ask for them, and optionally locks the hottest
+// of them in memory. Warming waits after each read for as long as the read
+// took, so that it yields to live traffic when the disk is busy, and is also
+// limited to a configured byte rate.
+// Warming is only available on Unix.
+class PageCacheWarmer
+{
+public:
+	static void start(const string &storePath, Int64 lockSize);
+	static void stop();
+	static bool enabled();
+
+	static void record(const string &path);
+	static void appendStatus(ostream &out);
+
+private:
+	class WarmerRunnable: public Runnable
+	{
+	public:
+		WarmerRunnable();
+
+		void run();
+		void stopWarming();
+		bool pause(long milliseconds);
+
+	private:
+		Event stopWarm;
+	};
+
+	static void loadStore(vector<string> &paths);
+	static void saveStore();
+	static void warmFiles(const vector<string> &paths);
+	static bool warmFile(int fd, UInt64 size);
+	static bool lockFile(int fd, UInt64 size);
+	static bool pace(UInt64 bytes, Int64 elapsed);
+	static void unlockFiles();
+
+	enum
+	{
+		MAX_TRACKED = 65536
+	};
+
+	static bool running;
+	static string storePath;
+	static Int64 lockSize;
+
+	static unordered_map<string, UInt32> counts;
+	static vector<pair<void *, size_t> > locked;
+	static UInt64 warmedFiles;
+	static UInt64 warmedBytes;
+	static UInt64 lockedBytes;
+	static FastMutex mutex;
+
+	static Thread *thread;
+	static WarmerRunnable runnable;
+};
+
+#endif //PAGECACHEWARMER_H
@@ -0,0 +1,171 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "Poco/URI.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/Exception.h"
+
+#include "ProxyShare.h"
+
+ProxyShare::ProxyShare(const string &url, SharedPtr<ShareCache> cache):
+	host(),
+	port(80),
+	prefix(),
+	cache(cache),
+	fetched(),
+	revalidated(),
+	relayed(),
+	failed()
+{
+	parseURL(url, host, port, prefix);
+}
+
+bool ProxyShare::isProxy(const string &sharePath)
+{
+	return sharePath.compare(0, 7, "http://") == 0;
+}
+
+// Splits the URL of an upstream directory. The prefix is the path of the directory, without a trailing slash.
+bool ProxyShare::parseURL(const string &url, string &host, UInt16 &port, string &prefix)
+{
+	try
+	{
+		URI uri(url);
+		if (uri.getScheme() != "http" || uri.getHost().empty() || !uri.getQuery().empty() || !uri.getFragment().empty())
+			return false;
+
+		host = uri.getHost();
+		port = uri.getPort();
+		prefix = uri.getPath();
+		while (!prefix.empty() && prefix[prefix.length() - 1] == '/')
+			prefix.resize(prefix.length() - 1);
+
+		return true;
+	}
+	catch (SyntaxException &se)
+	{
+		return false;
+	}
+}
+
+const string &ProxyShare::getHost() const
+{
+	return host;
+}
+
+UInt16 ProxyShare::getPort() const
+{
+	return port;
+}
+
+ShareCache *ProxyShare::getCache() const
+{
+	return cache.isNull() ? NULL : const_cast<ShareCache *>(cache.get());
+}
+
+// Returns the upstream request URI for the part of the request path below the share, with the query.
+string ProxyShare::makeURI(const RequestPath &uriPath) const
+{
+	string uri = prefix;
+
+	int depth = uriPath.depth();
+	for (int i = 1; i < depth; i++)
+	{
+		uri += '/';
+		URI::encode(string(uriPath.segment(i), uriPath.segmentLength(i)), "?#", uri);
+	}
+
+	if (uriPath.isDirectory() || uri.empty())
+		uri += '/';
+
+	if (uriPath.queryLength() > 0)
+	{
+		uri += '?';
+		uri.append(uriPath.query(), uriPath.queryLength());
+	}
+
+	return uri;
+}
+
+// Copies are kept by upstream and path, so that moving the share to another upstream does not serve stale copies.
+string ProxyShare::makeKey(const string &uri) const
+{
+	string key = "http://" + host + ':';
+	NumberFormatter::append(key, (unsigned) port);
+	key += uri;
+	return key;
+}
+
+// Maps a redirect of the upstream to the same place in this share, such as the directory redirects of Indigo Filer.
+string ProxyShare::rewriteLocation(const string &location, const string &shareName) const
+{
+	string path = location;
+
+	string origin = "http://" + host;
+	if (path.compare(0, origin.length(), origin) == 0 && (path.length() == origin.length() || path.find_first_of(":/", origin.length()) == origin.length()))
+	{
+		string::size_type slash = path.find('/', origin.length());
+		path.erase(0, slash != string::npos ? slash : path.length());
+		if (path.empty())
+			path = "/";
+	}
+
+	if (path.compare(0, prefix.length(), prefix) != 0 || (path.length() > prefix.length() && path[prefix.length()] != '/'))
+		return location;
+
+	string rewritten = "/";
+	URI::encode(shareName, "?#", rewritten);
+	rewritten.append(path, prefix.length(), string::npos);
+	return rewritten;
+}
+
+void ProxyShare::count(Outcome outcome) const
+{
+	switch (outcome)
+	{
+	case OUTCOME_FETCHED:
+		fetched++;
+		break;
+	case OUTCOME_REVALIDATED:
+		revalidated++;
+		break;
+	case OUTCOME_RELAYED:
+		relayed++;
+		break;
+	case OUTCOME_FAILED:
+		failed++;
+		break;
+	}
+}
+
+void ProxyShare::appendStatus(ostream &out) const
+{
+	out << "http://" << host << ':' << port << prefix << ", ";
+	out << fetched.value() << " fetched, " << revalidated.value() << " revalidated, ";
+	out << relayed.value() << " relayed, " << failed.value() << " failed" << endl;
+}
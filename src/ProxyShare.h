@@ -0,0 +1,93 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef PROXYSHARE_H
+#define PROXYSHARE_H
+
+#include <string>
+#include <ostream>
+
+#include "Poco/Types.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/AtomicCounter.h"
+
+#include "RequestPath.h"
+#include "ShareCache.h"
+
+using namespace std;
+
+using namespace Poco;
+
+// A share served on demand from an upstream server, usually another Indigo
+// Filer, named by a share path of the form http://host[:port]/prefix.
+// Requests for the share are passed on to the same path below the prefix. If
+// the share also has a share cache, files are stored in it while they are
+// sent, and are later revalidated with If-Modified-Since requests, so that
+// only files that changed upstream are transferred again. Directory listings,
+// requests with a query and error responses are relayed without caching.
+// Plain HTTP only.
+class ProxyShare
+{
+public:
+	enum Outcome
+	{
+		OUTCOME_FETCHED,
+		OUTCOME_REVALIDATED,
+		OUTCOME_RELAYED,
+		OUTCOME_FAILED
+	};
+
+	ProxyShare(const string &url, SharedPtr<ShareCache> cache);
+
+	static bool isProxy(const string &sharePath);
+	static bool parseURL(const string &url, string &host, UInt16 &port, string &prefix);
+
+	const string &getHost() const;
+	UInt16 getPort() const;
+	ShareCache *getCache() const;
+
+	string makeURI(const RequestPath &uriPath) const;
+	string makeKey(const string &uri) const;
+	string rewriteLocation(const string &location, const string &shareName) const;
+
+	void count(Outcome outcome) const;
+	void appendStatus(ostream &out) const;
+
+private:
+	string host;
+	UInt16 port;
+	string prefix;
+	SharedPtr<ShareCache> cache;
+
+	mutable AtomicCounter fetched;
+	mutable AtomicCounter revalidated;
+	mutable AtomicCounter relayed;
+	mutable AtomicCounter failed;
+};
+
+#endif //PROXYSHARE_H
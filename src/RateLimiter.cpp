@@ -0,0 +1,156 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <cmath>
+
+#include <algorithm>
+
+#include "RateLimiter.h"
+
+RateLimiter::Shard::Shard():
+	mutex(),
+	buckets()
+{
+}
+
+RateLimiter::RateLimiter()
+{
+}
+
+// Takes one token if one is available and returns 0.
+// Otherwise nothing is taken and the number of milliseconds until a token becomes available is returned.
+long RateLimiter::tryTake(const string &key, double rate, double burst)
+{
+	return acquire(key, 1, rate, burst, false);
+}
+
+// Takes the tokens even if the bucket goes into debt.
+// Returns the number of milliseconds the caller has to wait before the tokens may be used.
+long RateLimiter::take(const string &key, double amount, double rate, double burst)
+{
+	return acquire(key, amount, rate, burst, true);
+}
+
+// Returns 0 if a token is available, otherwise the number of milliseconds until one is. Nothing is taken.
+long RateLimiter::peek(const string &key, double rate, double burst)
+{
+	Timestamp now;
+
+	Shard &shard = shards[hash<string>()(key) % SHARD_COUNT];
+	FastMutex::ScopedLock lock(shard.mutex);
+
+	unordered_map<string, Bucket>::iterator it = shard.buckets.find(key);
+	if (it == shard.buckets.end())
+		return 0;
+
+	Bucket &bucket = it->second;
+	refill(bucket, now, rate, burst);
+
+	if (bucket.tokens >= 1)
+		return 0;
+
+	return (long) ceil((1 - bucket.tokens) * 1000 / rate);
+}
+
+// Puts back tokens that were taken for a request that did not go ahead.
+void RateLimiter::refund(const string &key, double amount, double burst)
+{
+	Shard &shard = shards[hash<string>()(key) % SHARD_COUNT];
+	FastMutex::ScopedLock lock(shard.mutex);
+
+	unordered_map<string, Bucket>::iterator it = shard.buckets.find(key);
+	if (it != shard.buckets.end())
+		it->second.tokens = min(burst, it->second.tokens + amount);
+}
+
+size_t RateLimiter::size() const
+{
+	size_t total = 0;
+	for (int i = 0; i < SHARD_COUNT; i++)
+	{
+		FastMutex::ScopedLock lock(shards[i].mutex);
+		total += shards[i].buckets.size();
+	}
+	return total;
+}
+
+long RateLimiter::acquire(const string &key, double amount, double rate, double burst, bool debt)
+{
+	Timestamp now;
+
+	Shard &shard = shards[hash<string>()(key) % SHARD_COUNT];
+	FastMutex::ScopedLock lock(shard.mutex);
+
+	unordered_map<string, Bucket>::iterator it = shard.buckets.find(key);
+	if (it == shard.buckets.end())
+	{
+		if (shard.buckets.size() >= MAX_SHARD_SIZE)
+			prune(shard, now, rate, burst);
+
+		Bucket bucket;
+		bucket.tokens = burst;
+		bucket.updated = now;
+		it = shard.buckets.insert(make_pair(key, bucket)).first;
+	}
+
+	Bucket &bucket = it->second;
+	refill(bucket, now, rate, burst);
+
+	if (bucket.tokens >= amount)
+	{
+		bucket.tokens -= amount;
+		return 0;
+	}
+
+	if (!debt)
+		return (long) ceil((amount - bucket.tokens) * 1000 / rate);
+
+	bucket.tokens -= amount;
+	return (long) ceil(-bucket.tokens * 1000 / rate);
+}
+
+void RateLimiter::refill(Bucket &bucket, const Timestamp &now, double rate, double burst)
+{
+	double elapsed = (double) (now - bucket.updated) / 1000000;
+	bucket.tokens = min(burst, bucket.tokens + elapsed * rate);
+	bucket.updated = now;
+}
+
+void RateLimiter::prune(Shard &shard, const Timestamp &now, double rate, double burst)
+{
+	// a full bucket behaves exactly like a missing one, so idle keys can be forgotten
+	unordered_map<string, Bucket>::iterator it = shard.buckets.begin();
+	while (it != shard.buckets.end())
+	{
+		refill(it->second, now, rate, burst);
+		if (it->second.tokens >= burst)
+			it = shard.buckets.erase(it);
+		else
+			++it;
+	}
+}
@@ -0,0 +1,86 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef RATELIMITER_H
+#define RATELIMITER_H
+
+#include <cstddef>
+
+#include <string>
+#include <tr1/unordered_map> // change to <unordered_map> on c++0x compilers
+
+#include "Poco/Mutex.h"
+#include "Poco/Timestamp.h"
+
+using namespace std;
+using namespace std::tr1; // remove this on c++0x compilers
+
+using namespace Poco;
+
+// Token buckets keyed by an arbitrary string, e.g. a client address or a share name.
+// The keys are spread over independently locked shards, so concurrent requests for different keys rarely contend.
+class RateLimiter
+{
+public:
+	RateLimiter();
+
+	long tryTake(const string &key, double rate, double burst);
+	long take(const string &key, double amount, double rate, double burst);
+	long peek(const string &key, double rate, double burst);
+	void refund(const string &key, double amount, double burst);
+	size_t size() const;
+
+private:
+	struct Bucket
+	{
+		double tokens;
+		Timestamp updated;
+	};
+
+	struct Shard
+	{
+		Shard();
+
+		mutable FastMutex mutex;
+		unordered_map<string, Bucket> buckets;
+	};
+
+	enum
+	{
+		SHARD_COUNT = 32,
+		MAX_SHARD_SIZE = 1024
+	};
+
+	long acquire(const string &key, double amount, double rate, double burst, bool debt);
+	static void refill(Bucket &bucket, const Timestamp &now, double rate, double burst);
+	static void prune(Shard &shard, const Timestamp &now, double rate, double burst);
+
+	Shard shards[SHARD_COUNT];
+};
+
+#endif //RATELIMITER_H
@@ -0,0 +1,400 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <cstring>
+
+#include "Poco/Platform.h"
+
+#include "RequestPath.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define REQUESTPATH_SSE2
+#include <emmintrin.h>
+#if __GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)
+#define REQUESTPATH_AVX2
+#include <immintrin.h>
+#endif
+#endif
+
+// Bytes that end a run of plain path characters: the percent sign, the
+// separator, the start of the query or fragment, and control bytes, which
+// are not allowed in URIs. On Windows, backslashes and colons would change
+// the meaning of the resulting filesystem path, so they are rejected too.
+
+#if defined(POCO_OS_FAMILY_WINDOWS)
+static const bool RESERVE_PATH_BYTES = true;
+#else
+static const bool RESERVE_PATH_BYTES = false;
+#endif
+
+static inline bool isReserved(unsigned char c)
+{
+	return RESERVE_PATH_BYTES && (c == '\\' || c == ':');
+}
+
+static inline bool isSpecial(unsigned char c)
+{
+	return c == '%' || c == '/' || c == '?' || c == '#' || c < 0x20 || c == 0x7F || isReserved(c);
+}
+
+static size_t scanScalar(const char *p, size_t n)
+{
+	size_t i = 0;
+	while (i < n && !isSpecial(p[i]))
+		i++;
+	return i;
+}
+
+#ifdef REQUESTPATH_SSE2
+static size_t scanSSE2(const char *p, size_t n)
+{
+	const __m128i percent = _mm_set1_epi8('%');
+	const __m128i slash = _mm_set1_epi8('/');
+	const __m128i question = _mm_set1_epi8('?');
+	const __m128i hash = _mm_set1_epi8('#');
+	const __m128i del = _mm_set1_epi8(0x7F);
+	const __m128i control = _mm_set1_epi8(0x1F);
+#if defined(POCO_OS_FAMILY_WINDOWS)
+	const __m128i backslash = _mm_set1_epi8('\\');
+	const __m128i colon = _mm_set1_epi8(':');
+#endif
+
+	size_t i = 0;
+	for (; i + 16 <= n; i += 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *) (p + i));
+
+		__m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, percent), _mm_cmpeq_epi8(v, slash));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, question));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, hash));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, del));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+#if defined(POCO_OS_FAMILY_WINDOWS)
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, backslash));
+		m = _mm_or_si128(m, _mm_cmpeq_epi8(v, colon));
+#endif
+
+		int mask = _mm_movemask_epi8(m);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + scanScalar(p + i, n - i);
+}
+#endif
+
+#ifdef REQUESTPATH_AVX2
+__attribute__((target("avx2")))
+static size_t scanAVX2(const char *p, size_t n)
+{
+	const __m256i percent = _mm256_set1_epi8('%');
+	const __m256i slash = _mm256_set1_epi8('/');
+	const __m256i question = _mm256_set1_epi8('?');
+	const __m256i hash = _mm256_set1_epi8('#');
+	const __m256i del = _mm256_set1_epi8(0x7F);
+	const __m256i control = _mm256_set1_epi8(0x1F);
+#if defined(POCO_OS_FAMILY_WINDOWS)
+	const __m256i backslash = _mm256_set1_epi8('\\');
+	const __m256i colon = _mm256_set1_epi8(':');
+#endif
+
+	size_t i = 0;
+	for (; i + 32 <= n; i += 32)
+	{
+		__m256i v = _mm256_loadu_si256((const __m256i *) (p + i));
+
+		__m256i m = _mm256_or_si256(_mm256_cmpeq_epi8(v, percent), _mm256_cmpeq_epi8(v, slash));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, question));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, hash));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, del));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(_mm256_min_epu8(v, control), v));
+#if defined(POCO_OS_FAMILY_WINDOWS)
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, backslash));
+		m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, colon));
+#endif
+
+		unsigned mask = (unsigned) _mm256_movemask_epi8(m);
+		if (mask != 0)
+			return i + __builtin_ctz(mask);
+	}
+
+	return i + scanSSE2(p + i, n - i);
+}
+#endif
+
+typedef size_t (*ScanFunction)(const char *p, size_t n);
+
+static ScanFunction selectScan()
+{
+#ifdef REQUESTPATH_AVX2
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return scanAVX2;
+#endif
+#ifdef REQUESTPATH_SSE2
+	return scanSSE2;
+#else
+	return scanScalar;
+#endif
+}
+
+// not const, so that misc/requestpath-fuzz.cpp can compare the scanners
+static ScanFunction scan = selectScan();
+
+RequestPath::RequestPath():
+	buffer(),
+	segments(),
+	directory(true),
+	queryBegin(NULL),
+	querySize(0)
+{
+}
+
+bool RequestPath::parse(const string &uri)
+{
+	const char *begin = uri.data();
+	const char *end = begin + uri.length();
+	const char *it = begin;
+
+	queryBegin = NULL;
+	querySize = 0;
+
+	// absolute-form request targets (scheme://authority/path) are reduced to their path
+	if (it != end && *it != '/')
+	{
+		while (it != end && *it != ':' && *it != '/' && *it != '?' && *it != '#')
+			++it;
+
+		if (end - it < 3 || it[0] != ':' || it[1] != '/' || it[2] != '/')
+			return false;
+
+		it += 3;
+		while (it != end && *it != '/' && *it != '?' && *it != '#')
+			++it;
+
+		if (it == end || *it != '/')
+			return false;
+	}
+
+	const char *pathEnd = build(it, end, true);
+	if (pathEnd == NULL)
+		return false;
+
+	if (pathEnd != end && *pathEnd == '?')
+	{
+		queryBegin = pathEnd + 1;
+		const char *queryEnd = queryBegin;
+		while (queryEnd != end && *queryEnd != '#')
+			++queryEnd;
+		querySize = queryEnd - queryBegin;
+	}
+
+	return true;
+}
+
+bool RequestPath::assign(const string &decodedPath)
+{
+	queryBegin = NULL;
+	querySize = 0;
+
+	const char *begin = decodedPath.data();
+	const char *end = begin + decodedPath.length();
+
+	return build(begin, end, false) != NULL;
+}
+
+bool RequestPath::isDirectory() const
+{
+	return directory;
+}
+
+int RequestPath::depth() const
+{
+	return segments.size();
+}
+
+const char *RequestPath::segment(int n) const
+{
+	return buffer.data() + segments[n].offset;
+}
+
+size_t RequestPath::segmentLength(int n) const
+{
+	return segments[n].length;
+}
+
+const char *RequestPath::query() const
+{
+	return queryBegin;
+}
+
+size_t RequestPath::queryLength() const
+{
+	return querySize;
+}
+
+void RequestPath::appendSegments(string &str, int first, char separator) const
+{
+	int d = depth();
+	for (int i = first; i < d; i++)
+	{
+		if (i > first)
+			str += separator;
+		str.append(segment(i), segmentLength(i));
+	}
+}
+
+string RequestPath::toDirectoryString() const
+{
+	string str(1, '/');
+	appendSegments(str, 0, '/');
+	if (depth() > 0)
+		str += '/';
+	return str;
+}
+
+const char *RequestPath::build(const char *begin, const char *end, bool encoded)
+{
+	segments.clear();
+	directory = true;
+
+	if (begin == end || *begin != '/')
+		return NULL;
+
+	// the decoded path is never longer than the encoded one
+	buffer.resize(end - begin);
+
+	char *base = &buffer[0];
+	char *out = base;
+	const char *it = begin;
+	size_t start = 0;
+
+	for (;;)
+	{
+		size_t n = scan(it, end - it);
+		memcpy(out, it, n);
+		out += n;
+		it += n;
+
+		if (it == end)
+			break;
+
+		unsigned char c = *it++;
+
+		if (c == '/')
+		{
+			endSegment(start, out - base, false);
+			*out++ = '/';
+			start = out - base;
+			continue;
+		}
+
+		if (!encoded)
+		{
+			if (c == '\0' || isReserved(c))
+				return NULL;
+
+			*out++ = c;
+			continue;
+		}
+
+		if (c == '?' || c == '#')
+		{
+			--it;
+			break;
+		}
+
+		if (c != '%' || end - it < 2)
+			return NULL;
+
+		int hi = hexValue(it[0]);
+		int lo = hexValue(it[1]);
+		if (hi < 0 || lo < 0)
+			return NULL;
+
+		it += 2;
+		c = (unsigned char) ((hi << 4) | lo);
+
+		if (c == '/')
+		{
+			endSegment(start, out - base, false);
+			*out++ = '/';
+			start = out - base;
+		}
+		else if (c == '\0' || isReserved(c))
+		{
+			return NULL;
+		}
+		else
+		{
+			*out++ = c;
+		}
+	}
+
+	endSegment(start, out - base, true);
+	buffer.resize(out - base);
+
+	return it;
+}
+
+void RequestPath::endSegment(size_t start, size_t stop, bool last)
+{
+	const char *data = buffer.data() + start;
+	size_t n = stop - start;
+
+	// the last segment determines whether the path refers to a directory
+	if (last)
+		directory = (n == 0);
+
+	if (n == 0 || (n == 1 && data[0] == '.'))
+		return;
+
+	if (n == 2 && data[0] == '.' && data[1] == '.')
+	{
+		if (!segments.empty())
+			segments.pop_back();
+		return;
+	}
+
+	Segment s;
+	s.offset = start;
+	s.length = n;
+	segments.push_back(s);
+}
+
+int RequestPath::hexValue(char c)
+{
+	if (c >= '0' && c <= '9')
+		return c - '0';
+	else if (c >= 'a' && c <= 'f')
+		return c - 'a' + 10;
+	else if (c >= 'A' && c <= 'F')
+		return c - 'A' + 10;
+	else
+		return -1;
+}
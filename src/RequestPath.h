@@ -0,0 +1,85 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef REQUESTPATH_H
+#define REQUESTPATH_H
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Percent-decodes, validates and normalizes the path of a request URI in a
+// single pass. Runs of plain characters are found 16 or 32 bytes at a time
+// with SSE2 or AVX2, depending on the CPU, and copied in bulk.
+// The decoded path and the segment boundaries are kept in buffers that are
+// reused by subsequent requests, so a parser that lives as long as the
+// connection's thread does not allocate memory once its buffers have grown.
+// Segments are views into the decoded path; "." and ".." segments are
+// resolved during parsing and never appear in the result.
+class RequestPath
+{
+public:
+	RequestPath();
+
+	bool parse(const string &uri);
+	bool assign(const string &decodedPath);
+
+	bool isDirectory() const;
+	int depth() const;
+	const char *segment(int n) const;
+	size_t segmentLength(int n) const;
+
+	const char *query() const;
+	size_t queryLength() const;
+
+	void appendSegments(string &str, int first, char separator) const;
+	string toDirectoryString() const;
+
+private:
+	struct Segment
+	{
+		size_t offset;
+		size_t length;
+	};
+
+	const char *build(const char *begin, const char *end, bool encoded);
+	void endSegment(size_t start, size_t stop, bool last);
+
+	static int hexValue(char c);
+
+	string buffer;
+	vector<Segment> segments;
+	bool directory;
+	const char *queryBegin;
+	size_t querySize;
+};
+
+#endif //REQUESTPATH_H
@@ -0,0 +1,118 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <algorithm>
+
+#include "Poco/Thread.h"
+
+#include "RequestThrottle.h"
+#include "IndigoConfiguration.h"
+
+RateLimiter RequestThrottle::clientRequests;
+RateLimiter RequestThrottle::clientBytes;
+RateLimiter RequestThrottle::shareRequests;
+RateLimiter RequestThrottle::shareBytes;
+
+AtomicCounter RequestThrottle::rejectedRequests;
+AtomicCounter RequestThrottle::delayedWrites;
+
+bool RequestThrottle::enabled()
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	return
+		configuration.getClientRequestRate() > 0 ||
+		configuration.getClientByteRate() > 0 ||
+		configuration.getShareRequestRate() > 0 ||
+		configuration.getShareByteRate() > 0;
+}
+
+// Returns 0 if the request may proceed, otherwise the number of milliseconds after which it may be retried.
+long RequestThrottle::admit(const string &client, const string &share)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	int clientRate = configuration.getClientRequestRate();
+	int clientBurst = max(configuration.getClientRequestBurst(), 1);
+	int shareRate = configuration.getShareRequestRate();
+	int shareBurst = max(configuration.getShareRequestBurst(), 1);
+
+	// both buckets are checked before either is charged, so a request rejected by the share limit costs the client nothing
+	long wait = 0;
+	if (clientRate > 0)
+		wait = max(wait, clientRequests.peek(client, clientRate, clientBurst));
+	if (shareRate > 0)
+		wait = max(wait, shareRequests.peek(share, shareRate, shareBurst));
+
+	if (wait == 0 && clientRate > 0)
+		wait = clientRequests.tryTake(client, clientRate, clientBurst);
+
+	if (wait == 0 && shareRate > 0)
+	{
+		// another request may have emptied the share bucket since it was checked
+		wait = shareRequests.tryTake(share, shareRate, shareBurst);
+		if (wait > 0 && clientRate > 0)
+			clientRequests.refund(client, 1, clientBurst);
+	}
+
+	if (wait > 0)
+		rejectedRequests++;
+
+	return wait;
+}
+
+// Blocks the calling thread until the bytes may be sent without exceeding the bandwidth limits.
+void RequestThrottle::pace(const string &client, const string &share, size_t bytes)
+{
+	const IndigoConfiguration &configuration = IndigoConfiguration::get();
+
+	long wait = 0;
+
+	// the burst is one second worth of data
+	int clientRate = configuration.getClientByteRate();
+	if (clientRate > 0)
+		wait = max(wait, clientBytes.take(client, bytes, clientRate, clientRate));
+
+	int shareRate = configuration.getShareByteRate();
+	if (shareRate > 0)
+		wait = max(wait, shareBytes.take(share, bytes, shareRate, shareRate));
+
+	if (wait > 0)
+	{
+		delayedWrites++;
+		Thread::sleep(wait);
+	}
+}
+
+void RequestThrottle::appendStatus(ostream &out)
+{
+	out << "Throttled clients: " << clientRequests.size() + clientBytes.size() << endl;
+	out << "Throttled shares: " << shareRequests.size() + shareBytes.size() << endl;
+	out << "Rejected requests: " << rejectedRequests.value() << endl;
+	out << "Delayed writes: " << delayedWrites.value() << endl;
+}
@@ -0,0 +1,64 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef REQUESTTHROTTLE_H
+#define REQUESTTHROTTLE_H
+
+#include <cstddef>
+
+#include <string>
+#include <ostream>
+
+#include "Poco/AtomicCounter.h"
+
+#include "RateLimiter.h"
+
+using namespace std;
+
+using namespace Poco;
+
+// Request and bandwidth limits per client address and per share, as set in the configuration.
+class RequestThrottle
+{
+public:
+	static bool enabled();
+	static long admit(const string &client, const string &share);
+	static void pace(const string &client, const string &share, size_t bytes);
+	static void appendStatus(ostream &out);
+
+private:
+	static RateLimiter clientRequests;
+	static RateLimiter clientBytes;
+	static RateLimiter shareRequests;
+	static RateLimiter shareBytes;
+
+	static AtomicCounter rejectedRequests;
+	static AtomicCounter delayedWrites;
+};
+
+#endif //REQUESTTHROTTLE_H
@@ -0,0 +1,261 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "Poco/Platform.h"
+
+#if defined(POCO_OS_FAMILY_UNIX)
+#include <time.h>
+#endif
+
+#ifdef INDIGO_USDT
+#include <sys/sdt.h>
+#else
+#define DTRACE_PROBE2(provider, name, arg1, arg2)
+#define DTRACE_PROBE4(provider, name, arg1, arg2, arg3, arg4)
+#endif
+
+#include <string>
+
+#include "Poco/Util/Application.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/Timestamp.h"
+
+#include "IndigoConfiguration.h"
+#include "RequestTrace.h"
+
+using namespace Poco::Util;
+
+ThreadLocal<RequestTrace::Trace> RequestTrace::traces;
+
+AtomicCounter RequestTrace::histograms[PHASE_COUNT + 1][TRACE_BUCKETS];
+
+const char *const RequestTrace::phaseNames[PHASE_COUNT] =
+{
+	"queue",
+	"parse",
+	"resolve",
+	"stat",
+	"index",
+	"open",
+	"send"
+};
+
+RequestTrace::Trace::Trace():
+	active(false),
+	start(0),
+	last(0),
+	touched(0),
+	queueWait(-1)
+{
+	for (int i = 0; i < PHASE_COUNT; i++)
+		durations[i] = 0;
+}
+
+RequestTrace::Scope::Scope(const HTTPServerRequest &request, const HTTPServerResponse &response):
+	request(request),
+	response(response)
+{
+	Trace &trace = *traces;
+
+	trace.active = true;
+	trace.start = now();
+	trace.last = trace.start;
+	trace.touched = 0;
+	for (int i = 0; i < PHASE_COUNT; i++)
+		trace.durations[i] = 0;
+
+	// the dispatch queue wait belongs to the first request of an HTTP/1.x connection;
+	// HTTP/2 streams run on other threads than the one that took the connection
+	if (trace.queueWait >= 0 && request.getVersion() != "HTTP/2.0")
+	{
+		trace.durations[PHASE_QUEUE] = trace.queueWait;
+		trace.touched |= 1 << PHASE_QUEUE;
+	}
+	trace.queueWait = -1;
+
+	DTRACE_PROBE2(indigo, request__start, request.getMethod().c_str(), request.getURI().c_str());
+}
+
+RequestTrace::Scope::~Scope()
+{
+	// whatever follows the last mark is the response being written
+	mark(PHASE_SEND);
+
+	Trace &trace = *traces;
+	trace.active = false;
+
+	Int64 total = trace.last - trace.start + trace.durations[PHASE_QUEUE];
+
+	for (int i = 0; i < PHASE_COUNT; i++)
+	{
+		if (trace.touched & (1 << i))
+			record(i, trace.durations[i]);
+	}
+	record(PHASE_COUNT, total);
+
+	DTRACE_PROBE4(indigo, request__done, request.getMethod().c_str(), request.getURI().c_str(), (int) response.getStatus(), (long) total);
+
+	int slowRequestTime = IndigoConfiguration::get().getSlowRequestTime();
+	if (slowRequestTime <= 0 || total < (Int64) slowRequestTime * 1000)
+		return;
+
+	try
+	{
+		string logString = "Slow request: " + request.clientAddress().host().toString() + " - " + request.getMethod() + " " + request.getURI() + " - ";
+		appendDuration(logString, total);
+
+		const char *separator = " (";
+		for (int i = 0; i < PHASE_COUNT; i++)
+		{
+			if (!(trace.touched & (1 << i)))
+				continue;
+
+			logString += separator;
+			logString += phaseNames[i];
+			logString += ' ';
+			appendDuration(logString, trace.durations[i]);
+			separator = ", ";
+		}
+		logString += ')';
+
+		Application::instance().logger().warning(logString);
+	}
+	catch (...)
+	{
+	}
+}
+
+void RequestTrace::mark(Phase phase)
+{
+	Trace &trace = *traces;
+	if (!trace.active)
+		return;
+
+	Int64 time = now();
+	Int64 duration = time - trace.last;
+
+	trace.durations[phase] += duration;
+	trace.touched |= 1 << phase;
+	trace.last = time;
+
+	DTRACE_PROBE2(indigo, phase, phaseNames[phase], (long) duration);
+}
+
+// Called when a connection is taken out of the dispatch queue, on the thread that will serve it.
+void RequestTrace::setQueueWait(long milliseconds)
+{
+	(*traces).queueWait = (milliseconds >= 0 ? (Int64) milliseconds * 1000 : -1);
+}
+
+void RequestTrace::appendStatus(ostream &out)
+{
+	for (int i = 0; i < PHASE_COUNT; i++)
+		appendHistogram(out, phaseNames[i], i);
+	appendHistogram(out, "request", PHASE_COUNT);
+}
+
+Int64 RequestTrace::now()
+{
+#if defined(POCO_OS_FAMILY_UNIX)
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (Int64) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+	Timestamp ts;
+	return ts.epochMicroseconds();
+#endif
+}
+
+void RequestTrace::record(int histogram, Int64 duration)
+{
+	int bucket = 0;
+	while (bucket < TRACE_BUCKETS - 1 && duration >= ((Int64) 1 << bucket))
+		bucket++;
+
+	histograms[histogram][bucket]++;
+}
+
+void RequestTrace::appendHistogram(ostream &out, const char *name, int histogram)
+{
+	const AtomicCounter *buckets = histograms[histogram];
+
+	long counts[TRACE_BUCKETS];
+	long total = 0;
+	for (int i = 0; i < TRACE_BUCKETS; i++)
+	{
+		counts[i] = buckets[i].value();
+		total += counts[i];
+	}
+
+	string line = "Phase ";
+	line += name;
+	line += ": ";
+	NumberFormatter::append(line, total);
+
+	// percentiles are the upper bounds of the buckets they fall in
+	static const int percentiles[] = { 50, 90, 99 };
+	int bucket = 0;
+	long seen = counts[0];
+	for (size_t p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]) && total > 0; p++)
+	{
+		while (seen * 100 < total * percentiles[p])
+			seen += counts[++bucket];
+
+		line += ", p";
+		NumberFormatter::append(line, percentiles[p]);
+		line += " < ";
+		appendDuration(line, (Int64) 1 << bucket);
+	}
+
+	if (total > 0)
+	{
+		int highest = TRACE_BUCKETS - 1;
+		while (counts[highest] == 0)
+			highest--;
+
+		line += ", max < ";
+		appendDuration(line, (Int64) 1 << highest);
+	}
+
+	out << line << endl;
+}
+
+void RequestTrace::appendDuration(string &s, Int64 duration)
+{
+	if (duration < 1000)
+	{
+		NumberFormatter::append(s, (int) duration);
+		s += " us";
+		return;
+	}
+
+	NumberFormatter::append(s, duration / 1000);
+	s += '.';
+	NumberFormatter::append(s, (int) (duration % 1000 / 100));
+	s += " ms";
+}
@@ -0,0 +1,110 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef REQUESTTRACE_H
+#define REQUESTTRACE_H
+
+#include <ostream>
+
+#include "Poco/Net/HTTPServerRequest.h"
+#include "Poco/Net/HTTPServerResponse.h"
+#include "Poco/ThreadLocal.h"
+#include "Poco/AtomicCounter.h"
+#include "Poco/Types.h"
+
+using namespace std;
+
+using namespace Poco;
+using namespace Poco::Net;
+
+#define TRACE_BUCKETS 32
+
+// Splits the time spent on each request into phases, measured with a monotonic clock.
+// The handler marks the end of each phase as it goes; the time since the previous mark is
+// added to the phase. Every phase has a histogram over all requests, shown on the status page,
+// and requests slower than Server.slowRequestTime are logged with their breakdown.
+// Built with -DINDIGO_USDT, the marks are also static tracepoints for perf and bpftrace.
+class RequestTrace
+{
+public:
+	enum Phase
+	{
+		PHASE_QUEUE,
+		PHASE_PARSE,
+		PHASE_RESOLVE,
+		PHASE_STAT,
+		PHASE_INDEX,
+		PHASE_OPEN,
+		PHASE_SEND,
+		PHASE_COUNT
+	};
+
+	// Traces the request handled by the calling thread, for the lifetime of the object.
+	class Scope
+	{
+	public:
+		Scope(const HTTPServerRequest &request, const HTTPServerResponse &response);
+		~Scope();
+
+	private:
+		const HTTPServerRequest &request;
+		const HTTPServerResponse &response;
+	};
+
+	static void mark(Phase phase);
+	static void setQueueWait(long milliseconds);
+
+	static void appendStatus(ostream &out);
+
+private:
+	struct Trace
+	{
+		Trace();
+
+		bool active;
+		Int64 start;
+		Int64 last;
+		Int64 durations[PHASE_COUNT];
+		unsigned touched;
+		Int64 queueWait;
+	};
+
+	static Int64 now();
+	static void record(int histogram, Int64 duration);
+	static void appendHistogram(ostream &out, const char *name, int histogram);
+	static void appendDuration(string &s, Int64 duration);
+
+	static ThreadLocal<Trace> traces;
+
+	// one histogram per phase, and one for whole requests; bucket i counts durations below 2^i microseconds
+	static AtomicCounter histograms[PHASE_COUNT + 1][TRACE_BUCKETS];
+
+	static const char *const phaseNames[PHASE_COUNT];
+};
+
+#endif //REQUESTTRACE_H
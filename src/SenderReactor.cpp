@@ -0,0 +1,318 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#if defined(__linux__)
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <cerrno>
+#include <cstring>
+#endif
+
+#include "Poco/Util/ServerApplication.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/Exception.h"
+
+#include "SenderReactor.h"
+
+using namespace Poco::Util;
+
+// the most a sender writes to one socket before it turns to the others
+#define SENDER_TURN_SIZE (1 << 20)
+
+// the most sockets a sender handles per wakeup
+#define SENDER_EVENTS 64
+
+// how often, in milliseconds, a sender wakes up to look for stalled transfers and to stop
+#define SENDER_TICK 250
+
+int SenderReactor::timeout = 0;
+vector<SenderReactor::Sender *> SenderReactor::senders;
+vector<Thread *> SenderReactor::threads;
+AtomicCounter SenderReactor::next;
+
+AtomicCounter SenderReactor::active;
+AtomicCounter SenderReactor::completed;
+AtomicCounter SenderReactor::failed;
+
+#if defined(__linux__)
+
+SenderReactor::Sender::Sender():
+	poller(epoll_create(SENDER_EVENTS)),
+	stopSend(),
+	transfers(),
+	mutex()
+{
+	if (poller < 0)
+		throw SystemException("Unable to create a sender poller", strerror(errno));
+}
+
+SenderReactor::Sender::~Sender()
+{
+	close(poller);
+}
+
+void SenderReactor::Sender::add(Transfer *transfer)
+{
+	// the sockets are written without blocking; the flag is kept by the open file description, which
+	// the duplicate shares with the socket of the worker, so the worker must not touch the connection again
+	int flags = fcntl(transfer->socket, F_GETFL);
+	fcntl(transfer->socket, F_SETFL, flags | O_NONBLOCK);
+
+	{
+		FastMutex::ScopedLock lock(mutex);
+		transfers.insert(transfer);
+	}
+
+	epoll_event event;
+	memset(&event, 0, sizeof(event));
+	event.events = EPOLLOUT;
+	event.data.ptr = transfer;
+	if (epoll_ctl(poller, EPOLL_CTL_ADD, transfer->socket, &event) != 0)
+		finish(transfer, strerror(errno));
+}
+
+void SenderReactor::Sender::run()
+{
+	// a client that goes away makes sendfile() fail with EPIPE, instead of raising SIGPIPE in the process
+	sigset_t signals;
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &signals, NULL);
+
+	epoll_event events[SENDER_EVENTS];
+
+	while (!stopSend.tryWait(0))
+	{
+		int n = epoll_wait(poller, events, SENDER_EVENTS, SENDER_TICK);
+
+		for (int i = 0; i < n; i++)
+		{
+			Transfer *transfer = (Transfer *) events[i].data.ptr;
+			if (events[i].events & (EPOLLERR | EPOLLHUP))
+				finish(transfer, "connection closed");
+			else
+				advance(transfer);
+		}
+
+		expire();
+	}
+
+	vector<Transfer *> remaining;
+	{
+		FastMutex::ScopedLock lock(mutex);
+		remaining.assign(transfers.begin(), transfers.end());
+	}
+
+	for (vector<Transfer *>::size_type i = 0; i < remaining.size(); i++)
+		finish(remaining[i], "server stopped");
+}
+
+void SenderReactor::Sender::stopSending()
+{
+	stopSend.set();
+}
+
+void SenderReactor::Sender::advance(Transfer *transfer)
+{
+	File::FileSize turn = 0;
+
+	while (transfer->offset < transfer->size && turn < SENDER_TURN_SIZE)
+	{
+		File::FileSize left = transfer->size - transfer->offset;
+		if (left > SENDER_TURN_SIZE - turn)
+			left = SENDER_TURN_SIZE - turn;
+
+		off_t offset = (off_t) transfer->offset;
+		ssize_t n = sendfile(transfer->socket, transfer->file, &offset, (size_t) left);
+		if (n > 0)
+		{
+			transfer->offset += n;
+			turn += n;
+			transfer->lastProgress.update();
+			continue;
+		}
+
+		if (n == 0)
+		{
+			finish(transfer, "file shrank while it was sent");
+			return;
+		}
+
+		if (errno == EINTR)
+			continue;
+
+		// the socket buffer is full, and the sender is woken up when it drains
+		if (errno == EAGAIN)
+			return;
+
+		finish(transfer, strerror(errno));
+		return;
+	}
+
+	if (transfer->offset == transfer->size)
+		finish(transfer, "");
+}
+
+void SenderReactor::Sender::expire()
+{
+	vector<Transfer *> stalled;
+	{
+		FastMutex::ScopedLock lock(mutex);
+		for (set<Transfer *>::iterator it = transfers.begin(); it != transfers.end(); ++it)
+		{
+			if ((*it)->lastProgress.isElapsed((Timestamp::TimeDiff) timeout * 1000000))
+				stalled.push_back(*it);
+		}
+	}
+
+	for (vector<Transfer *>::size_type i = 0; i < stalled.size(); i++)
+		finish(stalled[i], "timed out");
+}
+
+// Ends a transfer, which was successful if there is no error.
+void SenderReactor::Sender::finish(Transfer *transfer, const string &error)
+{
+	epoll_ctl(poller, EPOLL_CTL_DEL, transfer->socket, NULL);
+
+	{
+		FastMutex::ScopedLock lock(mutex);
+		transfers.erase(transfer);
+	}
+
+	close(transfer->file);
+	active--;
+
+	string sent = NumberFormatter::format(transfer->offset) + " of " + NumberFormatter::format(transfer->size) + " bytes";
+
+	if (!error.empty())
+	{
+		failed++;
+		log(transfer->description + " - failed after " + sent + ": " + error);
+	}
+	else
+	{
+		completed++;
+		log(transfer->description + " - sent " + sent);
+	}
+
+	close(transfer->socket);
+
+	delete transfer;
+}
+
+void SenderReactor::start(int threads, int timeout)
+{
+	SenderReactor::timeout = timeout;
+
+	for (int i = 0; i < threads; i++)
+	{
+		Sender *sender = new Sender();
+		Thread *thread = new Thread("Sender" + NumberFormatter::format(i));
+		thread->start(*sender);
+
+		senders.push_back(sender);
+		SenderReactor::threads.push_back(thread);
+	}
+}
+
+void SenderReactor::stop()
+{
+	for (vector<Sender *>::size_type i = 0; i < senders.size(); i++)
+		senders[i]->stopSending();
+
+	for (vector<Thread *>::size_type i = 0; i < threads.size(); i++)
+	{
+		threads[i]->join();
+		delete threads[i];
+		delete senders[i];
+	}
+
+	threads.clear();
+	senders.clear();
+}
+
+// Sends the rest of a response on one of the senders. The socket and the file
+// are descriptors of their own, which the sender closes when it is done.
+void SenderReactor::submit(int socket, int file, File::FileSize size, const string &description)
+{
+	Transfer *transfer = new Transfer;
+	transfer->socket = socket;
+	transfer->file = file;
+	transfer->offset = 0;
+	transfer->size = size;
+	transfer->description = description;
+
+	active++;
+
+	unsigned i = (unsigned) (next++) % senders.size();
+	senders[i]->add(transfer);
+}
+
+#else
+
+void SenderReactor::start(int threads, int timeout)
+{
+	SenderReactor::timeout = timeout;
+}
+
+void SenderReactor::stop()
+{
+}
+
+void SenderReactor::submit(int socket, int file, File::FileSize size, const string &description)
+{
+	poco_bugcheck_msg("Transfers cannot be submitted on this platform");
+}
+
+#endif
+
+bool SenderReactor::enabled()
+{
+	return !senders.empty();
+}
+
+int SenderReactor::activeTransfers()
+{
+	return active.value();
+}
+
+void SenderReactor::appendStatus(ostream &out)
+{
+	out << "Offloaded transfers: " << active.value() << " active, " << completed.value() << " completed, " << failed.value() << " failed" << endl;
+}
+
+void SenderReactor::log(const string &message)
+{
+	const ServerApplication &app = dynamic_cast<ServerApplication &>(Application::instance());
+	if (app.isInteractive())
+		app.logger().information(message);
+}
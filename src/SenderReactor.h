@@ -0,0 +1,110 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef SENDERREACTOR_H
+#define SENDERREACTOR_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <ostream>
+
+#include "Poco/Thread.h"
+#include "Poco/Runnable.h"
+#include "Poco/Mutex.h"
+#include "Poco/Event.h"
+#include "Poco/Timestamp.h"
+#include "Poco/AtomicCounter.h"
+#include "Poco/File.h"
+
+using namespace std;
+
+using namespace Poco;
+
+// Sends the bodies of large files on a few non-blocking threads, so that the
+// worker thread that sent the header can go on to the next connection
+// instead of waiting for a slow client for minutes. Each sender waits for
+// its sockets with epoll and writes them with sendfile(), a bounded amount
+// per turn. The connection is closed when the body is sent, or on failure.
+// Transfers are only done by the kernel, so this is only available on Linux.
+class SenderReactor
+{
+public:
+	static void start(int threads, int timeout);
+	static void stop();
+	static bool enabled();
+
+	static void submit(int socket, int file, File::FileSize size, const string &description);
+	static int activeTransfers();
+	static void appendStatus(ostream &out);
+
+private:
+	struct Transfer
+	{
+		int socket;
+		int file;
+		File::FileSize offset;
+		File::FileSize size;
+		string description;
+		Timestamp lastProgress;
+	};
+
+	class Sender: public Runnable
+	{
+	public:
+		Sender();
+		~Sender();
+
+		void add(Transfer *transfer);
+		void run();
+		void stopSending();
+
+	private:
+		void advance(Transfer *transfer);
+		void expire();
+		void finish(Transfer *transfer, const string &error);
+
+		int poller;
+		Event stopSend;
+		set<Transfer *> transfers;
+		FastMutex mutex;
+	};
+
+	static void log(const string &message);
+
+	static int timeout;
+	static vector<Sender *> senders;
+	static vector<Thread *> threads;
+	static AtomicCounter next;
+
+	static AtomicCounter active;
+	static AtomicCounter completed;
+	static AtomicCounter failed;
+};
+
+#endif //SENDERREACTOR_H
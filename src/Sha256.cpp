@@ -0,0 +1,255 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <cstring>
+
+#include "Sha256.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && (__GNUC__ >= 5)
+#define SHA256_SHANI
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+static const UInt32 K[64] =
+{
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+static inline UInt32 rotr(UInt32 x, int n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static void compressScalar(UInt32 state[8], const unsigned char *data, size_t blocks)
+{
+	UInt32 w[64];
+
+	for (; blocks > 0; blocks--, data += Sha256::BLOCK_SIZE)
+	{
+		for (int i = 0; i < 16; i++)
+			w[i] = ((UInt32) data[4 * i] << 24) | ((UInt32) data[4 * i + 1] << 16) | ((UInt32) data[4 * i + 2] << 8) | data[4 * i + 3];
+
+		for (int i = 16; i < 64; i++)
+		{
+			UInt32 s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+			UInt32 s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+			w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+		}
+
+		UInt32 a = state[0], b = state[1], c = state[2], d = state[3];
+		UInt32 e = state[4], f = state[5], g = state[6], h = state[7];
+
+		for (int i = 0; i < 64; i++)
+		{
+			UInt32 t1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+			UInt32 t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+			h = g;
+			g = f;
+			f = e;
+			e = d + t1;
+			d = c;
+			c = b;
+			b = a;
+			a = t1 + t2;
+		}
+
+		state[0] += a;
+		state[1] += b;
+		state[2] += c;
+		state[3] += d;
+		state[4] += e;
+		state[5] += f;
+		state[6] += g;
+		state[7] += h;
+	}
+}
+
+#ifdef SHA256_SHANI
+// The SHA extensions keep the state as ABEF and CDGH and run two rounds per
+// instruction; the message schedule is extended four words at a time.
+__attribute__((target("sha,sse4.1,ssse3")))
+static void compressSHANI(UInt32 state[8], const unsigned char *data, size_t blocks)
+{
+	const __m128i byteSwap = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+	__m128i tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[0]), 0xB1);
+	__m128i state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *) &state[4]), 0x1B);
+	__m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+	for (; blocks > 0; blocks--, data += Sha256::BLOCK_SIZE)
+	{
+		__m128i saved0 = state0;
+		__m128i saved1 = state1;
+		__m128i msg[4];
+
+		for (int i = 0; i < 16; i++)
+		{
+			__m128i w;
+			if (i < 4)
+			{
+				w = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16 * i)), byteSwap);
+			}
+			else
+			{
+				w = _mm_sha256msg1_epu32(msg[(i - 4) & 3], msg[(i - 3) & 3]);
+				w = _mm_add_epi32(w, _mm_alignr_epi8(msg[(i - 1) & 3], msg[(i - 2) & 3], 4));
+				w = _mm_sha256msg2_epu32(w, msg[(i - 1) & 3]);
+			}
+			msg[i & 3] = w;
+
+			__m128i k = _mm_add_epi32(w, _mm_loadu_si128((const __m128i *) &K[4 * i]));
+			state1 = _mm_sha256rnds2_epu32(state1, state0, k);
+			state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(k, 0x0E));
+		}
+
+		state0 = _mm_add_epi32(state0, saved0);
+		state1 = _mm_add_epi32(state1, saved1);
+	}
+
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	_mm_storeu_si128((__m128i *) &state[0], _mm_blend_epi16(tmp, state1, 0xF0));
+	_mm_storeu_si128((__m128i *) &state[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+
+static bool cpuHasSHA()
+{
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid_max(0, NULL) < 7)
+		return false;
+	__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	bool sha = ((ebx & (1 << 29)) != 0);
+
+	__cpuid(1, eax, ebx, ecx, edx);
+	bool sse41 = ((ecx & (1 << 19)) != 0);
+
+	return sha && sse41;
+}
+#endif
+
+typedef void (*CompressFunction)(UInt32 state[8], const unsigned char *data, size_t blocks);
+
+static CompressFunction selectCompress()
+{
+#ifdef SHA256_SHANI
+	if (cpuHasSHA())
+		return compressSHANI;
+#endif
+	return compressScalar;
+}
+
+static const CompressFunction compressBlocks = selectCompress();
+
+Sha256::Sha256():
+	buffered(0),
+	total(0)
+{
+	static const UInt32 initial[8] =
+	{
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+	};
+
+	memcpy(state, initial, sizeof(state));
+}
+
+void Sha256::update(const char *data, size_t length)
+{
+	const unsigned char *p = (const unsigned char *) data;
+	total += length;
+
+	if (buffered > 0)
+	{
+		size_t n = BLOCK_SIZE - buffered;
+		if (n > length)
+			n = length;
+
+		memcpy(buffer + buffered, p, n);
+		buffered += n;
+		p += n;
+		length -= n;
+
+		if (buffered < BLOCK_SIZE)
+			return;
+
+		compressBlocks(state, buffer, 1);
+		buffered = 0;
+	}
+
+	// whole blocks are compressed in place, without going through the buffer
+	size_t blocks = length / BLOCK_SIZE;
+	if (blocks > 0)
+	{
+		compressBlocks(state, p, blocks);
+		p += blocks * BLOCK_SIZE;
+		length -= blocks * BLOCK_SIZE;
+	}
+
+	memcpy(buffer, p, length);
+	buffered = length;
+}
+
+void Sha256::finish(unsigned char digest[DIGEST_SIZE])
+{
+	UInt64 bits = total * 8;
+
+	buffer[buffered++] = 0x80;
+	if (buffered > BLOCK_SIZE - 8)
+	{
+		memset(buffer + buffered, 0, BLOCK_SIZE - buffered);
+		compressBlocks(state, buffer, 1);
+		buffered = 0;
+	}
+
+	memset(buffer + buffered, 0, BLOCK_SIZE - 8 - buffered);
+	for (int i = 0; i < 8; i++)
+		buffer[BLOCK_SIZE - 1 - i] = (unsigned char) (bits >> (8 * i));
+	compressBlocks(state, buffer, 1);
+
+	for (int i = 0; i < 8; i++)
+	{
+		digest[4 * i] = (unsigned char) (state[i] >> 24);
+		digest[4 * i + 1] = (unsigned char) (state[i] >> 16);
+		digest[4 * i + 2] = (unsigned char) (state[i] >> 8);
+		digest[4 * i + 3] = (unsigned char) state[i];
+	}
+}
+
+const char *Sha256::implementation()
+{
+	return (compressBlocks == compressScalar ? "scalar" : "SHA extensions");
+}
@@ -0,0 +1,63 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <cstddef>
+
+#include "Poco/Types.h"
+
+using namespace Poco;
+
+// SHA-256, as POCO 1.4 only provides MD5 and SHA-1. Blocks are compressed
+// with the SHA extensions when the CPU has them, and in plain C++ otherwise.
+class Sha256
+{
+public:
+	enum
+	{
+		DIGEST_SIZE = 32,
+		BLOCK_SIZE = 64
+	};
+
+	Sha256();
+
+	void update(const char *data, size_t length);
+	void finish(unsigned char digest[DIGEST_SIZE]);
+
+	static const char *implementation();
+
+private:
+	UInt32 state[8];
+	unsigned char buffer[BLOCK_SIZE];
+	size_t buffered;
+	UInt64 total;
+};
+
+#endif //SHA256_H
@@ -0,0 +1,527 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <algorithm>
+#include <vector>
+#include <utility>
+
+#include "Poco/Util/Application.h"
+#include "Poco/DirectoryIterator.h"
+#include "Poco/NumberFormatter.h"
+#include "Poco/Buffer.h"
+#include "Poco/ScopedLock.h"
+#include "Poco/Exception.h"
+
+#if defined(POCO_OS_FAMILY_UNIX)
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#endif
+
+#include "ShareCache.h"
+#include "Sha256.h"
+
+using namespace Poco::Util;
+
+unordered_map<string, SharedPtr<ShareCache> > ShareCache::caches;
+FastMutex ShareCache::cachesMutex;
+
+// Returns the cache kept in the directory, opening it if this is the first configuration that uses it.
+SharedPtr<ShareCache> ShareCache::open(const string &directory, UInt64 capacity)
+{
+	FastMutex::ScopedLock lock(cachesMutex);
+
+	SharedPtr<ShareCache> &cache = caches[directory];
+	if (cache.isNull())
+	{
+		cache = new ShareCache(directory);
+		cache->load();
+	}
+
+	FastMutex::ScopedLock cacheLock(cache->mutex);
+	cache->capacity = capacity;
+	cache->evict();
+
+	return cache;
+}
+
+ShareCache::ShareCache(const string &directory):
+	directory(directory),
+	capacity(0),
+	used(0),
+	entries(),
+	uses(),
+	filling(),
+	mutex(),
+	hits(),
+	misses(),
+	fills(),
+	evictions()
+{
+}
+
+bool ShareCache::cacheable(File::FileSize size) const
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	return size > 0 && size <= capacity / MAX_FILE_PART;
+}
+
+void ShareCache::appendStatus(ostream &out) const
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	out << entries.size() << " files, " << used << " of " << capacity << " bytes, ";
+	out << hits.value() << " hits, " << misses.value() << " misses, " << fills.value() << " filled, " << evictions.value() << " evicted" << endl;
+}
+
+string ShareCache::makeKey(const string &path)
+{
+	unsigned char digest[Sha256::DIGEST_SIZE];
+	Sha256 sha;
+	sha.update(path.data(), path.length());
+	sha.finish(digest);
+
+	string key;
+	for (int i = 0; i < Sha256::DIGEST_SIZE; i++)
+		NumberFormatter::appendHex(key, (unsigned) digest[i], 2);
+	return key;
+}
+
+// Accounts for a copy as the most recently used one, replacing the previous copy of the file.
+void ShareCache::insert(const string &key, UInt64 size)
+{
+	unordered_map<string, Entry>::iterator it = entries.find(key);
+	if (it != entries.end())
+	{
+		used -= it->second.size;
+		uses.erase(it->second.use);
+		entries.erase(it);
+	}
+
+	uses.push_front(key);
+	Entry &entry = entries[key];
+	entry.use = uses.begin();
+	entry.size = size;
+	used += size;
+}
+
+ShareCache::Copy::Copy():
+	fd(-1),
+	cachedPath()
+{
+}
+
+int ShareCache::Copy::descriptor() const
+{
+	return fd;
+}
+
+const string &ShareCache::Copy::path() const
+{
+	return cachedPath;
+}
+
+#if defined(POCO_OS_FAMILY_UNIX)
+
+ShareCache::Copy::~Copy()
+{
+	if (fd >= 0)
+		close(fd);
+}
+
+ShareCache::Fill::Fill(ShareCache &cache, const string &path, File::FileSize size, const Timestamp &modified):
+	cache(cache),
+	key(makeKey(path)),
+	size(size),
+	modified(modified),
+	tempPath(),
+	fd(-1),
+	written(0),
+	active(false)
+{
+	// a file that another request is already copying is only sent
+	{
+		FastMutex::ScopedLock lock(cache.mutex);
+		if (!cache.filling.insert(key).second)
+			return;
+	}
+	active = true;
+
+	string pattern = cache.directory + "/.fill-XXXXXX";
+	Buffer<char> buffer(pattern.length() + 1);
+	memcpy(buffer.begin(), pattern.c_str(), pattern.length() + 1);
+
+	fd = mkstemp(buffer.begin());
+	if (fd < 0)
+	{
+		abandon();
+		return;
+	}
+	tempPath = buffer.begin();
+}
+
+ShareCache::Fill::~Fill()
+{
+	if (active)
+		abandon();
+}
+
+void ShareCache::Fill::write(const char *data, size_t length)
+{
+	if (!active)
+		return;
+
+	while (length > 0)
+	{
+		ssize_t n = ::write(fd, data, length);
+		if (n < 0 && errno == EINTR)
+			continue;
+
+		// a full or failing cache disk only costs the copy, not the response
+		if (n <= 0)
+		{
+			abandon();
+			return;
+		}
+
+		data += n;
+		length -= n;
+		written += n;
+	}
+}
+
+// Keeps the copy, if it is complete. Whether the original changed while it was read is up to the caller.
+void ShareCache::Fill::commit()
+{
+	if (!active)
+		return;
+
+	keep(modified.epochTime(), 0);
+}
+
+// Keeps the copy of a file, if it is complete and the original still has the size and modification time it was sent with.
+// The copy gets the modification time of the original to the nanosecond, which is what lookup() compares.
+void ShareCache::Fill::commit(const string &original)
+{
+	if (!active)
+		return;
+
+	struct stat st;
+	if (stat(original.c_str(), &st) != 0 || (File::FileSize) st.st_size != size || st.st_mtime != modified.epochTime())
+	{
+		abandon();
+		return;
+	}
+
+	keep(st.st_mtim.tv_sec, st.st_mtim.tv_nsec);
+}
+
+void ShareCache::Fill::keep(Int64 seconds, long nanoseconds)
+{
+	bool complete = (written == size);
+
+	int result = close(fd);
+	fd = -1;
+	if (!complete || result != 0)
+	{
+		abandon();
+		return;
+	}
+
+	// the access time orders the copies by use when the cache is loaded again
+	struct timespec times[2];
+	times[0].tv_sec = 0;
+	times[0].tv_nsec = UTIME_NOW;
+	times[1].tv_sec = (time_t) seconds;
+	times[1].tv_nsec = nanoseconds;
+
+	string cachedPath = cache.directory + '/' + key;
+	if (utimensat(AT_FDCWD, tempPath.c_str(), times, 0) != 0 || rename(tempPath.c_str(), cachedPath.c_str()) != 0)
+	{
+		abandon();
+		return;
+	}
+
+	active = false;
+	cache.fills++;
+
+	FastMutex::ScopedLock lock(cache.mutex);
+	cache.filling.erase(key);
+	cache.insert(key, size);
+	cache.evict();
+}
+
+void ShareCache::Fill::abandon()
+{
+	if (fd >= 0)
+		close(fd);
+	fd = -1;
+
+	if (!tempPath.empty())
+		unlink(tempPath.c_str());
+	tempPath.clear();
+
+	active = false;
+
+	FastMutex::ScopedLock lock(cache.mutex);
+	cache.filling.erase(key);
+}
+
+// Opens the copy of the file, if there is one of this version.
+bool ShareCache::lookup(const string &path, File::FileSize size, Copy &copy)
+{
+	struct stat original;
+	if (stat(path.c_str(), &original) != 0 || (File::FileSize) original.st_size != size)
+	{
+		misses++;
+		return false;
+	}
+
+	string key = makeKey(path);
+	string cachedPath = directory + '/' + key;
+
+	int fd;
+	{
+		FastMutex::ScopedLock lock(mutex);
+
+		unordered_map<string, Entry>::iterator it = entries.find(key);
+		if (it == entries.end())
+		{
+			misses++;
+			return false;
+		}
+
+		// the copy is opened before another request can evict it; once open, it stays readable until the caller closes it
+		fd = ::open(cachedPath.c_str(), O_RDONLY);
+		if (fd < 0)
+		{
+			remove(key);
+			misses++;
+			return false;
+		}
+
+		uses.splice(uses.begin(), uses, it->second.use);
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size == original.st_size &&
+		st.st_mtim.tv_sec == original.st_mtim.tv_sec && st.st_mtim.tv_nsec == original.st_mtim.tv_nsec)
+	{
+		copy.fd = fd;
+		copy.cachedPath = cachedPath;
+		hits++;
+		return true;
+	}
+
+	close(fd);
+
+	// the original changed since it was copied
+	FastMutex::ScopedLock lock(mutex);
+	remove(key);
+	misses++;
+	return false;
+}
+
+// Returns the path, size and modification time of the copy of the file, whatever version it is, if there is one.
+bool ShareCache::find(const string &path, string &cachedPath, File::FileSize &size, Timestamp &modified)
+{
+	string key = makeKey(path);
+
+	{
+		FastMutex::ScopedLock lock(mutex);
+
+		unordered_map<string, Entry>::iterator it = entries.find(key);
+		if (it == entries.end())
+		{
+			misses++;
+			return false;
+		}
+
+		uses.splice(uses.begin(), uses, it->second.use);
+	}
+
+	cachedPath = directory + '/' + key;
+
+	struct stat st;
+	if (stat(cachedPath.c_str(), &st) != 0)
+	{
+		FastMutex::ScopedLock lock(mutex);
+		remove(key);
+		misses++;
+		return false;
+	}
+
+	size = st.st_size;
+	modified = Timestamp::fromEpochTime(st.st_mtime);
+	hits++;
+	return true;
+}
+
+void ShareCache::discard(const string &path)
+{
+	FastMutex::ScopedLock lock(mutex);
+	remove(makeKey(path));
+}
+
+// Accounts for the copies left by previous runs, and removes the temporary files of interrupted copies.
+void ShareCache::load()
+{
+	vector<pair<time_t, pair<string, UInt64> > > found;
+
+	try
+	{
+		File(directory).createDirectories();
+
+		DirectoryIterator it(directory);
+		DirectoryIterator end;
+		for (; it != end; ++it)
+		{
+			const string &name = it.name();
+			string filePath = directory + '/' + name;
+
+			struct stat st;
+			if (stat(filePath.c_str(), &st) != 0 || !S_ISREG(st.st_mode))
+				continue;
+
+			if (name.compare(0, 6, ".fill-") == 0)
+				unlink(filePath.c_str());
+			else if (name.length() == Sha256::DIGEST_SIZE * 2)
+				found.push_back(make_pair(st.st_atime, make_pair(name, (UInt64) st.st_size)));
+		}
+	}
+	catch (Exception &e)
+	{
+		Application::instance().logger().error("Unable to use the share cache " + directory + ": " + e.displayText());
+	}
+
+	sort(found.begin(), found.end());
+
+	FastMutex::ScopedLock lock(mutex);
+	for (size_t i = 0; i < found.size(); i++)
+		insert(found[i].second.first, found[i].second.second);
+}
+
+void ShareCache::remove(const string &key)
+{
+	unordered_map<string, Entry>::iterator it = entries.find(key);
+	if (it == entries.end())
+		return;
+
+	string cachedPath = directory + '/' + key;
+	unlink(cachedPath.c_str());
+
+	used -= it->second.size;
+	uses.erase(it->second.use);
+	entries.erase(it);
+}
+
+void ShareCache::evict()
+{
+	while (used > capacity && !uses.empty())
+	{
+		remove(uses.back());
+		evictions++;
+	}
+}
+
+#else
+
+ShareCache::Copy::~Copy()
+{
+}
+
+ShareCache::Fill::Fill(ShareCache &cache, const string &path, File::FileSize size, const Timestamp &modified):
+	cache(cache),
+	key(),
+	size(size),
+	modified(modified),
+	tempPath(),
+	fd(-1),
+	written(0),
+	active(false)
+{
+}
+
+ShareCache::Fill::~Fill()
+{
+}
+
+void ShareCache::Fill::write(const char *data, size_t length)
+{
+}
+
+void ShareCache::Fill::commit()
+{
+}
+
+void ShareCache::Fill::commit(const string &original)
+{
+}
+
+void ShareCache::Fill::keep(Int64 seconds, long nanoseconds)
+{
+}
+
+void ShareCache::Fill::abandon()
+{
+}
+
+bool ShareCache::lookup(const string &path, File::FileSize size, Copy &copy)
+{
+	return false;
+}
+
+bool ShareCache::find(const string &path, string &cachedPath, File::FileSize &size, Timestamp &modified)
+{
+	return false;
+}
+
+void ShareCache::discard(const string &path)
+{
+}
+
+void ShareCache::load()
+{
+}
+
+void ShareCache::remove(const string &key)
+{
+}
+
+void ShareCache::evict()
+{
+}
+
+#endif
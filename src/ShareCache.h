@@ -0,0 +1,158 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef SHARECACHE_H
+#define SHARECACHE_H
+
+#include <cstddef>
+
+#include <string>
+#include <list>
+#include <ostream>
+#include <tr1/unordered_map> // change to <unordered_map> on c++0x compilers
+#include <tr1/unordered_set> // change to <unordered_set> on c++0x compilers
+
+#include "Poco/Types.h"
+#include "Poco/File.h"
+#include "Poco/Timestamp.h"
+#include "Poco/SharedPtr.h"
+#include "Poco/Mutex.h"
+#include "Poco/AtomicCounter.h"
+
+using namespace std;
+using namespace std::tr1; // remove this on c++0x compilers
+
+using namespace Poco;
+
+// A local copy of the files of a share on slow storage, such as an NFS or SMB
+// mount, or of a proxy share. A file is copied into the cache directory while
+// it is first sent, and later requests are served from the copy, as long as the
+// size and modification time of the original, to the nanosecond, have not
+// changed. The least recently used copies are
+// removed when the cache grows over its size. Copies are named after the hash
+// of the original path, and carry the modification time of the original, so
+// the cache survives restarts. Caches are kept by directory, so that
+// reloading the configuration keeps using the same cache. Unix only.
+class ShareCache
+{
+public:
+	// copies a file into the cache while it is read
+	class Fill
+	{
+	public:
+		Fill(ShareCache &cache, const string &path, File::FileSize size, const Timestamp &modified);
+		~Fill();
+
+		void write(const char *data, size_t length);
+		void commit();
+		void commit(const string &original);
+
+	private:
+		void keep(Int64 seconds, long nanoseconds);
+		void abandon();
+
+		ShareCache &cache;
+		const string key;
+		const File::FileSize size;
+		const Timestamp modified;
+		string tempPath;
+		int fd;
+		File::FileSize written;
+		bool active;
+	};
+
+	// an open copy, which stays readable until it is closed, even if it is evicted meanwhile
+	class Copy
+	{
+	public:
+		Copy();
+		~Copy();
+
+		int descriptor() const;
+		const string &path() const;
+
+	private:
+		friend class ShareCache;
+
+		Copy(const Copy &);
+		Copy &operator = (const Copy &);
+
+		int fd;
+		string cachedPath;
+	};
+
+	static SharedPtr<ShareCache> open(const string &directory, UInt64 capacity);
+
+	bool lookup(const string &path, File::FileSize size, Copy &copy);
+	bool find(const string &path, string &cachedPath, File::FileSize &size, Timestamp &modified);
+	void discard(const string &path);
+	bool cacheable(File::FileSize size) const;
+	void appendStatus(ostream &out) const;
+
+private:
+	friend class Fill;
+
+	struct Entry
+	{
+		list<string>::iterator use;
+		UInt64 size;
+	};
+
+	ShareCache(const string &directory);
+
+	static string makeKey(const string &path);
+	void load();
+	void insert(const string &key, UInt64 size);
+	void remove(const string &key);
+	void evict();
+
+	enum
+	{
+		// a file may take at most this part of the cache, so that one file cannot flush the whole cache
+		MAX_FILE_PART = 4
+	};
+
+	const string directory;
+	UInt64 capacity;
+	UInt64 used;
+
+	unordered_map<string, Entry> entries;
+	list<string> uses;
+	unordered_set<string> filling;
+	mutable FastMutex mutex;
+
+	AtomicCounter hits;
+	AtomicCounter misses;
+	AtomicCounter fills;
+	AtomicCounter evictions;
+
+	static unordered_map<string, SharedPtr<ShareCache> > caches;
+	static FastMutex cachesMutex;
+};
+
+#endif //SHARECACHE_H
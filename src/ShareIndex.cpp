@@ -0,0 +1,418 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include <cstring>
+
+#include <algorithm>
+#include <utility>
+#include <deque>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "Poco/DirectoryIterator.h"
+#include "Poco/ScopedLock.h"
+#include "Poco/Exception.h"
+
+#include "ShareIndex.h"
+
+ShareIndex::CrawlerRunnable::CrawlerRunnable(ShareIndex &index):
+	index(index),
+	stopCrawl()
+{
+}
+
+void ShareIndex::CrawlerRunnable::run()
+{
+	index.crawl();
+}
+
+void ShareIndex::CrawlerRunnable::stopCrawling()
+{
+	stopCrawl.set();
+}
+
+bool ShareIndex::CrawlerRunnable::stopped()
+{
+	return stopCrawl.tryWait(0);
+}
+
+ShareIndex::ShareIndex(const string &path):
+	Thread("ShareIndex"),
+	path(path),
+	nodes(),
+	names(),
+	complete(false),
+	mutex(),
+	runnable(*this)
+{
+}
+
+ShareIndex::~ShareIndex()
+{
+	stopCrawling();
+}
+
+void ShareIndex::startCrawling()
+{
+	start(runnable);
+}
+
+void ShareIndex::stopCrawling()
+{
+	if (isRunning())
+	{
+		runnable.stopCrawling();
+		join();
+	}
+}
+
+bool ShareIndex::ready() const
+{
+	FastMutex::ScopedLock lock(mutex);
+	return complete;
+}
+
+size_t ShareIndex::count() const
+{
+	return (ready() ? nodes.size() : 0);
+}
+
+bool ShareIndex::find(const RequestPath &uriPath, int first, Entry &entry) const
+{
+	if (!ready())
+		return false;
+
+	UInt32 node = 0;
+	int depth = uriPath.depth();
+	for (int i = first; i < depth; i++)
+	{
+		if ((getFlags(node) & FLAG_UNINDEXED) != 0)
+			return false;
+
+		if (!findNode(node, uriPath.segment(i), uriPath.segmentLength(i), node))
+		{
+			entry.exists = false;
+			return true;
+		}
+	}
+
+	if ((getFlags(node) & FLAG_UNINDEXED) != 0)
+		return false;
+
+	fillEntry(node, entry);
+	return true;
+}
+
+bool ShareIndex::findChild(const Entry &directory, const string &path, Entry &entry) const
+{
+	UInt32 node = directory.node;
+
+	string::size_type begin = 0;
+	while (begin < path.length())
+	{
+		if ((getFlags(node) & FLAG_UNINDEXED) != 0)
+			return false;
+
+		string::size_type end = path.find('/', begin);
+		if (end == string::npos)
+			end = path.length();
+
+		if (!findNode(node, path.data() + begin, end - begin, node))
+		{
+			entry.exists = false;
+			return true;
+		}
+
+		begin = end + 1;
+	}
+
+	if ((getFlags(node) & FLAG_UNINDEXED) != 0)
+		return false;
+
+	fillEntry(node, entry);
+	return true;
+}
+
+bool ShareIndex::list(const Entry &directory, vector<string> &entries) const
+{
+	const Node &dir = nodes[directory.node];
+	if ((getFlags(directory.node) & FLAG_UNINDEXED) != 0)
+		return false;
+
+	UInt32 end = dir.firstChild + dir.childCount;
+	for (UInt32 i = dir.firstChild; i < end; i++)
+	{
+		const Node &child = nodes[i];
+		UInt32 flags = getFlags(i);
+		if ((flags & FLAG_HIDDEN) != 0 || flags == FLAG_UNINDEXED)
+			continue;
+
+		string entry(names, child.nameOffset, child.nameLength);
+		if ((flags & FLAG_DIRECTORY) != 0)
+			entry += '/';
+
+		entries.push_back(entry);
+	}
+
+	return true;
+}
+
+// Like list(), but with the type, size and modification time of each entry.
+bool ShareIndex::listEntries(const Entry &directory, vector<pair<string, Entry> > &entries) const
+{
+	const Node &dir = nodes[directory.node];
+	if ((getFlags(directory.node) & FLAG_UNINDEXED) != 0)
+		return false;
+
+	UInt32 end = dir.firstChild + dir.childCount;
+	for (UInt32 i = dir.firstChild; i < end; i++)
+	{
+		const Node &child = nodes[i];
+		UInt32 flags = getFlags(i);
+		if ((flags & FLAG_HIDDEN) != 0 || flags == FLAG_UNINDEXED)
+			continue;
+
+		Entry entry;
+		fillEntry(i, entry);
+		entries.push_back(make_pair(string(names, child.nameOffset, child.nameLength), entry));
+	}
+
+	return true;
+}
+
+// Leaves the directory of the entry at the URI path to the filesystem, or its closest indexed ancestor.
+// A lookup that races with this may still be answered from the index, as if it came a moment earlier.
+void ShareIndex::invalidate(const RequestPath &uriPath, int first) const
+{
+	if (!ready())
+		return;
+
+	UInt32 node = 0;
+	int depth = uriPath.depth();
+	for (int i = first; i < depth - 1; i++)
+	{
+		if ((getFlags(node) & FLAG_UNINDEXED) != 0)
+			return;
+
+		if (!findNode(node, uriPath.segment(i), uriPath.segmentLength(i), node))
+			break;
+	}
+
+	setFlags(node, FLAG_UNINDEXED);
+}
+
+bool ShareIndex::findNode(UInt32 parent, const char *name, size_t length, UInt32 &node) const
+{
+	const Node &dir = nodes[parent];
+	if ((getFlags(parent) & FLAG_DIRECTORY) == 0)
+		return false;
+
+	// binary search over the children, which are sorted by name
+	UInt32 low = dir.firstChild;
+	UInt32 high = dir.firstChild + dir.childCount;
+	while (low < high)
+	{
+		UInt32 mid = low + (high - low) / 2;
+		const Node &child = nodes[mid];
+
+		int cmp = memcmp(names.data() + child.nameOffset, name, min((size_t) child.nameLength, length));
+		if (cmp == 0)
+			cmp = (child.nameLength < length ? -1 : (child.nameLength > length ? 1 : 0));
+
+		if (cmp == 0)
+		{
+			node = mid;
+			return true;
+		}
+		else if (cmp < 0)
+		{
+			low = mid + 1;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+
+	return false;
+}
+
+void ShareIndex::fillEntry(UInt32 node, Entry &entry) const
+{
+	const Node &n = nodes[node];
+
+	entry.node = node;
+	entry.exists = true;
+	entry.directory = ((getFlags(node) & FLAG_DIRECTORY) != 0);
+	entry.size = n.size;
+	entry.modified = Timestamp(n.modified);
+}
+
+UInt32 ShareIndex::getFlags(UInt32 node) const
+{
+#if defined(_MSC_VER)
+	return (UInt32) _InterlockedOr((volatile long *) &nodes[node].flags, 0);
+#else
+	return __sync_fetch_and_or(&nodes[node].flags, 0);
+#endif
+}
+
+void ShareIndex::setFlags(UInt32 node, UInt32 flags) const
+{
+#if defined(_MSC_VER)
+	_InterlockedOr((volatile long *) &nodes[node].flags, (long) flags);
+#else
+	__sync_fetch_and_or(&nodes[node].flags, flags);
+#endif
+}
+
+void ShareIndex::crawl()
+{
+	vector<Node> crawled;
+	string crawledNames;
+
+	Node root;
+	try
+	{
+		root = makeNode("", File(path), crawledNames);
+	}
+	catch (Exception &e)
+	{
+		// a missing share is answered by the filesystem, like any other failure
+		root = makeNode("", File(), crawledNames);
+		root.flags = FLAG_UNINDEXED;
+	}
+	crawled.push_back(root);
+
+	// the children of each directory are appended next to each other when it is taken from the queue
+	deque<pair<UInt32, string> > pending;
+	pending.push_back(make_pair(0, path));
+
+	vector<pair<string, File> > children;
+	while (!pending.empty())
+	{
+		if (runnable.stopped())
+			return;
+
+		UInt32 i = pending.front().first;
+		string dirPath;
+		dirPath.swap(pending.front().second);
+		pending.pop_front();
+
+		Node &dir = crawled[i];
+		if ((dir.flags & FLAG_DIRECTORY) == 0 || (dir.flags & FLAG_UNINDEXED) != 0)
+			continue;
+
+		children.clear();
+		try
+		{
+			DirectoryIterator it(dirPath);
+			DirectoryIterator end;
+			for (; it != end; ++it)
+				children.push_back(make_pair(it.name(), *it));
+		}
+		catch (Exception &e)
+		{
+			dir.flags |= FLAG_UNINDEXED;
+			continue;
+		}
+
+		sort(children.begin(), children.end(), compareChildren);
+
+		dir.firstChild = crawled.size();
+		dir.childCount = children.size();
+
+		for (vector<pair<string, File> >::const_iterator it = children.begin(); it != children.end(); ++it)
+		{
+			Node node;
+			try
+			{
+				node = makeNode(it->first, it->second, crawledNames);
+			}
+			catch (Exception &e)
+			{
+				// entries that vanish or cannot be read are left to the filesystem
+				node = makeNode(it->first, File(), crawledNames);
+				node.flags = FLAG_UNINDEXED;
+			}
+
+			if ((node.flags & FLAG_DIRECTORY) != 0)
+				pending.push_back(make_pair((UInt32) crawled.size(), it->second.path()));
+
+			crawled.push_back(node);
+		}
+	}
+
+	FastMutex::ScopedLock lock(mutex);
+	nodes.swap(crawled);
+	names.swap(crawledNames);
+	complete = true;
+}
+
+bool ShareIndex::compareChildren(const pair<string, File> &a, const pair<string, File> &b)
+{
+	return a.first < b.first;
+}
+
+ShareIndex::Node ShareIndex::makeNode(const string &name, const File &file, string &names)
+{
+	Node node;
+	node.nameOffset = names.length();
+	node.nameLength = name.length();
+	node.firstChild = 0;
+	node.childCount = 0;
+	node.size = 0;
+	node.modified = 0;
+	node.flags = 0;
+
+	names += name;
+
+	if (file.path().empty())
+		return node;
+
+	node.modified = file.getLastModified().epochMicroseconds();
+	if (file.isHidden())
+		node.flags |= FLAG_HIDDEN;
+
+	if (file.isDirectory())
+	{
+		node.flags |= FLAG_DIRECTORY;
+
+		// linked directories may form cycles, so they are left to the filesystem
+		if (file.isLink())
+			node.flags |= FLAG_UNINDEXED;
+	}
+	else
+	{
+		node.size = file.getSize();
+	}
+
+	return node;
+}
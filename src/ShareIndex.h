@@ -0,0 +1,139 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef SHAREINDEX_H
+#define SHAREINDEX_H
+
+#include <cstddef>
+
+#include <string>
+#include <vector>
+#include <utility>
+
+#include "Poco/Types.h"
+#include "Poco/Thread.h"
+#include "Poco/Runnable.h"
+#include "Poco/Event.h"
+#include "Poco/Mutex.h"
+#include "Poco/File.h"
+#include "Poco/Timestamp.h"
+
+#include "RequestPath.h"
+
+using namespace std;
+
+using namespace Poco;
+
+// An in-memory snapshot of the names, types, sizes and modification times in
+// a share, crawled by a background thread. Until the crawl is complete, and
+// below directories that could not be crawled, lookups report that the index
+// cannot answer, and the caller falls back to the filesystem.
+// Nodes are kept in breadth-first order, so that the children of a directory
+// are contiguous and sorted by name, and names are packed into one buffer.
+// Changes made through the server leave the directory they were made in to
+// the filesystem, until the share is crawled again.
+class ShareIndex: public Thread
+{
+public:
+	struct Entry
+	{
+		UInt32 node;
+		bool exists;
+		bool directory;
+		File::FileSize size;
+		Timestamp modified;
+	};
+
+	ShareIndex(const string &path);
+	~ShareIndex();
+
+	void startCrawling();
+	void stopCrawling();
+
+	bool ready() const;
+	size_t count() const;
+
+	bool find(const RequestPath &uriPath, int first, Entry &entry) const;
+	bool findChild(const Entry &directory, const string &path, Entry &entry) const;
+	bool list(const Entry &directory, vector<string> &entries) const;
+	bool listEntries(const Entry &directory, vector<pair<string, Entry> > &entries) const;
+	void invalidate(const RequestPath &uriPath, int first) const;
+
+private:
+	struct Node
+	{
+		UInt32 nameOffset;
+		UInt32 nameLength;
+		UInt32 firstChild;
+		UInt32 childCount;
+		UInt64 size;
+		Int64 modified;
+		// FLAG_UNINDEXED is set on directories in which entries were changed after the crawl,
+		// while other threads read the flags, so once the index is complete they are only accessed atomically
+		mutable volatile UInt32 flags;
+	};
+
+	enum
+	{
+		FLAG_DIRECTORY = 1,
+		FLAG_HIDDEN = 2,
+		FLAG_UNINDEXED = 4
+	};
+
+	class CrawlerRunnable: public Runnable
+	{
+	public:
+		CrawlerRunnable(ShareIndex &index);
+
+		void run();
+		void stopCrawling();
+		bool stopped();
+
+	private:
+		ShareIndex &index;
+		Event stopCrawl;
+	};
+
+	void crawl();
+	bool findNode(UInt32 parent, const char *name, size_t length, UInt32 &node) const;
+	void fillEntry(UInt32 node, Entry &entry) const;
+	UInt32 getFlags(UInt32 node) const;
+	void setFlags(UInt32 node, UInt32 flags) const;
+
+	static bool compareChildren(const pair<string, File> &a, const pair<string, File> &b);
+	static Node makeNode(const string &name, const File &file, string &names);
+
+	const string path;
+	vector<Node> nodes;
+	string names;
+	bool complete;
+	mutable FastMutex mutex;
+	CrawlerRunnable runnable;
+};
+
+#endif //SHAREINDEX_H
@@ -0,0 +1,334 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "Poco/Platform.h"
+
+#if defined(POCO_OS_FAMILY_UNIX)
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#endif
+
+#include "Poco/Net/HTTPServerRequestImpl.h"
+#include "Poco/Net/NetException.h"
+#include "Poco/Path.h"
+#include "Poco/Buffer.h"
+
+#include "ShareWriter.h"
+#include "TlsConnection.h"
+
+// the most that is moved from the socket to the pipe at a time, which fits in the pipe buffer
+#define SPLICE_CHUNK_SIZE (1 << 16)
+
+// the buffer size used for bodies that cannot be spliced
+#define COPY_CHUNK_SIZE (1 << 16)
+
+POCO_IMPLEMENT_EXCEPTION(InsufficientStorageException, FileException, "Insufficient storage")
+
+AtomicCounter ShareWriter::writtenFiles;
+AtomicCounter ShareWriter::splicedFiles;
+AtomicCounter ShareWriter::removedFiles;
+AtomicCounter ShareWriter::failedWrites;
+
+// Returns whether the body of the request can be received. The bodies of HTTP/2 requests are discarded.
+bool ShareWriter::accepts(const HTTPServerRequest &request)
+{
+	return (dynamic_cast<const HTTPServerRequestImpl *>(&request) != NULL);
+}
+
+#if defined(POCO_OS_FAMILY_UNIX)
+
+// Stores the body of the request as the file at the path, and returns whether the file is new.
+bool ShareWriter::writeFile(HTTPServerRequest &request, const string &path)
+{
+	bool created = (access(path.c_str(), F_OK) != 0);
+
+	string tempPath;
+	int fd = createTemporary(path, tempPath);
+	bool spliced = false;
+
+	try
+	{
+		spliced = receiveBody(request, fd, path);
+
+		int result = close(fd);
+		fd = -1;
+		if (result != 0)
+			fail(errno, path);
+
+		if (rename(tempPath.c_str(), path.c_str()) != 0)
+			fail(errno, path);
+	}
+	catch (...)
+	{
+		if (fd >= 0)
+			close(fd);
+		unlink(tempPath.c_str());
+
+		failedWrites++;
+		throw;
+	}
+
+	writtenFiles++;
+	if (spliced)
+		splicedFiles++;
+
+	return created;
+}
+
+void ShareWriter::removeFile(const string &path)
+{
+	if (unlink(path.c_str()) != 0)
+		fail(errno, path);
+
+	removedFiles++;
+}
+
+// Creates a hidden file next to the target, so that it stays out of listings and can be renamed over the target.
+int ShareWriter::createTemporary(const string &path, string &tempPath)
+{
+	Path target(path);
+	Path temp(target.parent(), "." + target.getFileName() + ".XXXXXX");
+
+	string name = temp.toString();
+	Buffer<char> buffer(name.length() + 1);
+	memcpy(buffer.begin(), name.c_str(), name.length() + 1);
+
+	int fd = mkstemp(buffer.begin());
+	if (fd < 0)
+		fail(errno, path);
+
+	tempPath.assign(buffer.begin());
+
+	// mkstemp() creates the file readable only by its owner, but the file is going to be served
+	fchmod(fd, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
+
+	return fd;
+}
+
+// Writes the body of the request to the file, and returns whether it was spliced.
+bool ShareWriter::receiveBody(HTTPServerRequest &request, int fd, const string &path)
+{
+	istream &in = request.stream();
+
+	// chunked bodies end when they say so, and are copied through the request stream
+	if (request.getChunkedTransferEncoding() || request.getContentLength64() == HTTPMessage::UNKNOWN_CONTENT_LENGTH)
+	{
+		copyStream(in, fd, 0, path);
+		return false;
+	}
+
+	File::FileSize length = (File::FileSize) request.getContentLength64();
+
+#if defined(__linux__)
+	if (length > 0 && fallocate(fd, 0, 0, (off_t) length) != 0)
+	{
+		// filesystems that cannot allocate ahead just grow the file as it is written
+		if (errno == ENOSPC || errno == EDQUOT)
+			fail(errno, path);
+	}
+
+	StreamSocket &socket = dynamic_cast<HTTPServerRequestImpl &>(request).socket();
+	bool plain = true;
+#ifdef INDIGO_TLS
+	plain = (dynamic_cast<TlsSocketImpl *>(socket.impl()) == NULL);
+#endif
+
+	if (plain)
+	{
+		File::FileSize buffered = copyBuffered(in, fd, length, path);
+		spliceBody(socket, fd, length - buffered, path);
+		return true;
+	}
+#endif
+
+	copyStream(in, fd, length, path);
+	return false;
+}
+
+// Copies the part of the body that POCO has already read from the socket, together with the request header.
+// The first read of the request stream takes exactly that part out of the session buffer, which is smaller
+// than the stream buffer, or reads from the socket if the session buffer is empty. Either way, the rest of
+// the body is still in the socket afterwards.
+File::FileSize ShareWriter::copyBuffered(istream &in, int fd, File::FileSize length, const string &path)
+{
+	if (length == 0 || in.peek() == char_traits<char>::eof())
+		return 0;
+
+	streamsize available = in.rdbuf()->in_avail();
+	Buffer<char> buffer((size_t) available);
+	in.read(buffer.begin(), available);
+	writeAll(fd, buffer.begin(), (size_t) in.gcount(), path);
+
+	return (File::FileSize) in.gcount();
+}
+
+// Copies the body through the request stream, and checks that all of it has arrived if the length is known.
+void ShareWriter::copyStream(istream &in, int fd, File::FileSize length, const string &path)
+{
+	Buffer<char> buffer(COPY_CHUNK_SIZE);
+	File::FileSize received = 0;
+
+	while (in.good())
+	{
+		in.read(buffer.begin(), COPY_CHUNK_SIZE);
+		writeAll(fd, buffer.begin(), (size_t) in.gcount(), path);
+		received += in.gcount();
+	}
+
+	if (in.bad() || (length > 0 && received != length))
+		throw NetException("Request body ended early", path);
+}
+
+void ShareWriter::spliceBody(StreamSocket &socket, int fd, File::FileSize length, const string &path)
+{
+#if defined(__linux__)
+	int pipes[2];
+	if (pipe(pipes) != 0)
+		throw SystemException("Unable to create a pipe", strerror(errno));
+
+	try
+	{
+		while (length > 0)
+		{
+			size_t count = (size_t) (length < SPLICE_CHUNK_SIZE ? length : SPLICE_CHUNK_SIZE);
+			ssize_t n = splice(socket.impl()->sockfd(), NULL, pipes[1], NULL, count, SPLICE_F_MOVE | SPLICE_F_MORE);
+			if (n == 0)
+				throw NetException("Request body ended early", path);
+
+			if (n < 0)
+			{
+				if (errno == EINTR)
+					continue;
+
+				if (errno == EAGAIN)
+				{
+					if (!socket.poll(socket.getReceiveTimeout(), Socket::SELECT_READ))
+						throw TimeoutException();
+					continue;
+				}
+
+				throw NetException("Cannot receive request body", strerror(errno));
+			}
+
+			length -= n;
+
+			// the pipe is emptied every time, so that the next part fits in it
+			while (n > 0)
+			{
+				ssize_t m = splice(pipes[0], NULL, fd, NULL, (size_t) n, SPLICE_F_MOVE | SPLICE_F_MORE);
+				if (m < 0)
+				{
+					if (errno == EINTR)
+						continue;
+
+					fail(errno, path);
+				}
+
+				n -= m;
+			}
+		}
+	}
+	catch (...)
+	{
+		close(pipes[0]);
+		close(pipes[1]);
+		throw;
+	}
+
+	close(pipes[0]);
+	close(pipes[1]);
+#endif
+}
+
+void ShareWriter::writeAll(int fd, const char *data, size_t length, const string &path)
+{
+	while (length > 0)
+	{
+		ssize_t n = write(fd, data, length);
+		if (n < 0)
+		{
+			if (errno == EINTR)
+				continue;
+
+			fail(errno, path);
+		}
+
+		data += n;
+		length -= n;
+	}
+}
+
+// Throws the exception for a failed file operation, as the request handler expects it.
+void ShareWriter::fail(int error, const string &path)
+{
+	switch (error)
+	{
+	case ENOENT:
+	case ENOTDIR:
+		throw FileNotFoundException(path);
+	case EACCES:
+	case EPERM:
+	case EROFS:
+		throw FileAccessDeniedException(path);
+	case EISDIR:
+	case ENOTEMPTY:
+	case EEXIST:
+		throw FileExistsException(path);
+	case ENOSPC:
+	case EDQUOT:
+		throw InsufficientStorageException(path);
+	default:
+		throw WriteFileException(path, strerror(error));
+	}
+}
+
+#else
+
+bool ShareWriter::writeFile(HTTPServerRequest &request, const string &path)
+{
+	throw NotImplementedException("Files can only be written on Unix");
+}
+
+void ShareWriter::removeFile(const string &path)
+{
+	throw NotImplementedException("Files can only be removed on Unix");
+}
+
+#endif
+
+void ShareWriter::appendStatus(ostream &out)
+{
+	out << "Written files: " << writtenFiles.value() << " (" << splicedFiles.value() << " spliced, " << failedWrites.value() << " failed)" << endl;
+	out << "Removed files: " << removedFiles.value() << endl;
+}
@@ -0,0 +1,81 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef SHAREWRITER_H
+#define SHAREWRITER_H
+
+#include <string>
+#include <istream>
+#include <ostream>
+
+#include "Poco/Net/HTTPServerRequest.h"
+#include "Poco/Net/StreamSocket.h"
+#include "Poco/AtomicCounter.h"
+#include "Poco/Exception.h"
+#include "Poco/File.h"
+
+using namespace std;
+
+using namespace Poco;
+using namespace Poco::Net;
+
+POCO_DECLARE_EXCEPTION(, InsufficientStorageException, FileException)
+
+// Stores the bodies of PUT requests as files, and removes files for DELETE
+// requests. A body is received into a temporary file in the directory of the
+// target, which is renamed over the target once the whole body has arrived,
+// so that readers see either the old or the new file, never a partial one.
+// When the length of the body is known, the space for it is allocated up
+// front. On Linux, the body of a plain HTTP/1.x request is moved from the
+// socket to the file with splice(), through a pipe, without being copied
+// through the process. Files are only written on Unix.
+class ShareWriter
+{
+public:
+	static bool accepts(const HTTPServerRequest &request);
+	static bool writeFile(HTTPServerRequest &request, const string &path);
+	static void removeFile(const string &path);
+
+	static void appendStatus(ostream &out);
+
+private:
+	static int createTemporary(const string &path, string &tempPath);
+	static bool receiveBody(HTTPServerRequest &request, int fd, const string &path);
+	static File::FileSize copyBuffered(istream &in, int fd, File::FileSize length, const string &path);
+	static void copyStream(istream &in, int fd, File::FileSize length, const string &path);
+	static void spliceBody(StreamSocket &socket, int fd, File::FileSize length, const string &path);
+	static void writeAll(int fd, const char *data, size_t length, const string &path);
+	static void fail(int error, const string &path);
+
+	static AtomicCounter writtenFiles;
+	static AtomicCounter splicedFiles;
+	static AtomicCounter removedFiles;
+	static AtomicCounter failedWrites;
+};
+
+#endif //SHAREWRITER_H
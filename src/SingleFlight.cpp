@@ -0,0 +1,125 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "Poco/ScopedLock.h"
+
+#include "SingleFlight.h"
+
+SingleFlight::Flight::Flight():
+	done(false),
+	result()
+{
+}
+
+// Waits up to timeout milliseconds for the result of the work in progress for the key. If there is none,
+// the call leads, and its result is given to the calls that join it. A timeout of 0 disables coalescing.
+SingleFlight::Call::Call(SingleFlight &flights, const string &key, long timeout):
+	flights(flights),
+	key(key),
+	flight(),
+	leading(false),
+	shared()
+{
+	if (timeout <= 0)
+		return;
+
+	{
+		FastMutex::ScopedLock lock(flights.mutex);
+
+		SharedPtr<Flight> &current = flights.flights[key];
+		if (current.isNull())
+		{
+			current = new Flight;
+			flight = current;
+			leading = true;
+			flights.led++;
+			return;
+		}
+
+		flight = current;
+	}
+
+	if (flight->done.tryWait(timeout))
+	{
+		shared = flight->result;
+		if (!shared.isNull())
+			flights.joined++;
+	}
+	else
+	{
+		flights.expired++;
+	}
+}
+
+// a leader that fails lets the waiting calls do the work themselves
+SingleFlight::Call::~Call()
+{
+	if (leading)
+		complete(Result());
+}
+
+// Returns the result of the call that led, or NULL if this call has to do the work itself.
+const SingleFlight::Result &SingleFlight::Call::result() const
+{
+	return shared;
+}
+
+void SingleFlight::Call::complete(const Result &result)
+{
+	if (!leading)
+		return;
+
+	leading = false;
+
+	{
+		FastMutex::ScopedLock lock(flights.mutex);
+
+		flight->result = result;
+		flights.flights.erase(key);
+	}
+
+	flight->done.set();
+}
+
+SingleFlight::SingleFlight(const string &name):
+	name(name),
+	mutex(),
+	flights(),
+	led(),
+	joined(),
+	expired()
+{
+}
+
+void SingleFlight::appendStatus(ostream &out) const
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	out << name << " coalescing: " << flights.size() << " in progress, " << led.value() << " led, ";
+	out << joined.value() << " joined, " << expired.value() << " expired" << endl;
+}
@@ -0,0 +1,101 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef SINGLEFLIGHT_H
+#define SINGLEFLIGHT_H
+
+#include <string>
+#include <ostream>
+#include <tr1/unordered_map> // change to <unordered_map> on c++0x compilers
+
+#include "Poco/SharedPtr.h"
+#include "Poco/Mutex.h"
+#include "Poco/Event.h"
+#include "Poco/AtomicCounter.h"
+
+using namespace std;
+using namespace std::tr1; // remove this on c++0x compilers
+
+using namespace Poco;
+
+// Coalesces identical requests that are served at the same time. The first request for a key does the
+// work, and the requests for the same key that arrive before it is done wait for its result instead of
+// repeating the work. Results are only shared while the work is in progress, not cached.
+// A request waits for the result at most until its own deadline, and then does the work itself,
+// so a slow leader cannot hold up everyone that asked after it.
+class SingleFlight
+{
+	struct Flight;
+
+public:
+	typedef SharedPtr<string> Result;
+
+	// joins the work in progress for the key, or takes the lead if there is none
+	class Call
+	{
+	public:
+		Call(SingleFlight &flights, const string &key, long timeout);
+		~Call();
+
+		const Result &result() const;
+		void complete(const Result &result);
+
+	private:
+		SingleFlight &flights;
+		const string key;
+		SharedPtr<Flight> flight;
+		bool leading;
+		Result shared;
+	};
+
+	SingleFlight(const string &name);
+
+	void appendStatus(ostream &out) const;
+
+private:
+	friend class Call;
+
+	struct Flight
+	{
+		Flight();
+
+		Event done;
+		Result result;
+	};
+
+	const string name;
+
+	mutable FastMutex mutex;
+	unordered_map<string, SharedPtr<Flight> > flights;
+
+	AtomicCounter led;
+	AtomicCounter joined;
+	AtomicCounter expired;
+};
+
+#endif //SINGLEFLIGHT_H
@@ -0,0 +1,346 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "SocketHandoff.h"
+
+#if defined(POCO_OS_FAMILY_UNIX)
+
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "Poco/Util/Application.h"
+#include "Poco/Net/ServerSocketImpl.h"
+
+using namespace Poco::Util;
+
+// how long the running server waits for its replacement to confirm that it is serving
+#define CONFIRMATION_TIMEOUT 60000
+
+class SocketHandoff::InheritedSocketImpl: public ServerSocketImpl
+{
+public:
+	InheritedSocketImpl(int fd)
+	{
+		reset(fd);
+	}
+};
+
+class SocketHandoff::InheritedSocket: public ServerSocket
+{
+public:
+	InheritedSocket(int fd):
+		ServerSocket(new InheritedSocketImpl(fd), true)
+	{
+	}
+};
+
+SocketHandoff::HandoffRunnable::HandoffRunnable(const string &path):
+	path(path),
+	sock(),
+	stopListeningEvent(),
+	handedOffFlag(false)
+{
+}
+
+void SocketHandoff::HandoffRunnable::run()
+{
+	Application &app = Application::instance();
+
+	int listener = listenOn(path);
+	if (listener < 0)
+	{
+		app.logger().error("Unable to listen for socket handoff on " + path + ": " + strerror(errno));
+		return;
+	}
+
+	while (!stopListeningEvent.tryWait(0))
+	{
+		pollfd pfd;
+		pfd.fd = listener;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, 1000) <= 0)
+			continue;
+
+		int fd = accept(listener, NULL, NULL);
+		if (fd < 0)
+			continue;
+
+		bool success = handOff(fd);
+		close(fd);
+
+		if (success)
+		{
+			handedOffFlag = true;
+			break;
+		}
+
+		app.logger().warning("Socket handoff was not confirmed, continuing to serve");
+	}
+
+	close(listener);
+
+	if (handedOffFlag)
+	{
+		// the path now belongs to the replacement, so it is not unlinked
+		app.logger().information("Listening socket handed off, draining connections");
+		kill(getpid(), SIGTERM);
+	}
+	else
+	{
+		unlink(path.c_str());
+	}
+}
+
+void SocketHandoff::HandoffRunnable::setSocket(const ServerSocket &sock)
+{
+	this->sock = sock;
+}
+
+void SocketHandoff::HandoffRunnable::stopListening()
+{
+	stopListeningEvent.set();
+}
+
+bool SocketHandoff::HandoffRunnable::handedOff() const
+{
+	return handedOffFlag;
+}
+
+bool SocketHandoff::HandoffRunnable::handOff(int fd)
+{
+	if (!sendDescriptor(fd, sock.impl()->sockfd()))
+		return false;
+
+	pollfd pfd;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	if (poll(&pfd, 1, CONFIRMATION_TIMEOUT) <= 0)
+		return false;
+
+	char confirmation;
+	return recv(fd, &confirmation, 1, 0) == 1;
+}
+
+SocketHandoff::SocketHandoff(const string &path):
+	Thread("SocketHandoff"),
+	path(path),
+	connection(-1),
+	runnable(path)
+{
+}
+
+SocketHandoff::~SocketHandoff()
+{
+	stopListening();
+
+	if (connection >= 0)
+		close(connection);
+}
+
+bool SocketHandoff::receive(ServerSocket &sock)
+{
+	poco_assert(connection < 0);
+
+	int fd = connectTo(path);
+	if (fd < 0)
+		return false;
+
+	int descriptor = receiveDescriptor(fd);
+	if (descriptor < 0)
+	{
+		close(fd);
+		return false;
+	}
+
+	sock = InheritedSocket(descriptor);
+
+	// kept open until confirm(), the running server keeps accepting connections in the meantime
+	connection = fd;
+
+	return true;
+}
+
+void SocketHandoff::confirm()
+{
+	poco_assert(connection >= 0);
+
+	char confirmation = 1;
+	send(connection, &confirmation, 1, 0);
+
+	close(connection);
+	connection = -1;
+}
+
+void SocketHandoff::startListening(const ServerSocket &sock)
+{
+	runnable.setSocket(sock);
+	start(runnable);
+}
+
+void SocketHandoff::stopListening()
+{
+	if (isRunning())
+	{
+		runnable.stopListening();
+		join();
+	}
+}
+
+bool SocketHandoff::handedOff() const
+{
+	return runnable.handedOff();
+}
+
+int SocketHandoff::connectTo(const string &path)
+{
+	sockaddr_un addr;
+	if (path.length() >= sizeof(addr.sun_path))
+		return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	if (connect(fd, (sockaddr *) &addr, sizeof(addr)) != 0)
+	{
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+int SocketHandoff::listenOn(const string &path)
+{
+	sockaddr_un addr;
+	if (path.length() >= sizeof(addr.sun_path))
+	{
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path.c_str());
+
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0)
+		return -1;
+
+	// a stale path is left behind by a server that did not shut down cleanly
+	unlink(path.c_str());
+
+	// only processes running as the same user may take over the socket
+	mode_t mask = umask(0077);
+	int rc = bind(fd, (sockaddr *) &addr, sizeof(addr));
+	umask(mask);
+
+	if (rc != 0 || listen(fd, 1) != 0)
+	{
+		int error = errno;
+		close(fd);
+		errno = error;
+		return -1;
+	}
+
+	return fd;
+}
+
+bool SocketHandoff::sendDescriptor(int fd, int descriptor)
+{
+	char data = 0;
+	iovec iov;
+	iov.iov_base = &data;
+	iov.iov_len = 1;
+
+	char control[CMSG_SPACE(sizeof(int))];
+	memset(control, 0, sizeof(control));
+
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &descriptor, sizeof(int));
+
+	return sendmsg(fd, &msg, 0) == 1;
+}
+
+int SocketHandoff::receiveDescriptor(int fd)
+{
+	char data;
+	iovec iov;
+	iov.iov_base = &data;
+	iov.iov_len = 1;
+
+	char control[CMSG_SPACE(sizeof(int))];
+	memset(control, 0, sizeof(control));
+
+	msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control;
+	msg.msg_controllen = sizeof(control);
+
+	if (recvmsg(fd, &msg, 0) != 1)
+		return -1;
+
+	cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS || cmsg->cmsg_len != CMSG_LEN(sizeof(int)))
+		return -1;
+
+	int descriptor;
+	memcpy(&descriptor, CMSG_DATA(cmsg), sizeof(int));
+
+	return descriptor;
+}
+
+#endif
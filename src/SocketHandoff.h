@@ -0,0 +1,99 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef SOCKETHANDOFF_H
+#define SOCKETHANDOFF_H
+
+#include "Poco/Platform.h"
+
+#if defined(POCO_OS_FAMILY_UNIX)
+
+#include <string>
+
+#include "Poco/Thread.h"
+#include "Poco/Runnable.h"
+#include "Poco/Event.h"
+#include "Poco/Net/ServerSocket.h"
+
+using namespace std;
+
+using namespace Poco;
+using namespace Poco::Net;
+
+// Passes the listening socket from a running server to its replacement over a Unix domain socket.
+// The replacement receives the socket with receive(), starts serving and then calls confirm().
+// Only after the confirmation does the running server stop accepting connections.
+class SocketHandoff: public Thread
+{
+public:
+	SocketHandoff(const string &path);
+	~SocketHandoff();
+
+	bool receive(ServerSocket &sock);
+	void confirm();
+
+	void startListening(const ServerSocket &sock);
+	void stopListening();
+	bool handedOff() const;
+
+private:
+	class HandoffRunnable: public Runnable
+	{
+	public:
+		HandoffRunnable(const string &path);
+
+		void run();
+		void setSocket(const ServerSocket &sock);
+		void stopListening();
+		bool handedOff() const;
+
+	private:
+		bool handOff(int fd);
+
+		const string path;
+		ServerSocket sock;
+		Event stopListeningEvent;
+		bool handedOffFlag;
+	};
+
+	class InheritedSocketImpl;
+	class InheritedSocket;
+
+	static int connectTo(const string &path);
+	static int listenOn(const string &path);
+	static bool sendDescriptor(int fd, int descriptor);
+	static int receiveDescriptor(int fd);
+
+	const string path;
+	int connection;
+	HandoffRunnable runnable;
+};
+
+#endif
+
+#endif //SOCKETHANDOFF_H
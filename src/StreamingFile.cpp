@@ -0,0 +1,168 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "StreamingFile.h"
+
+#if defined(POCO_OS_FAMILY_UNIX)
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "Poco/Exception.h"
+
+// already read data is dropped from the page cache in steps of this size
+#define DROP_STEP 1048576
+
+#if defined(POCO_OS_FAMILY_UNIX)
+
+StreamingFile::StreamingFile(const string &path, bool bulk, long readahead):
+	path(path),
+	fd(-1),
+	bulk(bulk),
+	readahead(readahead > 0 ? readahead : 0),
+	offset(0),
+	prefetched(0),
+	dropped(0)
+{
+	fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0)
+		throw OpenFileException(path);
+
+	advise();
+}
+
+// Reads a file that the caller has already opened, and keeps open, from its current position.
+StreamingFile::StreamingFile(const string &path, int file, bool bulk, long readahead):
+	path(path),
+	fd(-1),
+	bulk(bulk),
+	readahead(readahead > 0 ? readahead : 0),
+	offset(0),
+	prefetched(0),
+	dropped(0)
+{
+	fd = (file >= 0 ? dup(file) : open(path.c_str(), O_RDONLY));
+	if (fd < 0)
+		throw OpenFileException(path);
+
+	advise();
+}
+
+StreamingFile::~StreamingFile()
+{
+	close(fd);
+}
+
+streamsize StreamingFile::read(char *buffer, streamsize length)
+{
+	if (bulk && readahead > 0 && offset + readahead / 2 >= prefetched)
+	{
+		// keep a window of readahead bytes in flight ahead of the read position
+		File::FileSize start = (prefetched > offset ? prefetched : offset);
+		prefetch(start, offset + readahead - start);
+		prefetched = offset + readahead;
+	}
+
+	ssize_t n;
+	do
+	{
+		n = ::read(fd, buffer, length);
+	}
+	while (n < 0 && errno == EINTR);
+
+	if (n < 0)
+		throw ReadFileException(path);
+
+	offset += n;
+
+	if (bulk && offset - dropped >= DROP_STEP)
+	{
+		drop(dropped, offset - dropped);
+		dropped = offset;
+	}
+
+	return n;
+}
+
+void StreamingFile::advise()
+{
+#if defined(POSIX_FADV_SEQUENTIAL)
+	if (bulk)
+		posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+}
+
+void StreamingFile::prefetch(File::FileSize start, File::FileSize length)
+{
+#if defined(POSIX_FADV_WILLNEED)
+	posix_fadvise(fd, start, length, POSIX_FADV_WILLNEED);
+#endif
+}
+
+void StreamingFile::drop(File::FileSize start, File::FileSize length)
+{
+#if defined(POSIX_FADV_DONTNEED)
+	posix_fadvise(fd, start, length, POSIX_FADV_DONTNEED);
+#endif
+}
+
+#else
+
+StreamingFile::StreamingFile(const string &path, bool bulk, long readahead):
+	path(path),
+	istr(path)
+{
+	if (!istr.good())
+		throw OpenFileException(path);
+}
+
+// Descriptors are not used here, so the file is opened again by its path.
+StreamingFile::StreamingFile(const string &path, int file, bool bulk, long readahead):
+	path(path),
+	istr(path)
+{
+	if (!istr.good())
+		throw OpenFileException(path);
+}
+
+StreamingFile::~StreamingFile()
+{
+}
+
+streamsize StreamingFile::read(char *buffer, streamsize length)
+{
+	istr.read(buffer, length);
+	if (istr.bad())
+		throw ReadFileException(path);
+
+	return istr.gcount();
+}
+
+#endif
@@ -0,0 +1,74 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef STREAMINGFILE_H
+#define STREAMINGFILE_H
+
+#include <string>
+#include <ios>
+
+#include "Poco/Platform.h"
+#include "Poco/File.h"
+#include "Poco/FileStream.h"
+
+using namespace std;
+
+using namespace Poco;
+
+// Reads a file front to back for sending. Large files are read with a sequential access policy:
+// the kernel is asked to read ahead of the current position, and the parts that were already read
+// are dropped from the page cache, so that one-off bulk transfers do not evict frequently used files.
+class StreamingFile
+{
+public:
+	StreamingFile(const string &path, bool bulk, long readahead);
+	StreamingFile(const string &path, int file, bool bulk, long readahead);
+	~StreamingFile();
+
+	streamsize read(char *buffer, streamsize length);
+
+private:
+	const string path;
+
+#if defined(POCO_OS_FAMILY_UNIX)
+	void advise();
+	void prefetch(File::FileSize start, File::FileSize length);
+	void drop(File::FileSize start, File::FileSize length);
+
+	int fd;
+	bool bulk;
+	File::FileSize readahead;
+	File::FileSize offset;
+	File::FileSize prefetched;
+	File::FileSize dropped;
+#else
+	FileInputStream istr;
+#endif
+};
+
+#endif //STREAMINGFILE_H
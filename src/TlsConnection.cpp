@@ -0,0 +1,402 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifdef INDIGO_TLS
+
+#include <cerrno>
+#include <cstring>
+
+#include <unistd.h>
+
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+#include "Poco/Net/HTTPServerConnection.h"
+#include "Poco/Net/NetException.h"
+#include "Poco/Util/Application.h"
+#include "Poco/Exception.h"
+
+#include "TlsConnection.h"
+#include "Http2Connection.h"
+
+using namespace Poco::Util;
+
+// the protocols offered with ALPN, in order of preference
+static const unsigned char http2Protocols[] = "\x02h2\x08http/1.1";
+static const unsigned char http1Protocols[] = "\x08http/1.1";
+
+SSL_CTX *TlsConnection::context = NULL;
+
+AtomicCounter TlsConnection::handshakes;
+AtomicCounter TlsConnection::failedHandshakes;
+AtomicCounter TlsConnection::kernelSends;
+AtomicCounter TlsConnection::kernelReceives;
+AtomicCounter TlsConnection::http2Connections;
+
+TlsSocketImpl::TlsSocketImpl(poco_socket_t sockfd, SSL_CTX *context, bool http2):
+	StreamSocketImpl(sockfd),
+	ssl(NULL),
+	http2(http2),
+	failed(false)
+{
+	ssl = SSL_new(context);
+	if (ssl == NULL)
+		throw NetException("Cannot create TLS session", TlsConnection::lastError());
+
+	SSL_set_app_data(ssl, this);
+	SSL_set_fd(ssl, (int) sockfd);
+
+	setBlocking(false);
+}
+
+TlsSocketImpl::~TlsSocketImpl()
+{
+	close();
+
+	SSL_free(ssl);
+}
+
+void TlsSocketImpl::handshake(const Timespan &timeout)
+{
+	while (true)
+	{
+		int r = SSL_accept(ssl);
+		if (r == 1)
+			break;
+
+		int error = SSL_get_error(ssl, r);
+		if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+			wait(error, timeout);
+		else
+			fail(error, errno);
+	}
+}
+
+int TlsSocketImpl::sendBytes(const void *buffer, int length, int)
+{
+	if (length <= 0)
+		return 0;
+
+	while (true)
+	{
+		int n;
+		int error;
+		int code;
+
+		{
+			FastMutex::ScopedLock lock(mutex);
+
+			n = SSL_write(ssl, buffer, length);
+			if (n > 0)
+				return n;
+
+			error = SSL_get_error(ssl, n);
+			code = errno;
+		}
+
+		if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+			wait(error, getSendTimeout());
+		else
+			fail(error, code);
+	}
+}
+
+int TlsSocketImpl::receiveBytes(void *buffer, int length, int)
+{
+	while (true)
+	{
+		int n;
+		int error;
+		int code;
+
+		{
+			FastMutex::ScopedLock lock(mutex);
+
+			n = SSL_read(ssl, buffer, length);
+			if (n > 0)
+				return n;
+
+			error = SSL_get_error(ssl, n);
+			code = errno;
+		}
+
+		if (error == SSL_ERROR_ZERO_RETURN)
+			return 0;
+
+		if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
+			wait(error, getReceiveTimeout());
+		else
+			fail(error, code);
+	}
+}
+
+bool TlsSocketImpl::poll(const Timespan &timeout, int mode)
+{
+	// records that were already decrypted are not seen by polling the socket
+	if ((mode & SELECT_READ) && available() > 0)
+		return true;
+
+	return StreamSocketImpl::poll(timeout, mode);
+}
+
+int TlsSocketImpl::available()
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	return SSL_pending(ssl);
+}
+
+void TlsSocketImpl::close()
+{
+	{
+		FastMutex::ScopedLock lock(mutex);
+
+		// send close_notify once, without waiting for the client's reply
+		if (!failed && initialized() && SSL_is_init_finished(ssl))
+			SSL_shutdown(ssl);
+		failed = true;
+
+		ERR_clear_error();
+	}
+
+	StreamSocketImpl::close();
+}
+
+bool TlsSocketImpl::acceptsHttp2() const
+{
+	return http2;
+}
+
+bool TlsSocketImpl::usesHttp2() const
+{
+	const unsigned char *protocol;
+	unsigned int length;
+	SSL_get0_alpn_selected(ssl, &protocol, &length);
+
+	return (length == 2 && memcmp(protocol, "h2", 2) == 0);
+}
+
+bool TlsSocketImpl::sendsInKernel() const
+{
+#if defined(BIO_get_ktls_send)
+	return BIO_get_ktls_send(SSL_get_wbio(ssl));
+#else
+	return false;
+#endif
+}
+
+bool TlsSocketImpl::receivesInKernel() const
+{
+#if defined(BIO_get_ktls_recv)
+	return BIO_get_ktls_recv(SSL_get_rbio(ssl));
+#else
+	return false;
+#endif
+}
+
+void TlsSocketImpl::wait(int error, const Timespan &timeout)
+{
+	// a zero timeout means that the socket never times out
+	Timespan limit = (timeout.totalMicroseconds() > 0 ? timeout : Timespan(Timespan::DAYS));
+	int mode = (error == SSL_ERROR_WANT_READ ? SELECT_READ : SELECT_WRITE);
+
+	if (!StreamSocketImpl::poll(limit, mode))
+		throw TimeoutException();
+}
+
+void TlsSocketImpl::fail(int error, int code)
+{
+	{
+		FastMutex::ScopedLock lock(mutex);
+
+		// no more records may be sent after a fatal error, not even close_notify
+		failed = true;
+	}
+
+	string message = TlsConnection::lastError();
+
+	if (error == SSL_ERROR_SYSCALL)
+	{
+		if (code != 0)
+			SocketImpl::error(code);
+		throw ConnectionResetException();
+	}
+
+	throw NetException("TLS error", message);
+}
+
+TlsConnection::TlsConnection(const StreamSocket &socket, HTTPServerParams::Ptr params, HTTPRequestHandlerFactory::Ptr factory, ThreadPool &pool, bool http2, int maxStreams):
+	TCPServerConnection(socket),
+	params(params),
+	factory(factory),
+	pool(pool),
+	http2(http2),
+	maxStreams(maxStreams)
+{
+}
+
+void TlsConnection::run()
+{
+	// the TLS socket gets a descriptor of its own, since both sockets close theirs
+	poco_socket_t fd = dup(socket().impl()->sockfd());
+	if (fd < 0)
+		return;
+
+	TlsSocketImpl *impl = new TlsSocketImpl(fd, context, http2);
+	StreamSocket tlsSocket(impl);
+
+	try
+	{
+		impl->handshake(params->getTimeout());
+		handshakes++;
+	}
+	catch (Exception &e)
+	{
+		// mostly clients that give up, or do not trust the certificate
+		failedHandshakes++;
+		return;
+	}
+
+	if (impl->sendsInKernel())
+		kernelSends++;
+	if (impl->receivesInKernel())
+		kernelReceives++;
+
+	if (impl->usesHttp2())
+	{
+		http2Connections++;
+
+		Http2Connection connection(tlsSocket, params, factory, pool, maxStreams);
+		connection.run();
+	}
+	else
+	{
+		HTTPServerConnection connection(tlsSocket, params, factory);
+		connection.run();
+	}
+}
+
+void TlsConnection::initialize(const string &certificate, const string &key, bool offload)
+{
+	SSL_CTX *ctx = SSL_CTX_new(TLS_server_method());
+	if (ctx == NULL)
+		throw ApplicationException("Cannot create TLS context", lastError());
+
+	SSL_CTX_set_min_proto_version(ctx, TLS1_2_VERSION);
+	SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+	SSL_CTX_set_alpn_select_cb(ctx, selectProtocol, NULL);
+
+#if defined(SSL_OP_IGNORE_UNEXPECTED_EOF)
+	// clients often close the connection without close_notify once they have the whole response
+	SSL_CTX_set_options(ctx, SSL_OP_IGNORE_UNEXPECTED_EOF);
+#endif
+
+#if defined(SSL_OP_ENABLE_KTLS)
+	if (offload)
+		SSL_CTX_set_options(ctx, SSL_OP_ENABLE_KTLS);
+#else
+	if (offload)
+		Application::instance().logger().warning("Kernel TLS is not supported by this OpenSSL version");
+#endif
+
+	if (SSL_CTX_use_certificate_chain_file(ctx, certificate.c_str()) != 1)
+	{
+		string message = lastError();
+		SSL_CTX_free(ctx);
+		throw ApplicationException("Cannot load TLS certificate \"" + certificate + "\"", message);
+	}
+
+	if (SSL_CTX_use_PrivateKey_file(ctx, key.c_str(), SSL_FILETYPE_PEM) != 1 || SSL_CTX_check_private_key(ctx) != 1)
+	{
+		string message = lastError();
+		SSL_CTX_free(ctx);
+		throw ApplicationException("Cannot load TLS private key \"" + key + "\"", message);
+	}
+
+	context = ctx;
+}
+
+void TlsConnection::uninitialize()
+{
+	if (context != NULL)
+	{
+		SSL_CTX_free(context);
+		context = NULL;
+	}
+}
+
+bool TlsConnection::enabled()
+{
+	return (context != NULL);
+}
+
+void TlsConnection::appendStatus(ostream &out)
+{
+	if (!enabled())
+		return;
+
+	out << "TLS handshakes: " << handshakes.value() << endl;
+	out << "TLS failed handshakes: " << failedHandshakes.value() << endl;
+	out << "TLS connections encrypted by the kernel: " << kernelSends.value() << endl;
+	out << "TLS connections decrypted by the kernel: " << kernelReceives.value() << endl;
+	out << "TLS connections using HTTP/2: " << http2Connections.value() << endl;
+}
+
+int TlsConnection::selectProtocol(SSL *ssl, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen, void *)
+{
+	const TlsSocketImpl *impl = (const TlsSocketImpl *) SSL_get_app_data(ssl);
+
+	const unsigned char *protocols = http1Protocols;
+	unsigned int length = sizeof(http1Protocols) - 1;
+	if (impl->acceptsHttp2())
+	{
+		protocols = http2Protocols;
+		length = sizeof(http2Protocols) - 1;
+	}
+
+	// without a common protocol, the handshake goes on without ALPN and the client speaks HTTP/1.1
+	if (SSL_select_next_proto((unsigned char **) out, outlen, protocols, length, in, inlen) != OPENSSL_NPN_NEGOTIATED)
+		return SSL_TLSEXT_ERR_NOACK;
+
+	return SSL_TLSEXT_ERR_OK;
+}
+
+string TlsConnection::lastError()
+{
+	unsigned long error = ERR_get_error();
+	ERR_clear_error();
+
+	if (error == 0)
+		return "unknown error";
+
+	char buffer[256];
+	ERR_error_string_n(error, buffer, sizeof(buffer));
+	return buffer;
+}
+
+#endif //INDIGO_TLS
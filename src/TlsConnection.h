@@ -0,0 +1,124 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef TLSCONNECTION_H
+#define TLSCONNECTION_H
+
+#include <string>
+#include <ostream>
+
+#include "Poco/Net/TCPServerConnection.h"
+#include "Poco/Net/HTTPServerParams.h"
+#include "Poco/Net/HTTPRequestHandlerFactory.h"
+#include "Poco/Net/StreamSocket.h"
+#include "Poco/Net/StreamSocketImpl.h"
+#include "Poco/ThreadPool.h"
+#include "Poco/Timespan.h"
+#include "Poco/Mutex.h"
+#include "Poco/AtomicCounter.h"
+
+typedef struct ssl_st SSL;
+typedef struct ssl_ctx_st SSL_CTX;
+
+using namespace std;
+
+using namespace Poco;
+using namespace Poco::Net;
+
+// The socket of a TLS connection. The handshake is done by OpenSSL in user space. When kernel TLS
+// is enabled and supported, OpenSSL then hands the session keys to the kernel, so that records are
+// encrypted by the socket itself and file bodies can be written to it with sendfile().
+// The socket works in non-blocking mode, so that a thread waiting to read does not keep others from writing.
+class TlsSocketImpl: public StreamSocketImpl
+{
+public:
+	TlsSocketImpl(poco_socket_t sockfd, SSL_CTX *context, bool http2);
+
+	void handshake(const Timespan &timeout);
+
+	int sendBytes(const void *buffer, int length, int flags = 0);
+	int receiveBytes(void *buffer, int length, int flags = 0);
+	bool poll(const Timespan &timeout, int mode);
+	int available();
+	void close();
+
+	bool acceptsHttp2() const;
+	bool usesHttp2() const;
+	bool sendsInKernel() const;
+	bool receivesInKernel() const;
+
+protected:
+	~TlsSocketImpl();
+
+private:
+	void wait(int error, const Timespan &timeout);
+	void fail(int error, int code);
+
+	SSL *ssl;
+	bool http2;
+	bool failed;
+	FastMutex mutex;
+};
+
+// Serves a connection over TLS, as HTTP/2 if the client asks for it with ALPN and HTTP/2 is enabled,
+// otherwise as HTTP/1.x. The server context is set up once at startup with initialize().
+class TlsConnection: public TCPServerConnection
+{
+public:
+	TlsConnection(const StreamSocket &socket, HTTPServerParams::Ptr params, HTTPRequestHandlerFactory::Ptr factory, ThreadPool &pool, bool http2, int maxStreams);
+
+	void run();
+
+	static void initialize(const string &certificate, const string &key, bool offload);
+	static void uninitialize();
+	static bool enabled();
+
+	static void appendStatus(ostream &out);
+
+private:
+	static int selectProtocol(SSL *ssl, const unsigned char **out, unsigned char *outlen, const unsigned char *in, unsigned int inlen, void *arg);
+	static string lastError();
+
+	HTTPServerParams::Ptr params;
+	HTTPRequestHandlerFactory::Ptr factory;
+	ThreadPool &pool;
+	bool http2;
+	int maxStreams;
+
+	static SSL_CTX *context;
+
+	static AtomicCounter handshakes;
+	static AtomicCounter failedHandshakes;
+	static AtomicCounter kernelSends;
+	static AtomicCounter kernelReceives;
+	static AtomicCounter http2Connections;
+
+	friend class TlsSocketImpl;
+};
+
+#endif //TLSCONNECTION_H
@@ -0,0 +1,124 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "Poco/Net/StreamSocket.h"
+#include "Poco/Timespan.h"
+#include "Poco/ErrorHandler.h"
+#include "Poco/Exception.h"
+
+#include "WorkerGroup.h"
+#include "AdmissionControl.h"
+
+WorkerGroup::AcceptorRunnable::AcceptorRunnable(const ServerSocket &socket, TCPServerDispatcher &dispatcher):
+	socket(socket),
+	dispatcher(dispatcher),
+	stopAccept()
+{
+}
+
+// Accepts connections like the acceptor of TCPServer, until stopAccepting() is called.
+void WorkerGroup::AcceptorRunnable::run()
+{
+	while (!stopAccept.tryWait(0))
+	{
+		if (!socket.poll(Timespan(0, 250000), Socket::SELECT_READ))
+			continue;
+
+		try
+		{
+			StreamSocket ss = socket.acceptConnection();
+			ss.setNoDelay(true);
+			dispatcher.enqueue(ss);
+		}
+		catch (Exception &e)
+		{
+			ErrorHandler::handle(e);
+		}
+	}
+}
+
+void WorkerGroup::AcceptorRunnable::stopAccepting()
+{
+	stopAccept.set();
+}
+
+WorkerGroup::WorkerGroup(const string &name, const ServerSocket &socket, HTTPServerParams::Ptr params, HTTPRequestHandlerFactory::Ptr factory, int minThreads, int idleTime):
+	pool(name, minThreads, params->getMaxThreads(), idleTime),
+	collector(pool),
+	dispatcher(new TCPServerDispatcher(new AdmissionControl(params, factory, pool), pool, params)),
+	runnable(socket, *dispatcher),
+	acceptor(name + " acceptor"),
+	stopped(false)
+{
+}
+
+WorkerGroup::~WorkerGroup()
+{
+	stop();
+	dispatcher->release();
+}
+
+void WorkerGroup::start(bool collectIdleThreads)
+{
+	if (collectIdleThreads)
+		collector.startCollecting();
+
+	acceptor.start(runnable);
+}
+
+// Stops taking new connections. Those already queued are still served.
+void WorkerGroup::stopAccepting()
+{
+	if (acceptor.isRunning())
+	{
+		runnable.stopAccepting();
+		acceptor.join();
+	}
+}
+
+// Stops taking new connections, and drops those that are still queued.
+void WorkerGroup::stop()
+{
+	stopAccepting();
+
+	if (!stopped)
+	{
+		dispatcher->stop();
+		stopped = true;
+	}
+}
+
+int WorkerGroup::currentConnections() const
+{
+	return dispatcher->currentConnections();
+}
+
+int WorkerGroup::queuedConnections() const
+{
+	return dispatcher->queuedConnections();
+}
@@ -0,0 +1,95 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef WORKERGROUP_H
+#define WORKERGROUP_H
+
+#include <string>
+
+#include "Poco/Net/TCPServerDispatcher.h"
+#include "Poco/Net/ServerSocket.h"
+#include "Poco/Net/HTTPServerParams.h"
+#include "Poco/Net/HTTPRequestHandlerFactory.h"
+#include "Poco/ThreadPool.h"
+#include "Poco/Thread.h"
+#include "Poco/Runnable.h"
+#include "Poco/Event.h"
+
+#include "ThreadPoolCollector.h"
+
+using namespace std;
+
+using namespace Poco;
+using namespace Poco::Net;
+
+// A thread pool, with the TCP server that accepts connections for it on the shared listening socket.
+// All threads of a group, the acceptor included, are created by the thread that constructs and starts
+// the group, so they inherit its CPU affinity. A connection is then served on the CPUs of the group
+// that accepted it, and the buffers its threads allocate are placed on the local NUMA node.
+// The acceptor is separate from the dispatcher, unlike in TCPServer, so that on shutdown the group can
+// stop taking connections and still serve those that are already queued.
+class WorkerGroup
+{
+public:
+	WorkerGroup(const string &name, const ServerSocket &socket, HTTPServerParams::Ptr params, HTTPRequestHandlerFactory::Ptr factory, int minThreads, int idleTime);
+	~WorkerGroup();
+
+	void start(bool collectIdleThreads);
+	void stopAccepting();
+	void stop();
+
+	int currentConnections() const;
+	int queuedConnections() const;
+
+private:
+	class AcceptorRunnable: public Runnable
+	{
+	public:
+		AcceptorRunnable(const ServerSocket &socket, TCPServerDispatcher &dispatcher);
+
+		void run();
+		void stopAccepting();
+
+	private:
+		ServerSocket socket;
+		TCPServerDispatcher &dispatcher;
+		Event stopAccept;
+	};
+
+	WorkerGroup(const WorkerGroup &);
+	WorkerGroup &operator = (const WorkerGroup &);
+
+	ThreadPool pool;
+	ThreadPoolCollector collector;
+	TCPServerDispatcher *dispatcher;
+	AcceptorRunnable runnable;
+	Thread acceptor;
+	bool stopped;
+};
+
+#endif //WORKERGROUP_H
@@ -0,0 +1,113 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#include "Poco/Timestamp.h"
+
+#include "WorkerLane.h"
+
+WorkerLane::Slot::Slot(WorkerLane &lane):
+	lane(lane)
+{
+}
+
+WorkerLane::Slot::~Slot()
+{
+	lane.leave();
+}
+
+WorkerLane::WorkerLane(const string &name):
+	name(name),
+	mutex(),
+	slotFreed(),
+	active(0),
+	waiting(0),
+	admitted(0),
+	rejected(0),
+	maxWait(0)
+{
+}
+
+// Waits up to timeout milliseconds until fewer than limit requests are in the lane, and enters it.
+// A limit of 0 means that the lane is unlimited. Returns false if no slot became free in time.
+bool WorkerLane::enter(int limit, long timeout)
+{
+	Timestamp start;
+
+	FastMutex::ScopedLock lock(mutex);
+
+	if (limit > 0 && active >= limit)
+	{
+		waiting++;
+
+		long remaining = timeout;
+		while (active >= limit && remaining > 0)
+		{
+			mutex.unlock();
+			slotFreed.tryWait(remaining);
+			mutex.lock();
+
+			remaining = timeout - (long) (start.elapsed() / 1000);
+		}
+
+		waiting--;
+
+		long waited = (long) (start.elapsed() / 1000);
+		if (waited > maxWait)
+			maxWait = waited;
+
+		if (active >= limit)
+		{
+			rejected++;
+			return false;
+		}
+	}
+
+	active++;
+	admitted++;
+
+	return true;
+}
+
+void WorkerLane::leave()
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	active--;
+
+	if (waiting > 0)
+		slotFreed.set();
+}
+
+void WorkerLane::appendStatus(ostream &out) const
+{
+	FastMutex::ScopedLock lock(mutex);
+
+	out << name << " lane: " << active << " active, " << waiting << " waiting, ";
+	out << admitted << " admitted, " << rejected << " rejected, ";
+	out << "max wait " << maxWait << " ms" << endl;
+}
@@ -0,0 +1,77 @@
+
+/*
+ * Copyright (C) 2010, Victor Semionov
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions are met:
+ *     * Redistributions of source code must retain the above copyright notice,
+ *       this list of conditions and the following disclaimer.
+ *     * Redistributions in binary form must reproduce the above copyright notice,
+ *       this list of conditions and the following disclaimer in the documentation
+ *       and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND
+ * CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES,
+ * INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+ * DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS
+ * BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY,
+ * OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO,
+ * PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR
+ * PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY
+ * THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+ * (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE
+ * USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH
+ * DAMAGE.
+ */
+
+#ifndef WORKERLANE_H
+#define WORKERLANE_H
+
+#include <string>
+#include <ostream>
+
+#include "Poco/Mutex.h"
+#include "Poco/Event.h"
+
+using namespace std;
+
+using namespace Poco;
+
+// Limits how many worker threads may serve one class of requests at the same time.
+// Capping the bulk transfers keeps the remaining workers free for small requests.
+class WorkerLane
+{
+public:
+	// leaves the lane when the request is done with it
+	class Slot
+	{
+	public:
+		Slot(WorkerLane &lane);
+		~Slot();
+
+	private:
+		WorkerLane &lane;
+	};
+
+	WorkerLane(const string &name);
+
+	bool enter(int limit, long timeout);
+	void leave();
+	void appendStatus(ostream &out) const;
+
+private:
+	const string name;
+
+	mutable FastMutex mutex;
+	Event slotFreed;
+
+	int active;
+	int waiting;
+	int admitted;
+	int rejected;
+	long maxWait;
+};
+
+#endif //WORKERLANE_H